@@ -0,0 +1,112 @@
+/*
+ * @FilePath: /simtochat/loadgen/include/LoadGenerator.h
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ *  Drive a server with many client connections and measure the latency of the messages between them.
+ */
+#ifndef SIMTOCHAT_LOADGEN_INCLUDE_LOAD_GENERATOR_H
+#define SIMTOCHAT_LOADGEN_INCLUDE_LOAD_GENERATOR_H
+
+#include "Histogram.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @author: CGL
+ * @struct LoadOptions
+ * @description: What a LoadGenerator runs.
+ */
+struct LoadOptions
+{
+    std::string host = "127.0.0.1";
+    unsigned short port = 8010;
+    int threads = 4;
+    int connections = 1000;         // In total, spread over the threads
+    int sources = 1;                // Local addresses 127.0.0.1, 127.0.0.2, ... to connect from, for more than 28k ports
+    bool registers = false;         // Send RT_REGISTER before RT_LOGIN
+    double rate = 0;                // Messages per second in total in open loop, 0 for a closed loop
+    int window = 1;                 // Messages in flight per connection in a closed loop
+    std::chrono::milliseconds warmup = std::chrono::milliseconds(1000);
+    std::chrono::milliseconds duration = std::chrono::milliseconds(10000);
+    std::chrono::milliseconds connectTimeout = std::chrono::milliseconds(30000);
+};
+
+/**
+ * @author: CGL
+ * @struct LoadReport
+ * @description: What a LoadGenerator measured.
+ */
+struct LoadReport
+{
+    int connected;
+    int failed;                     // Connections refused, reset or timed out
+    double connectSeconds;          // From the start until every connection logged in
+    uint64_t sent;                  // Messages sent during the measurement
+    uint64_t received;              // Messages received during the measurement
+    double seconds;                 // The length of the measurement
+    Histogram connectLatency;       // Nanoseconds from connect() to the greeting of the server
+    Histogram latency;              // Nanoseconds from sending a message until its receiver read it
+};
+
+/**
+ * @author: CGL
+ * @class LoadGenerator
+ * @description:
+ *  Every thread owns its connections and an epoll instance, and the connections of a thread are paired:
+ *  each one logs in as its own user and sends RT_SENDMESSAGE to its partner, so the server routes every
+ *  message from one socket to another. The send time travels in the sendtime field, and the receiver
+ *  records the latency in the histogram of its thread.
+ *  In a closed loop a connection keeps `window` messages in flight and sends the next one when its partner
+ *  receives one. In an open loop the threads send at a fixed total rate whatever the server does, and the
+ *  latency is counted from when each message was due, so a stalled server is not hidden by the client
+ *  waiting for it (coordinated omission).
+ *  Run() connects, logs in, warms up, measures and returns the report.
+ */
+class LoadGenerator
+{
+public:
+    explicit LoadGenerator(const LoadOptions& options);
+    virtual ~LoadGenerator();
+
+    LoadGenerator(const LoadGenerator&) = delete;
+    LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @return Return what was measured.
+     * @description: Run the workload to the end. Throw std::runtime_error if no connection logs in.
+     */
+    LoadReport Run();
+
+protected:
+    enum Phase
+    {
+        PH_CONNECT,     // Connecting and logging in
+        PH_WARMUP,      // Sending, not measured
+        PH_MEASURE,     // Sending and measured
+        PH_STOP
+    };
+
+    struct Worker;
+
+    // Connect the connections of a worker and run its loop until PH_STOP.
+    void _Work(Worker& worker);
+
+protected:
+    LoadOptions m_options;
+    std::atomic<int> m_phase;
+    std::atomic<int> m_ready;       // Connections logged in or failed
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // !SIMTOCHAT_LOADGEN_INCLUDE_LOAD_GENERATOR_H
@@ -0,0 +1,121 @@
+/*
+ * @FilePath: /simtochat/loadgen/src/LoadGen.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ *  The command line of the load generator.
+ */
+#include "LoadGenerator.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <iomanip>
+#include <iostream>
+
+static void usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+        << "  -H, --host ADDR         server address (127.0.0.1)\n"
+        << "  -p, --port PORT         server port (8010)\n"
+        << "  -t, --threads N         client threads (4)\n"
+        << "  -c, --connections N     connections in total (1000)\n"
+        << "  -s, --sources N         connect from 127.0.0.1 to 127.0.0.N, for more than 28k connections (1)\n"
+        << "  -r, --rate N            open loop: messages per second in total (0: closed loop)\n"
+        << "  -w, --window N          closed loop: messages in flight per connection (1)\n"
+        << "  -d, --duration SEC      measurement (10)\n"
+        << "      --warmup SEC        sending before the measurement (1)\n"
+        << "      --register          send RT_REGISTER before RT_LOGIN, needed once per user, the server keeps them across restarts\n";
+}
+
+// Print a histogram of nanoseconds in microseconds.
+static void report(const char* name, const Histogram& histogram)
+{
+    auto us = [](uint64_t ns) { return ns / 1e3; };
+    std::cout << std::fixed << std::setprecision(1) << name << " (us): "
+        << "min " << us(histogram.getMin()) << ", mean " << histogram.getMean() / 1e3
+        << ", p50 " << us(histogram.getPercentile(50)) << ", p90 " << us(histogram.getPercentile(90))
+        << ", p99 " << us(histogram.getPercentile(99)) << ", p99.9 " << us(histogram.getPercentile(99.9))
+        << ", p99.99 " << us(histogram.getPercentile(99.99)) << ", max " << us(histogram.getMax()) << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    static const option longOptions[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "threads", required_argument, nullptr, 't' },
+        { "connections", required_argument, nullptr, 'c' },
+        { "sources", required_argument, nullptr, 's' },
+        { "rate", required_argument, nullptr, 'r' },
+        { "window", required_argument, nullptr, 'w' },
+        { "duration", required_argument, nullptr, 'd' },
+        { "warmup", required_argument, nullptr, 'W' },
+        { "register", no_argument, nullptr, 'R' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    LoadOptions options;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:t:c:s:r:w:d:", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = (unsigned short)atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'c': options.connections = atoi(optarg); break;
+        case 's': options.sources = atoi(optarg); break;
+        case 'r': options.rate = atof(optarg); break;
+        case 'w': options.window = atoi(optarg); break;
+        case 'd': options.duration = std::chrono::milliseconds(long(atof(optarg) * 1000)); break;
+        case 'W': options.warmup = std::chrono::milliseconds(long(atof(optarg) * 1000)); break;
+        case 'R': options.registers = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.connections <= 0 || options.threads <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Every connection is a file descriptor.
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::cout << options.connections << " connections from " << options.threads << " threads to "
+        << options.host << ":" << options.port << ", "
+        << (options.rate > 0 ? "open loop at " + std::to_string(long(options.rate)) + " messages/sec"
+                             : "closed loop with " + std::to_string(options.window) + " in flight per connection")
+        << std::endl;
+
+    try
+    {
+        LoadGenerator generator(options);
+        LoadReport result = generator.Run();
+
+        std::cout << result.connected << " logged in, " << result.failed << " failed, in "
+            << std::setprecision(2) << std::fixed << result.connectSeconds << " s" << std::endl;
+        report("connect", result.connectLatency);
+        std::cout << std::setprecision(0) << result.sent << " sent, " << result.received << " received in "
+            << std::setprecision(2) << result.seconds << " s: "
+            << std::setprecision(0) << result.received / result.seconds << " messages/sec" << std::endl;
+        report("latency", result.latency);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,368 @@
+/*
+ * @FilePath: /simtochat/loadgen/src/LoadGenerator.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ */
+#include "LoadGenerator.h"
+#include "Codec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+const size_t kGreetingSize = 14;    // "Hello client." and its '\0', written by the acceptor of the server
+const int kConnecting = 256;        // Connects in progress per thread, so the accept queue does not overflow
+const int kBurst = 1024;            // Messages an open loop sends at most before it looks at the sockets again
+
+enum ConnectionState
+{
+    CS_IDLE,
+    CS_CONNECTING,
+    CS_GREETING,
+    CS_READY,
+    CS_CLOSED
+};
+
+struct Connection
+{
+    int fd = -1;
+    int state = CS_IDLE;
+    int partner = 0;                    // The index of the connection it sends to, in the same worker
+    size_t greeting = kGreetingSize;    // Bytes of the greeting still to skip
+    bool watchingOut = false;
+    Buffer input{ 0 };
+    Buffer output{ 0 };
+    char name[16];
+    std::chrono::steady_clock::time_point connectStart;
+};
+
+} // namespace
+
+struct LoadGenerator::Worker
+{
+    int index;
+    int epfd = -1;
+    std::vector<Connection> connections;
+    Histogram connectLatency;
+    Histogram latency;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    int connected = 0;
+    int failed = 0;
+    std::thread thread;
+};
+
+LoadGenerator::LoadGenerator(const LoadOptions& options)
+    : m_options(options), m_phase(PH_CONNECT), m_ready(0)
+{
+    m_options.threads = std::max(1, std::min(m_options.threads, m_options.connections));
+    m_options.sources = std::max(1, m_options.sources);
+    m_options.window = std::max(1, m_options.window);
+}
+
+LoadGenerator::~LoadGenerator()
+{
+
+}
+
+LoadReport LoadGenerator::Run()
+{
+    m_phase = PH_CONNECT;
+    m_ready = 0;
+    m_start = std::chrono::steady_clock::now();
+
+    std::vector<Worker> workers(m_options.threads);
+    for (int i = 0; i < m_options.threads; i++)
+    {
+        Worker& worker = workers[i];
+        worker.index = i;
+        int count = m_options.connections / m_options.threads + (i < m_options.connections % m_options.threads);
+        worker.connections.resize(count);
+    }
+    for (Worker& worker : workers) worker.thread = std::thread(&LoadGenerator::_Work, this, std::ref(worker));
+
+    auto deadline = m_start + m_options.connectTimeout;
+    while (m_ready < m_options.connections && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    LoadReport report;
+    report.connectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+
+    m_phase = PH_WARMUP;
+    std::this_thread::sleep_for(m_options.warmup);
+    m_phase = PH_MEASURE;
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(m_options.duration);
+    m_phase = PH_STOP;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    report.connected = report.failed = 0;
+    report.sent = report.received = 0;
+    for (Worker& worker : workers)
+    {
+        worker.thread.join();
+        report.connected += worker.connected;
+        report.failed += worker.failed;
+        report.sent += worker.sent;
+        report.received += worker.received;
+        report.connectLatency.Merge(worker.connectLatency);
+        report.latency.Merge(worker.latency);
+    }
+    if (report.connected == 0) throw std::runtime_error("no connection to " + m_options.host + " logged in");
+    return report;
+}
+
+void LoadGenerator::_Work(Worker& worker)
+{
+    std::vector<Connection>& connections = worker.connections;
+    const int count = int(connections.size());
+    const int first = worker.index * (m_options.connections / m_options.threads)
+        + std::min(worker.index, m_options.connections % m_options.threads);
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(m_options.port);
+    server.sin_addr.s_addr = inet_addr(m_options.host.c_str());
+
+    worker.epfd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < count; i++)
+    {
+        Connection& conn = connections[i];
+        snprintf(conn.name, sizeof(conn.name), "load%d", first + i);
+        conn.partner = (i ^ 1) < count ? (i ^ 1) : i;
+    }
+
+    auto now = [this] {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+    };
+    auto fail = [&](Connection& conn) {
+        if (conn.fd != -1) close(conn.fd);
+        conn.fd = -1;
+        if (conn.state == CS_READY) worker.connected--;
+        else m_ready++;
+        worker.failed++;
+        conn.state = CS_CLOSED;
+    };
+    auto watch = [&](int index, uint32_t events) {
+        epoll_event ev;
+        ev.events = events;
+        ev.data.u32 = uint32_t(index);
+        epoll_ctl(worker.epfd, EPOLL_CTL_MOD, connections[index].fd, &ev);
+    };
+    // Write what the connection has queued, and wait for EPOLLOUT while the socket is full.
+    auto flush = [&](int index) {
+        Connection& conn = connections[index];
+        int savedErrno = 0;
+        while (conn.output.getReadableBytes() > 0)
+        {
+            if (conn.output.WriteFd(conn.fd, &savedErrno) < 0)
+            {
+                if (savedErrno != EAGAIN && savedErrno != EWOULDBLOCK) fail(conn);
+                break;
+            }
+        }
+        bool pending = conn.state != CS_CLOSED && conn.output.getReadableBytes() > 0;
+        if (pending != conn.watchingOut && conn.state != CS_CLOSED)
+        {
+            conn.watchingOut = pending;
+            watch(index, pending ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        }
+    };
+    auto post = [&](int index, uint64_t sendtime) {
+        Connection& conn = connections[index];
+        if (conn.state != CS_READY) return;
+        msg_sendmessage msg;
+        memset(&msg, 0, sizeof(msg));
+        memcpy(msg.sender, conn.name, sizeof(msg.sender));
+        memcpy(msg.reciver, connections[conn.partner].name, sizeof(msg.reciver));
+        msg.sendtime = int64_t(sendtime);
+        snprintf(msg.message, sizeof(msg.message), "load message from %s", conn.name);
+        EncodeRequest(conn.output, RT_SENDMESSAGE, msg);
+        if (m_phase == PH_MEASURE) worker.sent++;
+        if (!conn.watchingOut) flush(index);
+    };
+    auto start = [&](int index) {
+        Connection& conn = connections[index];
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (m_options.sources > 1)
+        {
+            // The port is picked at connect(), so every source address has its own range of ports.
+            sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + uint32_t((first + index) % m_options.sources));
+            setsockopt(conn.fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+            bind(conn.fd, (sockaddr*)&local, sizeof(local));
+        }
+        conn.connectStart = std::chrono::steady_clock::now();
+        conn.state = CS_CONNECTING;
+        if (connect(conn.fd, (sockaddr*)&server, sizeof(server)) == -1 && errno != EINPROGRESS)
+        {
+            fail(conn);
+            return;
+        }
+        epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.u32 = uint32_t(index);
+        epoll_ctl(worker.epfd, EPOLL_CTL_ADD, conn.fd, &ev);
+    };
+
+    int next = 0, connecting = 0;
+    int phase = PH_CONNECT;
+    uint64_t interval = m_options.rate > 0 ? uint64_t(1e9 * m_options.threads / m_options.rate) : 0;
+    uint64_t due = 0;
+    int turn = 0;
+    std::vector<epoll_event> events(1024);
+
+    while (true)
+    {
+        // Start the connects a few hundred at a time.
+        while (phase == PH_CONNECT && next < count && connecting < kConnecting)
+        {
+            start(next++);
+            if (connections[next - 1].state == CS_CONNECTING) connecting++;
+        }
+
+        int current = m_phase;
+        if (current == PH_STOP) break;
+        if (current != phase && phase == PH_CONNECT)
+        {
+            // Sending starts: whoever did not log in by now gave up.
+            for (Connection& conn : connections) if (conn.state != CS_READY && conn.state != CS_CLOSED) fail(conn);
+            for (; next < count; next++) fail(connections[next]);
+            if (interval == 0)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    for (int w = 0; w < m_options.window; w++) post(i, now());
+                }
+            }
+            due = now();
+        }
+        phase = current;
+
+        // Open loop: send what is due, stamped with when it was due rather than when it went out.
+        int timeout = phase == PH_CONNECT ? 10 : 100;
+        if (interval > 0 && phase != PH_CONNECT)
+        {
+            for (int burst = 0; burst < kBurst && due <= now(); burst++)
+            {
+                for (int tries = 0; tries < count; tries++)
+                {
+                    int index = turn++ % count;
+                    if (connections[index].state == CS_READY)
+                    {
+                        post(index, due);
+                        break;
+                    }
+                }
+                due += interval;
+            }
+            uint64_t clock = now();
+            timeout = due > clock ? int((due - clock) / 1000000) : 0;
+        }
+
+        int n = epoll_wait(worker.epfd, events.data(), int(events.size()), timeout);
+        for (int e = 0; e < n; e++)
+        {
+            int index = int(events[e].data.u32);
+            Connection& conn = connections[index];
+            if (conn.state == CS_CLOSED) continue;
+
+            if (conn.state == CS_CONNECTING)
+            {
+                connecting--;
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error != 0 || (events[e].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    fail(conn);
+                    continue;
+                }
+                conn.state = CS_GREETING;
+                watch(index, EPOLLIN);
+                continue;
+            }
+
+            if (events[e].events & EPOLLOUT) flush(index);
+            if (!(events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) || conn.state == CS_CLOSED) continue;
+
+            int savedErrno = 0;
+            bool eof = false;
+            ssize_t bytes = conn.input.ReadFd(conn.fd, &savedErrno, &eof);
+            if (eof || (bytes < 0 && savedErrno != EAGAIN && savedErrno != EWOULDBLOCK))
+            {
+                fail(conn);
+                continue;
+            }
+
+            if (conn.state == CS_GREETING)
+            {
+                size_t skip = std::min(conn.greeting, conn.input.getReadableBytes());
+                conn.input.Retrieve(skip);
+                conn.greeting -= skip;
+                if (conn.greeting > 0) continue;
+
+                worker.connectLatency.Record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - conn.connectStart).count()));
+                if (m_options.registers)
+                {
+                    msg_register reg;
+                    memset(&reg, 0, sizeof(reg));
+                    memcpy(reg.username, conn.name, sizeof(reg.username));
+                    memcpy(reg.nickname, conn.name, sizeof(conn.name));
+                    EncodeRequest(conn.output, RT_REGISTER, reg);
+                }
+                msg_login login;
+                memset(&login, 0, sizeof(login));
+                memcpy(login.username, conn.name, sizeof(login.username));
+                EncodeRequest(conn.output, RT_LOGIN, login);
+                conn.state = CS_READY;
+                worker.connected++;
+                m_ready++;
+                flush(index);
+                if (conn.state == CS_CLOSED) continue;
+            }
+
+            Request request;
+            RequestDecoder decoder(conn.input);
+            while (decoder.Next(request))
+            {
+                auto msg = RequestCast<msg_sendmessage>(request);
+                if (request.type != RT_SENDMESSAGE || !msg) continue;
+
+                uint64_t sendtime = uint64_t(msg->sendtime), received = now();
+                if (phase == PH_MEASURE)
+                {
+                    worker.received++;
+                    worker.latency.Record(received > sendtime ? received - sendtime : 0);
+                }
+                // Closed loop: the partner sent this one, so it may send the next.
+                if (interval == 0 && phase != PH_CONNECT) post(conn.partner, received);
+            }
+            if (decoder.isBroken()) fail(conn);
+        }
+    }
+
+    for (Connection& conn : connections) if (conn.fd != -1) close(conn.fd);
+    close(worker.epfd);
+}
@@ -11,5 +11,22 @@
 #define SIMTOCHAT_SERVER_INCLUDE_CONFIG_H
 
 #define SERVER_PORT         8010
+#define SERVER_LOOPS        0       // The number of event loops, 0 means one loop per core.
+#define SERVER_WORKERS      4       // The threads which run logins and registrations off the loops, 0 runs them on the loops.
+#define SERVER_IDLE_TIMEOUT     300000  // Close a client which sends nothing for this long, in milliseconds.
+#define SERVER_LOGIN_TIMEOUT    30000   // Close a client which does not login for this long, in milliseconds.
+#define SERVER_FASTOPEN_QUEUE   4096    // Pending TCP Fast Open connections per listener, 0 disables it.
+#define SERVER_OFFLINE_DIR      "offline"   // The segment files of the messages to users who are not connected.
+#define SERVER_METRICS_FILE     "metrics.txt"   // Rewritten with the counters and latencies of the server.
+#define SERVER_METRICS_INTERVAL 10000   // Milliseconds between two writes of SERVER_METRICS_FILE and SERVER_TRACE_FILE.
+#define SERVER_TRACE_SAMPLING   0       // The share of the requests traced, 0 disables SERVER_TRACE_FILE.
+#define SERVER_TRACE_FILE       "trace.json"    // Rewritten with the latest sampled spans as a Chrome trace.
+
+// The database which keeps the history of the messages, an empty host disables it.
+#define SERVER_MYSQL_HOST       ""
+#define SERVER_MYSQL_PORT       3306
+#define SERVER_MYSQL_USER       "simtochat"
+#define SERVER_MYSQL_PASSWORD   ""
+#define SERVER_MYSQL_DB         "simtochat"
 
 #endif // !SIMTOCHAT_SERVER_INCLUDE_CONFIG_H
@@ -6,33 +6,329 @@
  * @LastEditTime: 2021-05-03 15:41:38
  * @Description: 
  */
-#include "Socket.h"
+#include "UringServer.h"
+#include "Codec.h"
+#include "Router.h"
+#include "Channel.h"
+#include "SegmentLog.h"
+#include "MySQLBatchWriter.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include "Config.h"
 
+#include <string.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-bool acceptor(Socket& client)
+static Router router;
+static ChannelIndex channels(router);
+static std::unique_ptr<SegmentLog> offline;
+static MySQLConnectionPool database(1, 4);
+static std::unique_ptr<MySQLBatchWriter> history;
+
+// The time to handle each type of request, indexed by RequestType.
+static const int requestTime[] = {
+    -1,
+    Metrics::RegisterHistogram("request.login"),
+    Metrics::RegisterHistogram("request.register"),
+    Metrics::RegisterHistogram("request.sendmessage"),
+    Metrics::RegisterHistogram("request.createchannel"),
+    Metrics::RegisterHistogram("request.joinchannel"),
+    Metrics::RegisterHistogram("request.leavechannel"),
+    Metrics::RegisterHistogram("request.postchannel")
+};
+
+// The registered users are kept in the offline log under a key no user gets, ahead of every message to them,
+// so the IDs of the messages mean the same users after a restart.
+static const uint64_t usersKey = UINT64_MAX;
+
+/**
+ * @author: CGL
+ * @struct UserRecord
+ * @description: A registered user in the offline log.
+ */
+struct UserRecord
+{
+    uint64_t user;
+    char username[16];
+    char password[20];
+};
+
+// Messages to users who are not connected that the offline log could not keep.
+static const int offlineDropped = Metrics::RegisterCounter("offline.dropped");
+
+// The names of the spans of each type of request, indexed by RequestType.
+static const char* const requestSpan[] = {
+    "request.unknown",
+    "request.login",
+    "request.register",
+    "request.sendmessage",
+    "request.createchannel",
+    "request.joinchannel",
+    "request.leavechannel",
+    "request.postchannel"
+};
+
+// Queue a message for the history. The loop never waits for MySQL: a full queue drops the row.
+void persist(Socket& client, const Request& request)
+{
+    uint64_t sender = client.getContext();
+    if (!history || sender == 0) return;
+
+    if (request.flags & RF_COMPACT)
+    {
+        SendMessage msg;
+        if (DecodeSendMessage(request, msg))
+        {
+            history->Insert({ sender, msg.reciver, msg.sendtime, MySQLValue(msg.message, msg.length) });
+        }
+    }
+    else if (auto msg = RequestCast<msg_sendmessage>(request))
+    {
+        uint64_t receiver = router.FindUserId(msg->reciver, strnlen(msg->reciver, sizeof(msg->reciver)));
+        history->Insert({ sender, receiver, msg->sendtime, MySQLValue(msg->message, strnlen(msg->message, sizeof(msg->message))) });
+    }
+}
+
+void acceptor(Socket& client)
+{
+    client.Write("Hello client.", 14);
+
+    // The file descriptor may belong to another connection by then, the serial tells them apart.
+    EventLoop* loop = client.getLoop();
+    int fd = client.getfd();
+    uint64_t serial = client.getSerial();
+    loop->RunAfter(std::chrono::milliseconds(SERVER_LOGIN_TIMEOUT),
+        [loop, fd, serial]
+        {
+            Socket* client = loop->getClient(fd);
+            if (client && client->getSerial() == serial && client->getContext() == 0) client->Disconnect();
+        }
+    );
+}
+
+// Handle a request on the loop of its connection. Return false if the connection should be closed.
+bool handle(Socket& client, const Request& request)
+{
+    switch (request.type)
+    {
+    case RT_SENDMESSAGE:
+        if (!router.Route(client, request)) return false;
+        persist(client, request);
+        return true;
+    case RT_CREATECHANNEL:
+    case RT_JOINCHANNEL:
+    case RT_LEAVECHANNEL:
+    case RT_POSTCHANNEL:
+        return channels.Handle(client, request);
+    default:
+        return true;
+    }
+}
+
+void processor(Socket& client);
+
+/**
+ * @author: CGL
+ * @struct LoginState
+ * @description: What the worker of a login hands to its loop.
+ */
+struct LoginState
+{
+    std::string username;
+    std::string password;
+    std::string ip;
+    uint64_t user = 0;
+    uint64_t position = 0;      // Of the last record of the backlog
+    std::vector<SharedBuffer> backlog;
+};
+
+// Check the password and read the backlog from the disk on a worker, then bind the session and send the backlog
+// on the loop. It stays in the log until it is sent, a connection which closes before that leaves it for the next login.
+// A wrong password closes the connection, it is never bound and sees nothing of the user.
+void login(Socket& client, const msg_login& login)
 {
-    bool active = client.Write("Hello client.", 14);
-    return true;
+    auto state = std::make_shared<LoginState>();
+    state->username.assign(login.username, strnlen(login.username, sizeof(login.username)));
+    state->password.assign(login.password, strnlen(login.password, sizeof(login.password)));
+    state->ip = client.getIpStr();
+    client.Offload(
+        [state]
+        {
+            state->user = router.Authenticate(state->username.data(), state->username.size(),
+                state->password.data(), state->password.size());
+            if (state->user == 0)
+            {
+                std::cout << state->ip << " login refused: " << state->username << std::endl;
+                return;
+            }
+            offline->Read(state->user, state->backlog, state->position);
+            std::cout << state->ip << " login: " << state->username << " (" << state->user << ")" << std::endl;
+        },
+        [state](Socket& client)
+        {
+            if (state->user == 0)
+            {
+                client.Disconnect();
+                return;
+            }
+
+            // Messages which went offline before the session was bound are read too.
+            router.Bind(state->user, client);
+            offline->Read(state->user, state->backlog, state->position, state->position);
+
+            // The backlog goes out in a few large writes after this task.
+            for (const SharedBuffer& batch : state->backlog) client.Send(batch, true);
+            offline->Remove(state->user, state->position);
+            processor(client);
+        }
+    );
 }
 
-bool processor(Socket& client)
+// The requests after a login or a registration wait in the input buffer until its done decodes them,
+// so they keep their order, and a client flooding meanwhile is closed at the maximum input size.
+void processor(Socket& client)
 {
-    char buf[1024] = {0};
-    bool active = client.Read(buf, 1024);
-    if (active)
+    Request request;
+    RequestDecoder decoder(client.getInput());
+    while (!client.isOffloading() && decoder.Next(request))
     {
-        std::cout << client.getIpStr() << ": " << buf << std::endl;
+        bool known = request.type < sizeof(requestTime) / sizeof(*requestTime);
+        MetricsTimer timer(known ? requestTime[request.type] : -1);
+        TRACE_SCOPE(known ? requestSpan[request.type] : requestSpan[RT_UNKNOW]);
+
+        if (request.type == RT_LOGIN)
+        {
+            if (auto msg = RequestCast<msg_login>(request)) login(client, *msg);
+        }
+        else if (request.type == RT_REGISTER)
+        {
+            if (auto reg = RequestCast<msg_register>(request))
+            {
+                std::string username(reg->username, strnlen(reg->username, sizeof(reg->username)));
+                std::string password(reg->password, strnlen(reg->password, sizeof(reg->password)));
+                std::string ip = client.getIpStr();
+                client.Offload(
+                    [username, password, ip]
+                    {
+                        uint64_t user = router.Register(username.data(), username.size(), password.data(), password.size());
+                        if (user != 0) std::cout << ip << " register: " << username << " (" << user << ")" << std::endl;
+                        else std::cout << ip << " register refused: " << username << std::endl;
+                    },
+                    processor);
+            }
+        }
+        else if (!handle(client, request))
+        {
+            client.Disconnect();
+            return;
+        }
     }
-    return active;
+    if (decoder.isBroken()) client.Disconnect();
+}
+
+void closer(Socket& client)
+{
+    router.Unbind(client);
 }
 
 int main()
 {
-    EpollServer server;
+    try
+    {
+        offline.reset(new SegmentLog(SERVER_OFFLINE_DIR));
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    // Without the users of the earlier runs, their IDs would go to new users along with their messages.
+    std::vector<SharedBuffer> users;
+    uint64_t position = 0;
+    offline->Read(usersKey, users, position);
+    for (const SharedBuffer& batch : users)
+    {
+        for (size_t at = 0; at + sizeof(UserRecord) <= batch.getSize(); at += sizeof(UserRecord))
+        {
+            UserRecord record;
+            memcpy(&record, batch.getData() + at, sizeof(record));
+            router.Restore(record.user, record.username, sizeof(record.username), record.password, sizeof(record.password));
+        }
+    }
+    router.setRegisterHandler(
+        [](uint64_t user, const char* username, const char* password)
+        {
+            UserRecord record;
+            memset(&record, 0, sizeof(record));
+            record.user = user;
+            memcpy(record.username, username, sizeof(record.username));
+            memcpy(record.password, password, sizeof(record.password));
+            return offline->Append(usersKey, &record, sizeof(record));
+        }
+    );
+
+    if (strlen(SERVER_MYSQL_HOST) > 0)
+    {
+        try
+        {
+            database.Setup(SERVER_MYSQL_HOST, SERVER_MYSQL_USER, SERVER_MYSQL_PASSWORD, SERVER_MYSQL_DB, SERVER_MYSQL_PORT);
+            database.Checkout()->Excute(
+                "CREATE TABLE IF NOT EXISTS messages ("
+                "id BIGINT AUTO_INCREMENT PRIMARY KEY, sender BIGINT NOT NULL, receiver BIGINT NOT NULL, "
+                "sendtime BIGINT NOT NULL, message VARBINARY(1024) NOT NULL, INDEX (receiver))"
+            );
+            history.reset(new MySQLBatchWriter(database, "messages", { "sender", "receiver", "sendtime", "message" }));
+        }
+        catch(const MySQLException& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    router.setOfflineHandler(
+        [](uint64_t receiver, const Request& request)
+        {
+            char header[REQUEST_HEADER_SIZE];
+            EncodeHeader(header, request.type, request.length, request.flags);
+            iovec vec[2] = { { header, REQUEST_HEADER_SIZE }, { const_cast<char*>(request.msg), request.length } };
+            if (offline->Append(receiver, vec, 2)) return;
+
+            // The log refuses every append after a failed write, say it once and count the messages lost.
+            Metrics::Add(offlineDropped);
+            static std::once_flag reported;
+            std::call_once(reported, [] { std::cerr << "The offline log failed, undelivered messages are dropped." << std::endl; });
+        }
+    );
+
+    if (history)
+    {
+        Metrics::RegisterGauge("mysql.queued", [] { return int64_t(history->getStats().queuedRows); });
+    }
+    MetricsDumper dumper(SERVER_METRICS_FILE, std::chrono::milliseconds(SERVER_METRICS_INTERVAL));
+    std::unique_ptr<TraceDumper> tracer;
+    if (SERVER_TRACE_SAMPLING > 0)
+    {
+        Tracer::setSampling(SERVER_TRACE_SAMPLING);
+        tracer.reset(new TraceDumper(SERVER_TRACE_FILE, std::chrono::milliseconds(SERVER_METRICS_INTERVAL)));
+    }
+
+    UringServer server;
+    server.setLoopCount(SERVER_LOOPS);
     server.setAcceptor(acceptor);
     server.setProcessor(processor);
+    server.setCloser(closer);
+    server.setIdleTimeout(std::chrono::milliseconds(SERVER_IDLE_TIMEOUT));
+    server.setWorkerCount(SERVER_WORKERS);
+
+    // Chat messages are small and should not wait for Nagle.
+    SocketOptions options;
+    options.noDelay = true;
+    options.fastOpen = SERVER_FASTOPEN_QUEUE;
+    server.setSocketOptions(options);
     
     try
     {
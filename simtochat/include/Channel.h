@@ -0,0 +1,163 @@
+/*
+ * @FilePath: /simtochat/simtochat/include/Channel.h
+ * @Author: CGL
+ * @Date: 2026-10-18 10:12:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 10:12:37
+ * @Description:
+ *  Group chat: named channels, their members, and the fan-out of posts to the online members.
+ */
+#ifndef SIMTOCHAT_INCLUDE_CHANNEL_H
+#define SIMTOCHAT_INCLUDE_CHANNEL_H
+
+#include "Request.h"
+#include "Router.h"
+#include "FlatMap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @author: CGL
+ * @class ChannelIndex
+ * @description:
+ *  Map the channel names to channel IDs and every channel to its members, and handle
+ *  the RT_CREATECHANNEL, RT_JOINCHANNEL, RT_LEAVECHANNEL and RT_POSTCHANNEL requests.
+ *  The members of a channel are a sorted flat vector of user IDs: a post walks it in order,
+ *  and a membership test is a binary search. Members stay members while they are offline,
+ *  and a post goes through Router::Broadcast, so only the connected ones are written to.
+ *  A post holds a snapshot of the members instead of the lock of the channel, so joins and
+ *  leaves never wait for a fan-out. They copy the vector only while a post still holds it.
+ *  Channels are never removed, their IDs are dense and start at 1.
+ *  All the methods are safe to call from the callbacks of any loop.
+ */
+class ChannelIndex
+{
+public:
+    typedef std::vector<uint64_t> Members;
+
+    /**
+     * @author: CGL
+     * @param router The router of the users, to find the senders and deliver the posts.
+     */
+    explicit ChannelIndex(Router& router);
+    virtual ~ChannelIndex();
+
+    ChannelIndex(const ChannelIndex&) = delete;
+    ChannelIndex& operator=(const ChannelIndex&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param name The name of the channel, not always terminated by '\0'.
+     * @param length The length of the name, at most 16 bytes are used.
+     * @param owner The user ID of the creator, who becomes the first member, or 0.
+     * @return Return the ID of the new channel, or 0 if the name is taken.
+     */
+    uint64_t Create(const char* name, size_t length, uint64_t owner);
+
+    /**
+     * @author: CGL
+     * @param name The name of the channel, not always terminated by '\0'.
+     * @param length The length of the name, at most 16 bytes are used.
+     * @return Return the ID of the channel, or 0 if there is no such channel.
+     */
+    uint64_t FindChannelId(const char* name, size_t length);
+
+    /**
+     * @author: CGL
+     * @param channel The channel ID.
+     * @param user The user ID.
+     * @return Return false if there is no such channel or the user is already a member.
+     */
+    bool Join(uint64_t channel, uint64_t user);
+
+    /**
+     * @author: CGL
+     * @param channel The channel ID.
+     * @param user The user ID.
+     * @return Return false if there is no such channel or the user is not a member.
+     */
+    bool Leave(uint64_t channel, uint64_t user);
+
+    /**
+     * @author: CGL
+     * @param channel The channel ID.
+     * @param user The user ID.
+     * @return Return true if the user is a member of the channel.
+     */
+    bool isMember(uint64_t channel, uint64_t user);
+
+    /**
+     * @author: CGL
+     * @param channel The channel ID.
+     * @return Return the sorted members of the channel as they are now, or nullptr if there is no such channel.
+     */
+    std::shared_ptr<const Members> getMembers(uint64_t channel);
+
+    /**
+     * @author: CGL
+     * @param from The connection of the sender, which must be logged in and a member.
+     * @param channel The channel ID.
+     * @param request The request to forward to the members.
+     * @return Return the number of online members it went to, the sender excluded.
+     */
+    size_t Post(Socket& from, uint64_t channel, const Request& request);
+
+    /**
+     * @author: CGL
+     * @param client The connection which sent the request. It must be logged in.
+     * @param request An RT_CREATECHANNEL, RT_JOINCHANNEL, RT_LEAVECHANNEL or RT_POSTCHANNEL request.
+     * @return Return false if the request is malformed, or posts as another user than the one logged in,
+     *  and the connection should be closed.
+     * @description: Requests about unknown channels, or from users who are not allowed, are ignored.
+     */
+    bool Handle(Socket& client, const Request& request);
+
+    /**
+     * @author: CGL
+     * @return Return the number of channels.
+     */
+    size_t getChannelCount();
+
+protected:
+    /**
+     * @author: CGL
+     * @struct ChannelName
+     * @description: A channel name padded with '\0', the same 16 bytes as in the message structs.
+     */
+    struct ChannelName
+    {
+        char data[16];
+
+        bool operator==(const ChannelName& other) const;
+    };
+
+    struct ChannelNameHash
+    {
+        size_t operator()(const ChannelName& name) const;
+    };
+
+    struct Channel
+    {
+        std::mutex lock;
+        std::shared_ptr<Members> members;
+    };
+
+    // Pad or cut a channel name to the key.
+    static ChannelName _MakeName(const char* name, size_t length);
+
+    // Return the channel, or nullptr if there is no such channel.
+    Channel* _Find(uint64_t channel);
+
+protected:
+    Router& m_router;
+    std::mutex m_lock;
+    FlatMap<ChannelName, uint64_t, ChannelNameHash> m_names;
+    std::vector<std::unique_ptr<Channel>> m_channels;  // Indexed by the channel ID minus 1
+};
+
+#endif // !SIMTOCHAT_INCLUDE_CHANNEL_H
@@ -0,0 +1,195 @@
+/*
+ * @FilePath: /simtochat/simtochat/include/Codec.h
+ * @Author: CGL
+ * @Date: 2026-10-17 14:05:12
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 14:05:12
+ * @Description:
+ *  Encode requests into a buffer and decode them from a stream without copying.
+ */
+#ifndef SIMTOCHAT_INCLUDE_CODEC_H
+#define SIMTOCHAT_INCLUDE_CODEC_H
+
+#include "Request.h"
+#include "Buffer.h"
+#include "Coroutine.h"
+#include "SharedBuffer.h"
+
+#include <stddef.h>
+
+/**
+ * @author: CGL
+ * @class RequestDecoder
+ * @description:
+ *  Pull complete requests out of the input buffer of a connection.
+ *  The payloads are views into the buffer: they stay valid while the decoder lives,
+ *  and the decoded bytes are retrieved from the buffer when it is destroyed.
+ *  A request split across reads stays in the buffer until the rest arrives,
+ *  and one read with many requests is decoded in a single pass.
+ *  @example
+ *      Request request;
+ *      RequestDecoder decoder(client.getInput());
+ *      while (decoder.Next(request)) { ... }
+ *      if (decoder.isBroken()) client.Disconnect();
+ */
+class RequestDecoder
+{
+public:
+    /**
+     * @author: CGL
+     * @param input The buffer to decode.
+     * @param maxLength The largest payload accepted. A longer one breaks the stream.
+     * @description: Create a decoder over the readable bytes of the buffer.
+     */
+    explicit RequestDecoder(Buffer& input, uint32_t maxLength = REQUEST_MAX_LENGTH);
+
+    // Retrieve the decoded requests from the buffer.
+    virtual ~RequestDecoder();
+
+    RequestDecoder(const RequestDecoder&) = delete;
+    RequestDecoder& operator=(const RequestDecoder&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param request Receive the next request.
+     * @return Return false if there is no complete request left or the stream is broken.
+     * @description: Decode the next complete request.
+     */
+    bool Next(Request& request);
+
+    /**
+     * @author: CGL
+     * @return Return true if a header with an invalid length was found.
+     * @description: A broken stream can not be resynchronized, the connection should be closed.
+     */
+    bool isBroken() const;
+
+    /**
+     * @author: CGL
+     * @return Return the number of bytes decoded so far.
+     */
+    size_t getDecodedBytes() const;
+
+protected:
+    Buffer& m_input;
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset;
+    uint32_t m_maxLength;
+    bool m_broken;
+};
+
+/**
+ * @author: CGL
+ * @param socket The connection of a coroutine handler.
+ * @param request Receive the next request.
+ * @param maxLength The largest payload accepted. A longer one disconnects the client.
+ * @return co_await it for false once the connection is closed or broken.
+ * @description:
+ *  Wait for the next complete request, waking up only once all of it arrived.
+ *  The payload is a view into the input buffer until the handler awaits again.
+ */
+CoTask<bool> ReadRequest(CoSocket& socket, Request& request, uint32_t maxLength = REQUEST_MAX_LENGTH);
+
+/**
+ * @author: CGL
+ * @param header The REQUEST_HEADER_SIZE bytes to write.
+ * @param type The type of the request.
+ * @param length The number of bytes of the payload.
+ * @param flags The flags of the request.
+ * @description: Write the header of a request, to send it in front of a payload which stays where it is.
+ */
+void EncodeHeader(char* header, uint8_t type, uint32_t length, uint8_t flags = RF_NONE);
+
+/**
+ * @author: CGL
+ * @param output The buffer to append the request.
+ * @param type The type of the request.
+ * @param payload The payload of the request.
+ * @param length The number of bytes of the payload.
+ * @param flags The flags of the request.
+ * @description: Append a header and the payload to the buffer.
+ */
+void EncodeRequest(Buffer& output, uint8_t type, const void* payload, uint32_t length, uint8_t flags = RF_NONE);
+
+/**
+ * @author: CGL
+ * @param type The type of the request.
+ * @param payload The payload of the request.
+ * @param length The number of bytes of the payload.
+ * @param flags The flags of the request.
+ * @return Return the header and the payload in a new shared buffer.
+ * @description: Encode a request once for many connections.
+ */
+SharedBuffer EncodeSharedRequest(uint8_t type, const void* payload, uint32_t length, uint8_t flags = RF_NONE);
+
+/**
+ * @author: CGL
+ * @param output The buffer to append the request.
+ * @param type The type of the request.
+ * @param msg The message struct to send as the payload.
+ * @description: Append a message struct as a request to the buffer.
+ */
+template<class T>
+void EncodeRequest(Buffer& output, uint8_t type, const T& msg)
+{
+    static_assert(alignof(T) == 1, "Only packed message structs can be encoded as they are.");
+    EncodeRequest(output, type, &msg, sizeof(msg));
+}
+
+/**
+ * @author: CGL
+ * @param request A decoded request.
+ * @return Return a pointer to the message in the input buffer, or nullptr if the payload is too short.
+ * @description: View the payload of a request as a message struct without copying it.
+ */
+template<class T>
+const T* RequestCast(const Request& request)
+{
+    // Packed structs can be read at any address in the buffer.
+    static_assert(alignof(T) == 1, "Only packed message structs can be viewed in place.");
+    if (request.length < sizeof(T)) return nullptr;
+    return reinterpret_cast<const T*>(request.msg);
+}
+
+// The largest size of a varint of 64 bits.
+#define VARINT_MAX_SIZE     10
+
+/**
+ * @author: CGL
+ * @param p The address to write. It should have VARINT_MAX_SIZE bytes.
+ * @param value The value to encode.
+ * @return Return the number of bytes written.
+ * @description: Encode an unsigned integer as a LEB128 varint, 7 bits per byte.
+ */
+size_t EncodeVarint(char* p, uint64_t value);
+
+/**
+ * @author: CGL
+ * @param p The address to read, moved past the varint on success.
+ * @param end The end of the readable bytes.
+ * @param value Receive the decoded value.
+ * @return Return false if the varint is truncated or too long.
+ * @description: Decode a LEB128 varint.
+ */
+bool DecodeVarint(const char*& p, const char* end, uint64_t& value);
+
+/**
+ * @author: CGL
+ * @param output The buffer to append the request.
+ * @param msg The message to send.
+ * @description: Append a compact RT_SENDMESSAGE request to the buffer.
+ */
+void EncodeSendMessage(Buffer& output, const SendMessage& msg);
+
+/**
+ * @author: CGL
+ * @param request A decoded RT_SENDMESSAGE request with RF_COMPACT.
+ * @param msg Receive the message. Its text is a view into the request payload.
+ * @return Return false if the payload is malformed.
+ * @description: Decode a compact message without copying the text.
+ */
+bool DecodeSendMessage(const Request& request, SendMessage& msg);
+
+#endif // !SIMTOCHAT_INCLUDE_CODEC_H
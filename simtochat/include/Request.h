@@ -11,6 +11,18 @@
 #ifndef SIMTOCHAT_INCLUDE_REQUEST_H
 #define SIMTOCHAT_INCLUDE_REQUEST_H
 
+#include <stdint.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The message structs are read in place and assume a little-endian host."
+#endif
+
+// The size of the fixed header in front of every request on the wire.
+#define REQUEST_HEADER_SIZE     6
+
+// The largest payload accepted by default.
+#define REQUEST_MAX_LENGTH      (1 << 20)
+
 /**
  * @author: CGL
  * @enum RequestType
@@ -21,21 +33,43 @@ enum RequestType
     RT_UNKNOW,
     RT_LOGIN,
     RT_REGISTER,
-    RT_SENDMESSAGE
+    RT_SENDMESSAGE,
+    RT_CREATECHANNEL,
+    RT_JOINCHANNEL,
+    RT_LEAVECHANNEL,
+    RT_POSTCHANNEL
+};
+
+/**
+ * @author: CGL
+ * @enum RequestFlag
+ * @description: Bits of the flags field in the request header.
+ */
+enum RequestFlag
+{
+    RF_NONE = 0,
+    RF_COMPACT = 1 << 0     // The payload uses the compact encoding instead of the fixed struct.
 };
 
 /**
  * @author: CGL
  * @struct Request
- * @description: Request data format.
+ * @description:
+ *  A decoded request. On the wire it is a fixed little-endian header followed by the payload:
+ *      | type: u8 | flags: u8 | length: u32 | payload: length bytes |
+ *  msg points into the input buffer of the connection, it is not a copy.
  */
 struct Request
 {
-    char type;
-    long length;
-    char* msg;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t length;
+    const char* msg;
 };
 
+// The message structs travel as they are, so they must not have any padding.
+#pragma pack(push, 1)
+
 /**
  * @author: CGL
  * @struct msg_login
@@ -68,8 +102,51 @@ struct msg_sendmessage
 {
     char sender[16];
     char reciver[16];
-    long sendtime;
+    int64_t sendtime;
+    char message[1024];
+};
+
+/**
+ * @author: CGL
+ * @struct msg_channel
+ * @description: The message that creates, joins or leaves a channel.
+ */
+struct msg_channel
+{
+    char channel[16];
+};
+
+/**
+ * @author: CGL
+ * @struct msg_postchannel
+ * @description: The message that posts to every member of a channel.
+ */
+struct msg_postchannel
+{
+    char sender[16];
+    char channel[16];
+    int64_t sendtime;
     char message[1024];
 };
 
+#pragma pack(pop)
+
+/**
+ * @author: CGL
+ * @struct SendMessage
+ * @description:
+ *  The compact form of msg_sendmessage, sent as RT_SENDMESSAGE with RF_COMPACT.
+ *  Users are numeric IDs and the text only takes its own length:
+ *      | sender: varint | reciver: varint | sendtime: zigzag varint | length: varint | message: UTF-8 |
+ *  After decoding, message points into the input buffer of the connection.
+ */
+struct SendMessage
+{
+    uint64_t sender;
+    uint64_t reciver;
+    int64_t sendtime;
+    uint32_t length;
+    const char* message;
+};
+
 #endif // !SIMTOCHAT_INCLUDE_REQUEST_H
\ No newline at end of file
@@ -0,0 +1,278 @@
+/*
+ * @FilePath: /simtochat/simtochat/include/Router.h
+ * @Author: CGL
+ * @Date: 2026-10-17 19:26:51
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 19:26:51
+ * @Description:
+ *  Route the messages between the users connected to the event loops of EpollServer.
+ */
+#ifndef SIMTOCHAT_INCLUDE_ROUTER_H
+#define SIMTOCHAT_INCLUDE_ROUTER_H
+
+#include "Request.h"
+#include "Socket.h"
+#include "FlatMap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// The session table is split into shards with their own locks.
+#define ROUTER_SHARDS       64
+
+/**
+ * @author: CGL
+ * @struct Session
+ * @description: Where a logged-in user is connected.
+ */
+struct Session
+{
+    EventLoop* loop;
+    int fd;
+    uint64_t serial;    // Socket::getSerial(), to detect a file descriptor reused by another connection
+};
+
+/**
+ * @author: CGL
+ * @class Router
+ * @description:
+ *  Map the usernames to user IDs and the user IDs to their sessions,
+ *  and deliver RT_SENDMESSAGE requests to the connection of the receiver.
+ *  A receiver on the same loop gets the message in its output buffer right away.
+ *  A receiver on another loop gets it through the lock-free mailbox of that loop,
+ *  so the sending loop never touches a socket it does not own.
+ *  Messages to users who are not connected go to the offline handler, or are dropped without one.
+ *  All the methods are safe to call from the callbacks of any loop.
+ */
+class Router
+{
+public:
+    // Called with a message to a user who is not connected, from the loop of the sender,
+    // or from the loop of the receiver when it left while the message was handed over.
+    typedef std::function<void(uint64_t receiver, const Request& request)> OfflineHandler;
+
+    // Called with a new user, its 16 bytes of username and its 20 bytes of password padded with '\0',
+    // before anyone can find the name. Return false to refuse the registration, such as when it can not be saved.
+    typedef std::function<bool(uint64_t user, const char* username, const char* password)> RegisterHandler;
+
+    /**
+     * @author: CGL
+     * @param expectedUsers The number of sessions to make room for.
+     */
+    explicit Router(size_t expectedUsers = 1024);
+    virtual ~Router();
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username, at most 16 bytes are used.
+     * @return Return the ID of the user, given on first use.
+     */
+    uint64_t getUserId(const char* username, size_t length);
+
+    /**
+     * @author: CGL
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username, at most 16 bytes are used.
+     * @return Return the ID of the user, or 0 if the name was never seen.
+     */
+    uint64_t FindUserId(const char* username, size_t length);
+
+    /**
+     * @author: CGL
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username, at most 16 bytes are used.
+     * @param password The password, not always terminated by '\0'.
+     * @param passwordLength The length of the password, at most 20 bytes are used.
+     * @return Return the ID of the new user, or 0 if the username is empty or already taken,
+     *  or the register handler refused it.
+     */
+    uint64_t Register(const char* username, size_t length, const char* password, size_t passwordLength);
+
+    /**
+     * @author: CGL
+     * @param user The ID the user was registered with, such as by an earlier run of the server.
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username, at most 16 bytes are used.
+     * @param password The password, not always terminated by '\0'.
+     * @param passwordLength The length of the password, at most 20 bytes are used.
+     * @return Return false if the username is empty or already taken, or the ID is not larger than every ID given.
+     * @description: Register a user again with its ID, without the register handler. Restore the users
+     *  in the order of their IDs, before the server starts. The users registered later get larger IDs.
+     */
+    bool Restore(uint64_t user, const char* username, size_t length, const char* password, size_t passwordLength);
+
+    /**
+     * @author: CGL
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username, at most 16 bytes are used.
+     * @param password The password, not always terminated by '\0'.
+     * @param passwordLength The length of the password, at most 20 bytes are used.
+     * @return Return the ID of the user, or 0 if the user was not registered or the password is wrong.
+     *  A name given an ID by getUserId() has no password and never logs in this way.
+     */
+    uint64_t Authenticate(const char* username, size_t length, const char* password, size_t passwordLength);
+
+    /**
+     * @author: CGL
+     * @param user The user ID.
+     * @return Return true if the ID was given to a username.
+     */
+    bool isUser(uint64_t user) const;
+
+    /**
+     * @author: CGL
+     * @param client The connection which logged in.
+     * @param username The username, not always terminated by '\0'.
+     * @param length The length of the username.
+     * @return Return the ID of the user.
+     * @description: Bind the user to the connection. A previous session of the user stops receiving.
+     */
+    uint64_t Login(Socket& client, const char* username, size_t length);
+
+    /**
+     * @author: CGL
+     * @param user The user ID.
+     * @param client The connection of the user. Its context becomes the user ID.
+     * @description: Route the messages to the user into this connection.
+     */
+    void Bind(uint64_t user, Socket& client);
+
+    /**
+     * @author: CGL
+     * @param user The user ID.
+     * @param session The session to route to.
+     * @description: Route the messages to the user into a session, such as the one of another user.
+     */
+    void Bind(uint64_t user, const Session& session);
+
+    /**
+     * @author: CGL
+     * @param client The connection which is closing.
+     * @description: Forget the session of the user of this connection, if it is still this one.
+     *  Call it from the closer of EpollServer.
+     */
+    void Unbind(Socket& client);
+
+    /**
+     * @author: CGL
+     * @param user The user ID.
+     * @param session Receive the session of the user.
+     * @return Return false if the user is not connected.
+     */
+    bool Find(uint64_t user, Session& session);
+
+    /**
+     * @author: CGL
+     * @param from The connection which sent the request.
+     * @param request An RT_SENDMESSAGE request, in the compact or the fixed form.
+     * @return Return false if the request is malformed, or the connection is not logged in as its sender,
+     *  and the connection should be closed.
+     * @description: Forward the request as it is to the receiver. A receiver who is not a user is dropped.
+     */
+    bool Route(Socket& from, const Request& request);
+
+    /**
+     * @author: CGL
+     * @param handler Keep the messages Route() can not deliver, such as in an offline store.
+     *  Set it before the server starts.
+     */
+    void setOfflineHandler(OfflineHandler handler);
+
+    /**
+     * @author: CGL
+     * @param handler Save the users Register() gives an ID, such as next to the offline store,
+     *  so the IDs of its messages mean the same users after a restart. Set it before the server starts.
+     */
+    void setRegisterHandler(RegisterHandler handler);
+
+    /**
+     * @author: CGL
+     * @param from The connection which sent the request.
+     * @param receiver The user ID of the receiver.
+     * @param request The request to forward.
+     * @return Return false if the receiver is not connected. A receiver on another loop who leaves
+     *  before the message gets there has it passed to the offline handler from that loop.
+     */
+    bool Deliver(Socket& from, uint64_t receiver, const Request& request);
+
+    /**
+     * @author: CGL
+     * @param from The connection which sent the request.
+     * @param receivers The user IDs of the receivers.
+     * @param count The number of receivers.
+     * @param request The request to forward.
+     * @param except A user ID among the receivers to skip, such as the sender, or 0.
+     * @return Return the number of receivers which are connected.
+     * @description:
+     *  Forward one request to many users. It is encoded once into a SharedBuffer and every connection
+     *  queues a reference to it, so the cost in memory and copies does not grow with the receivers.
+     *  The receivers are looked up shard by shard, with one lock per shard instead of one per receiver,
+     *  and the receivers of each other loop are handed over in one task. The frames are only queued,
+     *  each loop writes them after the current callback, with the other frames for the same connection.
+     */
+    size_t Broadcast(Socket& from, const uint64_t* receivers, size_t count, const Request& request,
+        uint64_t except = 0);
+
+    /**
+     * @author: CGL
+     * @return Return the number of connected users.
+     */
+    size_t getSessionCount();
+
+protected:
+    /**
+     * @author: CGL
+     * @struct UserName
+     * @description: A username padded with '\0', the same 16 bytes as in the message structs.
+     */
+    struct UserName
+    {
+        char data[16];
+
+        bool operator==(const UserName& other) const;
+    };
+
+    struct UserNameHash
+    {
+        size_t operator()(const UserName& name) const;
+    };
+
+    // A password padded with '\0', the same 20 bytes as in the message structs.
+    struct Password
+    {
+        char data[20];
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        FlatMap<uint64_t, Session> sessions;
+    };
+
+    // Pad or cut a username to the key.
+    static UserName _MakeName(const char* username, size_t length);
+
+    // Pad or cut a password.
+    static Password _MakePassword(const char* password, size_t length);
+
+    Shard& _ShardOf(uint64_t user);
+
+protected:
+    Shard m_shards[ROUTER_SHARDS];
+    std::mutex m_nameLock;
+    FlatMap<UserName, uint64_t, UserNameHash> m_names;
+    FlatMap<uint64_t, Password> m_passwords;   // Of the registered users, under m_nameLock
+    std::atomic<uint64_t> m_nextId;     // Written under m_nameLock, read by isUser() without it
+    OfflineHandler m_offline;
+    RegisterHandler m_register;         // Called under m_nameLock
+};
+
+#endif // !SIMTOCHAT_INCLUDE_ROUTER_H
@@ -0,0 +1,198 @@
+/*
+ * @FilePath: /simtochat/simtochat/src/Channel.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 10:12:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 10:12:37
+ * @Description:
+ */
+#include "Channel.h"
+#include "Codec.h"
+
+#include <string.h>
+#include <algorithm>
+
+ChannelIndex::ChannelIndex(Router& router)
+    : m_router(router)
+{
+
+}
+
+ChannelIndex::~ChannelIndex()
+{
+
+}
+
+uint64_t ChannelIndex::Create(const char* name, size_t length, uint64_t owner)
+{
+    ChannelName key = _MakeName(name, length);
+    std::unique_ptr<Channel> channel(new Channel);
+    channel->members = std::make_shared<Members>();
+    if (owner != 0) channel->members->push_back(owner);
+
+    std::lock_guard<std::mutex> lock{ m_lock };
+    auto rst = m_names.Insert(key, m_channels.size() + 1);
+    if (!rst.second) return 0;
+    m_channels.push_back(std::move(channel));
+    return *rst.first;
+}
+
+uint64_t ChannelIndex::FindChannelId(const char* name, size_t length)
+{
+    ChannelName key = _MakeName(name, length);
+    std::lock_guard<std::mutex> lock{ m_lock };
+    uint64_t* channel = m_names.Find(key);
+    return channel ? *channel : 0;
+}
+
+bool ChannelIndex::Join(uint64_t channel, uint64_t user)
+{
+    Channel* found = _Find(channel);
+    if (!found || user == 0) return false;
+
+    std::lock_guard<std::mutex> lock{ found->lock };
+    Members& members = *found->members;
+    auto it = std::lower_bound(members.begin(), members.end(), user);
+    if (it != members.end() && *it == user) return false;
+
+    // A post still walks the current vector, the change goes to a copy.
+    if (found->members.use_count() > 1)
+    {
+        auto copy = std::make_shared<Members>();
+        copy->reserve(members.size() + 1);
+        copy->insert(copy->end(), members.begin(), it);
+        copy->push_back(user);
+        copy->insert(copy->end(), it, members.end());
+        found->members = std::move(copy);
+    }
+    else
+    {
+        members.insert(it, user);
+    }
+    return true;
+}
+
+bool ChannelIndex::Leave(uint64_t channel, uint64_t user)
+{
+    Channel* found = _Find(channel);
+    if (!found) return false;
+
+    std::lock_guard<std::mutex> lock{ found->lock };
+    Members& members = *found->members;
+    auto it = std::lower_bound(members.begin(), members.end(), user);
+    if (it == members.end() || *it != user) return false;
+
+    if (found->members.use_count() > 1)
+    {
+        auto copy = std::make_shared<Members>();
+        copy->reserve(members.size() - 1);
+        copy->insert(copy->end(), members.begin(), it);
+        copy->insert(copy->end(), it + 1, members.end());
+        found->members = std::move(copy);
+    }
+    else
+    {
+        members.erase(it);
+    }
+    return true;
+}
+
+bool ChannelIndex::isMember(uint64_t channel, uint64_t user)
+{
+    Channel* found = _Find(channel);
+    if (!found) return false;
+
+    std::lock_guard<std::mutex> lock{ found->lock };
+    return std::binary_search(found->members->begin(), found->members->end(), user);
+}
+
+std::shared_ptr<const ChannelIndex::Members> ChannelIndex::getMembers(uint64_t channel)
+{
+    Channel* found = _Find(channel);
+    if (!found) return nullptr;
+
+    std::lock_guard<std::mutex> lock{ found->lock };
+    return found->members;
+}
+
+size_t ChannelIndex::Post(Socket& from, uint64_t channel, const Request& request)
+{
+    uint64_t sender = from.getContext();
+    std::shared_ptr<const Members> members = getMembers(channel);
+    if (!members || sender == 0 || !std::binary_search(members->begin(), members->end(), sender)) return 0;
+
+    return m_router.Broadcast(from, members->data(), members->size(), request, sender);
+}
+
+bool ChannelIndex::Handle(Socket& client, const Request& request)
+{
+    uint64_t user = client.getContext();
+    if (request.type == RT_POSTCHANNEL)
+    {
+        auto msg = RequestCast<msg_postchannel>(request);
+        if (!msg) return false;
+        if (user == 0) return true;
+
+        // Members post only as themselves, the receivers trust the sender of the post.
+        if (m_router.FindUserId(msg->sender, strnlen(msg->sender, sizeof(msg->sender))) != user) return false;
+
+        uint64_t channel = FindChannelId(msg->channel, strnlen(msg->channel, sizeof(msg->channel)));
+        if (channel != 0) Post(client, channel, request);
+        return true;
+    }
+
+    auto msg = RequestCast<msg_channel>(request);
+    if (!msg) return false;
+    if (user == 0) return true;
+
+    size_t length = strnlen(msg->channel, sizeof(msg->channel));
+    switch (request.type)
+    {
+    case RT_CREATECHANNEL:
+        Create(msg->channel, length, user);
+        break;
+    case RT_JOINCHANNEL:
+        Join(FindChannelId(msg->channel, length), user);
+        break;
+    case RT_LEAVECHANNEL:
+        Leave(FindChannelId(msg->channel, length), user);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+size_t ChannelIndex::getChannelCount()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_channels.size();
+}
+
+bool ChannelIndex::ChannelName::operator==(const ChannelName& other) const
+{
+    return memcmp(data, other.data, sizeof(data)) == 0;
+}
+
+size_t ChannelIndex::ChannelNameHash::operator()(const ChannelName& name) const
+{
+    uint64_t a, b;
+    memcpy(&a, name.data, sizeof(a));
+    memcpy(&b, name.data + sizeof(a), sizeof(b));
+    return size_t(a ^ (b * 0xC2B2AE3D27D4EB4Full) ^ (b >> 29));
+}
+
+ChannelIndex::ChannelName ChannelIndex::_MakeName(const char* name, size_t length)
+{
+    ChannelName key;
+    memset(key.data, 0, sizeof(key.data));
+    memcpy(key.data, name, std::min(length, sizeof(key.data)));
+    return key;
+}
+
+ChannelIndex::Channel* ChannelIndex::_Find(uint64_t channel)
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    if (channel == 0 || channel > m_channels.size()) return nullptr;
+    return m_channels[channel - 1].get();
+}
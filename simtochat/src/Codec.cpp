@@ -0,0 +1,177 @@
+/*
+ * @FilePath: /simtochat/simtochat/src/Codec.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 14:05:12
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 14:05:12
+ * @Description:
+ */
+#include "Codec.h"
+
+#include <string.h>
+
+static uint32_t ReadUint32(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(u[0]) | uint32_t(u[1]) << 8 | uint32_t(u[2]) << 16 | uint32_t(u[3]) << 24;
+}
+
+static void WriteUint32(char* p, uint32_t value)
+{
+    p[0] = char(value);
+    p[1] = char(value >> 8);
+    p[2] = char(value >> 16);
+    p[3] = char(value >> 24);
+}
+
+RequestDecoder::RequestDecoder(Buffer& input, uint32_t maxLength)
+    : m_input(input), m_data(nullptr), m_size(input.getReadableBytes()),
+      m_offset(0), m_maxLength(maxLength), m_broken(false)
+{
+    m_data = input.Peek();
+}
+
+RequestDecoder::~RequestDecoder()
+{
+    m_input.Retrieve(m_offset);
+}
+
+bool RequestDecoder::Next(Request& request)
+{
+    if (m_broken) return false;
+    if (m_size - m_offset < REQUEST_HEADER_SIZE) return false;
+
+    const char* header = m_data + m_offset;
+    uint32_t length = ReadUint32(header + 2);
+    if (length > m_maxLength)
+    {
+        m_broken = true;
+        return false;
+    }
+    if (m_size - m_offset - REQUEST_HEADER_SIZE < length) return false;
+
+    request.type = static_cast<uint8_t>(header[0]);
+    request.flags = static_cast<uint8_t>(header[1]);
+    request.length = length;
+    request.msg = header + REQUEST_HEADER_SIZE;
+    m_offset += REQUEST_HEADER_SIZE + length;
+    return true;
+}
+
+bool RequestDecoder::isBroken() const
+{
+    return m_broken;
+}
+
+size_t RequestDecoder::getDecodedBytes() const
+{
+    return m_offset;
+}
+
+CoTask<bool> ReadRequest(CoSocket& socket, Request& request, uint32_t maxLength)
+{
+    size_t wanted = REQUEST_HEADER_SIZE;
+    while (co_await socket.Read(wanted))
+    {
+        Buffer& input = socket.get()->getInput();
+        {
+            // The decoder retrieves the request, its bytes stay in place until the next read.
+            RequestDecoder decoder(input, maxLength);
+            if (decoder.Next(request)) co_return true;
+            if (decoder.isBroken()) break;
+        }
+        // Only the header is here: wait for the whole payload at once.
+        wanted = REQUEST_HEADER_SIZE + ReadUint32(input.Peek() + 2);
+    }
+    if (Socket* client = socket.get()) client->Disconnect();
+    co_return false;
+}
+
+void EncodeHeader(char* header, uint8_t type, uint32_t length, uint8_t flags)
+{
+    header[0] = static_cast<char>(type);
+    header[1] = static_cast<char>(flags);
+    WriteUint32(header + 2, length);
+}
+
+void EncodeRequest(Buffer& output, uint8_t type, const void* payload, uint32_t length, uint8_t flags)
+{
+    char header[REQUEST_HEADER_SIZE];
+    EncodeHeader(header, type, length, flags);
+
+    output.EnsureWritable(REQUEST_HEADER_SIZE + length);
+    output.Append(header, REQUEST_HEADER_SIZE);
+    output.Append(payload, length);
+}
+
+SharedBuffer EncodeSharedRequest(uint8_t type, const void* payload, uint32_t length, uint8_t flags)
+{
+    SharedBuffer frame(REQUEST_HEADER_SIZE + size_t(length));
+    EncodeHeader(frame.getMutableData(), type, length, flags);
+    memcpy(frame.getMutableData() + REQUEST_HEADER_SIZE, payload, length);
+    return frame;
+}
+
+size_t EncodeVarint(char* p, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        p[n++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = static_cast<char>(value);
+    return n;
+}
+
+bool DecodeVarint(const char*& p, const char* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint64_t byte = static_cast<unsigned char>(*p++);
+        value |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void EncodeSendMessage(Buffer& output, const SendMessage& msg)
+{
+    // Zigzag keeps a small negative time small.
+    uint64_t sendtime = (static_cast<uint64_t>(msg.sendtime) << 1) ^ static_cast<uint64_t>(msg.sendtime >> 63);
+
+    char fields[VARINT_MAX_SIZE * 4];
+    size_t n = EncodeVarint(fields, msg.sender);
+    n += EncodeVarint(fields + n, msg.reciver);
+    n += EncodeVarint(fields + n, sendtime);
+    n += EncodeVarint(fields + n, msg.length);
+
+    char header[REQUEST_HEADER_SIZE];
+    header[0] = static_cast<char>(RT_SENDMESSAGE);
+    header[1] = static_cast<char>(RF_COMPACT);
+    WriteUint32(header + 2, static_cast<uint32_t>(n + msg.length));
+
+    output.EnsureWritable(REQUEST_HEADER_SIZE + n + msg.length);
+    output.Append(header, REQUEST_HEADER_SIZE);
+    output.Append(fields, n);
+    output.Append(msg.message, msg.length);
+}
+
+bool DecodeSendMessage(const Request& request, SendMessage& msg)
+{
+    const char* p = request.msg;
+    const char* end = request.msg + request.length;
+    uint64_t sendtime, length;
+
+    if (!DecodeVarint(p, end, msg.sender)) return false;
+    if (!DecodeVarint(p, end, msg.reciver)) return false;
+    if (!DecodeVarint(p, end, sendtime)) return false;
+    if (!DecodeVarint(p, end, length)) return false;
+    if (length > static_cast<uint64_t>(end - p)) return false;
+
+    msg.sendtime = static_cast<int64_t>(sendtime >> 1) ^ -static_cast<int64_t>(sendtime & 1);
+    msg.length = static_cast<uint32_t>(length);
+    msg.message = p;
+    return true;
+}
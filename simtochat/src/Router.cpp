@@ -0,0 +1,330 @@
+/*
+ * @FilePath: /simtochat/simtochat/src/Router.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 19:26:51
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 19:26:51
+ * @Description:
+ */
+#include "Router.h"
+#include "Codec.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+Router::Router(size_t expectedUsers)
+    : m_names(expectedUsers), m_passwords(expectedUsers), m_nextId(1)
+{
+    for (auto& shard : m_shards)
+    {
+        shard.sessions.Reserve(expectedUsers / ROUTER_SHARDS);
+    }
+}
+
+Router::~Router()
+{
+
+}
+
+uint64_t Router::getUserId(const char* username, size_t length)
+{
+    UserName name = _MakeName(username, length);
+    std::lock_guard<std::mutex> lock{ m_nameLock };
+    uint64_t next = m_nextId.load(std::memory_order_relaxed);
+    auto rst = m_names.Insert(name, next);
+    if (rst.second) m_nextId.store(next + 1, std::memory_order_release);
+    return *rst.first;
+}
+
+uint64_t Router::FindUserId(const char* username, size_t length)
+{
+    UserName name = _MakeName(username, length);
+    std::lock_guard<std::mutex> lock{ m_nameLock };
+    uint64_t* user = m_names.Find(name);
+    return user ? *user : 0;
+}
+
+uint64_t Router::Register(const char* username, size_t length, const char* password, size_t passwordLength)
+{
+    UserName name = _MakeName(username, length);
+    if (name.data[0] == '\0') return 0;
+    Password secret = _MakePassword(password, passwordLength);
+    std::lock_guard<std::mutex> lock{ m_nameLock };
+    if (m_names.Find(name)) return 0;
+
+    // Saved before the name is found, so nothing is ever kept for an ID a restart would give to someone else.
+    uint64_t next = m_nextId.load(std::memory_order_relaxed);
+    if (m_register && !m_register(next, name.data, secret.data)) return 0;
+    m_names.Insert(name, next);
+    m_passwords.Insert(next, secret);
+    m_nextId.store(next + 1, std::memory_order_release);
+    return next;
+}
+
+bool Router::Restore(uint64_t user, const char* username, size_t length, const char* password, size_t passwordLength)
+{
+    UserName name = _MakeName(username, length);
+    if (user == 0 || name.data[0] == '\0') return false;
+    std::lock_guard<std::mutex> lock{ m_nameLock };
+    if (user < m_nextId.load(std::memory_order_relaxed) || !m_names.Insert(name, user).second) return false;
+    m_passwords.Insert(user, _MakePassword(password, passwordLength));
+    m_nextId.store(user + 1, std::memory_order_release);
+    return true;
+}
+
+uint64_t Router::Authenticate(const char* username, size_t length, const char* password, size_t passwordLength)
+{
+    UserName name = _MakeName(username, length);
+    Password given = _MakePassword(password, passwordLength);
+    std::lock_guard<std::mutex> lock{ m_nameLock };
+    uint64_t* user = m_names.Find(name);
+    Password* expected = user ? m_passwords.Find(*user) : nullptr;
+    if (!expected) return 0;
+
+    // Compare every byte, so the time does not tell how much of the password is right.
+    unsigned char diff = 0;
+    for (size_t i = 0; i < sizeof(given.data); i++) diff |= given.data[i] ^ expected->data[i];
+    return diff == 0 ? *user : 0;
+}
+
+uint64_t Router::Login(Socket& client, const char* username, size_t length)
+{
+    uint64_t user = getUserId(username, length);
+    Bind(user, client);
+    return user;
+}
+
+void Router::Bind(uint64_t user, Socket& client)
+{
+    // A connection which logs in again as someone else leaves its old user.
+    if (client.getContext() != 0 && client.getContext() != user) Unbind(client);
+
+    client.setContext(user);
+    Bind(user, Session{ client.getLoop(), client.getfd(), client.getSerial() });
+}
+
+void Router::Bind(uint64_t user, const Session& session)
+{
+    Shard& shard = _ShardOf(user);
+    std::lock_guard<std::mutex> lock{ shard.lock };
+    shard.sessions[user] = session;
+}
+
+void Router::Unbind(Socket& client)
+{
+    uint64_t user = client.getContext();
+    if (user == 0) return;
+    client.setContext(0);
+
+    Shard& shard = _ShardOf(user);
+    std::lock_guard<std::mutex> lock{ shard.lock };
+    Session* session = shard.sessions.Find(user);
+    if (session && session->loop == client.getLoop() && session->fd == client.getfd()
+        && session->serial == client.getSerial())
+    {
+        shard.sessions.Erase(user);
+    }
+}
+
+bool Router::Find(uint64_t user, Session& session)
+{
+    Shard& shard = _ShardOf(user);
+    std::lock_guard<std::mutex> lock{ shard.lock };
+    Session* found = shard.sessions.Find(user);
+    if (!found) return false;
+    session = *found;
+    return true;
+}
+
+bool Router::Route(Socket& from, const Request& request)
+{
+    // Only a logged-in user sends, and only as itself.
+    uint64_t sender = from.getContext();
+    if (sender == 0) return false;
+
+    uint64_t receiver;
+    if (request.flags & RF_COMPACT)
+    {
+        SendMessage msg;
+        if (!DecodeSendMessage(request, msg) || msg.sender != sender) return false;
+        receiver = isUser(msg.reciver) ? msg.reciver : 0;
+    }
+    else
+    {
+        auto msg = RequestCast<msg_sendmessage>(request);
+        if (!msg || FindUserId(msg->sender, strnlen(msg->sender, sizeof(msg->sender))) != sender) return false;
+        receiver = FindUserId(msg->reciver, strnlen(msg->reciver, sizeof(msg->reciver)));
+    }
+
+    // A receiver nobody ever logged in as is dropped, so a client can not make up users to store for.
+    if (receiver != 0 && !Deliver(from, receiver, request) && m_offline) m_offline(receiver, request);
+    return true;
+}
+
+bool Router::isUser(uint64_t user) const
+{
+    return user != 0 && user < m_nextId.load(std::memory_order_acquire);
+}
+
+void Router::setOfflineHandler(OfflineHandler handler)
+{
+    m_offline = std::move(handler);
+}
+
+void Router::setRegisterHandler(RegisterHandler handler)
+{
+    m_register = std::move(handler);
+}
+
+bool Router::Deliver(Socket& from, uint64_t receiver, const Request& request)
+{
+    Session session;
+    if (!Find(receiver, session)) return false;
+
+    // Same loop: this thread owns the receiver, the payload goes from the input of the sender without a copy.
+    if (session.loop == from.getLoop())
+    {
+        Socket* to = session.loop->getClient(session.fd);
+        if (!to || to->getSerial() != session.serial) return false;
+        char header[REQUEST_HEADER_SIZE];
+        EncodeHeader(header, request.type, request.length, request.flags);
+        iovec vec[2] = { { header, REQUEST_HEADER_SIZE }, { const_cast<char*>(request.msg), request.length } };
+        return to->Send(vec, 2);
+    }
+
+    // The session, the frame and the receiver fit in the inline storage of the task.
+    SharedBuffer frame = EncodeSharedRequest(request.type, request.msg, request.length, request.flags);
+    session.loop->Post(
+        [this, session, receiver, frame = std::move(frame)]
+        {
+            Socket* to = session.loop->getClient(session.fd);
+            if (to && to->getSerial() == session.serial)
+            {
+                to->Send(frame);
+                return;
+            }
+
+            // The receiver left after the lookup: keep the message like any other to a user who is not connected.
+            if (!m_offline) return;
+            const char* header = frame.getData();
+            Request kept;
+            kept.type = static_cast<uint8_t>(header[0]);
+            kept.flags = static_cast<uint8_t>(header[1]);
+            kept.length = uint32_t(frame.getSize() - REQUEST_HEADER_SIZE);
+            kept.msg = header + REQUEST_HEADER_SIZE;
+            m_offline(receiver, kept);
+        }
+    );
+    return true;
+}
+
+size_t Router::Broadcast(Socket& from, const uint64_t* receivers, size_t count, const Request& request,
+    uint64_t except)
+{
+    SharedBuffer frame = EncodeSharedRequest(request.type, request.msg, request.length, request.flags);
+    EventLoop* local = from.getLoop();
+
+    // Sort the receivers by shard, so every shard is locked once however many of them it holds.
+    thread_local std::vector<uint64_t> t_byShard;
+    size_t offsets[ROUTER_SHARDS + 1] = {};
+    for (size_t i = 0; i < count; i++) offsets[receivers[i] % ROUTER_SHARDS + 1]++;
+    for (size_t shard = 0; shard < ROUTER_SHARDS; shard++) offsets[shard + 1] += offsets[shard];
+    t_byShard.resize(count);
+    {
+        size_t next[ROUTER_SHARDS];
+        std::copy(offsets, offsets + ROUTER_SHARDS, next);
+        for (size_t i = 0; i < count; i++) t_byShard[next[receivers[i] % ROUTER_SHARDS]++] = receivers[i];
+    }
+
+    // The sessions are copied out under the locks and written to after, the sockets never under a lock.
+    thread_local std::vector<Session> t_sessions;
+    t_sessions.clear();
+    for (size_t shard = 0; shard < ROUTER_SHARDS; shard++)
+    {
+        if (offsets[shard] == offsets[shard + 1]) continue;
+        std::lock_guard<std::mutex> lock{ m_shards[shard].lock };
+        for (size_t i = offsets[shard]; i < offsets[shard + 1]; i++)
+        {
+            if (t_byShard[i] == except) continue;
+            const Session* session = m_shards[shard].sessions.Find(t_byShard[i]);
+            if (session) t_sessions.push_back(*session);
+        }
+    }
+    size_t delivered = t_sessions.size();
+
+    // The receivers on other loops are grouped, to hand them over with one task per loop.
+    auto remote = std::partition(t_sessions.begin(), t_sessions.end(),
+        [local](const Session& session) { return session.loop == local; });
+    for (auto it = t_sessions.begin(); it != remote; ++it)
+    {
+        Socket* to = local->getClient(it->fd);
+        if (to && to->getSerial() == it->serial) to->Send(frame, true);
+    }
+
+    std::sort(remote, t_sessions.end(),
+        [](const Session& a, const Session& b) { return a.loop < b.loop; });
+    for (auto first = remote, last = remote; first != t_sessions.end(); first = last)
+    {
+        while (last != t_sessions.end() && last->loop == first->loop) last++;
+        EventLoop* loop = first->loop;
+        std::vector<Session> sessions(first, last);
+        loop->Post(
+            [loop, frame, sessions = std::move(sessions)]
+            {
+                for (const Session& session : sessions)
+                {
+                    Socket* to = loop->getClient(session.fd);
+                    if (to && to->getSerial() == session.serial) to->Send(frame, true);
+                }
+            }
+        );
+    }
+    return delivered;
+}
+
+size_t Router::getSessionCount()
+{
+    size_t count = 0;
+    for (auto& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock{ shard.lock };
+        count += shard.sessions.getSize();
+    }
+    return count;
+}
+
+bool Router::UserName::operator==(const UserName& other) const
+{
+    return memcmp(data, other.data, sizeof(data)) == 0;
+}
+
+size_t Router::UserNameHash::operator()(const UserName& name) const
+{
+    uint64_t a, b;
+    memcpy(&a, name.data, sizeof(a));
+    memcpy(&b, name.data + sizeof(a), sizeof(b));
+    return size_t(a ^ (b * 0xC2B2AE3D27D4EB4Full) ^ (b >> 29));
+}
+
+Router::UserName Router::_MakeName(const char* username, size_t length)
+{
+    UserName name;
+    memset(name.data, 0, sizeof(name.data));
+    memcpy(name.data, username, std::min(length, sizeof(name.data)));
+    return name;
+}
+
+Router::Password Router::_MakePassword(const char* password, size_t length)
+{
+    Password secret;
+    memset(secret.data, 0, sizeof(secret.data));
+    memcpy(secret.data, password, std::min(length, sizeof(secret.data)));
+    return secret;
+}
+
+Router::Shard& Router::_ShardOf(uint64_t user)
+{
+    return m_shards[user % ROUTER_SHARDS];
+}
@@ -0,0 +1,112 @@
+/*
+ * @FilePath: /simtochat/test/include/Bench.h
+ * @Author: CGL
+ * @Date: 2026-10-17 15:20:44
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 15:20:44
+ * @Description:
+ *  Tests and benchmarks run by the test program. Each one prints its own report.
+ */
+#ifndef TEST_INCLUDE_BENCH_H
+#define TEST_INCLUDE_BENCH_H
+
+#include <chrono>
+#include <string>
+
+class Buffer;
+
+// Compare the compact and the fixed encoding of msg_sendmessage.
+int BenchCodec();
+
+// Deliver messages between 100k sessions through Router.
+int BenchRouter();
+
+// Compare the echo round trips of the epoll and the io_uring loops.
+int BenchUring();
+
+// Accept a storm of connects on both event loops.
+int BenchAccept();
+
+// Check the vectored and the zero-copy sends of both event loops.
+int BenchSend();
+
+// Compare group broadcasts with shared buffers and with a copy per receiver.
+int BenchBroadcast();
+
+// Post to a channel of 10k members through ChannelIndex.
+int BenchChannel();
+
+// Append to SegmentLog, take the records back and recover them.
+int BenchOffline();
+
+// Check the percentiles of Histogram against the exact ones.
+int TestHistogram();
+
+// Check the per-thread metrics against known totals, and measure the cost of an update.
+int TestMetrics();
+
+// Check the sampled spans of Tracer and the Chrome trace, and measure the cost of tracing.
+int TestTrace();
+
+// Check the order of OrderedExecutor per key, and that offloaded work does not stall the other clients of a loop.
+int TestOffload();
+
+// Check coroutine handlers reading requests, offloading and writing on both backends, and their allocations.
+int TestCoroutine();
+
+// Get the number of heap allocations of the test program so far.
+long GetAllocationCount();
+
+// Check TimerWheel and the timers of both event loops.
+int TestTimer();
+
+// Check MySQLConnectionPool against a local MySQL server.
+int TestMySQLPool();
+
+// Check MySQLStatement against a local MySQL server.
+int TestMySQLStatement();
+
+// Check the streaming MySQLResultSet and its memory against a local MySQL server.
+int TestMySQLStream();
+
+// Compare one INSERT per row with MySQLBatchWriter against a local MySQL server.
+int TestMySQLBatch();
+
+/**
+ * @author: CGL
+ * @struct MySQLTestConfig
+ * @description: Where the MySQL tests connect to.
+ */
+struct MySQLTestConfig
+{
+    std::string host;
+    unsigned int port;
+    std::string user;
+    std::string password;
+    std::string dbname;
+};
+
+// Read the MySQL test configuration from the environment.
+MySQLTestConfig GetMySQLTestConfig();
+
+/**
+ * @author: CGL
+ * @param port The port of a server on 127.0.0.1.
+ * @param recvBuffer The receive buffer of the socket, or 0 for the default.
+ * @return Return the connected socket, or -1 if the server did not accept it within two seconds.
+ */
+int ConnectLocal(int port, int recvBuffer = 0);
+
+// Send everything readable in the buffer. Return false if the connection failed.
+bool SendAll(int fd, Buffer& buffer);
+
+/**
+ * @author: CGL
+ * @return Return the seconds elapsed since the given time point.
+ */
+inline double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif // !TEST_INCLUDE_BENCH_H
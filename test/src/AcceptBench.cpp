@@ -0,0 +1,121 @@
+/*
+ * @FilePath: /simtochat/test/src/AcceptBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 22:10:52
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 22:10:52
+ * @Description:
+ *  A reconnect storm against both event loops: thousands of connects at once,
+ *  all of them accepted, with the socket options inherited from the listeners.
+ */
+#include "Bench.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kConnections = 2000;
+const int kRecvBuffer = 256 * 1024;
+
+// Start a connect without waiting for it.
+int ConnectAsync(const sockaddr_in& addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) return -1;
+    if (0 == connect(fd, (const sockaddr*)&addr, sizeof(addr)) || errno == EINPROGRESS) return fd;
+    close(fd);
+    return -1;
+}
+
+bool RunStorm(bool uring, int port)
+{
+    std::atomic<int> accepted{ 0 };
+    std::atomic<int> wrongOptions{ 0 };
+
+    SocketOptions options;
+    options.noDelay = true;
+    options.recvBuffer = kRecvBuffer;
+    options.fastOpen = 256;
+
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setLoopCount(2);
+    server.setSocketOptions(options);
+    server.setAcceptor(
+        [&accepted, &wrongOptions](Socket& client)
+        {
+            int noDelay = 0, recvBuffer = 0;
+            socklen_t len = sizeof(int);
+            getsockopt(client.getfd(), IPPROTO_TCP, TCP_NODELAY, &noDelay, &len);
+            getsockopt(client.getfd(), SOL_SOCKET, SO_RCVBUF, &recvBuffer, &len);
+            int flags = fcntl(client.getfd(), F_GETFD);
+            if (!noDelay || recvBuffer < kRecvBuffer || !(flags & FD_CLOEXEC)) wrongOptions++;
+            accepted++;
+        }
+    );
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // The server may still be starting.
+    int probe = -1;
+    for (int retry = 0; retry < 100 && probe == -1; retry++)
+    {
+        probe = socket(AF_INET, SOCK_STREAM, 0);
+        if (0 == connect(probe, (sockaddr*)&addr, sizeof(addr))) break;
+        close(probe);
+        probe = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    while (probe != -1 && accepted.load() < 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> fds;
+    for (int i = 0; i < kConnections; i++)
+    {
+        int fd = ConnectAsync(addr);
+        if (fd != -1) fds.push_back(fd);
+    }
+    double connecting = SecondsSince(start);
+    while (accepted.load() < kConnections + 1 && SecondsSince(start) < 5.0)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    double seconds = SecondsSince(start);
+    int total = accepted.load() - 1;
+
+    std::cout << (uring ? "io_uring" : "epoll") << ": " << total << "/" << kConnections << " connections accepted in "
+        << seconds * 1e3 << " ms (connects issued in " << connecting * 1e3 << " ms), "
+        << wrongOptions.load() << " without the options" << std::endl;
+
+    for (int fd : fds) close(fd);
+    if (probe != -1) close(probe);
+    server.Stop();
+    serverThread.join();
+    return probe != -1 && total == kConnections && wrongOptions.load() == 0;
+}
+
+} // namespace
+
+int BenchAccept()
+{
+    bool ok = RunStorm(false, 8922);
+    ok = RunStorm(true, 8923) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+/*
+ * @FilePath: /simtochat/test/src/Bench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 20:12:05
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 20:12:05
+ * @Description:
+ *  The client side helpers shared by the tests which run a server.
+ */
+#include "Bench.h"
+#include "Buffer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <thread>
+
+int ConnectLocal(int port, int recvBuffer)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // The server may still be starting.
+    for (int retry = 0; retry < 100; retry++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (recvBuffer > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recvBuffer, sizeof(recvBuffer));
+        if (0 == connect(fd, (sockaddr*)&addr, sizeof(addr))) return fd;
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return -1;
+}
+
+bool SendAll(int fd, Buffer& buffer)
+{
+    while (buffer.getReadableBytes() > 0)
+    {
+        ssize_t n = send(fd, buffer.Peek(), buffer.getReadableBytes(), MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        buffer.Retrieve(n);
+    }
+    return true;
+}
@@ -0,0 +1,225 @@
+/*
+ * @FilePath: /simtochat/test/src/BroadcastBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 23:20:06
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 23:20:06
+ * @Description:
+ *  OutputQueue against a model of the stream, and group broadcasts to slow receivers
+ *  through Router::Broadcast against one Router::Deliver per receiver, in time and in memory.
+ */
+#include "Bench.h"
+#include "Codec.h"
+#include "Router.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kReceivers = 200;
+const int kBroadcasts = 16;
+const uint32_t kPayloadSize = 32 * 1024;
+const int kSocketBuffer = 64 * 1024;
+
+// Random appends of bytes and shared buffers, and random retrieves. The stream must keep the order.
+bool CheckQueue()
+{
+    std::mt19937 rng(2021);
+    OutputQueue queue;
+    std::string model;
+    std::vector<SharedBuffer> buffers;
+    for (int i = 0; i < 8; i++)
+    {
+        std::string data(rng() % 3000 + 1, char('a' + i));
+        buffers.emplace_back(data.data(), data.size());
+    }
+
+    long errors = 0;
+    for (int step = 0; step < 200000; step++)
+    {
+        int op = rng() % 4;
+        if (op == 0)
+        {
+            std::string data(rng() % 100, char('0' + rng() % 10));
+            if (rng() % 2) queue.Append(data.data(), data.size());
+            else queue.getBuffer().Append(data.data(), data.size());
+            model += data;
+        }
+        else if (op == 1)
+        {
+            const SharedBuffer& buffer = buffers[rng() % buffers.size()];
+            size_t offset = rng() % buffer.getSize();
+            queue.Append(buffer, offset);
+            model.append(buffer.getData() + offset, buffer.getSize() - offset);
+        }
+        else
+        {
+            iovec vec[16];
+            int count = queue.Gather(vec, 1 + rng() % 16);
+            std::string gathered;
+            for (int i = 0; i < count; i++) gathered.append(static_cast<const char*>(vec[i].iov_base), vec[i].iov_len);
+            if (model.compare(0, gathered.size(), gathered) != 0) errors++;
+
+            size_t n = gathered.empty() ? 0 : rng() % (gathered.size() + 1);
+            queue.Retrieve(n);
+            model.erase(0, n);
+        }
+        if (queue.getReadableBytes() != model.size()) errors++;
+    }
+    queue.RetrieveAll();
+    for (const SharedBuffer& buffer : buffers)
+    {
+        if (buffer.getRefCount() != 1) errors++;
+    }
+
+    std::cout << "output queue: " << errors << " errors" << std::endl;
+    return errors == 0;
+}
+
+bool RecvAll(int fd, char* data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t rst = recv(fd, data, n, 0);
+        if (rst <= 0) return false;
+        data += rst;
+        n -= rst;
+    }
+    return true;
+}
+
+size_t HeapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+void Login(int fd, const std::string& name)
+{
+    msg_login login;
+    memset(&login, 0, sizeof(login));
+    strncpy(login.username, name.c_str(), sizeof(login.username));
+    Buffer buffer;
+    EncodeRequest(buffer, RT_LOGIN, login);
+    SendAll(fd, buffer);
+}
+
+// The receivers do not read until every broadcast is queued, so the server holds most of them.
+bool RunBroadcast(bool uring, bool shared, int port)
+{
+    Router router(kReceivers + 1);
+    std::vector<uint64_t> receivers;
+    for (int i = 0; i < kReceivers; i++)
+    {
+        std::string name = "r" + std::to_string(i);
+        receivers.push_back(router.getUserId(name.data(), name.size()));
+    }
+    std::atomic<int> broadcasts{ 0 };
+    std::atomic<long> nanoseconds{ 0 };
+
+    SocketOptions options;
+    options.sendBuffer = kSocketBuffer;
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setLoopCount(2);
+    server.setSocketOptions(options);
+    server.setHighWaterMark(size_t(1) << 30);
+    server.setProcessor(
+        [&](Socket& client)
+        {
+            Request request;
+            RequestDecoder decoder(client.getInput());
+            while (decoder.Next(request))
+            {
+                if (request.type == RT_LOGIN)
+                {
+                    auto login = RequestCast<msg_login>(request);
+                    if (login) router.Login(client, login->username, strnlen(login->username, sizeof(login->username)));
+                    continue;
+                }
+                auto start = std::chrono::steady_clock::now();
+                if (shared) router.Broadcast(client, receivers.data(), receivers.size(), request);
+                else for (uint64_t receiver : receivers) router.Deliver(client, receiver, request);
+                nanoseconds += long(SecondsSince(start) * 1e9);
+                broadcasts++;
+            }
+        }
+    );
+    server.setCloser([&router](Socket& client) { router.Unbind(client); });
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    std::vector<int> fds;
+    for (int i = 0; i < kReceivers; i++)
+    {
+        int fd = ConnectLocal(port, kSocketBuffer);
+        if (fd == -1) break;
+        fds.push_back(fd);
+        Login(fd, "r" + std::to_string(i));
+    }
+    int sender = ConnectLocal(port);
+    Login(sender, "sender");
+    for (int wait = 0; wait < 3000 && router.getSessionCount() < size_t(kReceivers + 1); wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    bool ok = fds.size() == size_t(kReceivers) && router.getSessionCount() == size_t(kReceivers + 1);
+
+    std::string payload(kPayloadSize, '\0');
+    for (size_t i = 0; i < payload.size(); i++) payload[i] = char(i * 13 + i / 251);
+    size_t heapBefore = HeapInUse();
+    Buffer messages;
+    for (int i = 0; i < kBroadcasts; i++) EncodeRequest(messages, RT_SENDMESSAGE, payload.data(), kPayloadSize);
+    ok = ok && SendAll(sender, messages);
+    while (ok && broadcasts.load() < kBroadcasts) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Let the tasks posted to the other loop run.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    double heap = double(HeapInUse()) - double(heapBefore);
+
+    std::vector<char> frame(REQUEST_HEADER_SIZE + kPayloadSize);
+    int intact = 0;
+    for (int fd : fds)
+    {
+        for (int i = 0; i < kBroadcasts; i++)
+        {
+            if (!RecvAll(fd, frame.data(), frame.size())) break;
+            if (memcmp(frame.data() + REQUEST_HEADER_SIZE, payload.data(), kPayloadSize) == 0) intact++;
+        }
+    }
+
+    std::cout << (uring ? "io_uring" : "epoll   ") << (shared ? " Broadcast: " : " Deliver:   ")
+        << nanoseconds.load() / 1e3 / kBroadcasts << " us per broadcast to " << kReceivers << ", "
+        << heap / (1 << 20) << " MiB queued for " << (kBroadcasts * size_t(kPayloadSize) >> 10) << " KiB, "
+        << intact << "/" << kReceivers * kBroadcasts << " intact" << std::endl;
+    ok = ok && intact == kReceivers * kBroadcasts;
+
+    for (int fd : fds) close(fd);
+    close(sender);
+    server.Stop();
+    serverThread.join();
+    return ok;
+}
+
+} // namespace
+
+int BenchBroadcast()
+{
+    bool ok = CheckQueue();
+    ok = RunBroadcast(false, false, 8926) && ok;
+    ok = RunBroadcast(false, true, 8927) && ok;
+    ok = RunBroadcast(true, false, 8928) && ok;
+    ok = RunBroadcast(true, true, 8929) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,296 @@
+/*
+ * @FilePath: /simtochat/test/src/ChannelBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 10:12:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 10:12:37
+ * @Description:
+ *  The membership of ChannelIndex, and the time to post to a channel of 10k members
+ *  of which 8k are online, spread over the connections of two loops. A post must take less than 1 ms.
+ */
+#include "Bench.h"
+#include "Codec.h"
+#include "Channel.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kPort = 8930;
+const int kLoops = 2;
+const int kConnections = 64;
+const int kMembers = 10000;
+const int kOnline = 8000;
+const int kPosts = 64;
+
+// Joins and leaves keep the members sorted and unique, and never change a snapshot taken before.
+bool CheckMembership()
+{
+    Router router;
+    ChannelIndex channels(router);
+    long errors = 0;
+
+    uint64_t channel = channels.Create("lobby", 5, 7);
+    if (channel == 0 || channels.Create("lobby", 5, 8) != 0) errors++;
+    if (channels.FindChannelId("lobby", 5) != channel || channels.FindChannelId("none", 4) != 0) errors++;
+    if (channels.Join(channel + 1, 1) || channels.Join(channel, 7)) errors++;
+
+    for (uint64_t user : { 5, 3, 9, 1, 8 }) if (!channels.Join(channel, user)) errors++;
+    auto snapshot = channels.getMembers(channel);
+    if (!channels.Join(channel, 4) || !channels.Leave(channel, 9) || channels.Leave(channel, 9)) errors++;
+
+    auto members = channels.getMembers(channel);
+    if (*snapshot != ChannelIndex::Members{ 1, 3, 5, 7, 8, 9 }) errors++;
+    if (*members != ChannelIndex::Members{ 1, 3, 4, 5, 7, 8 }) errors++;
+    if (!channels.isMember(channel, 4) || channels.isMember(channel, 9)) errors++;
+    if (channels.getChannelCount() != 1) errors++;
+
+    std::cout << "membership: " << errors << " errors" << std::endl;
+    return errors == 0;
+}
+
+template<class T>
+bool SendRequest(int fd, uint8_t type, const T& msg)
+{
+    Buffer buffer;
+    EncodeRequest(buffer, type, msg);
+    return SendAll(fd, buffer);
+}
+
+// The CPU time of this thread in seconds, which another thread running meanwhile does not add to.
+double ThreadSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+} // namespace
+
+int BenchChannel()
+{
+    if (!CheckMembership())
+    {
+        std::cerr << "FAILED" << std::endl;
+        return 1;
+    }
+
+    Router router(kMembers + kConnections);
+    ChannelIndex channels(router);
+    std::mutex timesLock;
+    std::vector<double> times;
+
+    EpollServer server;
+    server.setLoopCount(kLoops);
+    server.setProcessor(
+        [&](Socket& client)
+        {
+            Request request;
+            RequestDecoder decoder(client.getInput());
+            while (decoder.Next(request))
+            {
+                if (request.type == RT_LOGIN)
+                {
+                    if (auto login = RequestCast<msg_login>(request))
+                    {
+                        router.Login(client, login->username, strnlen(login->username, sizeof(login->username)));
+                    }
+                    continue;
+                }
+                double start = ThreadSeconds();
+                if (!channels.Handle(client, request))
+                {
+                    client.Disconnect();
+                    return;
+                }
+                if (request.type == RT_POSTCHANNEL)
+                {
+                    double seconds = ThreadSeconds() - start;
+                    std::lock_guard<std::mutex> lock{ timesLock };
+                    times.push_back(seconds);
+                }
+            }
+            if (decoder.isBroken()) client.Disconnect();
+        }
+    );
+    server.setCloser([&router](Socket& client) { router.Unbind(client); });
+    std::thread serverThread([&server] { server.Run(kPort); });
+
+    // Log every connection in. The first one creates the channel and the others join it by request.
+    std::vector<int> fds;
+    std::vector<uint64_t> connUsers;
+    msg_channel lobby;
+    memset(&lobby, 0, sizeof(lobby));
+    strncpy(lobby.channel, "lobby", sizeof(lobby.channel));
+    for (int i = 0; i < kConnections; i++)
+    {
+        int fd = ConnectLocal(kPort);
+        if (fd == -1) break;
+        fds.push_back(fd);
+
+        msg_login login;
+        memset(&login, 0, sizeof(login));
+        snprintf(login.username, sizeof(login.username), "conn%d", i);
+        connUsers.push_back(router.getUserId(login.username, strlen(login.username)));
+        SendRequest(fd, RT_LOGIN, login);
+        if (i == 0)
+        {
+            SendRequest(fd, RT_CREATECHANNEL, lobby);
+            for (int wait = 0; wait < 3000 && channels.FindChannelId("lobby", 5) == 0; wait++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        else
+        {
+            SendRequest(fd, RT_JOINCHANNEL, lobby);
+        }
+    }
+    uint64_t channel = channels.FindChannelId("lobby", 5);
+    auto memberCount = [&] { auto members = channels.getMembers(channel); return members ? members->size() : 0; };
+    for (int wait = 0; wait < 3000 && memberCount() < fds.size(); wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto finish = [&] {
+        for (int fd : fds) close(fd);
+        server.Stop();
+        serverThread.join();
+    };
+    if (fds.size() != kConnections || memberCount() != kConnections)
+    {
+        std::cerr << "FAILED: could not join " << kConnections << " connections on port " << kPort << std::endl;
+        finish();
+        return 1;
+    }
+
+    // The other members are simulated users, the online ones share the sessions of the connections.
+    for (int i = kConnections; i < kMembers; i++)
+    {
+        std::string name = "member" + std::to_string(i);
+        uint64_t user = router.getUserId(name.data(), name.size());
+        channels.Join(channel, user);
+        if (i >= kOnline) continue;
+        Session session;
+        router.Find(connUsers[i % kConnections], session);
+        router.Bind(user, session);
+    }
+
+    msg_postchannel post;
+    memset(&post, 0, sizeof(post));
+    strncpy(post.sender, "conn0", sizeof(post.sender));
+    strncpy(post.channel, "lobby", sizeof(post.channel));
+    const char text[] = "hello from the channel benchmark";
+    memcpy(post.message, text, sizeof(text));
+
+    // Every post reaches the online members but the sender. The next post is sent once the last one is read,
+    // so the loops and this thread are idle while Handle() runs. It is timed in the CPU time of its loop,
+    // as the loop it hands the remote members to may run at once on a single CPU.
+    const int expected = kPosts * (kOnline - 1);
+    std::vector<pollfd> polls;
+    for (int fd : fds) polls.push_back(pollfd{ fd, POLLIN, 0 });
+    std::vector<Buffer> inputs(kConnections);
+    int delivered = 0, corrupted = 0;
+    char chunk[65536];
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kPosts && delivered == i * (kOnline - 1); i++)
+    {
+        post.sendtime = i;
+        SendRequest(fds[0], RT_POSTCHANNEL, post);
+        while (delivered < (i + 1) * (kOnline - 1))
+        {
+            if (poll(polls.data(), polls.size(), 3000) <= 0) break;
+            for (int conn = 0; conn < kConnections; conn++)
+            {
+                if (!(polls[conn].revents & POLLIN)) continue;
+                ssize_t n = recv(fds[conn], chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (n <= 0) continue;
+                inputs[conn].Append(chunk, n);
+
+                Request request;
+                RequestDecoder decoder(inputs[conn]);
+                while (decoder.Next(request))
+                {
+                    auto msg = RequestCast<msg_postchannel>(request);
+                    delivered++;
+                    if (request.type != RT_POSTCHANNEL || !msg || msg->sendtime != i || strcmp(msg->message, text) != 0)
+                    {
+                        corrupted++;
+                    }
+                }
+            }
+        }
+    }
+    double seconds = SecondsSince(start);
+
+    // The other loop may deliver the last post before Handle() returns.
+    std::vector<double> sorted;
+    for (int wait = 0; wait < 1000; wait++)
+    {
+        {
+            std::lock_guard<std::mutex> lock{ timesLock };
+            if (times.size() >= size_t(kPosts)) break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    {
+        std::lock_guard<std::mutex> lock{ timesLock };
+        sorted = times;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    double median = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+    double worst = sorted.empty() ? 0 : sorted.back();
+
+    std::cout << kMembers << " members, " << kOnline << " online on " << kConnections << " connections, "
+        << kLoops << " loops: " << median * 1e6 << " us per post (median), " << worst * 1e6 << " us (max), "
+        << delivered << "/" << expected << " delivered in " << seconds << " s" << std::endl;
+
+    // A member posting as another one is closed instead of heard.
+    int spoofer = ConnectLocal(kPort);
+    if (spoofer != -1)
+    {
+        msg_login login;
+        memset(&login, 0, sizeof(login));
+        strncpy(login.username, "spoofer", sizeof(login.username));
+        SendRequest(spoofer, RT_LOGIN, login);
+        SendRequest(spoofer, RT_JOINCHANNEL, lobby);
+        SendRequest(spoofer, RT_POSTCHANNEL, post);
+        timeval timeout = { 2, 0 };
+        setsockopt(spoofer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    char byte;
+    bool spoofed = spoofer == -1 || recv(spoofer, &byte, 1, 0) != 0;
+    if (spoofer != -1) close(spoofer);
+
+    int status = 0;
+    if (spoofed)
+    {
+        std::cerr << "FAILED: a post as another member was accepted" << std::endl;
+        status = 1;
+    }
+    if (delivered != expected || corrupted != 0 || sorted.size() != kPosts)
+    {
+        std::cerr << "FAILED: " << corrupted << " corrupted" << std::endl;
+        status = 1;
+    }
+    else if (median >= 1e-3)
+    {
+        std::cerr << "FAILED: a post takes " << median * 1e3 << " ms" << std::endl;
+        status = 1;
+    }
+    finish();
+
+    if (status == 0) std::cout << "passed" << std::endl;
+    return status;
+}
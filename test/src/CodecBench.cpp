@@ -0,0 +1,106 @@
+/*
+ * @FilePath: /simtochat/test/src/CodecBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 15:20:44
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 15:20:44
+ * @Description:
+ *  Bytes per message and messages per second of the two msg_sendmessage encodings.
+ */
+#include "Bench.h"
+#include "Codec.h"
+
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kMessages = 1000000;
+const int kBatch = 1000;    // Messages encoded before they are decoded, like one read of a connection
+
+// Our traffic: mostly short chat lines, some paragraphs and a few long pastes.
+std::vector<std::string> MakeTexts()
+{
+    std::mt19937 rng(2021);
+    std::vector<std::string> texts;
+    for (int i = 0; i < kBatch; i++)
+    {
+        int roll = rng() % 100;
+        size_t length = roll < 70 ? 5 + rng() % 36 : roll < 95 ? 40 + rng() % 160 : 200 + rng() % 800;
+        texts.emplace_back(length, 'a' + i % 26);
+    }
+    return texts;
+}
+
+void Report(const char* name, size_t bytes, size_t checksum, double seconds)
+{
+    std::cout << name << ": " << double(bytes) / kMessages << " bytes/message, "
+        << kMessages / seconds / 1e6 << " M messages/sec (checksum " << checksum << ")" << std::endl;
+}
+
+} // namespace
+
+int BenchCodec()
+{
+    std::vector<std::string> texts = MakeTexts();
+    Buffer buffer(1 << 20);
+    size_t fixedBytes = 0, compactBytes = 0, checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int done = 0; done < kMessages; done += kBatch)
+    {
+        for (int i = 0; i < kBatch; i++)
+        {
+            msg_sendmessage msg;
+            memset(&msg, 0, sizeof(msg));
+            snprintf(msg.sender, sizeof(msg.sender), "user%d", i);
+            snprintf(msg.reciver, sizeof(msg.reciver), "user%d", i + 1);
+            msg.sendtime = 1620000000 + i;
+            memcpy(msg.message, texts[i].data(), texts[i].size());
+            EncodeRequest(buffer, RT_SENDMESSAGE, msg);
+        }
+        fixedBytes += buffer.getReadableBytes();
+
+        Request request;
+        RequestDecoder decoder(buffer);
+        while (decoder.Next(request))
+        {
+            const msg_sendmessage* msg = RequestCast<msg_sendmessage>(request);
+            checksum += strnlen(msg->message, sizeof(msg->message));
+        }
+    }
+    Report("fixed  ", fixedBytes, checksum, SecondsSince(start));
+
+    checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int done = 0; done < kMessages; done += kBatch)
+    {
+        for (int i = 0; i < kBatch; i++)
+        {
+            SendMessage msg;
+            msg.sender = i;
+            msg.reciver = i + 1;
+            msg.sendtime = 1620000000 + i;
+            msg.length = texts[i].size();
+            msg.message = texts[i].data();
+            EncodeSendMessage(buffer, msg);
+        }
+        compactBytes += buffer.getReadableBytes();
+
+        Request request;
+        RequestDecoder decoder(buffer);
+        while (decoder.Next(request))
+        {
+            SendMessage msg;
+            if (DecodeSendMessage(request, msg)) checksum += msg.length;
+        }
+    }
+    Report("compact", compactBytes, checksum, SecondsSince(start));
+
+    std::cout << "compact is " << double(fixedBytes) / compactBytes << "x smaller" << std::endl;
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * @FilePath: /simtochat/test/src/CoroutineTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 18:40:11
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 18:40:11
+ * @Description:
+ *  A coroutine handler reads a request, awaits work on a worker and writes the reply, on both
+ *  backends, with its frames from the SlabPool, and a writer waits for a peer which does not read.
+ */
+#include "Bench.h"
+#include "Codec.h"
+#include "Coroutine.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kRequests = 20000;
+const size_t kChunk = 16 * 1024;
+const size_t kChunks = 2048;            // 32 MiB, more than the kernel buffers of a loopback connection
+
+std::atomic<int> s_live{ 0 };           // Handlers which did not end yet
+std::atomic<size_t> s_written{ 0 };     // Chunks written by the flood handler
+
+CoTask<int> Twice(int value)
+{
+    co_return value * 2;
+}
+
+CoTask<int> Sum(int n)
+{
+    int sum = 0;
+    for (int i = 0; i < n; i++) sum += co_await Twice(i);
+    co_return sum;
+}
+
+CoTask<int> Throw()
+{
+    throw std::runtime_error("thrown");
+    co_return 0;
+}
+
+CoTask<void> Catch(bool& caught)
+{
+    try
+    {
+        co_await Throw();
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+}
+
+CoTask<void> Count(int& total)
+{
+    total += co_await Sum(10);
+}
+
+// Values, exceptions and the allocations of frames, all without suspending.
+bool CheckTasks()
+{
+    bool caught = false;
+    Spawn(Catch(caught));
+
+    int total = 0;
+    Spawn(Count(total));
+    long before = GetAllocationCount();
+    for (int i = 0; i < kRequests; i++) Spawn(Count(total));
+    long allocations = GetAllocationCount() - before;
+
+    std::cout << "tasks: " << double(allocations) / kRequests << " allocs per spawn of 12 frames, exception "
+        << (caught ? "caught" : "lost") << std::endl;
+    return caught && total == 90 * (kRequests + 1) && allocations < kRequests / 100;
+}
+
+// Answer each request with its payload, a u32, times two plus one, computed on a worker.
+CoTask<void> Serve(CoSocket socket)
+{
+    s_live++;
+    Request request;
+    while (co_await ReadRequest(socket, request))
+    {
+        uint32_t value = 0;
+        if (request.length == sizeof(value)) memcpy(&value, request.msg, sizeof(value));
+        uint32_t answer = co_await socket.Offload([value] { return value * 2 + 1; });
+
+        char reply[REQUEST_HEADER_SIZE + sizeof(answer)];
+        EncodeHeader(reply, request.type, sizeof(answer));
+        memcpy(reply + REQUEST_HEADER_SIZE, &answer, sizeof(answer));
+        if (!co_await socket.Write(reply, sizeof(reply))) break;
+    }
+    s_live--;
+}
+
+// Write more than the peer reads, one chunk at a time.
+CoTask<void> Flood(CoSocket socket)
+{
+    s_live++;
+    std::vector<char> chunk(kChunk, 'x');
+    for (size_t i = 0; i < kChunks; i++)
+    {
+        if (!co_await socket.Write(chunk.data(), chunk.size())) break;
+        s_written++;
+    }
+    s_live--;
+}
+
+// Read n bytes into the buffer, or fewer after two seconds without any.
+size_t ReadAll(int fd, char* buffer, size_t n)
+{
+    timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    size_t got = 0;
+    while (got < n)
+    {
+        ssize_t r = recv(fd, buffer + got, n - got, 0);
+        if (r <= 0) break;
+        got += size_t(r);
+    }
+    return got;
+}
+
+bool WaitIdle()
+{
+    for (int i = 0; i < 200 && s_live.load() != 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return s_live.load() == 0;
+}
+
+// Requests split across reads and pipelined, answered in order, then the handler ends with the connection.
+bool CheckServe(bool uring, int port, unsigned short workers)
+{
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setWorkerCount(workers);
+    server.setAcceptor([](Socket& client) { Spawn(Serve(CoSocket(client))); });
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    int fd = ConnectLocal(port);
+    const size_t frame = REQUEST_HEADER_SIZE + sizeof(uint32_t);
+    std::vector<char> requests(frame * kRequests);
+    std::vector<char> replies(frame * kRequests);
+    for (uint32_t i = 0; i < kRequests; i++) EncodeHeader(&requests[frame * i], 1, sizeof(i));
+    for (uint32_t i = 0; i < kRequests; i++) memcpy(&requests[frame * i + REQUEST_HEADER_SIZE], &i, sizeof(i));
+
+    // The first request one byte at a time: the handler only wakes up once it is complete.
+    for (size_t i = 0; i < frame; i++)
+    {
+        send(fd, &requests[i], 1, MSG_NOSIGNAL);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    bool ok = ReadAll(fd, replies.data(), frame) == frame;
+
+    long before = GetAllocationCount();
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer(
+        [&] { send(fd, requests.data() + frame, requests.size() - frame, MSG_NOSIGNAL); }
+    );
+    ok = ReadAll(fd, replies.data() + frame, replies.size() - frame) == replies.size() - frame && ok;
+    double seconds = SecondsSince(start);
+    writer.join();
+    long allocations = GetAllocationCount() - before;
+
+    long wrong = 0;
+    for (uint32_t i = 0; i < kRequests; i++)
+    {
+        uint32_t answer;
+        memcpy(&answer, &replies[frame * i + REQUEST_HEADER_SIZE], sizeof(answer));
+        if (answer != i * 2 + 1) wrong++;
+    }
+
+    close(fd);
+    bool ended = WaitIdle();
+
+    std::cout << (uring ? "io_uring" : "epoll") << " with " << workers << " workers: "
+        << (kRequests - 1) / seconds / 1e3 << " k requests/sec, " << wrong << " wrong replies, "
+        << double(allocations) / (kRequests - 1) << " allocs per request, handler ended: " << ended << std::endl;
+
+    server.Stop();
+    serverThread.join();
+    // One thread for the writer, and what a growing buffer may take.
+    return ok && wrong == 0 && ended && allocations < kRequests / 100;
+}
+
+// A peer which does not read holds the writer at the high-water mark until it reads again.
+bool CheckBackpressure(bool uring, int port)
+{
+    s_written = 0;
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setHighWaterMark(64 * 1024);
+    server.setAcceptor([](Socket& client) { Spawn(Flood(CoSocket(client))); });
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    int fd = ConnectLocal(port);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    size_t held = s_written.load();
+
+    std::vector<char> buffer(kChunk * kChunks);
+    bool ok = ReadAll(fd, buffer.data(), buffer.size()) == buffer.size();
+    close(fd);
+    bool ended = WaitIdle();
+
+    std::cout << (uring ? "io_uring" : "epoll") << ": the writer waited after " << held << " of " << kChunks
+        << " chunks, all read: " << ok << ", handler ended: " << ended << std::endl;
+
+    server.Stop();
+    serverThread.join();
+    return ok && ended && held < kChunks && s_written.load() == kChunks;
+}
+
+} // namespace
+
+int TestCoroutine()
+{
+    bool ok = CheckTasks();
+    ok = CheckServe(false, 8940, 2) && ok;
+    ok = CheckServe(true, 8941, 2) && ok;
+    ok = CheckServe(false, 8942, 0) && ok;
+    ok = CheckBackpressure(false, 8943) && ok;
+    ok = CheckBackpressure(true, 8944) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/*
+ * @FilePath: /simtochat/test/src/HistogramTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ *  The percentiles of Histogram against the exact ones of sorted samples.
+ */
+#include "Bench.h"
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <iostream>
+
+int TestHistogram()
+{
+    // Latencies from a microsecond to a few seconds, log-normal like real ones.
+    std::mt19937_64 random(42);
+    std::lognormal_distribution<double> latency(std::log(200000.0), 1.5);
+    std::vector<uint64_t> samples;
+    Histogram whole, halves[2];
+    for (int i = 0; i < 1000000; i++)
+    {
+        uint64_t value = uint64_t(latency(random));
+        samples.push_back(value);
+        whole.Record(value);
+        halves[i & 1].Record(value);
+    }
+    std::sort(samples.begin(), samples.end());
+    halves[0].Merge(halves[1]);
+
+    long errors = 0;
+    double worst = 0;
+    for (double percentile : { 0.0, 1.0, 10.0, 50.0, 90.0, 99.0, 99.9, 99.99, 100.0 })
+    {
+        size_t rank = std::max<size_t>(1, size_t(std::ceil(percentile / 100 * samples.size())));
+        double exact = double(samples[rank - 1]);
+        double value = double(whole.getPercentile(percentile));
+        double error = exact > 0 ? std::fabs(value - exact) / exact : value;
+        worst = std::max(worst, error);
+        if (error > 1.0 / (1 << HISTOGRAM_PRECISION)) errors++;
+        if (halves[0].getPercentile(percentile) != whole.getPercentile(percentile)) errors++;
+    }
+    if (whole.getCount() != samples.size() || whole.getMin() != samples.front() || whole.getMax() != samples.back()) errors++;
+
+    // Small values are exact, and values past the range are kept in the last bucket.
+    Histogram small;
+    for (uint64_t value = 0; value < (1u << HISTOGRAM_PRECISION); value++) small.Record(value);
+    if (small.getPercentile(50) != (1u << HISTOGRAM_PRECISION) / 2 - 1) errors++;
+    small.Reset();
+    small.Record(UINT64_MAX);
+    if (small.getCount() != 1 || small.getPercentile(100) != UINT64_MAX) errors++;
+
+    std::cout << "largest relative error " << worst * 100 << " %, " << errors << " errors" << std::endl;
+    if (errors == 0) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return errors == 0 ? 0 : 1;
+}
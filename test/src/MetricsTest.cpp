@@ -0,0 +1,101 @@
+/*
+ * @FilePath: /simtochat/test/src/MetricsTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 23:11:40
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 23:11:40
+ * @Description:
+ *  Counters and histograms updated from several threads, some of which exit before the snapshot.
+ */
+#include "Bench.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+int TestMetrics()
+{
+    const int threads = 4;
+    const int updates = 1000000;
+    int counter = Metrics::RegisterCounter("test.updates");
+    int histogram = Metrics::RegisterHistogram("test.latency");
+    long errors = 0;
+    if (counter < 0 || histogram < 0 || Metrics::RegisterCounter("test.updates") != counter) errors++;
+
+    // Half of the threads stay alive until the snapshot, the others have exited by then.
+    std::atomic<int> done{ 0 };
+    std::atomic<bool> release{ false };
+    std::vector<std::thread> workers;
+    Histogram expected;
+    for (int i = 0; i < threads; i++) for (int j = 0; j < 1000; j++) expected.Record(uint64_t(i * 1000 + j) * 1000);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back(
+            [&, i]
+            {
+                for (int j = 0; j < updates; j++) Metrics::Add(counter);
+                for (int j = 0; j < 1000; j++) Metrics::Record(histogram, uint64_t(i * 1000 + j) * 1000);
+                done++;
+                if (i % 2 == 0) return;
+                while (!release.load()) std::this_thread::yield();
+            }
+        );
+    }
+    while (done.load() < threads) std::this_thread::yield();
+    double seconds = SecondsSince(start);
+    for (int i = 0; i < threads; i += 2) workers[i].join();
+
+    Metrics::RegisterGauge("test.gauge", [] { return int64_t(-7); });
+    MetricsSnapshot snapshot = Metrics::Snapshot();
+    release = true;
+    for (int i = 1; i < threads; i += 2) workers[i].join();
+
+    if (Metrics::getCounter(counter) != uint64_t(threads) * updates) errors++;
+    bool found = false;
+    for (auto& entry : snapshot.histograms)
+    {
+        if (entry.first != "test.latency") continue;
+        found = true;
+        const Histogram& merged = entry.second;
+        if (merged.getCount() != expected.getCount() || merged.getMax() != expected.getMax()
+            || merged.getMin() != expected.getMin() || merged.getMean() != expected.getMean()) errors++;
+        for (double percentile : { 50.0, 90.0, 99.0, 99.9 })
+        {
+            if (merged.getPercentile(percentile) != expected.getPercentile(percentile)) errors++;
+        }
+    }
+    if (!found) errors++;
+
+    std::string text = Metrics::Format(snapshot);
+    std::ostringstream line;
+    line << "counter test.updates " << uint64_t(threads) * updates << "\n";
+    if (text.find(line.str()) == std::string::npos) errors++;
+    if (text.find("gauge test.gauge -7\n") == std::string::npos) errors++;
+    if (text.find("histogram test.latency count=4000 ") == std::string::npos) errors++;
+    Metrics::RemoveGauge("test.gauge");
+
+    // The dumper writes once more when it is destroyed.
+    const char* path = "metrics-test.txt";
+    {
+        MetricsDumper dumper(path, std::chrono::milliseconds(3600000));
+    }
+    std::ifstream file(path);
+    std::string first;
+    if (!std::getline(file, first) || first.compare(0, 8, "counter ") != 0) errors++;
+    if (Metrics::Format(Metrics::Snapshot()).find("test.gauge") != std::string::npos) errors++;
+    remove(path);
+
+    std::cout << threads << " threads: " << seconds * 1e9 / updates << " ns per update and thread" << std::endl;
+    std::cout << text;
+    std::cout << errors << " errors" << std::endl;
+    if (errors == 0) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+/*
+ * @FilePath: /simtochat/test/src/MySQLTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 18:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 18:02:37
+ * @Description:
+ *  Tests against a locally started mysqld or mariadb, configured by environment variables:
+ *  SIMTOCHAT_MYSQL_HOST, SIMTOCHAT_MYSQL_PORT, SIMTOCHAT_MYSQL_USER, SIMTOCHAT_MYSQL_PASSWORD, SIMTOCHAT_MYSQL_DB.
+ *  They are skipped when the server can not be reached.
+ */
+#include "Bench.h"
+#include "MySQLConnectionPool.h"
+#include "MySQLBatchWriter.h"
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <iostream>
+
+MySQLTestConfig GetMySQLTestConfig()
+{
+    auto env = [](const char* name, const char* def) {
+        const char* value = getenv(name);
+        return std::string(value ? value : def);
+    };
+
+    MySQLTestConfig config;
+    config.host = env("SIMTOCHAT_MYSQL_HOST", "127.0.0.1");
+    config.port = std::stoi(env("SIMTOCHAT_MYSQL_PORT", "3306"));
+    config.user = env("SIMTOCHAT_MYSQL_USER", "root");
+    config.password = env("SIMTOCHAT_MYSQL_PASSWORD", "");
+    config.dbname = env("SIMTOCHAT_MYSQL_DB", "test");
+    return config;
+}
+
+#define CHECK(cond) do { if (!(cond)) { std::cerr << "FAILED: " #cond " at line " << __LINE__ << std::endl; return 1; } } while (0)
+
+int TestMySQLPool()
+{
+    MySQLTestConfig config = GetMySQLTestConfig();
+    MySQLConnectionPool pool(2, 8, std::chrono::seconds(1));
+    try
+    {
+        pool.Setup(config.host, config.user, config.password, config.dbname, config.port);
+    }
+    catch(const MySQLException& e)
+    {
+        std::cout << "skipped: no MySQL server at " << config.host << ":" << config.port << std::endl;
+        return 0;
+    }
+    CHECK(pool.getSize() == 2 && pool.getIdleCount() == 2);
+
+    // Many threads share at most maxSize connections.
+    {
+        ThreadPool threads(16);
+        std::atomic<unsigned int> largest{ 0 };
+        std::vector< std::future<void> > results;
+        for (int i = 0; i < 400; ++i)
+        {
+            results.emplace_back(threads.commit([&pool, &largest] {
+                MySQLConnectionPool::Handle handle = pool.Checkout();
+                MySQLResultSet result = handle->ExcuteQuery("SELECT 1");
+                result.Release();
+                unsigned int size = pool.getSize();
+                unsigned int seen = largest.load();
+                while (size > seen && !largest.compare_exchange_weak(seen, size));
+            }));
+        }
+        for (auto&& result : results) result.get();
+        CHECK(largest.load() <= 8);
+        CHECK(pool.getIdleCount() == pool.getSize());
+    }
+
+    // A connection killed on the server is reconnected when it comes back.
+    {
+        MySQLConnectionPool::Handle victim = pool.Checkout();
+        MySQLResultSet result = victim->ExcuteQuery("SELECT CONNECTION_ID()");
+        CHECK(result.NextRow());
+        std::string id = result[0];
+        result.Release();
+
+        unsigned int size = pool.getSize();
+        {
+            MySQLConnectionPool::Handle killer = pool.Checkout();
+            killer->Excute("KILL " + id);
+        }
+        victim.Release();
+        CHECK(pool.getSize() == size);
+
+        MySQLConnectionPool::Handle handle = pool.Checkout();
+        MySQLResultSet check = handle->ExcuteQuery("SELECT 1");
+        check.Release();
+    }
+
+    // The connections above minSize are closed after the idle timeout.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    pool.Checkout().Release();
+    CHECK(pool.getSize() == 2);
+
+    // Borrowing a connection against opening one for every request.
+    const int kRounds = 200;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+    {
+        MySQLConnectionPool::Handle handle = pool.Checkout();
+        MySQLResultSet result = handle->ExcuteQuery("SELECT 1");
+        result.Release();
+    }
+    double pooled = SecondsSince(start) / kRounds;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+    {
+        MySQLConnector connector;
+        connector.Setup(config.host, config.user, config.password, config.dbname, config.port);
+        connector.Connect();
+        MySQLResultSet result = connector.ExcuteQuery("SELECT 1");
+        result.Release();
+    }
+    double fresh = SecondsSince(start) / kRounds;
+
+    std::cout << "pooled " << pooled * 1e6 << " us/query, new connection " << fresh * 1e6 << " us/query" << std::endl;
+    std::cout << "passed" << std::endl;
+    return 0;
+}
+
+int TestMySQLStatement()
+{
+    MySQLTestConfig config = GetMySQLTestConfig();
+    MySQLConnector connector;
+    try
+    {
+        connector.Setup(config.host, config.user, config.password, config.dbname, config.port);
+        connector.Connect();
+    }
+    catch(const MySQLException& e)
+    {
+        std::cout << "skipped: no MySQL server at " << config.host << ":" << config.port << std::endl;
+        return 0;
+    }
+
+    connector.Excute(
+        "CREATE TEMPORARY TABLE stmt_test ("
+        "id BIGINT AUTO_INCREMENT PRIMARY KEY, sender BIGINT, score DOUBLE, message TEXT)"
+    );
+
+    // The same text gives back the same cached statement.
+    MySQLStatement& insert = connector.Prepare("INSERT INTO stmt_test (sender, score, message) VALUES (?, ?, ?)");
+    CHECK(&insert == &connector.Prepare("INSERT INTO stmt_test (sender, score, message) VALUES (?, ?, ?)"));
+
+    // Quotes are data, not SQL.
+    const std::string injection = "x'); DROP TABLE stmt_test; -- ";
+    const std::string longText(1000, 'a');
+    insert.BindInt(0, 10001);
+    insert.BindDouble(1, 2.5);
+    insert.BindString(2, injection);
+    CHECK(insert.Excute() == 1);
+    uint64_t first = insert.getInsertId();
+    insert.BindInt(0, -7);
+    insert.BindNull(1);
+    insert.BindString(2, longText);
+    CHECK(insert.Excute() == 1);
+
+    MySQLStatement& select = connector.Prepare("SELECT sender, score, message FROM stmt_test WHERE id >= ? ORDER BY id");
+    select.BindInt(0, first);
+    select.ExcuteQuery();
+    CHECK(select.getFiledsNum() == 3);
+    CHECK(select.NextRow());
+    CHECK(select.getInt(0) == 10001 && select.getDouble(1) == 2.5 && select.getString(2) == injection);
+    CHECK(select.NextRow());
+    CHECK(select.getInt(0) == -7 && select.isNull(1) && select.getString(2) == longText);
+    CHECK(!select.NextRow());
+    select.Release();
+
+    // Parsing every query against binding a prepared one.
+    const int kRounds = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+    {
+        MySQLResultSet result = connector.ExcuteQuery("SELECT message FROM stmt_test WHERE sender = " + std::to_string(i));
+        result.Release();
+    }
+    double raw = SecondsSince(start) / kRounds;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+    {
+        MySQLStatement& query = connector.Prepare("SELECT message FROM stmt_test WHERE sender = ?");
+        query.BindInt(0, i);
+        query.ExcuteQuery();
+        while (query.NextRow());
+        query.Release();
+    }
+    double prepared = SecondsSince(start) / kRounds;
+
+    std::cout << "raw " << raw * 1e6 << " us/query, prepared " << prepared * 1e6 << " us/query" << std::endl;
+    std::cout << "passed" << std::endl;
+    return 0;
+}
+
+// The resident set size of the process in KiB.
+static long ResidentKiB()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0) return std::stol(line.substr(6));
+    }
+    return 0;
+}
+
+int TestMySQLStream()
+{
+    MySQLTestConfig config = GetMySQLTestConfig();
+    MySQLConnector connector;
+    try
+    {
+        connector.Setup(config.host, config.user, config.password, config.dbname, config.port);
+        connector.Connect();
+    }
+    catch(const MySQLException& e)
+    {
+        std::cout << "skipped: no MySQL server at " << config.host << ":" << config.port << std::endl;
+        return 0;
+    }
+
+    // 2^16 rows of 1 KiB, about 64 MiB of result.
+    connector.Excute("CREATE TEMPORARY TABLE stream_test (id BIGINT AUTO_INCREMENT PRIMARY KEY, body BLOB)");
+    connector.Excute("INSERT INTO stream_test (body) VALUES (CONCAT('a', CHAR(0), 'b'))");
+    connector.Excute("INSERT INTO stream_test (body) SELECT REPEAT('x', 1024) FROM stream_test");
+    for (int i = 0; i < 16; ++i)
+    {
+        connector.Excute("INSERT INTO stream_test (body) SELECT body FROM stream_test WHERE id > 1");
+    }
+
+    // Binary data is read with its length, not up to the first '\0'.
+    {
+        MySQLResultSet result = connector.ExcuteQuery("SELECT body, NULL, 42, 2.5 FROM stream_test WHERE id = 1", MRM_USE);
+        CHECK(result.NextRow());
+        CHECK(result.getLength(0) == 3 && result.getString(0) == std::string("a\0b", 3));
+        CHECK(result.isNull(1) && result.getString(1).empty());
+        CHECK(result.getInt(2) == 42 && result.getDouble(3) == 2.5);
+        CHECK(!result.NextRow());
+        result.Release();
+    }
+
+    auto scan = [&connector](MySQLResultMode mode, long& peak) {
+        long before = ResidentKiB();
+        peak = 0;
+        uint64_t rows = 0, bytes = 0;
+        MySQLResultSet result = connector.ExcuteQuery("SELECT id, body FROM stream_test", mode);
+        while (result.NextRow())
+        {
+            bytes += result.getLength(1);
+            if ((++rows & 0xfff) == 0) peak = std::max(peak, ResidentKiB() - before);
+        }
+        result.Release();
+        return bytes;
+    };
+
+    // Streaming first, so the freed store buffers can not hide its own growth.
+    long usePeak, storePeak;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t useBytes = scan(MRM_USE, usePeak);
+    double useTime = SecondsSince(start);
+    start = std::chrono::steady_clock::now();
+    uint64_t storeBytes = scan(MRM_STORE, storePeak);
+    double storeTime = SecondsSince(start);
+    CHECK(useBytes == storeBytes);
+    CHECK(usePeak < 16 * 1024);
+
+    std::cout << "use: +" << usePeak << " KiB in " << useTime << " s, "
+              << "store: +" << storePeak << " KiB in " << storeTime << " s" << std::endl;
+
+    // The connection is usable after a streamed result is released early.
+    {
+        MySQLResultSet result = connector.ExcuteQuery("SELECT body FROM stream_test", MRM_USE);
+        CHECK(result.NextRow());
+        result.Release();
+        MySQLResultSet check = connector.ExcuteQuery("SELECT COUNT(*) FROM stream_test");
+        CHECK(check.NextRow() && check.getInt(0) == (1 << 16) + 1);
+        check.Release();
+    }
+
+    std::cout << "passed" << std::endl;
+    return 0;
+}
+
+int TestMySQLBatch()
+{
+    MySQLTestConfig config = GetMySQLTestConfig();
+    MySQLConnectionPool pool(2, 4);
+    try
+    {
+        pool.Setup(config.host, config.user, config.password, config.dbname, config.port);
+    }
+    catch(const MySQLException& e)
+    {
+        std::cout << "skipped: no MySQL server at " << config.host << ":" << config.port << std::endl;
+        return 0;
+    }
+
+    // The writer uses several connections, so the table can not be temporary.
+    auto count = [&pool] {
+        MySQLConnectionPool::Handle handle = pool.Checkout();
+        MySQLResultSet result = handle->ExcuteQuery("SELECT COUNT(*) FROM batch_test");
+        int64_t rows = result.NextRow() ? result.getInt(0) : -1;
+        result.Release();
+        return rows;
+    };
+    pool.Checkout()->Excute("DROP TABLE IF EXISTS batch_test");
+    pool.Checkout()->Excute(
+        "CREATE TABLE batch_test (id BIGINT AUTO_INCREMENT PRIMARY KEY, "
+        "sender BIGINT, receiver BIGINT, sendtime BIGINT, message VARBINARY(1024))"
+    );
+    const std::vector<std::string> columns = { "sender", "receiver", "sendtime", "message" };
+    const std::string text(200, 'm');
+
+    // One autocommit INSERT per message, as a handler would do it without the writer.
+    const int kSingle = 2000;
+    auto start = std::chrono::steady_clock::now();
+    {
+        MySQLConnectionPool::Handle handle = pool.Checkout();
+        MySQLStatement& insert = handle->Prepare("INSERT INTO batch_test (sender, receiver, sendtime, message) VALUES (?, ?, ?, ?)");
+        for (int i = 0; i < kSingle; ++i)
+        {
+            insert.BindInt(0, 1);
+            insert.BindInt(1, 2);
+            insert.BindInt(2, i);
+            insert.BindString(3, text);
+            insert.Excute();
+        }
+    }
+    double single = SecondsSince(start) / kSingle;
+
+    // An odd number of rows, so the last batch is split into powers of two.
+    const int kBatched = 100001;
+    MySQLBatchStats stats;
+    start = std::chrono::steady_clock::now();
+    {
+        MySQLBatchWriter writer(pool, "batch_test", columns);
+        double worstInsert = 0;
+        for (int i = 0; i < kBatched; ++i)
+        {
+            auto before = std::chrono::steady_clock::now();
+            CHECK(writer.Insert({ 1, 2, i, text }, std::chrono::milliseconds(5000)));
+            worstInsert = std::max(worstInsert, SecondsSince(before));
+        }
+        CHECK(!writer.Insert({ 1, 2 }));
+        writer.Flush();
+        stats = writer.getStats();
+        std::cout << "slowest insert " << worstInsert * 1e6 << " us" << std::endl;
+    }
+    double batched = SecondsSince(start) / kBatched;
+    CHECK(stats.written == kBatched && stats.failed == 0 && stats.queuedRows == 0);
+    CHECK(count() == kSingle + kBatched);
+
+    // A small queue refuses rows while the worker is busy, and every accepted row is still written.
+    {
+        MySQLBatchWriter writer(pool, "batch_test", columns, MYSQL_BATCH_ROWS, std::chrono::milliseconds(20), 64 * 1024);
+        for (int i = 0; i < 20000; ++i) writer.Insert({ 3, 4, i, text });
+        writer.Flush();
+        MySQLBatchStats small = writer.getStats();
+        std::cout << "small queue: " << small.inserted << " rows accepted, " << small.rejected << " refused" << std::endl;
+        CHECK(small.rejected > 0 && small.inserted + small.rejected == 20000 && small.written == small.inserted);
+        CHECK(count() == int64_t(kSingle + kBatched + small.inserted));
+    }
+
+    // A row waits for the deadline, not for a full batch.
+    {
+        MySQLBatchWriter writer(pool, "batch_test", columns, MYSQL_BATCH_ROWS, std::chrono::milliseconds(20));
+        writer.Insert({ 5, 6, 0, "alone" });
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        CHECK(writer.getStats().written == 1);
+    }
+    pool.Checkout()->Excute("DROP TABLE batch_test");
+
+    std::cout << "single " << single * 1e6 << " us/row, batched " << batched * 1e6 << " us/row, "
+              << stats.flushes << " transactions, flush latency " << stats.meanLatency * 1e3 << " ms (mean), "
+              << stats.maxLatency * 1e3 << " ms (max)" << std::endl;
+    std::cout << "passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * @FilePath: /simtochat/test/src/OfflineBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 14:36:02
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 14:36:02
+ * @Description:
+ *  Appends per second to SegmentLog from several threads with group commits,
+ *  taking the records back in order, and recovering them after reopening and after a torn write.
+ *  Records which are read stay until they are removed, and records which are never taken are moved forward
+ *  so the segments after them are deleted.
+ */
+#include "Bench.h"
+#include "Codec.h"
+#include "SegmentLog.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kThreads = 4;
+const int kAppends = 100000;        // Per thread
+const int kUsers = 10000;           // A multiple of kThreads
+const size_t kSegmentSize = 16 * 1024 * 1024;
+
+std::vector<std::string> ListSegments(const std::string& dir)
+{
+    std::vector<std::string> names;
+    DIR* handle = opendir(dir.c_str());
+    while (dirent* entry = handle ? readdir(handle) : nullptr)
+    {
+        if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    if (handle) closedir(handle);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void RemoveDir(const std::string& dir)
+{
+    for (const std::string& name : ListSegments(dir)) unlink((dir + "/" + name).c_str());
+    rmdir(dir.c_str());
+}
+
+// Flip a byte in the data of the last record of the newest segment, like a write torn by a crash.
+bool TearLastRecord(const std::string& dir)
+{
+    std::vector<std::string> names = ListSegments(dir);
+    for (auto it = names.rbegin(); it != names.rend(); ++it)
+    {
+        std::string path = dir + "/" + *it;
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd == -1) continue;
+
+        size_t offset = 0, last = 0;
+        bool found = false;
+        uint32_t length;
+        while (pread(fd, &length, sizeof(length), offset) == sizeof(length) && length != 0)
+        {
+            last = offset;
+            found = true;
+            offset += ((16 + (length & 0x3fffffff)) + 7) & ~size_t(7);
+        }
+        char byte = 0;
+        bool torn = found && pread(fd, &byte, 1, last + 16) == 1;
+        byte ^= 0x5a;
+        torn = torn && pwrite(fd, &byte, 1, last + 16) == 1;
+        close(fd);
+        if (found) return torn;
+    }
+    return false;
+}
+
+// A frame as the server keeps it: the header and a msg_sendmessage whose sendtime is a sequence number.
+void MakeFrame(char* frame, uint64_t user, int64_t sequence)
+{
+    msg_sendmessage msg;
+    memset(&msg, 0, sizeof(msg));
+    snprintf(msg.reciver, sizeof(msg.reciver), "user%llu", (unsigned long long)user);
+    msg.sendtime = sequence;
+    snprintf(msg.message, sizeof(msg.message), "offline message %lld", (long long)sequence);
+    EncodeHeader(frame, RT_SENDMESSAGE, sizeof(msg));
+    memcpy(frame + REQUEST_HEADER_SIZE, &msg, sizeof(msg));
+}
+
+const size_t kFrameSize = REQUEST_HEADER_SIZE + sizeof(msg_sendmessage);
+
+// Decode the frames of the batches. Return false unless they are the expected user's, in increasing order.
+bool CheckBatches(const std::vector<SharedBuffer>& batches, size_t expected, int64_t& last)
+{
+    size_t frames = 0;
+    for (const SharedBuffer& batch : batches)
+    {
+        if (batch.getSize() % kFrameSize != 0) return false;
+        for (size_t offset = 0; offset < batch.getSize(); offset += kFrameSize)
+        {
+            msg_sendmessage msg;
+            memcpy(&msg, batch.getData() + offset + REQUEST_HEADER_SIZE, sizeof(msg));
+            if (msg.sendtime <= last) return false;
+            last = msg.sendtime;
+            frames++;
+        }
+    }
+    return frames == expected;
+}
+
+} // namespace
+
+int BenchOffline()
+{
+    char path[] = "/tmp/simtochat-offline-XXXXXX";
+    if (!mkdtemp(path))
+    {
+        std::cerr << "FAILED: mkdtemp" << std::endl;
+        return 1;
+    }
+    std::string dir = path;
+    bool ok = true;
+
+    try
+    {
+        // Each thread has its own users, so the sequence numbers of a user increase in the log.
+        {
+            SegmentLog log(dir, kSegmentSize);
+            std::atomic<int> refused{ 0 };
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (int t = 0; t < kThreads; t++)
+            {
+                threads.emplace_back(
+                    [&log, &refused, t] {
+                        char frame[kFrameSize];
+                        for (int i = 0; i < kAppends; i++)
+                        {
+                            int64_t n = int64_t(i) * kThreads + t;
+                            MakeFrame(frame, n % kUsers + 1, n);
+                            if (!log.Append(n % kUsers + 1, frame, kFrameSize)) refused++;
+                        }
+                    }
+                );
+            }
+            for (std::thread& thread : threads) thread.join();
+            log.Sync();
+            double seconds = SecondsSince(start);
+            size_t total = size_t(kThreads) * kAppends;
+            std::cout << total << " appends of " << kFrameSize << " bytes from " << kThreads << " threads: "
+                << total / seconds / 1e3 << " k appends/sec, " << total * kFrameSize / seconds / (1 << 20)
+                << " MiB/sec, " << log.getCommitCount() << " group commits, "
+                << log.getSegmentCount() << " segments" << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            size_t taken = 0, bad = 0;
+            for (uint64_t user = 1; user <= kUsers; user++)
+            {
+                std::vector<SharedBuffer> batches;
+                size_t count = log.Take(user, batches);
+                int64_t last = -1;
+                if (count != total / kUsers || !CheckBatches(batches, count, last)) bad++;
+                taken += count;
+            }
+            seconds = SecondsSince(start);
+            std::cout << "took " << taken << " records of " << kUsers << " users in " << seconds * 1e3 << " ms, "
+                << bad << " users out of order or incomplete, " << log.getSegmentCount() << " segments left" << std::endl;
+            ok = ok && refused == 0 && taken == total && bad == 0 && log.getSegmentCount() <= 2;
+        }
+
+        // Reopen: what was taken stays taken, what was not comes back, and a torn record is dropped.
+        {
+            SegmentLog log(dir, kSegmentSize);
+            char frame[kFrameSize];
+            for (int64_t n = 0; n < 300; n++)
+            {
+                MakeFrame(frame, n % 100 + 1, n);
+                log.Append(n % 100 + 1, frame, kFrameSize);
+            }
+            std::vector<SharedBuffer> batches;
+            for (uint64_t user = 1; user <= 50; user++) log.Take(user, batches);
+            MakeFrame(frame, 101, 300);
+            log.Append(101, frame, kFrameSize);
+        }
+        bool torn = TearLastRecord(dir);
+        {
+            SegmentLog log(dir, kSegmentSize);
+            size_t wrong = 0;
+            for (uint64_t user = 1; user <= 100; user++)
+            {
+                if (log.getCount(user) != (user <= 50 ? 0u : 3u)) wrong++;
+            }
+            std::vector<SharedBuffer> batches;
+            int64_t last = -1;
+            if (log.Take(77, batches) != 3 || !CheckBatches(batches, 3, last)) wrong++;
+            std::cout << "recovered: " << wrong << " users wrong, torn record "
+                << (torn && log.getCount(101) == 0 ? "dropped" : "KEPT") << std::endl;
+            ok = ok && wrong == 0 && torn && log.getCount(101) == 0;
+        }
+
+        // Take while another thread appends into small segments, which roll and are dropped meanwhile:
+        // the records come out whole and in order, from the chunks not written yet or from the mappings.
+        RemoveDir(dir);
+        {
+            const int64_t appends = 50000;
+            SegmentLog log(dir, 1 << 20);
+            std::atomic<bool> done{ false };
+            std::thread appender(
+                [&log, &done, appends] {
+                    char frame[kFrameSize];
+                    for (int64_t n = 0; n < appends; n++)
+                    {
+                        MakeFrame(frame, n % 4 + 1, n);
+                        log.Append(n % 4 + 1, frame, kFrameSize);
+                    }
+                    done = true;
+                }
+            );
+            std::vector<int64_t> last(5, -1);
+            size_t taken = 0, wrong = 0;
+            for (bool finished = false; !finished; )
+            {
+                finished = done.load();
+                for (uint64_t user = 1; user <= 4; user++)
+                {
+                    std::vector<SharedBuffer> batches;
+                    size_t count = log.Take(user, batches);
+                    if (!CheckBatches(batches, count, last[user])) wrong++;
+                    taken += count;
+                }
+            }
+            appender.join();
+            log.Sync();
+            std::cout << "taken while appending: " << taken << " records, " << wrong << " takes out of order, "
+                << log.getSegmentCount() << " segments left" << std::endl;
+            ok = ok && taken == size_t(appends) && wrong == 0 && log.getSegmentCount() <= 2;
+        }
+
+        // Read leaves the records, Remove drops only those read, also after reopening.
+        RemoveDir(dir);
+        {
+            SegmentLog log(dir, kSegmentSize);
+            char frame[kFrameSize];
+            for (int64_t n = 0; n < 5; n++)
+            {
+                MakeFrame(frame, 9, n);
+                log.Append(9, frame, kFrameSize);
+            }
+            std::vector<SharedBuffer> batches;
+            uint64_t position = 0;
+            int64_t last = -1;
+            bool read = log.Read(9, batches, position) == 5 && CheckBatches(batches, 5, last) && log.getCount(9) == 5;
+
+            // Appended after the read, so not removed with it.
+            MakeFrame(frame, 9, 5);
+            log.Append(9, frame, kFrameSize);
+            batches.clear();
+            read = read && log.Read(9, batches, position, position) == 1 && CheckBatches(batches, 1, last);
+            MakeFrame(frame, 9, 6);
+            log.Append(9, frame, kFrameSize);
+            read = read && log.Remove(9, position) == 6 && log.getCount(9) == 1;
+            ok = ok && read;
+            std::cout << "read and removed up to a position: " << (read ? "right" : "WRONG") << std::endl;
+        }
+        {
+            SegmentLog log(dir, kSegmentSize);
+            std::vector<SharedBuffer> batches;
+            int64_t last = 5;
+            bool kept = log.Take(9, batches) == 1 && CheckBatches(batches, 1, last);
+            ok = ok && kept;
+            std::cout << "after reopening, the record appended after the read is " << (kept ? "kept" : "LOST") << std::endl;
+        }
+
+        // A user who never logs in does not keep every later segment on the disk: the records of users 1 and 3
+        // are moved forward in order, keep their positions, and come back after reopening.
+        RemoveDir(dir);
+        uint64_t position = 0;
+        {
+            SegmentLog log(dir, 64 * 1024);
+            char frame[kFrameSize];
+            MakeFrame(frame, 1, 0);
+            log.Append(1, frame, kFrameSize);
+            std::vector<SharedBuffer> batches;
+            log.Read(1, batches, position);
+            size_t most = 0;
+            for (int64_t n = 1; n <= 20000; n++)
+            {
+                uint64_t user = n % 4000 == 1 ? 3 : 2;
+                MakeFrame(frame, user, n);
+                log.Append(user, frame, kFrameSize);
+                if (n % 100 == 0)
+                {
+                    batches.clear();
+                    log.Take(2, batches);
+                    log.Sync();
+                    most = std::max(most, log.getSegmentCount());
+                }
+            }
+            std::cout << "one record never taken among " << 20000 * kFrameSize / (64 * 1024) << " segments of appends: "
+                << most << " segments at most" << std::endl;
+            ok = ok && most <= 8 && log.getCount(1) == 1 && log.getCount(3) == 5;
+        }
+        {
+            SegmentLog log(dir, 64 * 1024);
+            std::vector<SharedBuffer> batches;
+            uint64_t moved = 0;
+            int64_t last = -1;
+            bool kept = log.Read(1, batches, moved) == 1 && CheckBatches(batches, 1, last) && moved == position;
+            batches.clear();
+            last = -1;
+            kept = kept && log.Take(3, batches) == 5 && CheckBatches(batches, 5, last) && log.Remove(1, position) == 1;
+            ok = ok && kept;
+            std::cout << "after reopening, the moved records are " << (kept ? "kept in order" : "WRONG") << ", "
+                << log.getSegmentCount() << " segments" << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        ok = false;
+    }
+    RemoveDir(dir);
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+/*
+ * @FilePath: /simtochat/test/src/OffloadTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 15:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 15:02:37
+ * @Description:
+ *  OrderedExecutor keeps the tasks of a key in order and runs the keys in parallel, and a slow
+ *  request offloaded from a loop delays neither the other clients nor the order of its own replies.
+ */
+#include "Bench.h"
+#include "OrderedExecutor.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kKeys = 64;
+const int kTasksPerKey = 2000;
+const int kSlowMs = 100;
+
+// Tasks posted from two threads: every key must see its own in order and never two at once.
+bool CheckOrder()
+{
+    std::vector<int> next(kKeys, 0);
+    std::unique_ptr<std::atomic<int>[]> running(new std::atomic<int>[kKeys]);
+    for (int key = 0; key < kKeys; key++) running[key] = 0;
+    std::atomic<long> errors{ 0 };
+    std::atomic<long> done{ 0 };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        OrderedExecutor executor(4);
+        std::vector<std::thread> posters;
+        for (int t = 0; t < 2; t++)
+        {
+            posters.emplace_back(
+                [&, t]
+                {
+                    for (int i = 0; i < kTasksPerKey; i++)
+                    {
+                        for (int key = t; key < kKeys; key += 2)
+                        {
+                            executor.Post(uint64_t(key) << 32 | 7,
+                                [&, key, i]
+                                {
+                                    if (running[key]++ != 0) errors++;
+                                    if (next[key]++ != i) errors++;
+                                    running[key]--;
+                                    done++;
+                                }
+                            );
+                        }
+                    }
+                }
+            );
+        }
+        for (auto& poster : posters) poster.join();
+        while (done.load() < long(kKeys) * kTasksPerKey) std::this_thread::yield();
+        if (executor.getActiveCount() > kKeys) errors++;
+    }
+    double seconds = SecondsSince(start);
+
+    // Four keys with slow tasks take as long as one of them with four workers.
+    start = std::chrono::steady_clock::now();
+    {
+        OrderedExecutor executor(4);
+        for (int i = 0; i < 3; i++)
+        {
+            for (uint64_t key = 1; key <= 4; key++)
+            {
+                executor.Post(key, [] { std::this_thread::sleep_for(std::chrono::milliseconds(50)); });
+            }
+        }
+        while (executor.getActiveCount() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double parallel = SecondsSince(start);
+
+    std::cout << "ordered: " << long(kKeys) * kTasksPerKey / seconds / 1e6 << " M tasks/sec over " << kKeys
+        << " keys, " << errors.load() << " out of order or overlapping; 4 keys of 3 x 50 ms in "
+        << parallel * 1e3 << " ms" << std::endl;
+    return errors.load() == 0 && parallel < 0.3;
+}
+
+// A task which throws only drops itself: the next task of its key still runs.
+bool CheckThrow()
+{
+    std::atomic<int> ran{ 0 };
+    OrderedExecutor executor(2);
+    executor.Post(5, [] { throw std::runtime_error("thrown"); });
+    executor.Post(5, [&ran] { ran++; });
+    for (int wait = 0; wait < 200 && executor.getActiveCount() > 0; wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::cout << "after a task threw, the next one of its key ran: " << ran.load() << std::endl;
+    return ran.load() == 1 && executor.getActiveCount() == 0;
+}
+
+// Read n bytes, or fewer after two seconds.
+std::string ReadBytes(int fd, size_t n)
+{
+    std::string text;
+    timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char chunk[64];
+    while (text.size() < n)
+    {
+        ssize_t got = recv(fd, chunk, std::min(sizeof(chunk), n - text.size()), 0);
+        if (got <= 0) break;
+        text.append(chunk, size_t(got));
+    }
+    return text;
+}
+
+/**
+ * One loop. 'S' is a slow request offloaded to a worker, 'F' a fast one handled on the loop,
+ * unless a slow one of the same client is still on a worker. Each is answered with its letter.
+ * Return the milliseconds another client waits for a fast reply while a slow request runs.
+ */
+double CheckServer(bool uring, int port, unsigned short workers, bool& ordered)
+{
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setWorkerCount(workers);
+    server.setProcessor(
+        [](Socket& client)
+        {
+            Buffer& input = client.getInput();
+            std::string requests(input.Peek(), input.getReadableBytes());
+            input.RetrieveAll();
+            for (char request : requests)
+            {
+                if (request == 'X')
+                {
+                    client.Offload([] { throw std::runtime_error("failed"); },
+                        [](Socket& client) { client.Send("X", 1); });
+                }
+                else if (request == 'S')
+                {
+                    client.Offload([] { std::this_thread::sleep_for(std::chrono::milliseconds(kSlowMs)); },
+                        [](Socket& client) { client.Send("S", 1); });
+                }
+                else if (client.isOffloading())
+                {
+                    client.Offload([] {}, [](Socket& client) { client.Send("F", 1); });
+                }
+                else
+                {
+                    client.Send("F", 1);
+                }
+            }
+        }
+    );
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    int slow = ConnectLocal(port);
+    int fast = ConnectLocal(port);
+
+    // Answered in the order asked, the fast ones after a slow one wait for it.
+    send(slow, "FSFFSF", 6, MSG_NOSIGNAL);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto start = std::chrono::steady_clock::now();
+    send(fast, "F", 1, MSG_NOSIGNAL);
+    bool fastReplied = ReadBytes(fast, 1) == "F";
+    double waited = SecondsSince(start) * 1e3;
+    ordered = ReadBytes(slow, 6) == "FSFFSF" && fastReplied;
+
+    std::cout << (uring ? "io_uring" : "epoll") << " with " << workers << " workers: "
+        << "replies in order: " << ordered << ", another client waited " << waited << " ms during a "
+        << kSlowMs << " ms request" << std::endl;
+
+    // Work which throws closes its connection instead of answering.
+    int failing = ConnectLocal(port);
+    send(failing, "X", 1, MSG_NOSIGNAL);
+    timeval timeout = { 2, 0 };
+    setsockopt(failing, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char byte;
+    if (recv(failing, &byte, 1, 0) != 0) ordered = false;
+    close(failing);
+
+    close(slow);
+    close(fast);
+    server.Stop();
+    serverThread.join();
+    return waited;
+}
+
+} // namespace
+
+int TestOffload()
+{
+    bool ok = CheckOrder();
+    ok = CheckThrow() && ok;
+
+    bool ordered;
+    double waited = CheckServer(false, 8930, 2, ordered);
+    ok = ok && ordered && waited < kSlowMs / 2;
+    waited = CheckServer(true, 8931, 2, ordered);
+    ok = ok && ordered && waited < kSlowMs / 2;
+
+    // On the loop, the slow request holds up the other client.
+    waited = CheckServer(false, 8932, 0, ordered);
+    ok = ok && ordered && waited > kSlowMs / 2;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
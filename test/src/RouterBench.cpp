@@ -0,0 +1,296 @@
+/*
+ * @FilePath: /simtochat/test/src/RouterBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 19:26:51
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 19:26:51
+ * @Description:
+ *  Delivered messages per second through Router with 100k sessions,
+ *  and the lookup cost of the session table against the standard maps.
+ */
+#include "Bench.h"
+#include "Codec.h"
+#include "Router.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <map>
+#include <unordered_map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kPort = 8917;
+const int kLoops = 2;
+const int kConnections = 64;
+const int kSessions = 100000;
+const int kMessages = 400000;
+const int kBatch = 256;         // Messages written to a connection at once
+const int kLookups = 10000000;
+
+template<class Map>
+void BenchLookups(const char* name, Map& map, const std::vector<uint64_t>& keys)
+{
+    std::mt19937_64 rng(2021);
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; i++)
+    {
+        auto it = map.find(keys[rng() % keys.size()]);
+        checksum += it->second.fd;
+    }
+    double seconds = SecondsSince(start);
+    std::cout << name << ": " << seconds / kLookups * 1e9 << " ns/lookup (checksum " << checksum << ")" << std::endl;
+}
+
+// The same loop over FlatMap, which has its own lookup method.
+void BenchFlatLookups(FlatMap<uint64_t, Session>& map, const std::vector<uint64_t>& keys)
+{
+    std::mt19937_64 rng(2021);
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; i++)
+    {
+        checksum += map.Find(keys[rng() % keys.size()])->fd;
+    }
+    double seconds = SecondsSince(start);
+    std::cout << "FlatMap: " << seconds / kLookups * 1e9 << " ns/lookup (checksum " << checksum << ")" << std::endl;
+}
+
+} // namespace
+
+int BenchRouter()
+{
+    // The session table alone.
+    {
+        std::vector<uint64_t> keys;
+        FlatMap<uint64_t, Session> flat;
+        std::map<uint64_t, Session> tree;
+        std::unordered_map<uint64_t, Session> hash;
+        for (uint64_t user = 1; user <= kSessions; user++)
+        {
+            Session session{ nullptr, int(user % 1000), user };
+            keys.push_back(user * 7919);
+            flat.Insert(keys.back(), session);
+            tree[keys.back()] = session;
+            hash[keys.back()] = session;
+        }
+        BenchFlatLookups(flat, keys);
+        BenchLookups("std::map", tree, keys);
+        BenchLookups("std::unordered_map", hash, keys);
+    }
+
+    Router router(kSessions + kConnections);
+    EpollServer server;
+    server.setLoopCount(kLoops);
+    server.setProcessor(
+        [&router](Socket& client)
+        {
+            Request request;
+            RequestDecoder decoder(client.getInput());
+            while (decoder.Next(request))
+            {
+                if (request.type == RT_LOGIN)
+                {
+                    if (auto login = RequestCast<msg_login>(request))
+                    {
+                        router.Login(client, login->username, strnlen(login->username, sizeof(login->username)));
+                    }
+                }
+                else if (request.type == RT_SENDMESSAGE && !router.Route(client, request))
+                {
+                    client.Disconnect();
+                    return;
+                }
+            }
+            if (decoder.isBroken()) client.Disconnect();
+        }
+    );
+    server.setCloser([&router](Socket& client) { router.Unbind(client); });
+    std::thread serverThread([&server] { server.Run(kPort); });
+
+    // Log every connection in, then spread the simulated users over them.
+    std::vector<int> fds;
+    std::vector<uint64_t> connUsers;
+    for (int i = 0; i < kConnections; i++)
+    {
+        int fd = ConnectLocal(kPort);
+        if (fd == -1) break;
+        fds.push_back(fd);
+
+        msg_login login;
+        memset(&login, 0, sizeof(login));
+        snprintf(login.username, sizeof(login.username), "conn%d", i);
+        connUsers.push_back(router.getUserId(login.username, strlen(login.username)));
+        Buffer buffer;
+        EncodeRequest(buffer, RT_LOGIN, login);
+        SendAll(fd, buffer);
+    }
+    for (int wait = 0; wait < 3000 && router.getSessionCount() < fds.size(); wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    int status = 0;
+    auto finish = [&] {
+        for (int fd : fds) close(fd);
+        server.Stop();
+        serverThread.join();
+    };
+    if (fds.size() != kConnections || router.getSessionCount() != kConnections)
+    {
+        std::cerr << "FAILED: could not log in " << kConnections << " connections on port " << kPort << std::endl;
+        finish();
+        return 1;
+    }
+
+    std::vector<uint64_t> simUsers;
+    for (int i = 0; i < kSessions; i++)
+    {
+        std::string name = "sim" + std::to_string(i);
+        Session session;
+        router.Find(connUsers[i % kConnections], session);
+        simUsers.push_back(router.getUserId(name.data(), name.size()));
+        router.Bind(simUsers.back(), session);
+    }
+    uint64_t firstSim = simUsers.front();
+
+    // One thread writes to random receivers, the main thread reads what the server delivers.
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer(
+        [&] {
+            std::mt19937 rng(2021);
+            std::vector<Buffer> buffers(kConnections);
+            const char text[] = "hello from the router benchmark";
+            for (int i = 0; i < kMessages; i++)
+            {
+                int conn = i % kConnections;
+                SendMessage msg{ connUsers[conn], simUsers[rng() % kSessions], i, sizeof(text) - 1, text };
+                EncodeSendMessage(buffers[conn], msg);
+                if (buffers[conn].getReadableBytes() > kBatch * 48 || i + kConnections >= kMessages)
+                {
+                    SendAll(fds[conn], buffers[conn]);
+                }
+            }
+        }
+    );
+
+    std::vector<pollfd> polls;
+    for (int fd : fds) polls.push_back(pollfd{ fd, POLLIN, 0 });
+    std::vector<Buffer> inputs(kConnections);
+    int delivered = 0, misrouted = 0;
+    char chunk[65536];
+    while (delivered < kMessages)
+    {
+        if (poll(polls.data(), polls.size(), 3000) <= 0) break;
+        for (int conn = 0; conn < kConnections; conn++)
+        {
+            if (!(polls[conn].revents & POLLIN)) continue;
+            ssize_t n = recv(fds[conn], chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n <= 0) continue;
+            inputs[conn].Append(chunk, n);
+
+            Request request;
+            SendMessage msg;
+            RequestDecoder decoder(inputs[conn]);
+            while (decoder.Next(request))
+            {
+                if (!DecodeSendMessage(request, msg)) continue;
+                delivered++;
+                if ((msg.reciver - firstSim) % kConnections != uint64_t(conn)) misrouted++;
+            }
+        }
+    }
+    double seconds = SecondsSince(start);
+    writer.join();
+
+    std::cout << kSessions << " sessions on " << kConnections << " connections, " << kLoops << " loops: "
+        << delivered << "/" << kMessages << " delivered in " << seconds << " s, "
+        << delivered / seconds / 1e6 << " M messages/sec" << std::endl;
+    if (delivered != kMessages || misrouted != 0)
+    {
+        std::cerr << "FAILED: " << misrouted << " misrouted" << std::endl;
+        status = 1;
+    }
+
+    // A closed connection leaves the table.
+    close(fds[0]);
+    fds.erase(fds.begin());
+    Session session;
+    for (int wait = 0; wait < 500 && router.Find(connUsers[0], session); wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (router.Find(connUsers[0], session))
+    {
+        std::cerr << "FAILED: the session of a closed connection is still bound" << std::endl;
+        status = 1;
+    }
+
+    // A message from a connection which did not log in, or sent as another user, closes the connection.
+    for (int spoof = 0; spoof < 2; spoof++)
+    {
+        int fd = ConnectLocal(kPort);
+        Buffer buffer;
+        if (spoof == 1)
+        {
+            msg_login login;
+            memset(&login, 0, sizeof(login));
+            strcpy(login.username, "spoofer");
+            EncodeRequest(buffer, RT_LOGIN, login);
+        }
+        const char text[] = "spoofed";
+        EncodeSendMessage(buffer, SendMessage{ connUsers[1], connUsers[2], 0, sizeof(text) - 1, text });
+        SendAll(fd, buffer);
+
+        char byte;
+        timeval timeout = { 2, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(fd, &byte, 1, 0) != 0)
+        {
+            std::cerr << "FAILED: a message " << (spoof ? "as another user" : "before login") << " was accepted" << std::endl;
+            status = 1;
+        }
+        close(fd);
+    }
+    if (router.isUser(router.getUserId("spoofer", 7) + 1))
+    {
+        std::cerr << "FAILED: an ID never given is a user" << std::endl;
+        status = 1;
+    }
+
+    // Only a registered user with the right password logs in, and a name is registered once.
+    uint64_t registered = router.Register("alice", 5, "secret", 6);
+    if (registered == 0 || router.Register("alice", 5, "other", 5) != 0
+        || router.Authenticate("alice", 5, "secret", 6) != registered
+        || router.Authenticate("alice", 5, "secre", 5) != 0 || router.Authenticate("alice", 5, "", 0) != 0
+        || router.Authenticate("spoofer", 7, "", 0) != 0 || router.Authenticate("nobody", 6, "", 0) != 0
+        || router.FindUserId("nobody", 6) != 0)
+    {
+        std::cerr << "FAILED: a login without the right password was accepted" << std::endl;
+        status = 1;
+    }
+
+    // The users of an earlier run keep their IDs, the next ones get larger IDs, and a user the handler refuses
+    // is not registered.
+    Router restarted;
+    std::vector<uint64_t> saved;
+    restarted.setRegisterHandler([&saved](uint64_t user, const char*, const char*) { saved.push_back(user); return saved.size() < 2; });
+    if (!restarted.Restore(7, "bob", 3, "pw", 2) || restarted.Restore(7, "carol", 5, "pw", 2)
+        || restarted.Restore(8, "bob", 3, "pw", 2) || restarted.Authenticate("bob", 3, "pw", 2) != 7
+        || restarted.Register("carol", 5, "pw", 2) != 8 || restarted.Register("dave", 4, "pw", 2) != 0
+        || restarted.FindUserId("dave", 4) != 0 || saved != std::vector<uint64_t>{ 8, 9 })
+    {
+        std::cerr << "FAILED: the IDs of restored users were not kept" << std::endl;
+        status = 1;
+    }
+
+    finish();
+    if (status == 0) std::cout << "passed" << std::endl;
+    return status;
+}
@@ -0,0 +1,174 @@
+/*
+ * @FilePath: /simtochat/test/src/SendBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 22:48:16
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 22:48:16
+ * @Description:
+ *  The vectored and the zero-copy sends of both event loops: frames gathered from pieces,
+ *  and a large payload shared by many clients, released once the kernel is done with it,
+ *  also when an epoll connection is closed right after the send.
+ */
+#include "Bench.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kClients = 16;
+const int kRequests = 8;
+const int kFrames = 1000;
+const size_t kPayloadSize = 1 << 20;
+const size_t kClosingSize = 64 << 10;     // Taken by the kernel in one send on loopback
+
+bool RecvAll(int fd, std::string& data, size_t n)
+{
+    data.resize(n);
+    size_t received = 0;
+    while (received < n)
+    {
+        ssize_t rst = recv(fd, &data[received], n - received, 0);
+        if (rst <= 0) return false;
+        received += rst;
+    }
+    return true;
+}
+
+// A 'v' asks for kFrames frames of three pieces, corked but the last. A 'z' asks for the shared payload.
+bool RunBackend(bool uring, int port)
+{
+    auto payload = std::make_shared<std::string>(kPayloadSize, '\0');
+    for (size_t i = 0; i < payload->size(); i++) (*payload)[i] = char(i * 7 + i / 1000);
+
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setProcessor(
+        [payload](Socket& client)
+        {
+            Buffer& input = client.getInput();
+            while (input.getReadableBytes() > 0)
+            {
+                char request = *input.Peek();
+                input.Retrieve(1);
+                if (request == 'z')
+                {
+                    client.SendZeroCopy(payload->data(), payload->size(), payload);
+                    continue;
+                }
+                if (request == 'x')
+                {
+                    client.SendZeroCopy(payload->data(), kClosingSize, payload);
+                    client.Disconnect();
+                    return;
+                }
+                for (uint32_t i = 0; i < kFrames; i++)
+                {
+                    char tail = '\n';
+                    iovec vec[3] = { { (void*)"frame ", 6 }, { &i, sizeof(i) }, { &tail, 1 } };
+                    client.Send(vec, 3, i + 1 < kFrames);
+                }
+            }
+        }
+    );
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    bool ok = true;
+    std::vector<int> fds;
+    for (int i = 0; i < kClients; i++)
+    {
+        int fd = ConnectLocal(port);
+        if (fd == -1) ok = false;
+        else fds.push_back(fd);
+    }
+
+    // The frames, in order and intact.
+    std::string data;
+    send(fds[0], "v", 1, MSG_NOSIGNAL);
+    ok = ok && RecvAll(fds[0], data, kFrames * 11);
+    for (uint32_t i = 0; ok && i < kFrames; i++)
+    {
+        const char* frame = data.data() + i * 11;
+        uint32_t number;
+        memcpy(&number, frame + 6, sizeof(number));
+        ok = memcmp(frame, "frame ", 6) == 0 && number == i && frame[10] == '\n';
+    }
+
+    // Every client asks for the payload several times, all the sends share one copy of it.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> readers;
+    std::atomic<int> intact{ 0 };
+    for (int fd : fds)
+    {
+        readers.emplace_back(
+            [fd, &payload, &intact]
+            {
+                std::string received;
+                for (int i = 0; i < kRequests; i++) send(fd, "z", 1, MSG_NOSIGNAL);
+                for (int i = 0; i < kRequests; i++)
+                {
+                    if (RecvAll(fd, received, kPayloadSize) && received == *payload) intact++;
+                }
+            }
+        );
+    }
+    for (auto& reader : readers) reader.join();
+    double seconds = SecondsSince(start);
+
+    // The loop releases its references when the completions arrive.
+    while (payload.use_count() > 2 && SecondsSince(start) < seconds + 2.0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    long references = payload.use_count() - 2;
+
+    std::cout << (uring ? "io_uring" : "epoll") << ": " << kFrames << " vectored frames " << (ok ? "intact" : "BROKEN")
+        << ", " << intact.load() << "/" << kClients * kRequests << " shared payloads of " << (kPayloadSize >> 10)
+        << " KiB intact, " << kClients * kRequests * (kPayloadSize >> 20) / seconds << " MiB/sec, "
+        << references << " references left" << std::endl;
+    ok = ok && intact.load() == kClients * kRequests && references == 0;
+
+    // Closed right after a zero-copy send: the payload still arrives, and its reference is released after.
+    // Only the epoll loop sends with MSG_ZEROCOPY, the io_uring one copies and drops what is queued at a close.
+    if (!uring)
+    {
+        int closing = ConnectLocal(port);
+        bool closed = closing != -1 && send(closing, "x", 1, MSG_NOSIGNAL) == 1
+            && RecvAll(closing, data, kClosingSize) && memcmp(data.data(), payload->data(), kClosingSize) == 0;
+        char byte;
+        closed = closed && recv(closing, &byte, 1, 0) == 0;
+        if (closing != -1) close(closing);
+        start = std::chrono::steady_clock::now();
+        while (payload.use_count() > 2 && SecondsSince(start) < 2.0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::cout << "a payload sent before closing " << (closed ? "arrived" : "DID NOT ARRIVE") << ", "
+            << payload.use_count() - 2 << " references left" << std::endl;
+        ok = ok && closed && payload.use_count() == 2;
+    }
+
+    for (int fd : fds) close(fd);
+    server.Stop();
+    serverThread.join();
+    return ok;
+}
+
+} // namespace
+
+int BenchSend()
+{
+    bool ok = RunBackend(false, 8924);
+    ok = RunBackend(true, 8925) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*
+ * @FilePath: /simtochat/test/src/TimerTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 21:05:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 21:05:37
+ * @Description:
+ *  TimerWheel against a brute force model, the cost of its operations with a million timers,
+ *  and the idle timeout, heartbeat and delayed tasks of both event loops.
+ */
+#include "Bench.h"
+#include "TimerWheel.h"
+#include "UringServer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kTimers = 1000000;
+
+// Random schedules, cancels and jumps of time. Every timer must fire once, on time, and in order.
+bool CheckWheel()
+{
+    const int count = 20000;
+    TimerWheel wheel;
+    std::mt19937_64 rng(2021);
+    std::vector<TimerNode> nodes(count);
+    std::vector<uint64_t> due(count, 0);
+    std::vector<bool> pending(count, false);
+    for (int i = 0; i < count; i++) nodes[i].token = i;
+
+    uint64_t now = 0;
+    long fired = 0, errors = 0;
+    for (int step = 0; step < 100000; step++)
+    {
+        int i = rng() % count;
+        int op = rng() % 10;
+        if (op < 4)
+        {
+            uint64_t spans[] = { 300, 70000, 20000000, 5000000000ull };
+            wheel.Schedule(nodes[i], now + rng() % spans[rng() % 4]);
+            pending[i] = true;
+            due[i] = nodes[i].expire;
+        }
+        else if (op < 5)
+        {
+            if (wheel.Cancel(nodes[i]) != pending[i]) errors++;
+            pending[i] = false;
+        }
+        else
+        {
+            uint64_t target = now + (rng() % 4 == 0 ? rng() % 3000000 : rng() % 500);
+            int64_t timeout = wheel.getTimeout(now);
+            uint64_t last = 0;
+            wheel.Advance(target,
+                [&](TimerNode& node)
+                {
+                    uint64_t k = node.token;
+                    if (!pending[k] || due[k] > target || due[k] < last) errors++;
+                    if (timeout >= 0 && due[k] < now + uint64_t(timeout)) errors++;
+                    last = due[k];
+                    pending[k] = false;
+                    fired++;
+                }
+            );
+            now = target;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (pending[i] && due[i] <= now) errors++;
+    }
+
+    std::cout << "wheel: " << fired << " timers fired, " << errors << " errors" << std::endl;
+    return errors == 0;
+}
+
+// Schedule, move and cancel a million timers, like the idle timers of a million connections.
+void BenchWheel()
+{
+    TimerWheel wheel;
+    std::vector<TimerNode> nodes(kTimers);
+    std::mt19937_64 rng(2021);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kTimers; i++) wheel.Schedule(nodes[i], 30000 + rng() % 30000);
+    double schedule = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kTimers; i++) wheel.Schedule(nodes[i], 60000 + rng() % 30000);
+    double reschedule = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    long fired = 0;
+    wheel.Advance(75000, [&fired](TimerNode&) { fired++; });
+    double advance = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kTimers; i++) wheel.Cancel(nodes[i]);
+    double cancel = SecondsSince(start);
+
+    std::cout << kTimers << " timers: schedule " << schedule / kTimers * 1e9 << " ns, reschedule "
+        << reschedule / kTimers * 1e9 << " ns, cancel " << cancel / kTimers * 1e9 << " ns, advance 75000 ticks "
+        << advance * 1e3 << " ms for " << fired << " expiries" << std::endl;
+}
+
+// Return true if the server closed the connection, skipping the heartbeats it sent.
+bool isClosed(int fd)
+{
+    char chunk[256];
+    while (true)
+    {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n > 0) continue;
+        return n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+}
+
+// Wait until the server closes the connection, or the limit. Return the seconds waited.
+double WaitClosed(int fd, double limit)
+{
+    auto start = std::chrono::steady_clock::now();
+    while (!isClosed(fd) && SecondsSince(start) < limit)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return SecondsSince(start);
+}
+
+// An idle client is closed after the timeout, an active one is kept and gets its heartbeats.
+bool CheckServer(bool uring, int port)
+{
+    std::atomic<int> heartbeats{ 0 };
+    std::atomic<int> delayed{ 0 };
+
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setIdleTimeout(std::chrono::milliseconds(300));
+    server.setHeartbeat(std::chrono::milliseconds(100),
+        [&heartbeats](Socket& client)
+        {
+            heartbeats++;
+            client.Send("h", 1);
+        }
+    );
+    server.setProcessor(
+        [&delayed](Socket& client)
+        {
+            client.getInput().RetrieveAll();
+
+            // A delayed task, and one cancelled before it is due.
+            EventLoop* loop = client.getLoop();
+            loop->RunAfter(std::chrono::milliseconds(50), [&delayed] { delayed++; });
+            uint64_t id = loop->RunAfter(std::chrono::milliseconds(50), [&delayed] { delayed += 100; });
+            loop->Cancel(id);
+        }
+    );
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    int idle = ConnectLocal(port);
+    int active = ConnectLocal(port);
+    bool idleEarly = false;
+    auto lastInput = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++)
+    {
+        lastInput = std::chrono::steady_clock::now();
+        send(active, "a", 1, MSG_NOSIGNAL);
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        if (i == 3) idleEarly = isClosed(idle);
+    }
+    bool idleClosed = isClosed(idle);
+    bool activeClosed = isClosed(active);
+    WaitClosed(active, 2.0);
+    double activeAfter = SecondsSince(lastInput);
+
+    std::cout << (uring ? "io_uring" : "epoll") << ": idle client closed after 300 ms: " << idleClosed
+        << ", active client closed " << activeAfter * 1e3 << " ms after its last input, "
+        << heartbeats.load() << " heartbeats, " << delayed.load() << " delayed tasks" << std::endl;
+
+    bool ok = !idleEarly && idleClosed && !activeClosed && activeAfter > 0.25 && activeAfter < 0.7
+        && heartbeats.load() >= 8 && delayed.load() == 10;
+    close(idle);
+    close(active);
+
+    server.Stop();
+    serverThread.join();
+    return ok;
+}
+
+} // namespace
+
+int TestTimer()
+{
+    bool ok = CheckWheel();
+    BenchWheel();
+    ok = CheckServer(false, 8920) && ok;
+    ok = CheckServer(true, 8921) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/*
+ * @FilePath: /simtochat/test/src/TraceTest.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 10:24:05
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 10:24:05
+ * @Description:
+ *  Spans of sampled requests from several threads, a ring which wraps, and the cost of the scopes.
+ */
+#include "Bench.h"
+#include "Trace.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+// About 100 ns of work which the compiler can not drop.
+static uint64_t Work(uint64_t seed)
+{
+    for (int i = 0; i < 64; i++) seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return seed;
+}
+
+[[maybe_unused]] static uint64_t Untraced(uint64_t seed)
+{
+    return Work(Work(seed));
+}
+
+[[maybe_unused]] static uint64_t Traced(uint64_t seed)
+{
+    TRACE_REQUEST("test.request");
+    {
+        TRACE_SCOPE("test.parse");
+        seed = Work(seed);
+    }
+    TRACE_SCOPE("test.handle");
+    return Work(seed);
+}
+
+// Seconds to run a function the given number of times, the best of a few runs.
+template<class F>
+static double Time(F f, int count, uint64_t& sink)
+{
+    double best = 1e9;
+    for (int run = 0; run < 5; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) sink = f(sink);
+        best = std::min(best, SecondsSince(start));
+    }
+    return best;
+}
+
+int TestTrace()
+{
+#ifndef SIMTOCHAT_TRACE
+    std::cout << "tracing is compiled out" << std::endl;
+    return 0;
+#else
+    long errors = 0;
+    uint64_t sink = 1;
+
+    // Every request sampled, from threads which have all exited when the spans are collected.
+    Tracer::setSampling(1);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++)
+    {
+        threads.emplace_back([] { uint64_t seed = 1; for (int i = 0; i < 100; i++) seed = Traced(seed); });
+    }
+    for (auto& thread : threads) thread.join();
+    std::vector<TraceEvent> events = Tracer::Collect();
+
+    // A request holds its two spans in time, and they carry its ID.
+    std::map<uint64_t, std::vector<TraceEvent>> requests;
+    for (const TraceEvent& event : events) requests[event.request].push_back(event);
+    if (events.size() != 3 * 100 * 3 || requests.size() != 300 || requests.count(0)) errors++;
+    for (auto& request : requests)
+    {
+        const TraceEvent* root = nullptr;
+        for (const TraceEvent& event : request.second) if (!strcmp(event.name, "test.request")) root = &event;
+        if (!root || request.second.size() != 3) { errors++; continue; }
+        for (const TraceEvent& event : request.second)
+        {
+            if (event.start < root->start || event.end > root->end || event.thread != root->thread) errors++;
+        }
+    }
+
+    // One request in a hundred.
+    Tracer::setSampling(0.01);
+    std::thread([&sink] { for (int i = 0; i < 10000; i++) sink = Traced(sink); }).join();
+    size_t sampled = Tracer::Collect().size() - events.size();
+    if (Tracer::getPeriod() != 100 || sampled != 100 * 3) errors++;
+
+    // A wrapped ring keeps the latest spans, but for the slot a writer may be in.
+    Tracer::setSampling(1);
+    uint64_t last = 0;
+    std::thread(
+        [&last]
+        {
+            for (int i = 0; i < TRACE_RING_EVENTS; i++) Traced(i);
+            TRACE_REQUEST("test.last");
+            last = Metrics::Now();
+        }
+    ).join();
+    events = Tracer::Collect();
+    std::map<uint32_t, size_t> perThread;
+    for (const TraceEvent& event : events) perThread[event.thread]++;
+    if (events.empty() || strcmp(events.back().name, "test.last") != 0 || events.back().start > last
+        || perThread[events.back().thread] != TRACE_RING_EVENTS - 1) errors++;
+
+    // The Chrome trace.
+    const char* path = "trace-test.json";
+    if (!Tracer::Export(path)) errors++;
+    std::ifstream file(path);
+    std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (json.find("\"traceEvents\":[") == std::string::npos) errors++;
+    if (json.find("\"name\":\"test.last\",\"ph\":\"X\"") == std::string::npos || json.find("]}") == std::string::npos) errors++;
+    remove(path);
+
+    // The cost of a request with two spans, off and at 1 %.
+    const int count = 2000000;
+    double plain = Time(Untraced, count, sink);
+    Tracer::setSampling(0);
+    double off = Time(Traced, count, sink);
+    Tracer::setSampling(0.01);
+    double onePercent = Time(Traced, count, sink);
+    Tracer::setSampling(0);
+
+    printf("%zu spans of %zu requests from 3 threads, %zu spans at 1 %%\n", size_t(3 * 100 * 3), requests.size(), sampled);
+    printf("%.1f ns per request untraced, %+.2f %% with tracing off, %+.2f %% at 1 %% (sink %llu)\n",
+        plain * 1e9 / count, (off / plain - 1) * 100, (onePercent / plain - 1) * 100, (unsigned long long)(sink & 1));
+    std::cout << errors << " errors" << std::endl;
+    if (errors == 0) std::cout << "passed" << std::endl;
+    else std::cerr << "FAILED" << std::endl;
+    return errors == 0 ? 0 : 1;
+#endif
+}
@@ -0,0 +1,260 @@
+/*
+ * @FilePath: /simtochat/test/src/UringBench.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 20:14:09
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 20:14:09
+ * @Description:
+ *  Echo round trips through the epoll and the io_uring loops on loopback,
+ *  and a large echo which pauses the reading of the server at its high-water mark.
+ *  A client whose input is never processed is closed at the maximum input size.
+ */
+#include "Bench.h"
+#include "UringServer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace
+{
+
+const int kConnections = 32;
+const int kMessages = 200000;
+const int kMessageSize = 64;
+const size_t kLargeSize = 8 << 20;
+const size_t kHighWaterMark = 64 << 10;
+const size_t kMaxInputSize = 256 << 10;
+
+// Every connection has one message in flight, sent again as soon as its echo is back.
+bool BenchRoundTrips(int port)
+{
+    char message[kMessageSize];
+    memset(message, 'm', sizeof(message));
+
+    std::vector<int> fds;
+    for (int i = 0; i < kConnections; i++)
+    {
+        int fd = ConnectLocal(port);
+        if (fd == -1) break;
+        fds.push_back(fd);
+    }
+    if (fds.size() != kConnections)
+    {
+        for (int fd : fds) close(fd);
+        std::cerr << "FAILED: could not connect to port " << port << std::endl;
+        return false;
+    }
+    std::vector<pollfd> polls;
+    std::vector<size_t> received(kConnections, 0);
+    std::vector<std::chrono::steady_clock::time_point> sentAt(kConnections);
+    std::vector<double> latencies;
+    latencies.reserve(kMessages);
+
+    auto start = std::chrono::steady_clock::now();
+    int sent = 0;
+    for (int conn = 0; conn < kConnections; conn++)
+    {
+        polls.push_back(pollfd{ fds[conn], POLLIN, 0 });
+        sentAt[conn] = std::chrono::steady_clock::now();
+        send(fds[conn], message, sizeof(message), MSG_NOSIGNAL);
+        sent++;
+    }
+
+    char chunk[4096];
+    while (latencies.size() < size_t(kMessages))
+    {
+        if (poll(polls.data(), polls.size(), 3000) <= 0) break;
+        for (int conn = 0; conn < kConnections; conn++)
+        {
+            if (!(polls[conn].revents & POLLIN)) continue;
+            ssize_t n = recv(fds[conn], chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n <= 0) continue;
+            received[conn] += n;
+            if (received[conn] < sizeof(message)) continue;
+
+            received[conn] -= sizeof(message);
+            auto now = std::chrono::steady_clock::now();
+            latencies.push_back(std::chrono::duration<double, std::micro>(now - sentAt[conn]).count());
+            if (sent < kMessages)
+            {
+                sentAt[conn] = now;
+                send(fds[conn], message, sizeof(message), MSG_NOSIGNAL);
+                sent++;
+            }
+        }
+    }
+    double seconds = SecondsSince(start);
+    for (int fd : fds) close(fd);
+
+    if (latencies.size() != size_t(kMessages))
+    {
+        std::cerr << "FAILED: " << latencies.size() << "/" << kMessages << " echoed" << std::endl;
+        return false;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << kConnections << " connections: " << kMessages / seconds / 1e3 << " k round trips/sec, p50 "
+        << latencies[latencies.size() / 2] << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us" << std::endl;
+    return true;
+}
+
+// Write much more than the high-water mark before reading anything back.
+bool CheckLargeEcho(int port)
+{
+    int fd = ConnectLocal(port);
+    if (fd == -1) return false;
+
+    std::string data(kLargeSize, '\0');
+    for (size_t i = 0; i < data.size(); i++) data[i] = char(i * 131 + i / 4096);
+
+    std::thread writer(
+        [fd, &data] {
+            size_t sent = 0;
+            while (sent < data.size())
+            {
+                ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) return;
+                sent += n;
+            }
+        }
+    );
+
+    // Read slowly at first, so the output of the server passes the high-water mark.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::string echo;
+    char chunk[65536];
+    while (echo.size() < data.size())
+    {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        echo.append(chunk, n);
+    }
+    writer.join();
+    close(fd);
+
+    if (echo != data)
+    {
+        std::cerr << "FAILED: " << echo.size() << "/" << data.size() << " bytes echoed intact" << std::endl;
+        return false;
+    }
+    std::cout << "echoed " << (kLargeSize >> 20) << " MiB past a high-water mark of " << (kHighWaterMark >> 10) << " KiB" << std::endl;
+    return true;
+}
+
+// Reset connections whose echo is still being sent, then check a new connection is echoed intact.
+bool CheckAbortedEcho(int port)
+{
+    std::string data(kHighWaterMark, 'a');
+    for (int i = 0; i < 20; i++)
+    {
+        int fd = ConnectLocal(port);
+        if (fd == -1) return false;
+        send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        linger reset = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(fd);
+    }
+
+    int fd = ConnectLocal(port);
+    if (fd == -1) return false;
+    send(fd, "ping", 4, MSG_NOSIGNAL);
+    char echo[4];
+    timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    bool ok = recv(fd, echo, sizeof(echo), MSG_WAITALL) == 4 && memcmp(echo, "ping", 4) == 0;
+    close(fd);
+    if (!ok) std::cerr << "FAILED: no echo after connections were reset during their sends" << std::endl;
+    return ok;
+}
+
+bool RunBackend(bool uring, int port)
+{
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setLoopCount(1);
+    server.setHighWaterMark(kHighWaterMark);
+    server.setProcessor(
+        [](Socket& client)
+        {
+            Buffer& input = client.getInput();
+            client.Send(input.Peek(), input.getReadableBytes());
+            input.RetrieveAll();
+        }
+    );
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    bool ok = BenchRoundTrips(port);
+    ok = CheckLargeEcho(port) && ok;
+    ok = CheckAbortedEcho(port) && ok;
+
+    server.Stop();
+    serverThread.join();
+    return ok;
+}
+
+// The processor waits for a request which never completes, the server closes the client past the maximum
+// without reading much more than it first.
+bool CheckMaxInput(bool uring, int port)
+{
+    UringServer server;
+    server.setUringEnabled(uring);
+    server.setMaxInputSize(kMaxInputSize);
+    std::atomic<size_t> peak{ 0 };
+    server.setProcessor([&peak](Socket& client) { peak = std::max<size_t>(peak, client.getInput().getReadableBytes()); });
+    std::thread serverThread([&server, port] { server.Run(port); });
+
+    bool ok = false;
+    int fd = ConnectLocal(port);
+    if (fd != -1)
+    {
+        std::string data(kMaxInputSize * 4, 'a');
+        timeval timeout = { 2, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        char byte;
+        ssize_t got = recv(fd, &byte, 1, 0);
+        ok = got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+        close(fd);
+    }
+
+    server.Stop();
+    serverThread.join();
+    if (!ok) std::cerr << "FAILED: a client was not closed past the maximum input size" << std::endl;
+
+    // A read may overshoot by the free space of the buffer and 64 KiB, never by the whole flood.
+    if (peak > 2 * kMaxInputSize + (128 << 10))
+    {
+        std::cerr << "FAILED: " << peak << " bytes of input were buffered past the maximum" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+} // namespace
+
+int BenchUring()
+{
+    std::cout << "epoll: ";
+    bool ok = RunBackend(false, 8918);
+
+    if (!UringLoop::isSupported())
+    {
+        std::cout << "io_uring is not supported by this kernel, UringServer runs the epoll loops" << std::endl;
+    }
+    std::cout << "io_uring: ";
+    ok = RunBackend(true, 8919) && ok;
+    ok = CheckMaxInput(false, 8933) && ok;
+    ok = CheckMaxInput(true, 8934) && ok;
+
+    if (ok) std::cout << "passed" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -7,13 +7,41 @@
  * @Description: 
  */
 #include "ThreadPool.h"
+#include "Bench.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <iostream>
 using namespace std;
 
-int main()
+// Every heap allocation of the test program is counted.
+static std::atomic<long> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    g_allocations++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+long GetAllocationCount()
+{
+    return g_allocations.load();
+}
+
+int TestThreadPool(ThreadPoolMode mode)
 {
-    ThreadPool pool(4);
+    ThreadPool pool(4, mode);
     std::vector< std::future<int> > results;
 
     for(int i = 0; i < 8; ++i) {
@@ -32,4 +60,133 @@ int main()
     std::cout << std::endl;
 
     return 0;
+}
+
+// Micro-tasks committed from outside the pool, like requests handed over by the event loops.
+double BenchExternalTasks(ThreadPoolMode mode, unsigned short threads, int tasks)
+{
+    ThreadPool pool(threads, mode);
+    std::atomic<int> done{ 0 };
+    std::vector< std::future<void> > results;
+    results.reserve(tasks);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < tasks; ++i)
+    {
+        results.emplace_back(pool.commit([&done] { done++; }));
+    }
+    for (auto&& result : results) result.get();
+    return tasks / SecondsSince(start);
+}
+
+// Micro-tasks committed by the tasks themselves, where every worker keeps feeding its own deque.
+double BenchNestedTasks(ThreadPoolMode mode, unsigned short threads, int roots, int children)
+{
+    ThreadPool pool(threads, mode);
+    std::atomic<int> done{ 0 };
+    int total = roots * (children + 1);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < roots; ++i)
+    {
+        pool.commit([&pool, &done, children] {
+            for (int j = 0; j < children; ++j) pool.commit([&done] { done++; });
+            done++;
+        });
+    }
+    while (done.load() < total) std::this_thread::yield();
+    return total / SecondsSince(start);
+}
+
+int BenchThreadPool()
+{
+    const char* names[] = { "shared  ", "stealing" };
+    ThreadPoolMode modes[] = { TPM_SHARED, TPM_STEALING };
+
+    for (unsigned short threads : { 4, 16 })
+    {
+        for (int m = 0; m < 2; ++m)
+        {
+            double external = BenchExternalTasks(modes[m], threads, 500000);
+            double nested = BenchNestedTasks(modes[m], threads, 1000, 500);
+            std::cout << names[m] << " threads=" << threads
+                << ": external " << external / 1e6 << " M tasks/sec"
+                << ", nested " << nested / 1e6 << " M tasks/sec" << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Heap allocations per task of commit() and post() once the pool has warmed up.
+int BenchThreadPoolAllocations()
+{
+    const int kTasks = 100000;
+    const int kWindow = 256;    // Futures in flight at once
+    std::vector< std::future<int> > results(kWindow);
+    std::atomic<int> done{ 0 };
+
+    for (ThreadPoolMode mode : { TPM_SHARED, TPM_STEALING })
+    {
+        ThreadPool pool(4, mode);
+
+        for (int round = 0; round < 2; ++round)
+        {
+            // The first round warms up the queues and the slab, only the second one is counted.
+            long before = g_allocations.load();
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < kTasks; i += kWindow)
+            {
+                for (int j = 0; j < kWindow; ++j) results[j] = pool.commit([j] { return j * j; });
+                for (int j = 0; j < kWindow; ++j) results[j].get();
+            }
+            double commitSeconds = SecondsSince(start);
+            long commitAllocations = g_allocations.load() - before;
+
+            before = g_allocations.load();
+            done = 0;
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < kTasks; ++i) pool.post([&done] { done++; });
+            while (done.load() < kTasks) std::this_thread::yield();
+            double postSeconds = SecondsSince(start);
+            long postAllocations = g_allocations.load() - before;
+
+            if (round == 0) continue;
+            std::cout << (mode == TPM_SHARED ? "shared  " : "stealing")
+                << ": commit " << double(commitAllocations) / kTasks << " allocs/task, "
+                << kTasks / commitSeconds / 1e6 << " M tasks/sec; post "
+                << double(postAllocations) / kTasks << " allocs/task, "
+                << kTasks / postSeconds / 1e6 << " M tasks/sec" << std::endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = argc > 1 ? argv[1] : "threadpool";
+
+    if (!strcmp(name, "threadpool")) return TestThreadPool(TPM_SHARED) || TestThreadPool(TPM_STEALING);
+    if (!strcmp(name, "threadpool-bench")) return BenchThreadPool();
+    if (!strcmp(name, "threadpool-alloc")) return BenchThreadPoolAllocations();
+    if (!strcmp(name, "codec")) return BenchCodec();
+    if (!strcmp(name, "router")) return BenchRouter();
+    if (!strcmp(name, "uring")) return BenchUring();
+    if (!strcmp(name, "timer")) return TestTimer();
+    if (!strcmp(name, "accept")) return BenchAccept();
+    if (!strcmp(name, "send")) return BenchSend();
+    if (!strcmp(name, "broadcast")) return BenchBroadcast();
+    if (!strcmp(name, "channel")) return BenchChannel();
+    if (!strcmp(name, "offline")) return BenchOffline();
+    if (!strcmp(name, "histogram")) return TestHistogram();
+    if (!strcmp(name, "metrics")) return TestMetrics();
+    if (!strcmp(name, "trace")) return TestTrace();
+    if (!strcmp(name, "offload")) return TestOffload();
+    if (!strcmp(name, "coroutine")) return TestCoroutine();
+    if (!strcmp(name, "mysql-pool")) return TestMySQLPool();
+    if (!strcmp(name, "mysql-stmt")) return TestMySQLStatement();
+    if (!strcmp(name, "mysql-stream")) return TestMySQLStream();
+    if (!strcmp(name, "mysql-batch")) return TestMySQLBatch();
+
+    std::cerr << "Usage: " << argv[0] << " [threadpool|threadpool-bench|threadpool-alloc|codec|router|uring|timer|accept|send|broadcast|channel|offline|histogram|metrics|trace|offload|coroutine|mysql-pool|mysql-stmt|mysql-stream|mysql-batch]" << std::endl;
+    return 1;
 }
\ No newline at end of file
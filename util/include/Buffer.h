@@ -0,0 +1,155 @@
+/*
+ * @FilePath: /simtochat/util/include/Buffer.h
+ * @Author: CGL
+ * @Date: 2026-10-17 10:12:31
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 10:12:31
+ * @Description:
+ *  A growable ring buffer used as the input and output buffers of a connection.
+ */
+#ifndef UTIL_INCLUDE_BUFFER_H
+#define UTIL_INCLUDE_BUFFER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * @class Buffer
+ * @author: CGL
+ * @description:
+ *  A byte ring buffer whose capacity is always a power of two and grows on demand.
+ *  Data is appended at the tail and retrieved from the head.
+ *  Peek() returns a contiguous view of all readable bytes, and only rotates the data
+ *  when it happens to wrap around the end of the storage.
+ */
+class Buffer
+{
+public:
+    /**
+     * @author: CGL
+     * @param capacity The initial capacity. It will be rounded up to a power of two.
+     * @description: Create an empty buffer. With 0, nothing is allocated until the first write.
+     */
+    explicit Buffer(size_t capacity = 4096);
+
+    // Steal the storage of another buffer.
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    // Free the storage.
+    virtual ~Buffer();
+
+public:
+    /**
+     * @author: CGL
+     * @return Return the number of bytes which can be read.
+     */
+    size_t getReadableBytes() const;
+
+    /**
+     * @author: CGL
+     * @return Return the number of bytes which can be written without growing.
+     */
+    size_t getWritableBytes() const;
+
+    /**
+     * @author: CGL
+     * @return Return the capacity of the storage.
+     */
+    size_t getCapacity() const;
+
+    /**
+     * @author: CGL
+     * @return Return a contiguous view of all the readable bytes.
+     * @description:
+     *  The view is valid until the next non-const call on this buffer.
+     *  It makes the data contiguous first if it wraps around the storage.
+     */
+    const char* Peek();
+
+    /**
+     * @author: CGL
+     * @param n The number of bytes to discard.
+     * @description: Discard n bytes from the head after they are consumed.
+     */
+    void Retrieve(size_t n);
+
+    /**
+     * @author: CGL
+     * @description: Discard all the readable bytes.
+     */
+    void RetrieveAll();
+
+    /**
+     * @author: CGL
+     * @param n The number of bytes to take.
+     * @return Return the first n bytes as a string.
+     * @description: Copy n bytes from the head into a string and discard them.
+     */
+    std::string RetrieveAsString(size_t n);
+
+    /**
+     * @author: CGL
+     * @param data The data to append.
+     * @param n The number of bytes.
+     * @description: Append n bytes at the tail, growing the storage if it is full.
+     */
+    void Append(const void* data, size_t n);
+
+    /**
+     * @author: CGL
+     * @param vec The pieces of data to append, in order.
+     * @param count The number of pieces.
+     * @description: Append scattered data, growing the storage at most once.
+     */
+    void Append(const iovec* vec, int count);
+
+    /**
+     * @author: CGL
+     * @param n The number of bytes which will be written.
+     * @description: Make sure n bytes can be appended without growing.
+     */
+    void EnsureWritable(size_t n);
+
+    /**
+     * @author: CGL
+     * @param fd The non-blocking file descriptor to read.
+     * @param savedErrno Saves errno if an error occurs.
+     * @param eof Set to true if the peer has closed the connection.
+     * @param limit Stop before EAGAIN once more than this many bytes are readable.
+     * @return Return the number of bytes read, or -1 if an error occurs.
+     * @description:
+     *  Drain the file descriptor with readv until EAGAIN, which is required by edge-triggered epoll.
+     *  Every readv fills the free space of the ring and a stack buffer, so a burst is read
+     *  with few system calls and the ring only grows by what actually arrived.
+     *  Past the limit the caller must consume the buffer and call again, or give up on the file descriptor.
+     */
+    ssize_t ReadFd(int fd, int* savedErrno, bool* eof, size_t limit = SIZE_MAX);
+
+    /**
+     * @author: CGL
+     * @param fd The non-blocking file descriptor to write.
+     * @param savedErrno Saves errno if an error occurs.
+     * @return Return the number of bytes written, or -1 if an error occurs.
+     * @description: Write as much readable data as the socket accepts with one system call.
+     */
+    ssize_t WriteFd(int fd, int* savedErrno);
+
+protected:
+    // Make the readable bytes start at the beginning of a storage of this capacity.
+    void _Relocate(size_t capacity);
+
+protected:
+    char* m_data;
+    size_t m_capacity;      // Always a power of two
+    size_t m_head;          // Read position, grows without wrapping
+    size_t m_tail;          // Write position, grows without wrapping
+};
+
+#endif // !UTIL_INCLUDE_BUFFER_H
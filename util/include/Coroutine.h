@@ -0,0 +1,365 @@
+/*
+ * @FilePath: /simtochat/util/include/Coroutine.h
+ * @Author: CGL
+ * @Date: 2026-10-19 18:40:11
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 18:40:11
+ * @Description:
+ *  Write the handler of a connection as a coroutine which awaits its input, its output and its
+ *  slow work, on the loop of the connection.
+ */
+#ifndef UTIL_INCLUDE_COROUTINE_H
+#define UTIL_INCLUDE_COROUTINE_H
+
+#include "Slab.h"
+#include "Socket.h"
+#include "Task.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+template<class T>
+class CoTask;
+
+/**
+ * @author: CGL
+ * @struct CoPromiseBase
+ * @description:
+ *  What the promises of every CoTask share. The frames come from the SlabPool, so a handler
+ *  awaiting a CoTask costs no malloc. A frame above SLAB_MAX_SIZE falls back to the heap.
+ */
+struct CoPromiseBase
+{
+    static void* operator new(size_t size) { return SlabPool::Allocate(size); }
+    static void operator delete(void* p, size_t size) { SlabPool::Deallocate(p, size); }
+
+    // Lazy: the body starts when the task is awaited or spawned.
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /**
+     * @author: CGL
+     * @struct FinalAwaiter
+     * @description: Go on with the awaiting coroutine, or free the frame of a spawned one.
+     */
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            CoPromiseBase& promise = handle.promise();
+            if (promise.m_detached)
+            {
+                handle.destroy();
+                return std::noop_coroutine();
+            }
+            return promise.m_continuation;
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception()
+    {
+        // Nobody awaits a spawned task to rethrow it.
+        if (m_detached) std::terminate();
+        m_error = std::current_exception();
+    }
+
+    std::coroutine_handle<> m_continuation = std::noop_coroutine();    // The coroutine awaiting this one
+    std::exception_ptr m_error;
+    bool m_detached = false;    // Started by Spawn(), the frame frees itself at the end
+};
+
+template<class T>
+struct CoPromise : CoPromiseBase
+{
+    CoTask<T> get_return_object() noexcept;
+
+    template<class U>
+    void return_value(U&& value) { m_value.emplace(std::forward<U>(value)); }
+
+    T _Result()
+    {
+        if (m_error) std::rethrow_exception(m_error);
+        return std::move(*m_value);
+    }
+
+    std::optional<T> m_value;
+};
+
+template<>
+struct CoPromise<void> : CoPromiseBase
+{
+    CoTask<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void _Result()
+    {
+        if (m_error) std::rethrow_exception(m_error);
+    }
+};
+
+/**
+ * @author: CGL
+ * @class CoTask
+ * @description:
+ *  A coroutine returning T. It starts when awaited, and the awaiting coroutine resumes right
+ *  where it ends, with no trip through the loop. An exception it throws is rethrown to the
+ *  awaiting coroutine. The task owns its frame, so a task dropped before it ends frees it.
+ *  @example
+ *      CoTask<int> Answer() { co_return 42; }
+ *      CoTask<void> Handle() { int answer = co_await Answer(); ... }
+ */
+template<class T = void>
+class CoTask
+{
+public:
+    using promise_type = CoPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    CoTask() : m_handle(nullptr) {}
+    explicit CoTask(Handle handle) : m_handle(handle) {}
+    CoTask(CoTask&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    CoTask& operator=(CoTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    virtual ~CoTask() { if (m_handle) m_handle.destroy(); }
+
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+public:
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().m_continuation = awaiting;
+        return m_handle;
+    }
+
+    T await_resume() { return m_handle.promise()._Result(); }
+
+    /**
+     * @author: CGL
+     * @return Return the frame, which the caller now owns.
+     */
+    Handle Release() { return std::exchange(m_handle, nullptr); }
+
+protected:
+    Handle m_handle;
+};
+
+template<class T>
+CoTask<T> CoPromise<T>::get_return_object() noexcept
+{
+    return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() noexcept
+{
+    return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @author: CGL
+ * @param task The coroutine to start.
+ * @description:
+ *  Run a task until its first suspension, and let it free itself when it ends.
+ *  An exception escaping it terminates the program, like ThreadPool::post().
+ */
+void Spawn(CoTask<void>&& task);
+
+/**
+ * @author: CGL
+ * @class CoSocket
+ * @description:
+ *  A connection seen from its handler. It holds the loop and the serial of the client rather than
+ *  the socket, because the slot is reused once the connection is closed: get() is then nullptr and
+ *  every await returns false. Only use it on the loop of the client, where the handler always resumes.
+ *  One Read() at a time per connection. The payloads read stay valid until the handler awaits again.
+ *  A handler suspended in Offload() when the server stops is never resumed, and its frame is lost.
+ *  @example
+ *      server.setAcceptor([](Socket& client) { Spawn(Handle(CoSocket(client))); });
+ *
+ *      CoTask<void> Handle(CoSocket socket)
+ *      {
+ *          while (co_await socket.Read(4))
+ *          {
+ *              int n = co_await socket.Offload([] { return Query(); });
+ *              if (!co_await socket.Write(&n, sizeof(n))) break;
+ *              socket.get()->getInput().Retrieve(4);
+ *          }
+ *      }
+ */
+class CoSocket
+{
+public:
+    explicit CoSocket(Socket& client);
+
+public:
+    /**
+     * @author: CGL
+     * @return Return the client, or nullptr once it is closed or broken.
+     */
+    Socket* get() const;
+
+    /**
+     * @author: CGL
+     * @return Return the loop of the client.
+     */
+    EventLoop* getLoop() const;
+
+    /**
+     * @author: CGL
+     * @return Return the serial of the client.
+     */
+    uint64_t getSerial() const;
+
+    /**
+     * @author: CGL
+     * @class ReadAwaiter
+     * @description: co_await it for true once the input holds the bytes, false if the connection closed.
+     */
+    class ReadAwaiter
+    {
+    public:
+        ReadAwaiter(const CoSocket& socket, size_t n) : m_socket(socket), m_wanted(n) {}
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle);
+        bool await_resume() const;
+
+    protected:
+        const CoSocket& m_socket;
+        size_t m_wanted;
+    };
+
+    /**
+     * @author: CGL
+     * @param n The number of bytes the input should hold.
+     * @description: Wait until the input buffer has n bytes. It does not retrieve them.
+     */
+    [[nodiscard]] ReadAwaiter Read(size_t n) const { return ReadAwaiter(*this, n); }
+
+    /**
+     * @author: CGL
+     * @class WriteAwaiter
+     * @description: co_await it for true once the bytes are sent or queued, false if the connection closed.
+     */
+    class WriteAwaiter
+    {
+    public:
+        WriteAwaiter(const CoSocket& socket, const void* data, size_t n)
+            : m_socket(socket), m_data(data), m_size(n), m_sent(false) {}
+
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> handle);
+        bool await_resume() const;
+
+    protected:
+        const CoSocket& m_socket;
+        const void* m_data;
+        size_t m_size;
+        bool m_sent;
+    };
+
+    /**
+     * @author: CGL
+     * @param data The bytes to send, copied when awaited.
+     * @param n The number of bytes.
+     * @description:
+     *  Send like Socket::Send(). Above the high-water mark of the server, the handler waits until
+     *  half of the pending output is drained, so a peer which does not read can not grow it forever.
+     */
+    [[nodiscard]] WriteAwaiter Write(const void* data, size_t n) const { return WriteAwaiter(*this, data, n); }
+
+    /**
+     * @author: CGL
+     * @class OffloadAwaiter
+     * @description: co_await it to run work on a worker, and resume on the loop with what it returned.
+     */
+    template<class Work>
+    class OffloadAwaiter
+    {
+    public:
+        using Result = std::invoke_result_t<Work&>;
+
+        OffloadAwaiter(const CoSocket& socket, Work&& work)
+            : m_loop(socket.m_loop), m_serial(socket.m_serial), m_work(std::forward<Work>(work)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            // The awaiter lives in the suspended frame, so the tasks only carry this and the handle.
+            m_loop->_Offload(m_serial, Task(
+                [this, handle]
+                {
+                    try
+                    {
+                        if constexpr (std::is_void_v<Result>) m_work();
+                        else m_result.emplace(m_work());
+                    }
+                    catch (...)
+                    {
+                        m_error = std::current_exception();
+                    }
+                    m_loop->Post(Task([handle] { handle.resume(); }));
+                }
+            ));
+        }
+
+        Result await_resume()
+        {
+            if (m_error) std::rethrow_exception(m_error);
+            if constexpr (!std::is_void_v<Result>) return std::move(*m_result);
+        }
+
+    protected:
+        using Storage = std::conditional_t<std::is_void_v<Result>, bool, Result>;
+
+        EventLoop* m_loop;
+        uint64_t m_serial;
+        std::decay_t<Work> m_work;
+        std::optional<Storage> m_result;
+        std::exception_ptr m_error;
+    };
+
+    /**
+     * @author: CGL
+     * @param work Run on a worker of the server, such as a query to a database. It must not touch the socket.
+     * @return co_await it for what work returned, or the exception it threw.
+     * @description:
+     *  Like Socket::Offload(): the work of one connection runs in order, and without workers right
+     *  away on the loop. The handler always resumes on the loop, even if the connection closed meanwhile.
+     */
+    template<class Work>
+    [[nodiscard]] OffloadAwaiter<Work> Offload(Work&& work) const
+    {
+        return OffloadAwaiter<Work>(*this, std::forward<Work>(work));
+    }
+
+protected:
+    EventLoop* m_loop;
+    uint64_t m_serial;
+};
+
+#endif // !UTIL_INCLUDE_COROUTINE_H
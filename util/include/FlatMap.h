@@ -0,0 +1,237 @@
+/*
+ * @FilePath: /simtochat/util/include/FlatMap.h
+ * @Author: CGL
+ * @Date: 2026-10-17 19:26:51
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 19:26:51
+ * @Description:
+ *  A hash map with open addressing, for the hot lookup tables of the server.
+ */
+#ifndef UTIL_INCLUDE_FLAT_MAP_H
+#define UTIL_INCLUDE_FLAT_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <utility>
+
+/**
+ * @class FlatMap
+ * @author: CGL
+ * @description:
+ *  All the entries live in one power-of-two array and collisions probe the next slots,
+ *  so a lookup usually touches one or two cache lines instead of walking the nodes of std::map.
+ *  The hash is spread with a Fibonacci multiplication, so plain integer hashes work well.
+ *  Erasing shifts the following entries back instead of leaving tombstones.
+ *  Key and Value must be default constructible. Pointers to values are invalidated
+ *  by any insertion which grows the table and by any erasure.
+ */
+template<class Key, class Value, class Hash = std::hash<Key>>
+class FlatMap
+{
+public:
+    /**
+     * @author: CGL
+     * @param count The number of entries to make room for.
+     * @description: Create an empty map.
+     */
+    explicit FlatMap(size_t count = 0)
+        : m_capacity(0), m_shift(64), m_size(0)
+    {
+        Reserve(count);
+    }
+
+    FlatMap(FlatMap&&) = default;
+    FlatMap& operator=(FlatMap&&) = default;
+
+    FlatMap(const FlatMap&) = delete;
+    FlatMap& operator=(const FlatMap&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param key The key to find.
+     * @return Return the value, or nullptr if the key is absent.
+     */
+    Value* Find(const Key& key)
+    {
+        if (m_size == 0) return nullptr;
+        size_t mask = m_capacity - 1;
+        for (size_t i = _Home(key); ; i = (i + 1) & mask)
+        {
+            Slot& slot = m_slots[i];
+            if (!slot.used) return nullptr;
+            if (slot.key == key) return &slot.value;
+        }
+    }
+
+    const Value* Find(const Key& key) const
+    {
+        return const_cast<FlatMap*>(this)->Find(key);
+    }
+
+    /**
+     * @author: CGL
+     * @param key The key to insert.
+     * @param value The value to insert if the key is absent.
+     * @return Return the value of the key, and true if it was inserted.
+     */
+    std::pair<Value*, bool> Insert(const Key& key, Value value)
+    {
+        if ((m_size + 1) * 4 > m_capacity * 3) _Rehash(m_capacity ? m_capacity * 2 : 16);
+
+        size_t mask = m_capacity - 1;
+        for (size_t i = _Home(key); ; i = (i + 1) & mask)
+        {
+            Slot& slot = m_slots[i];
+            if (slot.used)
+            {
+                if (slot.key == key) return std::make_pair(&slot.value, false);
+                continue;
+            }
+            slot.key = key;
+            slot.value = std::move(value);
+            slot.used = true;
+            m_size++;
+            return std::make_pair(&slot.value, true);
+        }
+    }
+
+    /**
+     * @author: CGL
+     * @param key The key to access.
+     * @return Return the value of the key, default constructed if it was absent.
+     */
+    Value& operator[](const Key& key)
+    {
+        return *Insert(key, Value()).first;
+    }
+
+    /**
+     * @author: CGL
+     * @param key The key to erase.
+     * @return Return false if the key was absent.
+     */
+    bool Erase(const Key& key)
+    {
+        if (m_size == 0) return false;
+        size_t mask = m_capacity - 1;
+        size_t hole = _Home(key);
+        while (true)
+        {
+            if (!m_slots[hole].used) return false;
+            if (m_slots[hole].key == key) break;
+            hole = (hole + 1) & mask;
+        }
+
+        // Move back every following entry which would not be found past the hole.
+        for (size_t i = (hole + 1) & mask; m_slots[i].used; i = (i + 1) & mask)
+        {
+            size_t home = _Home(m_slots[i].key);
+            bool reachable = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (reachable) continue;
+            m_slots[hole].key = std::move(m_slots[i].key);
+            m_slots[hole].value = std::move(m_slots[i].value);
+            hole = i;
+        }
+        m_slots[hole].key = Key();
+        m_slots[hole].value = Value();
+        m_slots[hole].used = false;
+        m_size--;
+        return true;
+    }
+
+    /**
+     * @author: CGL
+     * @param f Called with the key and the value of every entry, in no particular order.
+     * @description: Visit the entries. f must not insert or erase.
+     */
+    template<class F>
+    void ForEach(F&& f)
+    {
+        for (size_t i = 0; i < m_capacity; i++)
+        {
+            if (m_slots[i].used) f(static_cast<const Key&>(m_slots[i].key), m_slots[i].value);
+        }
+    }
+
+    /**
+     * @author: CGL
+     * @param count The number of entries to make room for.
+     * @description: Grow the table so that count entries fit without rehashing.
+     */
+    void Reserve(size_t count)
+    {
+        size_t capacity = 16;
+        while (capacity * 3 < count * 4) capacity <<= 1;
+        if (capacity > m_capacity) _Rehash(capacity);
+    }
+
+    /**
+     * @author: CGL
+     * @description: Erase all the entries and keep the memory.
+     */
+    void Clear()
+    {
+        for (size_t i = 0; i < m_capacity; i++) m_slots[i] = Slot();
+        m_size = 0;
+    }
+
+    /**
+     * @author: CGL
+     * @return Return the number of entries.
+     */
+    size_t getSize() const { return m_size; }
+
+    /**
+     * @author: CGL
+     * @return Return the number of slots.
+     */
+    size_t getCapacity() const { return m_capacity; }
+
+protected:
+    struct Slot
+    {
+        Key key = Key();
+        Value value = Value();
+        bool used = false;
+    };
+
+    // The preferred slot of a key: the high bits of the hash times 2^64 / golden ratio.
+    size_t _Home(const Key& key) const
+    {
+        return size_t((uint64_t(Hash()(key)) * 0x9E3779B97F4A7C15ull) >> m_shift);
+    }
+
+    void _Rehash(size_t capacity)
+    {
+        std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+        std::swap(m_slots, slots);
+        size_t old = m_capacity;
+        m_capacity = capacity;
+        m_shift = 64;
+        while (capacity > 1)
+        {
+            capacity >>= 1;
+            m_shift--;
+        }
+
+        size_t mask = m_capacity - 1;
+        for (size_t i = 0; i < old; i++)
+        {
+            if (!slots[i].used) continue;
+            size_t j = _Home(slots[i].key);
+            while (m_slots[j].used) j = (j + 1) & mask;
+            m_slots[j] = std::move(slots[i]);
+        }
+    }
+
+protected:
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_capacity;      // Always a power of two
+    unsigned int m_shift;   // 64 - log2(m_capacity)
+    size_t m_size;
+};
+
+#endif // !UTIL_INCLUDE_FLAT_MAP_H
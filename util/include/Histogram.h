@@ -0,0 +1,92 @@
+/*
+ * @FilePath: /simtochat/util/include/Histogram.h
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ *  A log-bucketed histogram of latencies, in the manner of HdrHistogram.
+ */
+#ifndef UTIL_INCLUDE_HISTOGRAM_H
+#define UTIL_INCLUDE_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define HISTOGRAM_PRECISION     6       // Bits of sub-buckets per power of two, a value is kept within 1/64 of itself
+#define HISTOGRAM_BITS          40      // Values from 2^40 on, about 18 minutes in nanoseconds, share the last bucket
+
+/**
+ * @author: CGL
+ * @class Histogram
+ * @description:
+ *  Values below 2^HISTOGRAM_PRECISION are counted exactly. Above, every power of two is split into
+ *  2^HISTOGRAM_PRECISION buckets, so the relative error is the same from microseconds to seconds
+ *  and recording is a few shifts and an increment. A histogram is meant to be written by one thread:
+ *  keep one per thread and merge them to read the percentiles.
+ */
+class Histogram
+{
+public:
+    Histogram();
+    virtual ~Histogram();
+
+public:
+    /**
+     * @author: CGL
+     * @param value The value to count, such as a latency in nanoseconds.
+     * @param count How many times it was seen.
+     */
+    void Record(uint64_t value, uint64_t count = 1);
+
+    /**
+     * @author: CGL
+     * @param other Add the counts of this histogram.
+     */
+    void Merge(const Histogram& other);
+
+    // Forget every value.
+    void Reset();
+
+    /**
+     * @author: CGL
+     * @param buckets The counts of BUCKETS buckets, laid out like those of a Histogram.
+     * @param min The smallest value counted.
+     * @param max The largest value counted.
+     * @param sum The sum of the values counted.
+     * @description: Add counts kept elsewhere, such as the per-thread copies of Metrics.
+     */
+    void Merge(const uint64_t* buckets, uint64_t min, uint64_t max, double sum);
+
+    /**
+     * @author: CGL
+     * @param percentile From 0 to 100.
+     * @return Return the largest value of the bucket which holds this percentile, at most getMax().
+     */
+    uint64_t getPercentile(double percentile) const;
+
+    uint64_t getCount() const;
+    uint64_t getMin() const;
+    uint64_t getMax() const;
+    double getMean() const;
+
+    // The bucket of a value.
+    static size_t getBucket(uint64_t value);
+
+public:
+    static const size_t BUCKETS = size_t(HISTOGRAM_BITS + 1 - HISTOGRAM_PRECISION) << HISTOGRAM_PRECISION;
+
+protected:
+    // The largest value which falls in a bucket.
+    static uint64_t _Highest(size_t index);
+
+protected:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count;
+    uint64_t m_min;
+    uint64_t m_max;
+    double m_sum;
+};
+
+#endif // !UTIL_INCLUDE_HISTOGRAM_H
@@ -0,0 +1,111 @@
+/*
+ * @FilePath: /simtochat/util/include/Mailbox.h
+ * @Author: CGL
+ * @Date: 2026-10-17 19:26:51
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 19:26:51
+ * @Description:
+ *  A lock-free queue from many producer threads to one consumer thread.
+ */
+#ifndef UTIL_INCLUDE_MAILBOX_H
+#define UTIL_INCLUDE_MAILBOX_H
+
+#include "Slab.h"
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+/**
+ * @class Mailbox
+ * @author: CGL
+ * @description:
+ *  A linked queue where a producer pushes with a single atomic exchange and never waits,
+ *  and the only consumer pops without any atomic read-modify-write.
+ *  The nodes come from SlabPool, so the messages of a steady stream do not touch the heap.
+ *  A push which is still linking its node may be missed by a concurrent pop,
+ *  it is seen by the next one; pair the mailbox with a wakeup that is signaled after Push().
+ *  T must be default constructible and move assignable.
+ */
+template<class T>
+class Mailbox
+{
+public:
+    Mailbox()
+    {
+        Node* stub = _NewNode(T());
+        m_head.store(stub, std::memory_order_relaxed);
+        m_tail = stub;
+    }
+
+    // Destroy the messages which were never popped.
+    ~Mailbox()
+    {
+        while (m_tail)
+        {
+            Node* next = m_tail->next.load(std::memory_order_relaxed);
+            _DeleteNode(m_tail);
+            m_tail = next;
+        }
+    }
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param value The message to queue.
+     * @description: Queue a message. It is safe to call from any thread.
+     */
+    void Push(T&& value)
+    {
+        Node* node = _NewNode(std::move(value));
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @author: CGL
+     * @param value Receive the oldest message.
+     * @return Return false if the mailbox is empty.
+     * @description: Take a message. Only the consumer thread may call it.
+     */
+    bool Pop(T& value)
+    {
+        Node* next = m_tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+
+        // The next node becomes the stub, its message is moved out.
+        value = std::move(next->value);
+        _DeleteNode(m_tail);
+        m_tail = next;
+        return true;
+    }
+
+protected:
+    struct Node
+    {
+        std::atomic<Node*> next;
+        T value;
+
+        explicit Node(T&& v) : next(nullptr), value(std::move(v)) {}
+    };
+
+    static Node* _NewNode(T&& value)
+    {
+        return ::new (SlabPool::Allocate(sizeof(Node))) Node(std::move(value));
+    }
+
+    static void _DeleteNode(Node* node)
+    {
+        node->~Node();
+        SlabPool::Deallocate(node, sizeof(Node));
+    }
+
+protected:
+    alignas(64) std::atomic<Node*> m_head;  // The newest node, exchanged by the producers
+    alignas(64) Node* m_tail;               // The stub before the oldest message, owned by the consumer
+};
+
+#endif // !UTIL_INCLUDE_MAILBOX_H
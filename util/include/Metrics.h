@@ -0,0 +1,195 @@
+/*
+ * @FilePath: /simtochat/util/include/Metrics.h
+ * @Author: CGL
+ * @Date: 2026-10-18 23:11:40
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 23:11:40
+ * @Description:
+ *  Counters, gauges and latency histograms of the process, and a thread which dumps them to a file.
+ */
+#ifndef UTIL_INCLUDE_METRICS_H
+#define UTIL_INCLUDE_METRICS_H
+
+#include "Histogram.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define METRICS_MAX_COUNTERS    64      // Counters of the process at most
+#define METRICS_MAX_HISTOGRAMS  32      // Histograms of the process at most
+#define METRICS_DUMP_INTERVAL   10000   // Milliseconds between two dumps of MetricsDumper
+
+/**
+ * @author: CGL
+ * @struct MetricsSnapshot
+ * @description: The value of every metric at one time, merged over the threads.
+ */
+struct MetricsSnapshot
+{
+    std::vector<std::pair<std::string, uint64_t>> counters;
+    std::vector<std::pair<std::string, int64_t>> gauges;
+    std::vector<std::pair<std::string, Histogram>> histograms;  // In nanoseconds
+};
+
+/**
+ * @author: CGL
+ * @class Metrics
+ * @description:
+ *  A metric is registered once by name, usually into a static, and then updated by its ID.
+ *  Every thread writes into a block of its own, aligned to a cache line: an update is a load and
+ *  a store of a relaxed atomic that no other thread writes, with no lock and no shared cache line.
+ *  A histogram of a thread is only allocated when the thread first records into it.
+ *  Snapshot() sums the blocks of all the threads under the lock of the registry, and the blocks of
+ *  threads which exit are folded into it first, so nothing counted is lost.
+ *  Gauges are read through a function when a snapshot is taken, the hot path never sees them.
+ */
+class Metrics
+{
+public:
+    /**
+     * @author: CGL
+     * @param name The name of the counter, such as "server.accepted".
+     * @return Return its ID, the same one for the same name, or -1 if there are METRICS_MAX_COUNTERS already.
+     */
+    static int RegisterCounter(const std::string& name);
+
+    /**
+     * @author: CGL
+     * @param name The name of the histogram, such as "server.processor".
+     * @return Return its ID, the same one for the same name, or -1 if there are METRICS_MAX_HISTOGRAMS already.
+     */
+    static int RegisterHistogram(const std::string& name);
+
+    /**
+     * @author: CGL
+     * @param name The name of the gauge.
+     * @param read Return the current value. Called by Snapshot() from any thread.
+     * @description: Register or replace a gauge.
+     */
+    static void RegisterGauge(const std::string& name, std::function<int64_t()> read);
+
+    /**
+     * @author: CGL
+     * @param name The name of the gauge.
+     * @description: Remove a gauge, before what its function reads is destroyed.
+     */
+    static void RemoveGauge(const std::string& name);
+
+    /**
+     * @author: CGL
+     * @param counter The ID of the counter. -1 is ignored.
+     * @param n The amount to add.
+     */
+    static void Add(int counter, uint64_t n = 1);
+
+    /**
+     * @author: CGL
+     * @param histogram The ID of the histogram. -1 is ignored.
+     * @param nanoseconds The value to record.
+     */
+    static void Record(int histogram, uint64_t nanoseconds);
+
+    /**
+     * @author: CGL
+     * @return Return the nanoseconds of the steady clock, for the values given to Record().
+     */
+    static uint64_t Now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * @author: CGL
+     * @param counter The ID of the counter.
+     * @return Return the sum of the counter over the threads.
+     */
+    static uint64_t getCounter(int counter);
+
+    /**
+     * @author: CGL
+     * @return Return every metric merged over the threads.
+     */
+    static MetricsSnapshot Snapshot();
+
+    /**
+     * @author: CGL
+     * @param snapshot The metrics to format.
+     * @return Return one line per metric, the histograms in microseconds:
+     *      counter server.accepted 1024
+     *      gauge server.connections 1000
+     *      histogram server.processor count=... mean=... p50=... p90=... p99=... p99.9=... max=...
+     */
+    static std::string Format(const MetricsSnapshot& snapshot);
+};
+
+/**
+ * @author: CGL
+ * @class MetricsTimer
+ * @description: Record the time from its construction to its destruction into a histogram.
+ */
+class MetricsTimer
+{
+public:
+    explicit MetricsTimer(int histogram) : m_histogram(histogram), m_start(Metrics::Now()) {}
+    ~MetricsTimer() { Metrics::Record(m_histogram, Metrics::Now() - m_start); }
+
+    MetricsTimer(const MetricsTimer&) = delete;
+    MetricsTimer& operator=(const MetricsTimer&) = delete;
+
+protected:
+    int m_histogram;
+    uint64_t m_start;
+};
+
+/**
+ * @author: CGL
+ * @class MetricsDumper
+ * @description:
+ *  Write Metrics::Format() of a snapshot to a file every interval, and once more when it is destroyed.
+ *  The text goes to a temporary file renamed over the old one, so a reader never sees half of it.
+ */
+class MetricsDumper
+{
+public:
+    /**
+     * @author: CGL
+     * @param path The file to write.
+     * @param interval The time between two dumps.
+     */
+    explicit MetricsDumper(const std::string& path,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(METRICS_DUMP_INTERVAL));
+
+    virtual ~MetricsDumper();
+
+    MetricsDumper(const MetricsDumper&) = delete;
+    MetricsDumper& operator=(const MetricsDumper&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @return Return false if the file could not be written.
+     */
+    bool Dump();
+
+protected:
+    void _Run();
+
+protected:
+    std::string m_path;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_running;
+    std::thread m_thread;
+};
+
+#endif // !UTIL_INCLUDE_METRICS_H
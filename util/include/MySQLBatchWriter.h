@@ -0,0 +1,198 @@
+/*
+ * @FilePath: /simtochat/util/include/MySQLBatchWriter.h
+ * @Author: CGL
+ * @Date: 2026-10-18 17:20:45
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 17:20:45
+ * @Description:
+ *  Write-behind inserts into a MySQL table: rows are queued in memory and written in batches by a worker.
+ */
+#ifndef UTIL_INCLUDE_MYSQL_BATCH_WRITER_H
+#define UTIL_INCLUDE_MYSQL_BATCH_WRITER_H
+
+#include "MySQLConnectionPool.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define MYSQL_BATCH_ROWS        512                 // The rows of one multi-row INSERT at most
+#define MYSQL_BATCH_DEADLINE    20                  // Milliseconds a row waits before its batch is written at most
+#define MYSQL_BATCH_CAPACITY    (32 * 1024 * 1024)  // The bytes of the queued rows at most, then inserts are refused
+#define MYSQL_BATCH_RETRIES     3                   // Attempts to write a batch before its rows are dropped
+
+/**
+ * @author: CGL
+ * @struct MySQLValue
+ * @description: A value of a column of a row given to MySQLBatchWriter. A string is copied when the row is queued.
+ */
+struct MySQLValue
+{
+    enum Type
+    {
+        MV_NULL,
+        MV_INT,
+        MV_DOUBLE,
+        MV_STRING
+    };
+
+    MySQLValue() : type(MV_NULL), integer(0), real(0), data(nullptr), length(0) {}
+    MySQLValue(double value) : type(MV_DOUBLE), integer(0), real(value), data(nullptr), length(0) {}
+    MySQLValue(const char* value, size_t n) : type(MV_STRING), integer(0), real(0), data(value), length(n) {}
+    MySQLValue(const char* value) : MySQLValue(value, strlen(value)) {}
+    MySQLValue(const std::string& value) : MySQLValue(value.data(), value.size()) {}
+
+    template<class T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    MySQLValue(T value) : type(MV_INT), integer(int64_t(value)), real(0), data(nullptr), length(0) {}
+
+    Type type;
+    int64_t integer;
+    double real;
+    const char* data;
+    size_t length;
+};
+
+/**
+ * @author: CGL
+ * @struct MySQLBatchStats
+ * @description: The counters of a MySQLBatchWriter since it was created.
+ */
+struct MySQLBatchStats
+{
+    uint64_t inserted;      // Rows queued by Insert()
+    uint64_t rejected;      // Rows refused because the queue was full
+    uint64_t written;       // Rows committed
+    uint64_t failed;        // Rows dropped after MYSQL_BATCH_RETRIES failed attempts
+    uint64_t flushes;       // Transactions committed
+    size_t queuedRows;      // Rows waiting in the queue now
+    size_t queuedBytes;
+    double meanLatency;     // Seconds from the oldest row of a flush until its commit, on average
+    double maxLatency;
+    double lastLatency;
+};
+
+/**
+ * @author: CGL
+ * @class MySQLBatchWriter
+ * @description:
+ *  Insert() only appends the row to a queue in memory, so it can be called from an event loop.
+ *  A worker thread takes the whole queue once MYSQL_BATCH_ROWS rows are waiting or the oldest one
+ *  has waited MYSQL_BATCH_DEADLINE milliseconds, and writes it in one transaction with multi-row
+ *  prepared INSERTs. A batch of n rows is split into full statements and powers of two, so only a few
+ *  statements are ever prepared for each connection. The queue is bounded in bytes: when the database
+ *  falls behind, Insert() refuses the row instead of growing without limit, and the caller decides
+ *  whether to drop it or wait. A failed transaction is rolled back and tried again on another connection.
+ *  All the methods are safe to call from any thread.
+ */
+class MySQLBatchWriter
+{
+public:
+    /**
+     * @author: CGL
+     * @param pool The pool to check out connections from, it must outlive the writer.
+     * @param table The table to insert into.
+     * @param columns The columns given by every row, in order.
+     * @param batchRows The rows of one INSERT at most, lowered so that a statement has at most 65535 parameters.
+     * @param deadline The longest time a row waits before the worker writes it.
+     * @param capacity The bytes of the queued rows at most.
+     * @description: Start the worker.
+     */
+    MySQLBatchWriter(
+        MySQLConnectionPool& pool,
+        const std::string& table,
+        const std::vector<std::string>& columns,
+        size_t batchRows = MYSQL_BATCH_ROWS,
+        std::chrono::milliseconds deadline = std::chrono::milliseconds(MYSQL_BATCH_DEADLINE),
+        size_t capacity = MYSQL_BATCH_CAPACITY
+    );
+
+    // Write everything queued, then stop the worker.
+    virtual ~MySQLBatchWriter();
+
+    MySQLBatchWriter(const MySQLBatchWriter&) = delete;
+    MySQLBatchWriter& operator=(const MySQLBatchWriter&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param values A value for every column.
+     * @return Return false if the queue is full or the number of values is wrong. It never blocks.
+     */
+    bool Insert(std::initializer_list<MySQLValue> values);
+
+    /**
+     * @author: CGL
+     * @param values A value for every column.
+     * @param timeout How long to wait for room in the queue.
+     * @return Return false if the queue is still full after the timeout, or the number of values is wrong.
+     */
+    bool Insert(std::initializer_list<MySQLValue> values, std::chrono::milliseconds timeout);
+
+    /**
+     * @author: CGL
+     * @description: Wait until every row queued before is committed or dropped.
+     */
+    void Flush();
+
+    /**
+     * @author: CGL
+     * @return Return the counters and the flush latencies so far.
+     */
+    MySQLBatchStats getStats();
+
+    /**
+     * @author: CGL
+     * @return Return the error of the last failed attempt, or an empty string.
+     */
+    std::string getLastError();
+
+protected:
+    // Queue a row if it fits. m_lock must be held.
+    bool _Push(std::initializer_list<MySQLValue> values, size_t size);
+
+    // The bytes of a row in the queue.
+    static size_t _RowSize(std::initializer_list<MySQLValue> values);
+
+    // Write the queued rows in one transaction. Return false if it failed.
+    bool _Write(const std::vector<char>& rows, size_t count);
+
+    // INSERT ... VALUES (?, ...), ... for this many rows.
+    std::string _InsertSql(size_t rows) const;
+
+    // Take the queue and write it, until the writer is destroyed.
+    void _Run();
+
+protected:
+    MySQLConnectionPool& m_pool;
+    std::string m_table;
+    std::vector<std::string> m_columns;
+    size_t m_batchRows;
+    std::chrono::milliseconds m_deadline;
+    size_t m_capacity;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;         // Wakes the worker
+    std::condition_variable m_space;        // Wakes Insert() with a timeout
+    std::condition_variable m_flushed;      // Wakes Flush()
+    std::vector<char> m_queue;              // The encoded rows
+    std::vector<char> m_spare;              // Swapped with the queue, to keep its capacity
+    size_t m_rows;
+    std::chrono::steady_clock::time_point m_oldest; // When the first row of the queue came
+    uint64_t m_done;                        // Rows committed or dropped
+    int m_waiting;                          // The threads in Flush()
+    bool m_running;
+    MySQLBatchStats m_stats;
+    double m_totalLatency;
+    std::string m_lastError;
+    std::thread m_worker;
+};
+
+#endif // !UTIL_INCLUDE_MYSQL_BATCH_WRITER_H
@@ -0,0 +1,173 @@
+/*
+ * @FilePath: /simtochat/util/include/MySQLConnectionPool.h
+ * @Author: CGL
+ * @Date: 2026-10-17 18:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 18:02:37
+ * @Description:
+ *  A pool of MySQLConnector shared by the threads of the server.
+ */
+#ifndef UTIL_INCLUDE_MYSQL_CONNECTION_POOL_H
+#define UTIL_INCLUDE_MYSQL_CONNECTION_POOL_H
+
+#include "MySQLConnector.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+/**
+ * @author: CGL
+ * @class MySQLConnectionPool
+ * @description:
+ *  Keep between minSize and maxSize connections open, so a request borrows a connection
+ *  instead of paying for the TCP and authentication handshakes.
+ *  A connection is only used by one thread at a time, through a MySQLConnectionPool::Handle.
+ *  It is pinged when it comes back and reconnected if it is broken,
+ *  and one idle for longer than the idle timeout is closed, down to minSize connections.
+ */
+class MySQLConnectionPool
+{
+public:
+    /**
+     * @author: CGL
+     * @class Handle
+     * @description: A borrowed connection which goes back to the pool when the handle is destroyed.
+     */
+    class Handle
+    {
+    public:
+        Handle();
+        Handle(MySQLConnectionPool* pool, std::unique_ptr<MySQLConnector> connector);
+        Handle(Handle&& other);
+        Handle& operator=(Handle&& other);
+        virtual ~Handle();
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+    public:
+        MySQLConnector* operator->() const;
+        MySQLConnector& operator*() const;
+
+        /**
+         * @author: CGL
+         * @return Return true if the handle holds a connection.
+         */
+        explicit operator bool() const;
+
+        /**
+         * @author: CGL
+         * @description: Give the connection back to the pool before the handle is destroyed.
+         */
+        void Release();
+
+    protected:
+        MySQLConnectionPool* m_pool;
+        std::unique_ptr<MySQLConnector> m_connector;
+    };
+
+public:
+    /**
+     * @author: CGL
+     * @param minSize The number of connections kept open even when they are idle.
+     * @param maxSize The largest number of connections open at once.
+     * @param idleTimeout An idle connection above minSize is closed after this time.
+     * @description: Create an empty pool. Call Setup() before checking out.
+     */
+    MySQLConnectionPool(
+        unsigned int minSize = 2,
+        unsigned int maxSize = 16,
+        std::chrono::seconds idleTimeout = std::chrono::seconds(60)
+    );
+
+    // Close all the idle connections. Every handle should have been released.
+    virtual ~MySQLConnectionPool();
+
+    MySQLConnectionPool(const MySQLConnectionPool&) = delete;
+    MySQLConnectionPool& operator=(const MySQLConnectionPool&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param serverIp The IP address of the host to connect to.
+     * @param username MySQL database user.
+     * @param password The password for your user.
+     * @param dbname The name of the database to access.
+     * @param port The port of the host. It should be default if the host is local.
+     * @description: Set the connection configurations and open minSize connections.
+     */
+    virtual void Setup(
+        const std::string& serverIp,
+        const std::string& username,
+        const std::string& password,
+        const std::string& dbname,
+        unsigned int port = 0
+    );
+
+    /**
+     * @author: CGL
+     * @param timeout How long to wait when maxSize connections are all checked out.
+     * @return Return a handle of a live connection.
+     * @description:
+     *  Borrow an idle connection, or open a new one below maxSize.
+     *  A connection idle for longer than the validation interval is pinged first.
+     *  Throw MySQLException if it can not connect or the timeout expires.
+     */
+    Handle Checkout(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+
+    /**
+     * @author: CGL
+     * @return Return the number of open connections, idle or checked out.
+     */
+    unsigned int getSize();
+
+    /**
+     * @author: CGL
+     * @return Return the number of idle connections.
+     */
+    unsigned int getIdleCount();
+
+protected:
+    // Take the connection back from a handle.
+    void _Return(std::unique_ptr<MySQLConnector> connector);
+
+    // Open a new connection with the configurations.
+    std::unique_ptr<MySQLConnector> _Open();
+
+    // Take out the connections idle for too long, to be closed after unlocking. The lock must be held.
+    void _Reap(std::chrono::steady_clock::time_point now, std::vector<std::unique_ptr<MySQLConnector>>& expired);
+
+protected:
+    /**
+     * @author: CGL
+     * @struct IdleConnector
+     * @description: An idle connection and when it became idle.
+     */
+    struct IdleConnector
+    {
+        std::unique_ptr<MySQLConnector> connector;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::string m_serverIp;
+    std::string m_username;
+    std::string m_password;
+    std::string m_dbname;
+    unsigned int m_port;
+
+    unsigned int m_minSize;
+    unsigned int m_maxSize;
+    std::chrono::seconds m_idleTimeout;
+    std::chrono::seconds m_validation;     // Ping on checkout after idle for this long
+
+    std::mutex m_lock;
+    std::condition_variable m_cvReturn;
+    std::vector<IdleConnector> m_idle;      // Used as a stack, the back is the most recently used
+    unsigned int m_size;                    // Open connections, idle or checked out
+};
+
+#endif // !UTIL_INCLUDE_MYSQL_CONNECTION_POOL_H
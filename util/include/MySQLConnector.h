@@ -10,11 +10,15 @@
 #ifndef UTIL_INCLUDE_MYSQL_CONNECTOR_H
 #define UTIL_INCLUDE_MYSQL_CONNECTOR_H
 
+#include <stdint.h>
 #include <string>
 #include <exception>
+#include <memory>
+#include <unordered_map>
 
 struct MYSQL;
 struct MYSQL_RES;
+struct MYSQL_STMT;
 
 /**
  * @author: CGL
@@ -25,22 +29,51 @@ class MySQLException : public std::exception
 {
 public:
     MySQLException();
+
+    /**
+     * @author: CGL
+     * @param msg The error message, usually from mysql_error().
+     * @description: An exception with a custom error message.
+     */
+    MySQLException(const std::string& msg);
+
     virtual ~MySQLException();
 
 public:
     virtual const char* what() const noexcept override;
-    
+
+protected:
+    std::string m_errMsg;
+};
+
+/**
+ * @author: CGL
+ * @enum MySQLResultMode
+ * @description: How the rows of a query are read from the server.
+ */
+enum MySQLResultMode
+{
+    MRM_STORE,      // Read the whole result into client memory before the first row
+    MRM_USE         // Stream the rows one at a time while the cursor moves
 };
 
 /**
  * @author: CGL
  * @class MySQLResultSet
- * @description: A collection of results from a query using MySQLConnector.
+ * @description:
+ *  A collection of results from a query using MySQLConnector.
+ *  In MRM_USE mode only the current row is held in memory, however large the result is,
+ *  but the connection can not run another query until the result is released.
  */
 class MySQLResultSet
 {
 public:
-    MySQLResultSet(MYSQL_RES* mysql_res);
+    /**
+     * @author: CGL
+     * @param mysql_res The result from mysql_store_result() or mysql_use_result().
+     * @param mysql The connection, to report the errors while streaming the rows.
+     */
+    MySQLResultSet(MYSQL_RES* mysql_res, MYSQL* mysql = nullptr);
     virtual ~MySQLResultSet();
 
 public:
@@ -48,6 +81,7 @@ public:
      * @author: CGL
      * @return Return false if there is no next row.
      * @description: Move the cursor down to point to the next row of result data.
+     *  Throw MySQLException if the connection fails while streaming.
      */
     bool NextRow();
 
@@ -66,17 +100,32 @@ public:
      * @description: Get the data for a column of the current row, returned as a string address.
      */
     const char* operator[](unsigned int cols) const;
+
+    /**
+     * @author: CGL
+     * @param cols Specifies the column to be fetched.
+     * @return Return the length in bytes of the column for the current row.
+     * @description: The data may hold '\0' bytes, so its length is not always strlen().
+     */
+    unsigned long getLength(unsigned int cols) const;
+
+    /** Get a column of the current row, converted from its text. A NULL column gives 0 or "". */
+
+    bool isNull(unsigned int cols) const;
+    int64_t getInt(unsigned int cols) const;
+    double getDouble(unsigned int cols) const;
+    std::string getString(unsigned int cols) const;
     
     /**
      * @author: CGL
-     * @description: Release the result resources.
+     * @description: Release the result resources. The rows left of a streamed result are discarded.
      */
     void Release();
 
     /**
      * @author: CGL
      * @return Return the number of result rows.
-     * @description: Get the number of result rows.
+     * @description: Get the number of result rows. In MRM_USE mode, only the rows fetched so far.
      */
     unsigned int getRowsNum() const;
 
@@ -89,7 +138,105 @@ public:
 
 protected:
     MYSQL_RES* m_res;
+    MYSQL* m_mysql;
     char** m_rows;
+    unsigned long* m_lengths;
+};
+
+/**
+ * @author: CGL
+ * @class MySQLStatement
+ * @description:
+ *  A prepared statement with typed parameters and results.
+ *  The SQL is parsed by the server once, then every execution only sends the binary parameters,
+ *  which can never be interpreted as SQL.
+ *  Parameters and columns are indexed from 0. Get one from MySQLConnector::Prepare().
+ */
+class MySQLStatement
+{
+public:
+    /**
+     * @author: CGL
+     * @param mysql The connection to prepare on.
+     * @param sql The SQL with '?' for every parameter.
+     * @description: Prepare the statement. Throw MySQLException if the SQL is invalid.
+     */
+    MySQLStatement(MYSQL* mysql, const std::string& sql);
+
+    // Close the statement handle.
+    virtual ~MySQLStatement();
+
+    MySQLStatement(const MySQLStatement&) = delete;
+    MySQLStatement& operator=(const MySQLStatement&) = delete;
+
+public:
+    /** Bind a value to a parameter. It is kept for the following executions until bound again. */
+
+    void BindInt(unsigned int index, int64_t value);
+    void BindDouble(unsigned int index, double value);
+    void BindString(unsigned int index, const char* data, size_t length);
+    void BindString(unsigned int index, const std::string& value);
+    void BindNull(unsigned int index);
+
+    /**
+     * @author: CGL
+     * @return Return the number of affected rows.
+     * @description: Execute a statement which returns no result set, such as INSERT or UPDATE.
+     */
+    uint64_t Excute();
+
+    /**
+     * @author: CGL
+     * @description: Execute a query, then read the rows with NextRow().
+     * @attention Please call the 'Release()' method to release the result after you use it.
+     */
+    void ExcuteQuery();
+
+    /**
+     * @author: CGL
+     * @return Return false if there is no next row.
+     * @description: Move the cursor down to point to the next row of result data.
+     */
+    bool NextRow();
+
+    /** Get a column of the current row, converted if the column is of another type. */
+
+    bool isNull(unsigned int cols) const;
+    int64_t getInt(unsigned int cols) const;
+    double getDouble(unsigned int cols) const;
+    std::string getString(unsigned int cols) const;
+
+    /**
+     * @author: CGL
+     * @return Return the number of result columns.
+     */
+    unsigned int getFiledsNum() const;
+
+    /**
+     * @author: CGL
+     * @return Return the AUTO_INCREMENT id generated by the last execution.
+     */
+    uint64_t getInsertId() const;
+
+    /**
+     * @author: CGL
+     * @description: Release the result of the last query.
+     */
+    void Release();
+
+protected:
+    // Send the bound parameters and execute.
+    void _Execute();
+
+    // Throw the last error of the statement.
+    void _Throw() const;
+
+protected:
+    // The MYSQL_BIND arrays and the memory they point to.
+    struct Binding;
+
+    MYSQL_STMT* m_stmt;
+    std::unique_ptr<Binding> m_binding;
 };
 
 /**
@@ -138,6 +285,19 @@ public:
      */
     virtual void Close();
 
+    /**
+     * @author: CGL
+     * @return Return true if the connection is alive.
+     * @description: Check the connection with a round trip to the server.
+     */
+    virtual bool Ping();
+
+    /**
+     * @author: CGL
+     * @return Return true if it has connected and not closed since.
+     */
+    bool isConnected() const;
+
     /**
      * @author: CGL
      * @param sql The SQL statement to execute.
@@ -150,12 +310,23 @@ public:
     /**
      * @author: CGL
      * @param query The SQL statement to execute.
+     * @param mode Read the whole result at once, or stream it for large results.
      * @return Return a set of query results.
      * @description: Execute a query SQL statement without any security checks
      *  and return a set of query results.
      * @attention Please call the 'Release()' method to release the result set after you use it.
      */
-    virtual MySQLResultSet ExcuteQuery(const std::string& query);
+    virtual MySQLResultSet ExcuteQuery(const std::string& query, MySQLResultMode mode = MRM_STORE);
+
+    /**
+     * @author: CGL
+     * @param sql The SQL with '?' for every parameter.
+     * @return Return the prepared statement owned by this connection.
+     * @description:
+     *  Prepare a statement, or return the one prepared before with the same SQL.
+     *  The statements are closed with the connection and must not be used after Close().
+     */
+    virtual MySQLStatement& Prepare(const std::string& sql);
 
 protected:
     // Check if it is initialized before initializing it.
@@ -191,6 +362,7 @@ protected:
     MySQLConfig m_config;
     MYSQL* m_mysql;
     MYSQL_RES* m_result;
+    std::unordered_map<std::string, std::unique_ptr<MySQLStatement>> m_statements;
 
     bool m_ready;   // check mark
     bool m_init;    // check mark
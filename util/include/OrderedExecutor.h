@@ -0,0 +1,98 @@
+/*
+ * @FilePath: /simtochat/util/include/OrderedExecutor.h
+ * @Author: CGL
+ * @Date: 2026-10-19 15:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 15:02:37
+ * @Description:
+ *  Run tasks on a ThreadPool one at a time per key, and in parallel across keys.
+ */
+#ifndef UTIL_INCLUDE_ORDERED_EXECUTOR_H
+#define UTIL_INCLUDE_ORDERED_EXECUTOR_H
+
+#include "FlatMap.h"
+#include "Task.h"
+#include "ThreadPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define ORDERED_EXECUTOR_SHARDS 64      // Locks over the keys
+#define ORDERED_EXECUTOR_BATCH  16      // Tasks of one key run before the worker goes back to the pool
+
+/**
+ * @author: CGL
+ * @class OrderedExecutor
+ * @description:
+ *  Every key with queued tasks has a strand: its tasks in order, and one task on the pool which
+ *  runs them one after the other, so the tasks of a key never overlap and start in the order
+ *  they were posted. After ORDERED_EXECUTOR_BATCH tasks the strand goes back to the end of the
+ *  pool, so a busy key can not hold a worker forever. A strand is recycled with its memory when
+ *  its key runs dry, so a steady stream of tasks does not allocate.
+ *  An exception escaping a task is dropped, and the strand goes on with the next task of its key.
+ */
+class OrderedExecutor
+{
+public:
+    /**
+     * @author: CGL
+     * @param threads The number of workers.
+     * @param mode How the pool queues the strands.
+     */
+    explicit OrderedExecutor(unsigned short threads = 4, ThreadPoolMode mode = TPM_SHARED);
+
+    // Stop the workers. The tasks which did not start are dropped.
+    virtual ~OrderedExecutor();
+
+    OrderedExecutor(const OrderedExecutor&) = delete;
+    OrderedExecutor& operator=(const OrderedExecutor&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param key The tasks of the same key run one at a time, in the order they were posted.
+     * @param task The task to run on a worker.
+     * @description: It is safe to call from any thread, and from a task of the same key.
+     */
+    void Post(uint64_t key, Task&& task);
+
+    /**
+     * @author: CGL
+     * @return Return the number of keys with queued or running tasks.
+     */
+    size_t getActiveCount();
+
+protected:
+    /**
+     * @author: CGL
+     * @struct Strand
+     * @description: The tasks of one key, from head on. The vector keeps its memory when recycled.
+     */
+    struct Strand
+    {
+        std::vector<Task> tasks;
+        size_t head = 0;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        FlatMap<uint64_t, Strand*> strands;
+        std::vector<std::unique_ptr<Strand>> owned;     // Every strand of the shard
+        std::vector<Strand*> spare;                     // The strands with no key
+    };
+
+    Shard& _ShardOf(uint64_t key);
+
+    // Run the tasks of a key on a worker, until it is empty or the batch is over.
+    void _Drain(uint64_t key);
+
+protected:
+    Shard m_shards[ORDERED_EXECUTOR_SHARDS];
+    ThreadPool m_pool;      // Last, so the workers stop before the strands go
+};
+
+#endif // !UTIL_INCLUDE_ORDERED_EXECUTOR_H
@@ -0,0 +1,136 @@
+/*
+ * @FilePath: /simtochat/util/include/OutputQueue.h
+ * @Author: CGL
+ * @Date: 2026-10-17 23:20:06
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 23:20:06
+ * @Description:
+ *  The pending output of a connection: copied bytes and references to shared buffers, in order.
+ */
+#ifndef UTIL_INCLUDE_OUTPUT_QUEUE_H
+#define UTIL_INCLUDE_OUTPUT_QUEUE_H
+
+#include "Buffer.h"
+#include "SharedBuffer.h"
+
+#include <sys/uio.h>
+#include <vector>
+
+/**
+ * @class OutputQueue
+ * @author: CGL
+ * @description:
+ *  A Buffer for the bytes which are copied, and between them references to SharedBuffers
+ *  which are sent from where they are. Every reference remembers how many bytes of the Buffer
+ *  go before it, so the stream keeps the order of the appends, and the bytes appended to
+ *  getBuffer() directly go after everything queued so far.
+ *  A reference is released as soon as its last byte is retrieved.
+ */
+class OutputQueue
+{
+public:
+    /**
+     * @author: CGL
+     * @param capacity The initial capacity of the byte buffer, 0 allocates nothing.
+     */
+    explicit OutputQueue(size_t capacity = 0);
+
+    OutputQueue(OutputQueue&& other) noexcept;
+    OutputQueue& operator=(OutputQueue&& other) noexcept;
+
+    OutputQueue(const OutputQueue&) = delete;
+    OutputQueue& operator=(const OutputQueue&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @return Return the buffer of the copied bytes. What is appended to it is sent last.
+     */
+    Buffer& getBuffer() { return m_buffer; }
+
+    /**
+     * @author: CGL
+     * @return Return the number of bytes to send, copied and shared.
+     */
+    size_t getReadableBytes() const { return m_buffer.getReadableBytes() + m_sharedBytes; }
+
+    /**
+     * @author: CGL
+     * @return Return true if a shared buffer is queued.
+     */
+    bool hasShared() const { return m_first < m_segments.size(); }
+
+    /**
+     * @author: CGL
+     * @param data The data to copy at the tail.
+     * @param n The number of bytes.
+     */
+    void Append(const void* data, size_t n) { m_buffer.Append(data, n); }
+
+    /**
+     * @author: CGL
+     * @param vec The pieces of data to copy at the tail.
+     * @param count The number of pieces.
+     */
+    void Append(const iovec* vec, int count) { m_buffer.Append(vec, count); }
+
+    /**
+     * @author: CGL
+     * @param buffer The shared buffer to queue without copying.
+     * @param offset The first byte to send.
+     */
+    void Append(const SharedBuffer& buffer, size_t offset = 0);
+
+    /**
+     * @author: CGL
+     * @param vec Receive the pieces at the head of the queue.
+     * @param max The number of pieces vec can take.
+     * @return Return the number of pieces, 0 if the queue is empty.
+     * @description: The pieces are valid until the next non-const call.
+     */
+    int Gather(iovec* vec, int max);
+
+    /**
+     * @author: CGL
+     * @param n The number of bytes sent.
+     * @description: Discard n bytes from the head and release the shared buffers which are sent.
+     */
+    void Retrieve(size_t n);
+
+    /**
+     * @author: CGL
+     * @description: Discard everything.
+     */
+    void RetrieveAll();
+
+    /**
+     * @author: CGL
+     * @param fd The non-blocking file descriptor to write.
+     * @param savedErrno Saves errno if an error occurs.
+     * @return Return the number of bytes written, or -1 if an error occurs.
+     * @description: Write as much as the socket accepts with one sendmsg.
+     */
+    ssize_t WriteFd(int fd, int* savedErrno);
+
+protected:
+    /**
+     * @author: CGL
+     * @struct Segment
+     * @description: A shared buffer in the queue, after gap bytes of the buffer.
+     */
+    struct Segment
+    {
+        SharedBuffer buffer;
+        size_t offset;      // The next byte to send
+        size_t gap;         // The bytes of m_buffer which go before it
+    };
+
+protected:
+    Buffer m_buffer;
+    std::vector<Segment> m_segments;
+    size_t m_first;         // The first segment not sent yet
+    size_t m_gaps;          // The bytes of m_buffer before the last segment
+    size_t m_sharedBytes;   // The bytes of the segments not sent yet
+};
+
+#endif // !UTIL_INCLUDE_OUTPUT_QUEUE_H
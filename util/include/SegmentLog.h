@@ -0,0 +1,307 @@
+/*
+ * @FilePath: /simtochat/util/include/SegmentLog.h
+ * @Author: CGL
+ * @Date: 2026-10-18 14:36:02
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 14:36:02
+ * @Description:
+ *  An append-only log on the local disk, split into segment files, with an index of the records by key.
+ */
+#ifndef UTIL_INCLUDE_SEGMENT_LOG_H
+#define UTIL_INCLUDE_SEGMENT_LOG_H
+
+#include "FlatMap.h"
+#include "SharedBuffer.h"
+
+#include <sys/uio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SEGMENT_LOG_SIZE        (64 * 1024 * 1024)  // The size of a segment file, preallocated
+#define SEGMENT_LOG_INTERVAL    2                   // Milliseconds between two group commits at most
+#define SEGMENT_LOG_FLUSH_BYTES (1024 * 1024)       // Pending bytes which start a group commit at once
+#define SEGMENT_LOG_BATCH       (256 * 1024)        // The size of the batches returned by Take()
+
+/**
+ * @author: CGL
+ * @class LogException
+ * @description: Describe an error of the files of a SegmentLog.
+ */
+class LogException : public std::exception
+{
+public:
+    LogException();
+
+    /**
+     * @author: CGL
+     * @param msg The error message.
+     */
+    LogException(const std::string& msg);
+
+    /**
+     * @author: CGL
+     * @param errid The errno of the failed call.
+     * @param msg The failed call and its file.
+     */
+    LogException(int errid, const std::string& msg);
+
+    virtual ~LogException();
+
+public:
+    virtual const char* what() const noexcept override;
+
+    /**
+     * @author: CGL
+     * @return Return the errno of the failed call, or 0 without one.
+     */
+    int getErrorId() const;
+
+protected:
+    int m_errid;
+    std::string m_errMsg;
+};
+
+/**
+ * @author: CGL
+ * @class SegmentLog
+ * @description:
+ *  Records are appended under a key, such as the user ID of the receiver of an undelivered message,
+ *  and taken back all at once for that key. Appending only copies the record into memory:
+ *  a committer thread writes what was appended since its last pass with pwrite and makes it durable
+ *  with one fdatasync, every SEGMENT_LOG_INTERVAL milliseconds or as soon as SEGMENT_LOG_FLUSH_BYTES
+ *  are pending, so many appends share one commit. Sync() waits for the commit of everything before it.
+ *  A record is | length: u32 | checksum: u32 | key: u64 | data | padded to 8 bytes. Taking the records
+ *  of a key appends an acknowledgement record instead of rewriting anything. Read() copies them and
+ *  leaves them in the log, and Remove() acknowledges them up to the last one read, so the records
+ *  are only gone once they are delivered. A segment file is deleted once it is the oldest and none
+ *  of its records are pending. When the segments before the last one are mostly records which are gone,
+ *  the committer moves the records pending in the oldest segment to the last one, all the records of a key
+ *  at once so they stay in order, and deletes the oldest segment once the moved records are durable.
+ *  It does not when that would copy more than a segment, until the next segment is started.
+ *  So a key which is never taken does not keep every later segment on the disk. A moved record keeps
+ *  its position for Read() and Remove(). Opening a directory replays
+ *  the segments through the index, and stops at the first torn or corrupted record of each segment.
+ *  The segments are preallocated and mapped, so the records are read from the page cache without a copy
+ *  into a temporary buffer. Take() copies them out of the mappings without the lock, so a large backlog
+ *  does not hold up the appends. All the methods are safe to call from any thread.
+ */
+class SegmentLog
+{
+public:
+    /**
+     * @author: CGL
+     * @param dir The directory of the segment files, created if it is missing.
+     * @param segmentSize The size of a segment file.
+     * @param interval The longest time between an append and its commit.
+     * @description: Recover the records of the existing segments and start a new segment and the committer.
+     *  Throw LogException if the directory or a segment can not be opened.
+     */
+    explicit SegmentLog(const std::string& dir, size_t segmentSize = SEGMENT_LOG_SIZE,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(SEGMENT_LOG_INTERVAL));
+
+    // Commit everything appended, then close the segments.
+    virtual ~SegmentLog();
+
+    SegmentLog(const SegmentLog&) = delete;
+    SegmentLog& operator=(const SegmentLog&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param key The key of the record, not 0.
+     * @param data The bytes of the record.
+     * @param n The number of bytes, at least 1.
+     * @return Return false if the record is empty or larger than a segment, or the log failed to write.
+     */
+    bool Append(uint64_t key, const void* data, size_t n);
+
+    /**
+     * @author: CGL
+     * @param key The key of the record, not 0.
+     * @param vec The pieces of the record, such as a header and a payload.
+     * @param count The number of pieces.
+     * @return Return false if the record is empty or larger than a segment, or the log failed to write.
+     */
+    bool Append(uint64_t key, const iovec* vec, int count);
+
+    /**
+     * @author: CGL
+     * @param key The key of the records.
+     * @param batches Receive the records of the key in the order they were appended, concatenated
+     *  into buffers of about batchSize bytes. A larger record gets a buffer of its own.
+     * @param batchSize The size of the buffers.
+     * @return Return the number of records taken.
+     * @description: Take the records of the key out of the log. They are not returned again, even after reopening.
+     */
+    size_t Take(uint64_t key, std::vector<SharedBuffer>& batches, size_t batchSize = SEGMENT_LOG_BATCH);
+
+    /**
+     * @author: CGL
+     * @param key The key of the records.
+     * @param batches Receive the records of the key after the position, in the order they were appended,
+     *  concatenated into buffers of about batchSize bytes. A larger record gets a buffer of its own.
+     * @param position Receive the position of the last record read, unchanged if there is none.
+     * @param after Read only the records after this position, such as the one of a previous Read(). 0 reads all.
+     * @param batchSize The size of the buffers.
+     * @return Return the number of records read.
+     * @description: Copy the records of the key and leave them in the log, until Remove() is called for them.
+     */
+    size_t Read(uint64_t key, std::vector<SharedBuffer>& batches, uint64_t& position, uint64_t after = 0,
+        size_t batchSize = SEGMENT_LOG_BATCH);
+
+    /**
+     * @author: CGL
+     * @param key The key of the records.
+     * @param position The position returned by Read().
+     * @return Return the number of records removed.
+     * @description: Remove the records of the key up to the position, such as once they are delivered.
+     *  The records appended after it stay. They are not returned again, even after reopening.
+     */
+    size_t Remove(uint64_t key, uint64_t position);
+
+    /**
+     * @author: CGL
+     * @param key The key of the records.
+     * @return Return the number of records of the key.
+     */
+    size_t getCount(uint64_t key);
+
+    /**
+     * @author: CGL
+     * @description: Wait until everything appended so far is on the disk.
+     *  Throw LogException if the committer failed to write.
+     */
+    void Sync();
+
+    /**
+     * @author: CGL
+     * @return Return the number of segment files.
+     */
+    size_t getSegmentCount();
+
+    /**
+     * @author: CGL
+     * @return Return the number of group commits so far.
+     */
+    uint64_t getCommitCount();
+
+protected:
+    // The place of the data of a record.
+    struct Location
+    {
+        uint64_t position;      // Where it was appended, kept when it is moved
+        uint64_t segment;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Segment
+    {
+        uint64_t id;
+        int fd;
+        char* map;
+        size_t mapSize;
+        size_t end;         // The end of the records appended
+        size_t live;        // The records not taken yet
+        uint32_t pins;      // Take() calls copying from the mapping, which keep it
+        uint64_t moved;     // m_appended once its records were moved, it is deleted when they are durable
+    };
+
+    // A record in a mapping, copied without the lock.
+    struct Copy
+    {
+        char* to;
+        const char* from;
+        size_t length;
+    };
+
+    // Records appended and not written yet, at an offset of a segment.
+    struct Chunk
+    {
+        uint64_t segment;
+        size_t offset;
+        std::vector<char> data;
+    };
+
+    // Open or create a segment file and map it.
+    Segment _OpenSegment(uint64_t id, bool create);
+
+    // Read the records of a recovered segment into the index.
+    void _Recover(Segment& segment);
+
+    // Append a record to the chunks, and index it unless it is an acknowledgement or moved records.
+    // m_lock must be held.
+    bool _Append(uint64_t key, const iovec* vec, int count, uint32_t type);
+
+    // The position of a record appended at an offset of a segment: the ID of the segment and the offset.
+    static uint64_t _Position(uint64_t segment, size_t offset);
+
+    // Index the moved records of a key in place of the locations with the same positions. m_lock must be held.
+    void _Replace(uint64_t key, const std::vector<Location>& moved);
+
+    // Move the records of the keys in the oldest segment to the last one, while the segments before the last one
+    // are mostly records which are gone. m_lock must be held.
+    void _Compact();
+
+    // Move all the records of a key to the last segment. Return false if the log failed to write. m_lock must be held.
+    bool _Move(uint64_t key);
+
+    // Copy the records into batches, and pin their segments in pinned. Copies from mappings are left in copies.
+    // m_lock must be held.
+    void _Gather(const Location* locations, size_t count, std::vector<SharedBuffer>& batches, size_t batchSize,
+        std::vector<Copy>& copies, std::vector<uint64_t>& pinned);
+
+    // Copy the records from the mappings, then unpin their segments. m_lock must not be held.
+    void _Finish(const std::vector<Copy>& copies, const std::vector<uint64_t>& pinned);
+
+    // Remove the first count records of the key from the index. m_lock must be held.
+    void _Forget(uint64_t key, std::vector<Location>& locations, size_t count);
+
+    // Return the segment with this ID. m_lock must be held.
+    Segment* _FindSegment(uint64_t id);
+
+    // Return the data of a record in the chunks not written yet, or nullptr. m_lock must be held.
+    const char* _ReadPending(const Location& location);
+
+    // Delete the oldest segments which have nothing pending and are not pinned. m_lock must be held.
+    void _DropSegments();
+
+    // Write and commit the chunks, until the log is destroyed.
+    void _Commit();
+
+    // The path of a segment file.
+    std::string _Path(uint64_t id) const;
+
+protected:
+    std::string m_dir;
+    size_t m_segmentSize;
+    std::chrono::milliseconds m_interval;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;         // Wakes the committer
+    std::condition_variable m_committed;    // Wakes Sync()
+    FlatMap<uint64_t, std::vector<Location>> m_index;
+    std::deque<Segment> m_segments;         // By ID, the last one is appended to
+    std::vector<Chunk> m_pending;           // Appended since the committer took the chunks
+    std::vector<Chunk> m_writing;           // Being written by the committer
+    size_t m_pendingBytes;
+    uint64_t m_liveBytes;                   // The data of the records not taken yet
+    uint64_t m_compactAfter;                // The last segment when the oldest was too costly to move
+    uint64_t m_appended;                    // The bytes appended since opening
+    uint64_t m_durable;                     // The bytes committed since opening
+    uint64_t m_commits;
+    int m_waiting;                          // The threads in Sync()
+    int m_error;                            // The errno of a failed write, the log refuses appends after it
+    bool m_running;
+    std::thread m_committer;
+};
+
+#endif // !UTIL_INCLUDE_SEGMENT_LOG_H
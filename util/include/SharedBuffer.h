@@ -0,0 +1,100 @@
+/*
+ * @FilePath: /simtochat/util/include/SharedBuffer.h
+ * @Author: CGL
+ * @Date: 2026-10-17 23:20:06
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 23:20:06
+ * @Description:
+ *  An immutable reference-counted block of bytes, to send one message to many connections.
+ */
+#ifndef UTIL_INCLUDE_SHARED_BUFFER_H
+#define UTIL_INCLUDE_SHARED_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @class SharedBuffer
+ * @author: CGL
+ * @description:
+ *  A handle to bytes which are written once and then only read, by any number of threads.
+ *  Copying the handle only increments a counter, and the last handle frees the bytes.
+ *  The counter and the bytes are one block from SlabPool, so a message up to SLAB_MAX_SIZE
+ *  costs no heap allocation, and a larger one a single one.
+ *  Fill it through getMutableData() before the first copy, it must not change afterwards.
+ */
+class SharedBuffer
+{
+public:
+    // Create an empty handle.
+    SharedBuffer() noexcept : m_block(nullptr) {}
+
+    /**
+     * @author: CGL
+     * @param size The number of bytes.
+     * @description: Allocate uninitialized bytes, to be filled through getMutableData().
+     */
+    explicit SharedBuffer(size_t size);
+
+    /**
+     * @author: CGL
+     * @param data The bytes to copy.
+     * @param size The number of bytes.
+     */
+    SharedBuffer(const void* data, size_t size);
+
+    SharedBuffer(const SharedBuffer& other) noexcept;
+    SharedBuffer(SharedBuffer&& other) noexcept;
+    SharedBuffer& operator=(const SharedBuffer& other) noexcept;
+    SharedBuffer& operator=(SharedBuffer&& other) noexcept;
+
+    // Release the reference, the last one frees the bytes.
+    ~SharedBuffer();
+
+public:
+    /**
+     * @author: CGL
+     * @return Return the bytes, or nullptr for an empty handle.
+     */
+    const char* getData() const { return m_block ? reinterpret_cast<const char*>(m_block + 1) : nullptr; }
+
+    /**
+     * @author: CGL
+     * @return Return the bytes to fill. Only call it while this is the only handle.
+     */
+    char* getMutableData() { return m_block ? reinterpret_cast<char*>(m_block + 1) : nullptr; }
+
+    /**
+     * @author: CGL
+     * @return Return the number of bytes.
+     */
+    size_t getSize() const { return m_block ? m_block->size : 0; }
+
+    /**
+     * @author: CGL
+     * @return Return the number of handles to the bytes, 0 for an empty handle.
+     */
+    uint32_t getRefCount() const { return m_block ? m_block->refs.load(std::memory_order_acquire) : 0; }
+
+    explicit operator bool() const noexcept { return m_block != nullptr; }
+
+    /**
+     * @author: CGL
+     * @description: Release the reference and become empty.
+     */
+    void Reset() noexcept;
+
+protected:
+    // The header in front of the bytes, max_align_t aligned like the block.
+    struct alignas(16) Block
+    {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+    };
+
+protected:
+    Block* m_block;
+};
+
+#endif // !UTIL_INCLUDE_SHARED_BUFFER_H
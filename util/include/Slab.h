@@ -0,0 +1,83 @@
+/*
+ * @FilePath: /simtochat/util/include/Slab.h
+ * @Author: CGL
+ * @Date: 2026-10-17 16:40:18
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 16:40:18
+ * @Description:
+ *  A process-wide pool of small fixed-size blocks, and an allocator for standard containers on top of it.
+ */
+#ifndef UTIL_INCLUDE_SLAB_H
+#define UTIL_INCLUDE_SLAB_H
+
+#include <stddef.h>
+#include <new>
+
+/**
+ * @class SlabPool
+ * @author: CGL
+ * @description:
+ *  Blocks are grouped in size classes of 64 bytes up to SLAB_MAX_SIZE.
+ *  Every thread keeps a small cache of free blocks per class and only takes the lock of the class
+ *  to refill or flush the cache, so a steady state of allocating and freeing never reaches the heap.
+ *  A block may be freed by another thread than the one which allocated it.
+ *  Larger sizes fall back to operator new.
+ */
+class SlabPool
+{
+public:
+    /**
+     * @author: CGL
+     * @param size The number of bytes.
+     * @return Return a block aligned to alignof(max_align_t).
+     * @description: Allocate a block of at least size bytes.
+     */
+    static void* Allocate(size_t size);
+
+    /**
+     * @author: CGL
+     * @param p The block returned by Allocate().
+     * @param size The size passed to Allocate().
+     * @description: Give the block back to the pool.
+     */
+    static void Deallocate(void* p, size_t size);
+};
+
+// The largest block served by the pool.
+#define SLAB_MAX_SIZE       1024
+
+/**
+ * @class SlabAllocator
+ * @author: CGL
+ * @description: A stateless allocator which takes its memory from SlabPool.
+ */
+template<class T>
+class SlabAllocator
+{
+public:
+    using value_type = T;
+
+    SlabAllocator() noexcept {}
+
+    template<class U>
+    SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        static_assert(alignof(T) <= alignof(max_align_t), "SlabPool does not over-align blocks.");
+        return static_cast<T*>(SlabPool::Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        SlabPool::Deallocate(p, n * sizeof(T));
+    }
+
+    template<class U>
+    bool operator==(const SlabAllocator<U>&) const noexcept { return true; }
+
+    template<class U>
+    bool operator!=(const SlabAllocator<U>&) const noexcept { return false; }
+};
+
+#endif // !UTIL_INCLUDE_SLAB_H
@@ -9,18 +9,35 @@
  *  Socket: TCP socket. -> client  -Provide io interface;
  *  SingleServer: single-thread blocking-io tcp server -It can be extended to multithreading server.
  *  EpollServer: epoll + Reactor
+ *  EventLoop: one reactor of EpollServer, N loops make the multi-reactor model.
+ *  EpollLoop: the epoll implementation of EventLoop.
  */
 #ifndef UTIL_INCLUDE_SOCKET_SERVER_H
 #define UTIL_INCLUDE_SOCKET_SERVER_H
 
+#include "Buffer.h"
+#include "OutputQueue.h"
+#include "SharedBuffer.h"
+#include "Mailbox.h"
+#include "Task.h"
+#include "TimerWheel.h"
+
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
-#include <map>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <exception>
 #include <string>
 #include <functional>
 
+#define SOCKET_ZEROCOPY_MIN     (16 * 1024)     // Smaller payloads are cheaper to copy than to pin
+
 /**
  * @class SocketException
  * @extends std::exception
@@ -92,13 +109,14 @@ protected:
  *  Extract public members and encapsulate them into util base classes.
  *  It also provides the system call after exception handling.
  */
+class EventLoop;
+
 class _SocketUtil
 {
 public:
-    // Create sockaddr_in.
+    // Create a zeroed sockaddr_in without any file descriptor.
     _SocketUtil();
 
-    // Free sockaddr_in.
     virtual ~_SocketUtil();
     
 public:
@@ -151,6 +169,8 @@ protected:
     bool _read(int fd, void* buf, size_t n, int flags);
     bool _write(int fd, const void* buf, size_t n, int flags);
     void _close(int fd);
+    void _setsockopt(int fd, int level, int optname, const void* optval, socklen_t optlen);
+    int _eventfd(unsigned int initval, int flags);
 
     int _epoll_create (int size);
     int _epoll_create1 (int flags);
@@ -158,17 +178,26 @@ protected:
     void _epoll_ctl (int epfd, int op, int fd, struct epoll_event *event);
 
 protected:
-    int m_fd;
-    sockaddr_in* m_addr;
+    int m_fd;               // -1 when there is no file descriptor
+    sockaddr_in m_addr;     // Inline, so a socket does not allocate its address
     socklen_t m_addrLen;
 };
 
 /**
  * @author: CGL
- * @description: Socket stream which connect, read and write data from buffers.
+ * @description:
+ *  Socket stream which connect, read and write data from buffers.
+ *  A client of EpollServer also owns an input and an output buffer:
+ *  the loop drains the socket into the input buffer before calling the processor,
+ *  and flushes the output buffer after the callbacks return.
  */
 class Socket : public _SocketUtil
 {
+    friend class EventLoop;
+    friend class EpollLoop;
+    friend class UringLoop;
+    friend class CoSocket;
+
 public:
     /**
      * @author: CGL
@@ -184,6 +213,13 @@ public:
      */
     Socket(int fd, const sockaddr_in& addr_in);
 
+    // Take over the file descriptor and buffers of another socket.
+    Socket(Socket&& other);
+
+    // A socket owns its file descriptor and can not be copied.
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
     // Default destructor with closing file descriptor.
     virtual ~Socket();
 
@@ -233,6 +269,168 @@ public:
      */
     template<class T>
     bool Write(const T* dist, size_t n);
+
+    /**
+     * @author: CGL
+     * @param data The data to send.
+     * @param n The number of bytes.
+     * @return Return false if the connection is broken.
+     * @description:
+     *  Send data without blocking if the socket belongs to an event loop.
+     *  The bytes which the kernel does not take are queued in the output buffer,
+     *  and the loop sends them when the socket is writable again.
+     *  A standalone socket sends data directly like Write().
+     */
+    bool Send(const void* data, size_t n, bool more = false);
+
+    /**
+     * @author: CGL
+     * @param vec The pieces of data to send, in order.
+     * @param count The number of pieces.
+     * @param more Set MSG_MORE: more data follows at once, so the kernel waits for it instead of
+     *  pushing a partial segment. The last send of a batch of frames should not set it.
+     * @return Return false if the connection is broken.
+     * @description:
+     *  Send scattered data, like a header and a payload, with one sendmsg and no temporary copy.
+     *  What the kernel does not take is queued in the output buffer like Send().
+     */
+    bool Send(const iovec* vec, int count, bool more = false);
+
+    /**
+     * @author: CGL
+     * @param data The data to send. It must not change until owner is released.
+     * @param n The number of bytes.
+     * @param owner Keeps the data alive. It is released when the kernel no longer reads the data.
+     * @return Return false if the connection is broken.
+     * @description:
+     *  Send a large payload with MSG_ZEROCOPY, so the kernel reads the pages of the caller instead of copying them,
+     *  and the same payload can go to many clients without a copy per client.
+     *  The completions are read from the error queue of the socket, which releases owner.
+     *  It copies like Send() below SOCKET_ZEROCOPY_MIN bytes, when output is already queued,
+     *  on a standalone socket or a loop without zero copy, and after the kernel reports it had to copy anyway.
+     */
+    bool SendZeroCopy(const void* data, size_t n, std::shared_ptr<const void> owner);
+
+    /**
+     * @author: CGL
+     * @param buffer The shared message to send.
+     * @param more Only queue it: more messages follow at once, and the loop writes them together
+     *  after the current callback, timer or posted task returns.
+     * @return Return false if the connection is broken.
+     * @description:
+     *  Send a message shared with other connections. What the kernel does not take is queued
+     *  as a reference, not a copy, so a message queued for N connections exists once.
+     */
+    bool Send(const SharedBuffer& buffer, bool more = false);
+
+    /**
+     * @author: CGL
+     * @description:
+     *  Close the connection. A client of an event loop is closed by the loop
+     *  after the current callback, timer or posted task returns, and its pending output is dropped.
+     */
+    void Disconnect();
+
+    /**
+     * @author: CGL
+     * @return Return the input buffer.
+     * @description: Get the bytes received by the event loop and not consumed yet.
+     *  Retrieve the bytes after processing them, a partial message can stay for the next time.
+     */
+    Buffer& getInput();
+
+    /**
+     * @author: CGL
+     * @return Return the output buffer.
+     * @description: Get the bytes to be sent. The event loop writes them after the callbacks
+     *  and whenever the socket is writable again. They go after the shared buffers already queued.
+     */
+    Buffer& getOutput();
+
+    /**
+     * @author: CGL
+     * @return Return the loop which owns this client, or nullptr for a standalone socket.
+     */
+    EventLoop* getLoop() const;
+
+    /**
+     * @author: CGL
+     * @return Return the number given by the loop when it accepted this client.
+     * @description: A file descriptor is reused after closing, the serial tells the connections apart.
+     *  It holds the generation of the slot in the high 32 bits and the file descriptor in the low ones.
+     */
+    uint64_t getSerial() const;
+
+    /**
+     * @author: CGL
+     * @return Return the value set by setContext(), 0 by default.
+     */
+    uint64_t getContext() const;
+
+    /**
+     * @author: CGL
+     * @param context Any value the application wants to keep with the connection, such as a user ID.
+     */
+    void setContext(uint64_t context);
+
+    /**
+     * @author: CGL
+     * @param work Run on a worker of the server, such as a query to a database. It must not touch the socket.
+     * @param done Called with the socket on its loop after work, unless the connection was closed by then.
+     *  If work throws, the connection is disconnected instead.
+     * @description:
+     *  Move slow work off the loop of a client, see EpollServer::setWorkerCount().
+     *  The work of one connection runs one at a time in the order it was offloaded,
+     *  and the work of different connections in parallel. Every done goes back through the mailbox
+     *  of the loop in the same order. Without workers, work runs right away on the loop.
+     *  Only call it on the loop of the client, from a callback or a posted task.
+     */
+    template<class Work, class Done>
+    void Offload(Work&& work, Done&& done);
+
+    /**
+     * @author: CGL
+     * @return Return true if an Offload() of this connection did not call its done yet.
+     *  A request handled on the loop meanwhile would overtake it, offload it too to keep the order.
+     */
+    bool isOffloading() const;
+
+protected:
+    // Take a connection accepted by a loop. The buffers are kept from the previous connection.
+    void _Attach(EventLoop* loop, int fd, const sockaddr_in& addr, uint64_t serial);
+
+    // Close the connection and empty the buffers, so the socket can be attached again.
+    void _Detach();
+
+protected:
+    Buffer m_input;
+    OutputQueue m_output;
+    EventLoop* m_loop;      // The loop which owns this client, nullptr for a standalone socket
+    uint32_t m_watching;    // The events registered to the epoll, or the operations in flight on io_uring
+    bool m_broken;          // Set when a send fails or Disconnect() is called, the loop will close it
+    uint64_t m_serial;
+    uint64_t m_context;
+    TimerNode m_timer;          // The idle and heartbeat timer, armed for the earlier of both
+    uint64_t m_lastActive;      // The tick of the last input
+    uint64_t m_lastHeartbeat;   // The tick of the last heartbeat
+    uint32_t m_offloads;        // Offload() calls whose done did not run yet
+    void* m_reader;             // The coroutine waiting in CoSocket::Read(), resumed instead of the processor
+    size_t m_readWanted;        // The input bytes it waits for
+
+    /**
+     * @author: CGL
+     * @struct ZeroCopySend
+     * @description: A payload sent with MSG_ZEROCOPY, kept until the kernel reports its completion.
+     */
+    struct ZeroCopySend
+    {
+        uint32_t id;        // The counter of the kernel, incremented by every zero-copy send
+        std::shared_ptr<const void> owner;
+    };
+
+    std::vector<ZeroCopySend> m_zeroCopies;
+    uint32_t m_zeroCopyNext;    // The id of the next zero-copy send
+    uint8_t m_zeroCopy;         // SOCKET_ZEROCOPY_* state of the file descriptor
 };
 
 /**
@@ -262,15 +460,337 @@ public:
     virtual Socket Accept();
 };
 
+class EpollServer;
+class OrderedExecutor;
+
+/**
+ * @author: CGL
+ * @struct SocketOptions
+ * @description:
+ *  The options of the listeners of EpollServer. The accepted sockets inherit them from their listener,
+ *  so they cost nothing per connection. A size or a time of 0 keeps the default of the kernel.
+ */
+struct SocketOptions
+{
+    int backlog = SOMAXCONN;    // The accept queue, capped by net.core.somaxconn
+    bool reuseAddr = true;      // SO_REUSEADDR, to restart while old connections are in TIME_WAIT
+    bool noDelay = false;       // TCP_NODELAY, to send small messages without waiting for Nagle
+    int recvBuffer = 0;         // SO_RCVBUF in bytes
+    int sendBuffer = 0;         // SO_SNDBUF in bytes
+    int deferAccept = 0;        // TCP_DEFER_ACCEPT in seconds: accept a connection once its first data arrives
+    int fastOpen = 0;           // TCP_FASTOPEN queue length: take the data of the SYN from a returning client
+};
+
+/**
+ * @class EventLoop
+ * @author: CGL
+ * @description:
+ *  A single reactor owned by EpollServer, the common part of the epoll and the io_uring loops.
+ *  Every loop has its own SO_REUSEPORT listener, clients and mailbox,
+ *  so the kernel spreads new connections over the loops and a client never leaves its loop.
+ *  The clients live in a registry indexed by file descriptor, each slot with a generation
+ *  which tells the successive connections of the same file descriptor apart.
+ *  A TimerWheel drives the idle and heartbeat timers and the delayed tasks, through the timeout
+ *  of the wait for events. A client has one timer which is only moved when it fires,
+ *  so the input of a busy client costs a store of the current tick and no timer update.
+ */
+class EventLoop : public _SocketUtil
+{
+    friend class Socket;
+    friend class CoSocket;
+
+public:
+    /**
+     * @author: CGL
+     * @param server The server which provides callbacks to this loop.
+     * @description: Create a loop without listening.
+     */
+    EventLoop(EpollServer* server);
+
+    // Close the listener and the wakeup file descriptors.
+    virtual ~EventLoop();
+
+public:
+    /**
+     * @author: CGL
+     * @param port The port to listen.
+     * @description: Create a SO_REUSEPORT listener and the resources of this loop.
+     */
+    virtual void Listen(int port) = 0;
+
+    /**
+     * @author: CGL
+     * @description: Dispatch the events on the calling thread until Stop() is called.
+     */
+    virtual void Loop() = 0;
+
+    /**
+     * @author: CGL
+     * @description: Ask the loop to exit. It is safe to call from any thread.
+     */
+    void Stop();
+
+    /**
+     * @author: CGL
+     * @param task The task to run on the thread of this loop.
+     * @description:
+     *  Hand a task over to this loop without any lock. It is safe to call from any thread.
+     *  The loop is only woken up when its mailbox was idle, so a burst of tasks costs one wakeup.
+     *  Tasks which are still queued when the loop is destroyed are dropped.
+     */
+    void Post(Task&& task);
+
+    /**
+     * @author: CGL
+     * @param fd The file descriptor of the client.
+     * @return Return the client, or nullptr if it is not connected to this loop.
+     * @description: Only call it on the thread of this loop, from a callback or a posted task.
+     */
+    Socket* getClient(int fd);
+
+    /**
+     * @author: CGL
+     * @param delay The time to wait, with a resolution of one millisecond.
+     * @param task The task to run on the thread of this loop.
+     * @return Return an ID for Cancel(), never 0.
+     * @description:
+     *  Run a task once after a delay. Only call it on the thread of this loop,
+     *  other threads can Post() a task which calls it.
+     */
+    uint64_t RunAfter(std::chrono::milliseconds delay, Task&& task);
+
+    /**
+     * @author: CGL
+     * @param id The ID returned by RunAfter().
+     * @return Return false if the task already ran or was cancelled.
+     * @description: Cancel a delayed task. Only call it on the thread of this loop.
+     */
+    bool Cancel(uint64_t id);
+
+protected:
+    // Send or queue data for a client of this loop. Return false if the client is broken.
+    virtual bool _Send(Socket& client, const iovec* vec, int count, bool more) = 0;
+
+    // Send a payload without copying it if the backend can. It copies with _Send() by default.
+    virtual bool _SendZeroCopy(Socket& client, const void* data, size_t n, std::shared_ptr<const void>&& owner);
+
+    // Send or queue a reference to a shared buffer, only queue it with more. Return false if the client is broken.
+    virtual bool _SendShared(Socket& client, const SharedBuffer& buffer, bool more) = 0;
+
+    // Create the SO_REUSEPORT listener with the options of the server, and the wakeup eventfd.
+    void _ListenSocket(int port);
+
+    // Accept and close a pending connection, when the process is out of file descriptors. Return false if none was.
+    bool _Shed();
+
+    // Run the tasks posted by other threads.
+    void _RunPosted();
+
+    // Run a task of Socket::Offload() on the workers of the server, in order per client.
+    void _Offload(uint64_t serial, Task&& task);
+
+    // Get a connected client by its serial, or nullptr if it was closed since.
+    Socket* _FindClient(uint64_t serial);
+
+    // Get the bytes a client has yet to send. The backend may hold some besides the output queue.
+    virtual size_t _getPendingOutput(Socket& client);
+
+    // Resume the coroutines of CoSocket::Write() whose client drained to half the high-water mark, or closed.
+    void _ResumeWriters();
+
+    /** The callbacks and settings of the server. */
+
+    void _Accepted(Socket& client);
+    void _Received(Socket& client);
+    size_t _getHighWaterMark() const;
+    size_t _getMaxInputSize() const;
+
+    /** The metrics of the loops: the bytes moved, and the time to handle one batch of events. */
+
+    static void _CountReceived(size_t bytes);
+    static void _CountSent(size_t bytes);
+    static void _Dispatched(size_t events, uint64_t start);
+
+    /**
+     * @author: CGL
+     * @struct ClientSlot
+     * @description: The place of a client in the registry, indexed by its file descriptor.
+     */
+    struct ClientSlot
+    {
+        Socket socket;
+        uint32_t generation = 0;    // Incremented on every accept, 0 is never used by a client
+        bool used = false;
+    };
+
+    // Get the slot of a file descriptor, adding a page of slots if needed.
+    ClientSlot& _GetSlot(int fd);
+
+    // Get the slot of a file descriptor, or nullptr if it is beyond the pages.
+    ClientSlot* _FindSlot(int fd);
+
+    // Take the slot of an accepted file descriptor and attach its socket to this loop.
+    ClientSlot& _OpenClient(int fd, const sockaddr_in& addr);
+
+    // Call the closer and close the client.
+    void _CloseClient(ClientSlot& slot);
+
+    // Close a client from outside of its events. The backend may have operations to stop first.
+    virtual void _Close(ClientSlot& slot);
+
+    // Take the file descriptor of a client which is closing, so _Detach() does not close it. Return false to let it.
+    virtual bool _Retire(Socket& client);
+
+    /** The timers, in ticks of one millisecond since the loop was created. */
+
+    // Read the clock into m_now.
+    void _UpdateClock();
+
+    // Run the timers which expired up to m_now, then close the clients they disconnected.
+    void _RunTimers();
+
+    // Get the milliseconds to wait for events, -1 if no timer is pending.
+    int _getTimeout() const;
+
+    void _Expired(TimerNode& node);
+
+    // Close an idle client or send its heartbeat, then arm its timer again.
+    void _ClientTimer(ClientSlot& slot);
+
+    // Arm the timer of a client for the earlier of its idle and heartbeat deadlines.
+    void _ScheduleClient(Socket& client);
+
+    // Close the clients disconnected outside of their own callbacks.
+    void _CloseBroken();
+
+    // Close all the clients when the loop exits.
+    void _CloseAll();
+
+    // Return true if a client is still open, such as one whose close waits for an operation in flight.
+    bool _HasClients();
+
+protected:
+    EpollServer* m_server;
+    std::atomic<bool> m_running;
+    int m_wakeupfd;                 // eventfd to wake up the loop from other threads
+    int m_sparefd;                  // Reserved for _Shed()
+    std::vector<std::unique_ptr<ClientSlot[]>> m_slots;    // Pages of slots, which never move
+    Mailbox<Task> m_mailbox;
+    std::atomic<bool> m_signaled;   // The wakeup was written and the mailbox is not drained yet
+
+    /**
+     * @author: CGL
+     * @struct TimerTask
+     * @description: A task of RunAfter(), in pages of slots like the clients.
+     */
+    struct TimerTask
+    {
+        TimerNode node;
+        Task task;
+        uint32_t generation = 0;    // Incremented on every use, so a stale ID can not cancel a new task
+    };
+
+    TimerWheel m_wheel;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_now;                 // The tick of the last _UpdateClock()
+    std::vector<std::unique_ptr<TimerTask[]>> m_timerTasks;
+    std::vector<uint32_t> m_freeTimerTasks;
+    std::vector<uint64_t> m_closing;    // Serials of the clients disconnected by Disconnect()
+
+    // The coroutines waiting in CoSocket::Write(), with the serials of their clients.
+    std::vector<std::pair<uint64_t, void*>> m_writers;
+    std::vector<std::pair<uint64_t, void*>> m_resuming;     // Swapped with m_writers, both keep their memory
+};
+
+/**
+ * @class EpollLoop
+ * @author: CGL
+ * @description:
+ *  The edge-triggered epoll reactor. The epoll_event::data.u64 of a client is its serial,
+ *  so dispatching an event is an index into the registry.
+ */
+class EpollLoop : public EventLoop
+{
+public:
+    EpollLoop(EpollServer* server);
+
+    // Close the epoll file descriptor.
+    virtual ~EpollLoop();
+
+public:
+    virtual void Listen(int port) override;
+    virtual void Loop() override;
+
+protected:
+    virtual bool _Send(Socket& client, const iovec* vec, int count, bool more) override;
+    virtual bool _SendZeroCopy(Socket& client, const void* data, size_t n, std::shared_ptr<const void>&& owner) override;
+    virtual bool _SendShared(Socket& client, const SharedBuffer& buffer, bool more) override;
+
+    // Write the output of a client after the current batch of events, tasks or timers.
+    void _MarkDirty(Socket& client);
+
+    // Write the output of the clients marked dirty, and close the broken ones.
+    void _ProcessDirty();
+
+    // Release the zero-copy payloads whose completions are on the error queue of the client.
+    void _ReapZeroCopy(Socket& client);
+
+    // Release the zero-copy payloads whose completions are on the error queue of a file descriptor.
+    // Return true if the kernel copied them anyway.
+    static bool _ReapZeroCopy(int fd, std::vector<Socket::ZeroCopySend>& sends);
+
+    // Keep a closing client with zero-copy sends in flight until their completions, the kernel still reads the payloads.
+    virtual bool _Retire(Socket& client) override;
+
+    // Reap the completions of a retired file descriptor, and close it after the last one.
+    void _ReapRetired(int fd);
+
+    // Add a file descriptor need to listen on. The token comes back in epoll_event::data.u64.
+    void addfd(int epfd, int fd, bool enable_et, uint64_t token);
+
+    // Accept every pending connection, since the edge-triggered listener is not signaled again for them.
+    void _HandleAccept();
+
+    // Handle the events of a client. Return false if the client should be closed.
+    bool _HandleEvent(Socket& client, uint32_t events);
+
+    // Drain a readable client into its input buffer and call the processor.
+    // Return false if the client should be closed, also when its input exceeds the maximum.
+    bool _HandleRead(Socket& client);
+
+    // Write the output buffer of a client. Return false if the client is broken.
+    bool _Flush(Socket& client);
+
+    // Register EPOLLOUT only while output is pending, and pause reading above the high-water mark.
+    bool _UpdateEvents(Socket& client);
+
+protected:
+    int m_epfd;
+    epoll_event m_events[128];      // Epoll size default = 128
+    std::vector<uint64_t> m_dirty;  // Serials of the clients to write before waiting again
+
+    // A closed client whose zero-copy sends are in flight. Its file descriptor stays open and watched for EPOLLERR.
+    struct Retired
+    {
+        int fd;
+        std::vector<Socket::ZeroCopySend> sends;
+    };
+
+    std::vector<Retired> m_retired;
+};
+
 /**
  * @class EpollServer
  * @author: CGL
  * @description:
- *  The default single-threaded non-blocking server based on Epoll.
- *  Provide Acceptor and Processor callbacks. It can be extended into the Reactor model.
+ *  The non-blocking server based on Epoll + Reactor.
+ *  Provide Acceptor and Processor callbacks. By default it runs one single-threaded loop,
+ *  and setLoopCount() turns it into the multi-reactor model with one loop per thread.
  */
-class EpollServer : public _SocketUtil
+class EpollServer
 {
+    friend class EventLoop;
+
 public:
     /**
      * @author: CGL
@@ -278,7 +798,7 @@ public:
      */
     EpollServer();
 
-    // Auto close the file descriptor.
+    // Stop and wait for all the loops.
     virtual ~EpollServer();
 
 public:
@@ -287,40 +807,155 @@ public:
      * @param port The port to listen.
      * @description:
      *  Startup the server on this port.
-     *  It will run with a loop. You could set callbacks to process the events.
+     *  The first loop runs on the calling thread and the others run on their own threads.
+     *  It returns after Stop() is called, and rethrows the first exception from any loop.
      */
     virtual void Run(int port);
 
+    /**
+     * @author: CGL
+     * @description: Stop all the loops. It is safe to call from any thread.
+     */
+    virtual void Stop();
+
+    /**
+     * @author: CGL
+     * @param count The number of event loops. 0 means one loop per core.
+     * @description: Setup the number of event loops. It should be called before Run().
+     */
+    void setLoopCount(unsigned short count);
+
+    /**
+     * @author: CGL
+     * @param bytes The high-water mark of the pending output of a client. Default is 4 MiB.
+     * @description:
+     *  Stop reading from a client whose pending output exceeds the mark,
+     *  and resume after half of it is sent, so a slow consumer can not make the server buffer forever.
+     */
+    void setHighWaterMark(size_t bytes);
+
+    /**
+     * @author: CGL
+     * @param bytes The most input a client may have that the processor did not retrieve. Default is 4 MiB.
+     * @description:
+     *  Close a client whose input buffer exceeds it, such as one sending faster than it is processed
+     *  or a request larger than any the processor accepts, so one client can not grow its buffer forever.
+     */
+    void setMaxInputSize(size_t bytes);
+
     /**
      * @author: CGL
      * @param acceptor The callback will active when new client connect.
-     * @description: Setup the acceptor callback.
+     * @description:
+     *  Setup the acceptor callback.
+     *  With more than one loop it is called concurrently from different threads.
      */
     void setAcceptor(std::function<void(Socket&)> acceptor);
 
     /**
      * @author: CGL
      * @param processor The callback will active when new messages arrived except for new client.
-     * @description: Setup the processor callback.
+     * @description:
+     *  Setup the processor callback.
+     *  With more than one loop it is called concurrently from different threads.
      */
     void setProcessor(std::function<void(Socket&)> processor);
 
-protected:
-    // Set the file descriptor to non-blocking.
-    void setnonblocking(int fd);
+    /**
+     * @author: CGL
+     * @param closer The callback will active just before a client is closed.
+     * @description:
+     *  Setup the closer callback. It is called on the loop of the client,
+     *  whether the peer, an error, Disconnect() or stopping the server closes it.
+     */
+    void setCloser(std::function<void(Socket&)> closer);
 
-    // Add a file descriptor need to listen on.
-    void addfd(int epfd, int fd, bool enable_et);
+    /**
+     * @author: CGL
+     * @param timeout Close a client which sends nothing for this long. 0 disables it, which is the default.
+     * @description: Setup the idle timeout. It should be called before Run().
+     */
+    void setIdleTimeout(std::chrono::milliseconds timeout);
+
+    /**
+     * @author: CGL
+     * @param interval The time between two heartbeats of a client. 0 disables them, which is the default.
+     * @param heartbeat The callback, called on the loop of the client. It should write with Socket::Send().
+     * @description: Setup the heartbeat of every client. It should be called before Run().
+     */
+    void setHeartbeat(std::chrono::milliseconds interval, std::function<void(Socket&)> heartbeat);
+
+    /**
+     * @author: CGL
+     * @param options The options of the listeners and the accepted sockets.
+     * @description: Setup the socket options. It should be called before Run().
+     */
+    void setSocketOptions(const SocketOptions& options);
+
+    /**
+     * @author: CGL
+     * @param count The threads which run the work of Socket::Offload(). 0 runs it on the loops, which is the default.
+     * @description:
+     *  Setup the workers. It should be called before Run(). A slow handler, such as a login which
+     *  reads from a database, then only delays its own connection instead of every client of its loop.
+     */
+    void setWorkerCount(unsigned short count);
 
 protected:
-    bool m_running;
-    int m_epfd;
-    epoll_event m_events[128];      // Epoll size default = 128
-    std::map<int, Socket> m_clientMap;
+    // Create one loop of this server.
+    virtual std::unique_ptr<EventLoop> _CreateLoop();
+
+protected:
+    unsigned short m_loopCount;
+    size_t m_highWaterMark;
+    size_t m_maxInputSize;
+    std::vector<std::unique_ptr<EventLoop>> m_loops;
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;              // Guard the loops and the error
+    std::exception_ptr m_error;     // The first exception thrown by a loop thread
     std::function<void(Socket&)> m_acceptor;
     std::function<void(Socket&)> m_processor;
+    std::function<void(Socket&)> m_closer;
+    uint64_t m_idleTimeout;         // Milliseconds, 0 when disabled
+    uint64_t m_heartbeatInterval;   // Milliseconds, 0 when disabled
+    std::function<void(Socket&)> m_heartbeat;
+    SocketOptions m_options;
+    unsigned short m_workerCount;
+    std::unique_ptr<OrderedExecutor> m_workers;     // Last, so the workers stop before the loops go
 };
 
+template<class Work, class Done>
+void Socket::Offload(Work&& work, Done&& done)
+{
+    EventLoop* loop = m_loop;
+    uint64_t serial = m_serial;
+    m_offloads++;
+    loop->_Offload(serial, Task(
+        [loop, serial, work = std::forward<Work>(work), done = std::forward<Done>(done)]() mutable
+        {
+            bool failed = false;
+            try
+            {
+                work();
+            }
+            catch (...)
+            {
+                failed = true;
+            }
+            loop->Post(Task(
+                [loop, serial, failed, done = std::move(done)]() mutable
+                {
+                    Socket* client = loop->_FindClient(serial);
+                    if (!client) return;
+                    client->m_offloads--;
+                    if (failed) client->Disconnect();
+                    else done(*client);
+                }
+            ));
+        }
+    ));
+}
+
 template<class T>
 bool Socket::Read(T& obj)
 {
@@ -330,7 +965,7 @@ bool Socket::Read(T& obj)
 template<class T>
 bool Socket::Write(const T& obj)
 {
-    return _write(m_fd, &obj, sizeof(obj), 0);
+    return Send(&obj, sizeof(obj));
 }
 
 template<class T>
@@ -342,7 +977,7 @@ bool Socket::Read(T* dist, size_t n)
 template<class T>
 bool Socket::Write(const T* dist, size_t n)
 {
-    return _write(m_fd, dist, sizeof(T) * n, 0);
+    return Send(dist, sizeof(T) * n);
 }
 
 
@@ -0,0 +1,256 @@
+/*
+ * @FilePath: /simtochat/util/include/Task.h
+ * @Author: CGL
+ * @Date: 2026-10-17 16:40:18
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 16:40:18
+ * @Description:
+ *  A move-only callable with inline storage, and a ring of them used as a task queue.
+ */
+#ifndef UTIL_INCLUDE_TASK_H
+#define UTIL_INCLUDE_TASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @class Task
+ * @author: CGL
+ * @description:
+ *  A type-erased void() callable like std::function, but move-only,
+ *  so it can hold a std::promise or any other move-only state.
+ *  A callable up to TASK_INLINE_SIZE bytes which can be moved without exceptions
+ *  is stored inside the Task itself and never touches the heap.
+ */
+class Task
+{
+public:
+    // Create an empty task.
+    Task() noexcept : m_ops(nullptr) {}
+
+    /**
+     * @author: CGL
+     * @param f The callable to hold.
+     * @description: Hold a callable, inline if it is small enough.
+     */
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f)
+    {
+        using Fn = typename std::decay<F>::type;
+        using Inline = std::integral_constant<bool,
+            sizeof(Fn) <= TASK_INLINE_SIZE && alignof(Fn) <= alignof(max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value>;
+        _Store<Fn>(std::forward<F>(f), Inline());
+    }
+
+    Task(Task&& other) noexcept : m_ops(other.m_ops)
+    {
+        if (m_ops) m_ops->move(m_storage, other.m_storage);
+        other.m_ops = nullptr;
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_ops = other.m_ops;
+            if (m_ops) m_ops->move(m_storage, other.m_storage);
+            other.m_ops = nullptr;
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    // Destroy the held callable.
+    ~Task() { Reset(); }
+
+public:
+    /**
+     * @author: CGL
+     * @description: Call the held callable. The task must not be empty.
+     */
+    void operator()() { m_ops->invoke(m_storage); }
+
+    /**
+     * @author: CGL
+     * @return Return true if the task holds a callable.
+     */
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    /**
+     * @author: CGL
+     * @description: Destroy the held callable and become empty.
+     */
+    void Reset() noexcept
+    {
+        if (m_ops) m_ops->destroy(m_storage);
+        m_ops = nullptr;
+    }
+
+public:
+    // Task is one cache line: the storage and the pointer to the operations.
+    static const size_t TASK_INLINE_SIZE = 64 - sizeof(void*);
+
+protected:
+    struct Ops
+    {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    // The callable lives in the storage.
+    template<class Fn>
+    struct InlineOps
+    {
+        static void Invoke(void* storage) { (*static_cast<Fn*>(storage))(); }
+        static void Move(void* dst, void* src) noexcept
+        {
+            ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* storage) noexcept { static_cast<Fn*>(storage)->~Fn(); }
+        static const Ops table;
+    };
+
+    // The storage holds a pointer to the callable on the heap.
+    template<class Fn>
+    struct HeapOps
+    {
+        static void Invoke(void* storage) { (**static_cast<Fn**>(storage))(); }
+        static void Move(void* dst, void* src) noexcept { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); }
+        static void Destroy(void* storage) noexcept { delete *static_cast<Fn**>(storage); }
+        static const Ops table;
+    };
+
+    template<class Fn, class F>
+    void _Store(F&& f, std::true_type)
+    {
+        ::new (static_cast<void*>(m_storage)) Fn(std::forward<F>(f));
+        m_ops = &InlineOps<Fn>::table;
+    }
+
+    template<class Fn, class F>
+    void _Store(F&& f, std::false_type)
+    {
+        *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+        m_ops = &HeapOps<Fn>::table;
+    }
+
+protected:
+    alignas(max_align_t) unsigned char m_storage[TASK_INLINE_SIZE];
+    const Ops* m_ops;
+};
+
+template<class Fn>
+const Task::Ops Task::InlineOps<Fn>::table = { &Invoke, &Move, &Destroy };
+
+template<class Fn>
+const Task::Ops Task::HeapOps<Fn>::table = { &Invoke, &Move, &Destroy };
+
+/**
+ * @class TaskRing
+ * @author: CGL
+ * @description:
+ *  A double-ended queue of tasks on a power-of-two ring.
+ *  It only grows, so once it has reached its working size pushing and popping never allocate,
+ *  unlike std::deque which frees and allocates its blocks as the queue moves.
+ *  Every task carries a stamp beside it, such as the time it was queued.
+ */
+class TaskRing
+{
+public:
+    explicit TaskRing(size_t capacity = 64)
+        : m_capacity(64), m_head(0), m_tail(0)
+    {
+        while (m_capacity < capacity) m_capacity <<= 1;
+        m_tasks.reset(new Task[m_capacity]);
+        m_stamps.reset(new uint64_t[m_capacity]);
+    }
+
+public:
+    /**
+     * @author: CGL
+     * @return Return the number of queued tasks.
+     */
+    size_t getSize() const { return m_tail - m_head; }
+
+    /**
+     * @author: CGL
+     * @param task The task to queue.
+     * @param stamp Kept with the task and returned when it is popped.
+     * @description: Queue a task at the back, doubling the ring if it is full.
+     */
+    void PushBack(Task&& task, uint64_t stamp = 0)
+    {
+        if (getSize() == m_capacity) _Grow();
+        size_t slot = m_tail++ & (m_capacity - 1);
+        m_tasks[slot] = std::move(task);
+        m_stamps[slot] = stamp;
+    }
+
+    /**
+     * @author: CGL
+     * @param task Receive the oldest task.
+     * @param stamp Receive its stamp if not null.
+     * @return Return false if the ring is empty.
+     */
+    bool PopFront(Task& task, uint64_t* stamp = nullptr)
+    {
+        if (m_head == m_tail) return false;
+        size_t slot = m_head++ & (m_capacity - 1);
+        task = std::move(m_tasks[slot]);
+        if (stamp) *stamp = m_stamps[slot];
+        return true;
+    }
+
+    /**
+     * @author: CGL
+     * @param task Receive the newest task.
+     * @param stamp Receive its stamp if not null.
+     * @return Return false if the ring is empty.
+     */
+    bool PopBack(Task& task, uint64_t* stamp = nullptr)
+    {
+        if (m_head == m_tail) return false;
+        size_t slot = --m_tail & (m_capacity - 1);
+        task = std::move(m_tasks[slot]);
+        if (stamp) *stamp = m_stamps[slot];
+        return true;
+    }
+
+protected:
+    void _Grow()
+    {
+        std::unique_ptr<Task[]> tasks(new Task[m_capacity * 2]);
+        std::unique_ptr<uint64_t[]> stamps(new uint64_t[m_capacity * 2]);
+        size_t size = getSize();
+        for (size_t i = 0; i < size; i++)
+        {
+            size_t slot = (m_head + i) & (m_capacity - 1);
+            tasks[i] = std::move(m_tasks[slot]);
+            stamps[i] = m_stamps[slot];
+        }
+        m_tasks = std::move(tasks);
+        m_stamps = std::move(stamps);
+        m_capacity *= 2;
+        m_head = 0;
+        m_tail = size;
+    }
+
+protected:
+    std::unique_ptr<Task[]> m_tasks;
+    std::unique_ptr<uint64_t[]> m_stamps;   // Beside the tasks, so a Task stays one cache line
+    size_t m_capacity;      // Always a power of two
+    size_t m_head;          // Grows without wrapping
+    size_t m_tail;          // Grows without wrapping
+};
+
+#endif // !UTIL_INCLUDE_TASK_H
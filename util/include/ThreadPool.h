@@ -9,15 +9,29 @@
 #ifndef UTIL_INCLUDE_THREAD_POLL_H
 #define UTIL_INCLUDE_THREAD_POLL_H
 
+#include "Task.h"
+#include "Slab.h"
+
 #include <future>
 #include <vector>
-#include <queue>
+#include <memory>
 #include <functional>
 #include <mutex>
 #include <atomic>
 #include <thread>
 #include <condition_variable>
 
+/**
+ * @author: CGL
+ * @enum ThreadPoolMode
+ * @description: How the tasks are queued and shared by the threads.
+ */
+enum ThreadPoolMode
+{
+    TPM_SHARED,     // One queue shared by all threads.
+    TPM_STEALING    // One deque per thread, idle threads steal from the others.
+};
+
 class ThreadPool
 {
 public:
@@ -25,10 +39,14 @@ public:
     /**
      * @author: CGL
      * @param size The capacity of the thread pool.
+     * @param mode How the tasks are queued. TPM_SHARED by default.
      * @description: Creates a thread pool and
      *  initializes the specified number of threads.
+     *  In TPM_STEALING mode a task committed by a worker goes to the back of its own deque
+     *  and is popped LIFO by it, other tasks are spread round-robin.
+     *  An idle worker steals from the front of the other deques.
      */    
-    ThreadPool(unsigned short size = 4);
+    ThreadPool(unsigned short size = 4, ThreadPoolMode mode = TPM_SHARED);
 
     // Wait all threads to finish.
     virtual ~ThreadPool();
@@ -43,6 +61,8 @@ public:
      *  And you can use std::future<>::get() to get the return value of the task method.
      * @description:
      *  Commit a task to task queue and wake up one of the threads to excute when it is idle.
+     *  The shared state of the future comes from SlabPool and the task is stored inline,
+     *  so a small task does not allocate from the heap.
      */
     template<class F, class... Args>
     auto commit(F&& f, Args&&... args) ->std::future<decltype(f(args...))>
@@ -53,23 +73,34 @@ public:
         // Derive the type of value returned by the function.
         using rettype = decltype(f(args...));
         
-        auto task = std::make_shared<std::packaged_task<rettype()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        std::promise<rettype> promise(std::allocator_arg, SlabAllocator<rettype>());
+        std::future<rettype> future = promise.get_future();
 
-        {
-            std::lock_guard<std::mutex> lock{ m_lock };
+        _Enqueue(Task(
+            [promise = std::move(promise), call = std::bind(std::forward<F>(f), std::forward<Args>(args)...)]() mutable
+            {
+                _Fulfill(promise, call);
+            }
+        ));
 
-            // Enqueue.
-            m_tasks.emplace(
-                [task](){ (*task)(); }
-            );
-        }
+        return future;
+    }
 
-        // Wake up a thread to execute.
-        m_cvTask.notify_one();
+    /**
+     * @author: CGL
+     * @param f The task method to execute.
+     * @param args All parameters of the task method.
+     * @description:
+     *  Commit a task without a future, for callers which do not wait for the result.
+     *  An exception escaping the task terminates the program, like one escaping a std::thread.
+     */
+    template<class F, class... Args>
+    void post(F&& f, Args&&... args)
+    {
+        if (m_stoped.load())
+            throw std::runtime_error("Post when thread pool is stopped!");
 
-        return task->get_future();
+        _Enqueue(Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
     }
     
     /**
@@ -81,15 +112,73 @@ public:
 
 protected:
 
-    using Task = std::function<void()>;
+    // Run the call and pass its result or exception to the promise.
+    template<class R, class Call>
+    static void _Fulfill(std::promise<R>& promise, Call& call)
+    {
+        try
+        {
+            promise.set_value(call());
+        }
+        catch(...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    template<class Call>
+    static void _Fulfill(std::promise<void>& promise, Call& call)
+    {
+        try
+        {
+            call();
+            promise.set_value();
+        }
+        catch(...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    // Queue a task and wake up a thread.
+    void _Enqueue(Task&& task);
+
+    // The loop of a thread in TPM_SHARED mode.
+    void _RunShared();
+
+    // The loop of a thread in TPM_STEALING mode.
+    void _RunStealing(unsigned short index);
+
+    // Pop from the own deque or steal from another one, with the time the task was queued.
+    bool _TakeTask(unsigned short index, Task& task, uint64_t& queued);
+
+    // Run a task and record how long it waited and ran.
+    static void _Run(Task& task, uint64_t queued);
+
+    /**
+     * @author: CGL
+     * @struct WorkerQueue
+     * @description: The deque of one thread. Padded so that two locks never share a cache line.
+     */
+    struct alignas(64) WorkerQueue
+    {
+        std::mutex lock;
+        TaskRing tasks;
+    };
     
+    ThreadPoolMode m_mode;
     std::vector<std::thread> m_poll;
-    std::queue<Task> m_tasks;
+    TaskRing m_tasks;
     std::mutex m_lock;
     std::condition_variable m_cvTask;
     std::atomic<bool> m_stoped;
     std::atomic<int> m_idleNum;
 
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::atomic<unsigned int> m_nextQueue;  // Round-robin target for tasks from other threads
+    std::atomic<int> m_pending;             // Tasks in all the deques
+    std::atomic<int> m_sleeping;            // Threads waiting on m_cvTask
+
 };
 
 #endif // !UTIL_INCLUDE_THREAD_POLL_H
\ No newline at end of file
@@ -0,0 +1,134 @@
+/*
+ * @FilePath: /simtochat/util/include/TimerWheel.h
+ * @Author: CGL
+ * @Date: 2026-10-17 21:05:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 21:05:37
+ * @Description:
+ *  A hierarchical timing wheel for the timers of an event loop.
+ */
+#ifndef UTIL_INCLUDE_TIMER_WHEEL_H
+#define UTIL_INCLUDE_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_LEVELS        4
+#define TIMER_SLOT_BITS     8
+#define TIMER_SLOTS         (1 << TIMER_SLOT_BITS)
+
+/**
+ * @author: CGL
+ * @struct TimerNode
+ * @description:
+ *  A timer embedded in its owner, so scheduling never allocates.
+ *  The wheel only links it, the owner finds what expired through kind and token.
+ */
+struct TimerNode
+{
+    TimerNode* prev = nullptr;  // nullptr when the timer is not scheduled
+    TimerNode* next = nullptr;
+    uint64_t expire = 0;        // The tick to expire at
+    uint64_t token = 0;         // Any value of the owner
+    uint16_t slot = 0;          // Level * TIMER_SLOTS + index, to keep the bitmaps right on cancel
+    uint16_t kind = 0;          // Any value of the owner
+
+    bool isPending() const { return next != nullptr; }
+};
+
+/**
+ * @class TimerWheel
+ * @author: CGL
+ * @description:
+ *  TIMER_LEVELS wheels of TIMER_SLOTS slots each, every slot a list of the timers due in it.
+ *  A timer goes to the lowest level whose range covers its delay, so scheduling and cancelling are O(1),
+ *  and the timers of a higher slot cascade down once, when the lower wheel wraps around to it.
+ *  A bitmap of the slots in use lets an idle wheel skip straight to the next tick with work,
+ *  so time passing costs nothing per timer and nothing per empty tick.
+ *  Delays beyond TIMER_SLOTS ^ TIMER_LEVELS ticks are clamped. It is not thread-safe.
+ */
+class TimerWheel
+{
+public:
+    // Create an empty wheel at tick 0.
+    TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+public:
+    /**
+     * @author: CGL
+     * @param node The timer to schedule. If it is pending it is moved.
+     * @param expire The tick to expire at. A past tick expires on the next Advance().
+     */
+    void Schedule(TimerNode& node, uint64_t expire);
+
+    /**
+     * @author: CGL
+     * @param node The timer to cancel.
+     * @return Return false if it was not pending.
+     */
+    bool Cancel(TimerNode& node);
+
+    /**
+     * @author: CGL
+     * @param now The current tick.
+     * @param f Called with every timer which expires up to now, in order of expiry.
+     * @description: Move the wheel to now. f may schedule and cancel any timer, the expired one too.
+     */
+    template<class F>
+    void Advance(uint64_t now, F&& f)
+    {
+        while (_Step(now))
+        {
+            while (TimerNode* node = _PopExpired()) f(*node);
+        }
+    }
+
+    /**
+     * @author: CGL
+     * @param now The current tick.
+     * @return Return the ticks until the wheel has work, or -1 if it is empty.
+     * @description: The longest the loop may sleep. It can be earlier than the first expiry.
+     */
+    int64_t getTimeout(uint64_t now) const;
+
+    /**
+     * @author: CGL
+     * @return Return the next tick to process.
+     */
+    uint64_t getCurrent() const { return m_current; }
+
+    /**
+     * @author: CGL
+     * @return Return the number of scheduled timers.
+     */
+    size_t getSize() const { return m_size; }
+
+protected:
+    // Link a timer in the slot of its expiry, relative to m_current.
+    void _Insert(TimerNode& node);
+
+    // Return the next tick with an expiring slot or a cascade, or UINT64_MAX if the wheel is empty.
+    uint64_t _NextEvent() const;
+
+    // Process the next tick up to now: cascade and move its slot to the expired list.
+    bool _Step(uint64_t now);
+
+    // Unlink the first expired timer.
+    TimerNode* _PopExpired();
+
+    // Empty a slot of a higher level into the lower ones.
+    void _Cascade(int level, unsigned int index);
+
+protected:
+    TimerNode m_slots[TIMER_LEVELS * TIMER_SLOTS];              // Sentinels of circular lists
+    uint64_t m_bitmap[TIMER_LEVELS][TIMER_SLOTS / 64];          // The slots which are not empty
+    size_t m_levelSize[TIMER_LEVELS];
+    TimerNode m_expired;        // Timers of the tick being processed
+    uint64_t m_current;         // Every tick before it is processed
+    size_t m_size;
+};
+
+#endif // !UTIL_INCLUDE_TIMER_WHEEL_H
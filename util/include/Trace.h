@@ -0,0 +1,211 @@
+/*
+ * @FilePath: /simtochat/util/include/Trace.h
+ * @Author: CGL
+ * @Date: 2026-10-19 10:24:05
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 10:24:05
+ * @Description:
+ *  Sampled spans of the hot paths in per-thread rings, exported as a Chrome trace.
+ */
+#ifndef UTIL_INCLUDE_TRACE_H
+#define UTIL_INCLUDE_TRACE_H
+
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_RING_EVENTS   4096    // Latest spans kept per thread, a power of two, one less once it wraps
+#define TRACE_RETIRED_RINGS 16      // Rings of threads which exited that are still exported
+#define TRACE_DUMP_INTERVAL 10000   // Milliseconds between two exports of TraceDumper
+
+/**
+ * @author: CGL
+ * @struct TraceEvent
+ * @description: A span, with the times of the steady clock in nanoseconds like Metrics::Now().
+ */
+struct TraceEvent
+{
+    const char* name;       // A string literal
+    uint64_t start;
+    uint64_t end;
+    uint64_t request;       // The sampled request the span belongs to
+    uint32_t thread;        // The thread ID of the kernel, only set by Tracer::Collect()
+};
+
+/**
+ * @author: CGL
+ * @class Tracer
+ * @description:
+ *  A request is the root span of a unit of work, such as a batch of events of a loop or a task
+ *  of a ThreadPool. Each thread samples one request out of getPeriod() of its own, and only the
+ *  spans inside a sampled request are recorded: the others cost a test of a thread_local and no
+ *  clock read. A span goes to a ring of the thread with no lock, the oldest one is overwritten.
+ *  Collect() copies the rings from any thread and drops what was overwritten while copying.
+ *  The macros below compile to nothing without SIMTOCHAT_TRACE.
+ */
+class Tracer
+{
+public:
+    /**
+     * @author: CGL
+     * @param rate The share of the requests to sample, from 0 (none, the default) to 1 (all).
+     */
+    static void setSampling(double rate);
+
+    /**
+     * @author: CGL
+     * @return Return N when one request out of N is sampled, 0 when tracing is off.
+     */
+    static uint32_t getPeriod();
+
+    /**
+     * @author: CGL
+     * @return Return true if the thread is inside a request and it is sampled.
+     */
+    static bool isSampling();
+
+    /**
+     * @author: CGL
+     * @param name A string literal.
+     * @param start The nanoseconds of the steady clock.
+     * @param end The nanoseconds of the steady clock.
+     * @description: Record a span into the ring of the thread. Only call it while isSampling().
+     */
+    static void Record(const char* name, uint64_t start, uint64_t end);
+
+    /**
+     * @author: CGL
+     * @return Return true if the thread was not inside a request and now is.
+     *  End() must then be called once the request is done.
+     */
+    static bool Begin();
+
+    // Leave the request started by Begin().
+    static void End();
+
+    /**
+     * @author: CGL
+     * @return Return the spans in the rings of all the threads, oldest first per thread.
+     */
+    static std::vector<TraceEvent> Collect();
+
+    /**
+     * @author: CGL
+     * @param events The spans to format.
+     * @return Return the Chrome trace JSON of the spans, for chrome://tracing or Perfetto.
+     */
+    static std::string Format(const std::vector<TraceEvent>& events);
+
+    /**
+     * @author: CGL
+     * @param path The file to write.
+     * @return Return false if the file could not be written.
+     * @description: Write Format() of Collect() to a temporary file renamed over the path.
+     */
+    static bool Export(const std::string& path);
+};
+
+/**
+ * @author: CGL
+ * @class TraceScope
+ * @description: A span from its construction to its destruction, recorded if the request is sampled.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : m_name(name), m_start(Tracer::isSampling() ? Metrics::Now() : 0) {}
+    ~TraceScope() { if (m_start) Tracer::Record(m_name, m_start, Metrics::Now()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+protected:
+    const char* m_name;
+    uint64_t m_start;       // 0 when not recorded
+};
+
+/**
+ * @author: CGL
+ * @class TraceRequest
+ * @description:
+ *  The root span of a request, which decides whether it is sampled.
+ *  Inside another request it is an ordinary span of that one.
+ */
+class TraceRequest
+{
+public:
+    explicit TraceRequest(const char* name)
+        : m_name(name), m_owner(Tracer::Begin()), m_start(Tracer::isSampling() ? Metrics::Now() : 0) {}
+
+    ~TraceRequest()
+    {
+        if (m_start) Tracer::Record(m_name, m_start, Metrics::Now());
+        if (m_owner) Tracer::End();
+    }
+
+    TraceRequest(const TraceRequest&) = delete;
+    TraceRequest& operator=(const TraceRequest&) = delete;
+
+protected:
+    const char* m_name;
+    bool m_owner;
+    uint64_t m_start;       // 0 when not recorded
+};
+
+/**
+ * @author: CGL
+ * @class TraceDumper
+ * @description: Export the spans to a file every interval, and once more when it is destroyed.
+ */
+class TraceDumper
+{
+public:
+    /**
+     * @author: CGL
+     * @param path The file to write.
+     * @param interval The time between two exports.
+     */
+    explicit TraceDumper(const std::string& path,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(TRACE_DUMP_INTERVAL));
+
+    virtual ~TraceDumper();
+
+    TraceDumper(const TraceDumper&) = delete;
+    TraceDumper& operator=(const TraceDumper&) = delete;
+
+protected:
+    void _Run();
+
+protected:
+    std::string m_path;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_running;
+    std::thread m_thread;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef SIMTOCHAT_TRACE
+// Start a request, sampled or not, until the end of the block.
+#define TRACE_REQUEST(name) TraceRequest TRACE_CONCAT(trace_, __LINE__)(name)
+// A span until the end of the block.
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_, __LINE__)(name)
+// A span whose times were taken elsewhere, such as the wait of a task in a queue.
+#define TRACE_SPAN(name, start, end) do { if (Tracer::isSampling()) Tracer::Record(name, start, end); } while (0)
+#else
+#define TRACE_REQUEST(name) ((void)0)
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SPAN(name, start, end) ((void)0)
+#endif
+
+#endif // !UTIL_INCLUDE_TRACE_H
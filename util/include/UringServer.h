@@ -0,0 +1,196 @@
+/*
+ * @FilePath: /simtochat/util/include/UringServer.h
+ * @Author: CGL
+ * @Date: 2026-10-17 20:14:09
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 20:14:09
+ * @Description:
+ *  The io_uring backend of EpollServer, driven by the raw kernel interface.
+ *  UringLoop: one io_uring reactor.
+ *  UringServer: EpollServer with io_uring loops, or epoll loops when the kernel lacks support.
+ */
+#ifndef UTIL_INCLUDE_URING_SERVER_H
+#define UTIL_INCLUDE_URING_SERVER_H
+
+#include "Socket.h"
+
+#include <linux/io_uring.h>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#define URING_SEND_IOVECS   64          // Pieces of one sendmsg
+
+/**
+ * @class UringLoop
+ * @author: CGL
+ * @description:
+ *  A reactor which queues its operations on an io_uring and submits all of them
+ *  together with waiting for completions, in one io_uring_enter per round.
+ *  The listener has one multishot accept and every client one multishot recv,
+ *  which picks its buffers from a group provided to the kernel, given back after every round.
+ *  A client has at most one send in flight: the pending output is swapped into a sending buffer
+ *  which does not move until the send completes, and the next send is queued on completion,
+ *  so the bytes go out in order without any copy. Output with shared buffers goes out with a sendmsg.
+ */
+class UringLoop : public EventLoop
+{
+public:
+    UringLoop(EpollServer* server);
+
+    // Unmap the rings and close the io_uring.
+    virtual ~UringLoop();
+
+public:
+    /**
+     * @author: CGL
+     * @return Return true if the kernel supports everything this loop uses.
+     * @description: Probe the kernel once. It is safe to call from any thread.
+     */
+    static bool isSupported();
+
+    virtual void Listen(int port) override;
+    virtual void Loop() override;
+
+protected:
+    virtual bool _Send(Socket& client, const iovec* vec, int count, bool more) override;
+    virtual bool _SendShared(Socket& client, const SharedBuffer& buffer, bool more) override;
+
+    // Create the ring in the thread of the loop, which is the only one allowed to submit.
+    void _SetupRing();
+
+    // Get a free submission entry. While the ring is full, submit the queued ones, and stash the completions
+    // which keep the kernel from taking them, until an entry is free.
+    io_uring_sqe* _GetSqe();
+
+    // Move the completions in the ring to m_stashed without handling them, so the kernel can post more.
+    // Return how many there were.
+    size_t _Stash();
+
+    // Submit the queued entries and wait for at least minComplete completions, or timeout milliseconds.
+    void _Enter(unsigned int minComplete, int timeout = -1);
+
+    // Handle the stashed completions and every completion in the ring, in order. Return how many there were.
+    size_t _Reap();
+
+    void _Complete(const io_uring_cqe& cqe);
+
+    void _ArmAccept();
+    void _ArmWakeup();
+    void _ArmRecv(Socket& client);
+
+    // Queue a send of the pending output if none is in flight.
+    void _StartSend(Socket& client);
+
+    // Remember a client to visit after the current round of completions.
+    void _MarkDirty(Socket& client);
+
+    // Call the processor for the clients which received data, and start their sends.
+    void _ProcessDirty();
+
+    // Pause the multishot recv above the high-water mark, and arm it again below half of it.
+    void _UpdateReading(Socket& client);
+
+    // The output queue and the sends in flight.
+    virtual size_t _getPendingOutput(Socket& client) override;
+
+    // Queue a provided buffer to give back to the kernel.
+    void _RecycleBuffer(uint16_t bid);
+
+    // Give the queued buffers back to the kernel.
+    void _ProvideBuffers();
+
+    // Get the slot of a client from a completion token, or nullptr if the connection is gone.
+    ClientSlot* _FindLive(uint64_t token);
+
+    // Shut the client down, and close it once no send is in flight.
+    virtual void _Close(ClientSlot& slot) override;
+
+protected:
+    int m_ringfd;
+
+    // The mapped submission and completion rings.
+    void* m_sqRing;
+    void* m_cqRing;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    io_uring_sqe* m_sqes;
+    unsigned int m_sqEntries;
+    unsigned int* m_sqHead;
+    unsigned int* m_sqTail;
+    unsigned int* m_sqMask;
+    unsigned int* m_sqArray;
+    unsigned int m_sqLocalTail;     // Entries prepared, published to the kernel on _Enter()
+    unsigned int m_sqSubmitted;
+    unsigned int* m_cqHead;
+    unsigned int* m_cqTail;
+    unsigned int* m_cqMask;
+    io_uring_cqe* m_cqes;
+    std::vector<io_uring_cqe> m_stashed;    // Taken from the ring by _GetSqe(), handled by the next _Reap()
+    std::vector<io_uring_cqe> m_reaping;    // Swapped with m_stashed, both keep their memory
+
+    // The buffers provided to the multishot recvs.
+    char* m_bufPool;
+    std::vector<uint16_t> m_recycled;
+
+    uint64_t m_wakeupValue;         // The eventfd counter read by the wakeup operation
+    std::vector<OutputQueue> m_sending;     // The output in flight of every file descriptor
+
+    /**
+     * @author: CGL
+     * @struct UringMessage
+     * @description: The sendmsg in flight of a file descriptor whose output has shared buffers.
+     */
+    struct UringMessage
+    {
+        msghdr msg;
+        iovec vec[URING_SEND_IOVECS];
+    };
+
+    std::vector<std::unique_ptr<UringMessage>> m_messages;  // By file descriptor, created on first use
+    std::vector<uint64_t> m_dirty;  // Serials of the clients to visit after the completions
+};
+
+/**
+ * @class UringServer
+ * @author: CGL
+ * @description:
+ *  EpollServer with the same callbacks and settings, running UringLoop when the kernel
+ *  supports it and falling back to the epoll loops otherwise.
+ */
+class UringServer : public EpollServer
+{
+public:
+    UringServer();
+    virtual ~UringServer();
+
+public:
+    /**
+     * @author: CGL
+     * @param port The port to listen.
+     * @description: Choose the backend, then run like EpollServer::Run().
+     */
+    virtual void Run(int port) override;
+
+    /**
+     * @author: CGL
+     * @param enable Set false to force the epoll loops. Default is true.
+     * @description: Allow the io_uring loops. It should be called before Run().
+     */
+    void setUringEnabled(bool enable);
+
+    /**
+     * @author: CGL
+     * @return Return true if the loops of the last Run() use io_uring.
+     */
+    bool isUsingUring() const;
+
+protected:
+    virtual std::unique_ptr<EventLoop> _CreateLoop() override;
+
+protected:
+    bool m_enabled;
+    bool m_uring;
+};
+
+#endif // !UTIL_INCLUDE_URING_SERVER_H
@@ -0,0 +1,238 @@
+/*
+ * @FilePath: /simtochat/util/src/Buffer.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 10:12:31
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 10:12:31
+ * @Description:
+ */
+#include "Buffer.h"
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+static size_t RoundUpPowerOfTwo(size_t n)
+{
+    size_t capacity = 64;
+    while (capacity < n) capacity <<= 1;
+    return capacity;
+}
+
+Buffer::Buffer(size_t capacity)
+    : m_data(nullptr), m_capacity(0), m_head(0), m_tail(0)
+{
+    if (capacity == 0) return;
+    m_capacity = RoundUpPowerOfTwo(capacity);
+    m_data = new char[m_capacity];
+}
+
+Buffer::Buffer(Buffer&& other) noexcept
+    : m_data(other.m_data), m_capacity(other.m_capacity), m_head(other.m_head), m_tail(other.m_tail)
+{
+    other.m_data = nullptr;
+    other.m_capacity = 0;
+    other.m_head = other.m_tail = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        delete[] m_data;
+        m_data = other.m_data;
+        m_capacity = other.m_capacity;
+        m_head = other.m_head;
+        m_tail = other.m_tail;
+        other.m_data = nullptr;
+        other.m_capacity = 0;
+        other.m_head = other.m_tail = 0;
+    }
+    return *this;
+}
+
+Buffer::~Buffer()
+{
+    delete[] m_data;
+}
+
+size_t Buffer::getReadableBytes() const
+{
+    return m_tail - m_head;
+}
+
+size_t Buffer::getWritableBytes() const
+{
+    return m_capacity - (m_tail - m_head);
+}
+
+size_t Buffer::getCapacity() const
+{
+    return m_capacity;
+}
+
+const char* Buffer::Peek()
+{
+    size_t begin = m_head & (m_capacity - 1);
+    if (begin + getReadableBytes() > m_capacity) _Relocate(m_capacity);
+    return m_data + (m_head & (m_capacity - 1));
+}
+
+void Buffer::Retrieve(size_t n)
+{
+    if (n >= getReadableBytes())
+    {
+        RetrieveAll();
+        return;
+    }
+    m_head += n;
+}
+
+void Buffer::RetrieveAll()
+{
+    // Restart from the beginning so that following data rarely wraps around.
+    m_head = m_tail = 0;
+}
+
+std::string Buffer::RetrieveAsString(size_t n)
+{
+    if (n > getReadableBytes()) n = getReadableBytes();
+    std::string str(Peek(), n);
+    Retrieve(n);
+    return str;
+}
+
+void Buffer::Append(const void* data, size_t n)
+{
+    EnsureWritable(n);
+    size_t begin = m_tail & (m_capacity - 1);
+    size_t first = std::min(n, m_capacity - begin);
+    memcpy(m_data + begin, data, first);
+    memcpy(m_data, static_cast<const char*>(data) + first, n - first);
+    m_tail += n;
+}
+
+void Buffer::Append(const iovec* vec, int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += vec[i].iov_len;
+    EnsureWritable(total);
+    for (int i = 0; i < count; i++) Append(vec[i].iov_base, vec[i].iov_len);
+}
+
+void Buffer::EnsureWritable(size_t n)
+{
+    if (getWritableBytes() >= n) return;
+    _Relocate(RoundUpPowerOfTwo(getReadableBytes() + n));
+}
+
+ssize_t Buffer::ReadFd(int fd, int* savedErrno, bool* eof, size_t limit)
+{
+    char extra[65536];
+    ssize_t total = 0;
+    *eof = false;
+
+    while (true)
+    {
+        // The free space of the ring is at most two segments, the stack buffer takes the overflow.
+        iovec vec[3];
+        int count = 0;
+        size_t writable = getWritableBytes();
+        size_t begin = m_tail & (m_capacity - 1);
+        size_t first = std::min(writable, m_capacity - begin);
+        if (first > 0)
+        {
+            vec[count].iov_base = m_data + begin;
+            vec[count++].iov_len = first;
+        }
+        if (writable > first)
+        {
+            vec[count].iov_base = m_data;
+            vec[count++].iov_len = writable - first;
+        }
+        vec[count].iov_base = extra;
+        vec[count++].iov_len = sizeof(extra);
+
+        ssize_t n = readv(fd, vec, count);
+        if (n > 0)
+        {
+            total += n;
+            if (static_cast<size_t>(n) <= writable)
+            {
+                m_tail += n;
+            }
+            else
+            {
+                m_tail += writable;
+                Append(extra, n - writable);
+            }
+            if (getReadableBytes() > limit) return total;
+        }
+        else if (n == 0)
+        {
+            *eof = true;
+            return total;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return total;
+        }
+        else
+        {
+            *savedErrno = errno;
+            return -1;
+        }
+    }
+}
+
+ssize_t Buffer::WriteFd(int fd, int* savedErrno)
+{
+    size_t readable = getReadableBytes();
+    if (readable == 0) return 0;
+
+    iovec vec[2];
+    int count = 0;
+    size_t begin = m_head & (m_capacity - 1);
+    size_t first = std::min(readable, m_capacity - begin);
+    vec[count].iov_base = m_data + begin;
+    vec[count++].iov_len = first;
+    if (readable > first)
+    {
+        vec[count].iov_base = m_data;
+        vec[count++].iov_len = readable - first;
+    }
+
+    // sendmsg instead of writev, a closed peer must not raise SIGPIPE.
+    msghdr msg = {};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+        return -1;
+    }
+    Retrieve(n);
+    return n;
+}
+
+void Buffer::_Relocate(size_t capacity)
+{
+    size_t readable = getReadableBytes();
+    char* data = new char[capacity];
+    size_t begin = m_head & (m_capacity - 1);
+    size_t first = std::min(readable, m_capacity - begin);
+    memcpy(data, m_data + begin, first);
+    memcpy(data + first, m_data, readable - first);
+    delete[] m_data;
+    m_data = data;
+    m_capacity = capacity;
+    m_head = 0;
+    m_tail = readable;
+}
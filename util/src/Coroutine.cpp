@@ -0,0 +1,76 @@
+/*
+ * @FilePath: /simtochat/util/src/Coroutine.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 18:40:11
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 18:40:11
+ * @Description:
+ */
+#include "Coroutine.h"
+
+void Spawn(CoTask<void>&& task)
+{
+    auto handle = task.Release();
+    if (!handle) return;
+    handle.promise().m_detached = true;
+    handle.resume();
+}
+
+CoSocket::CoSocket(Socket& client)
+    : m_loop(client.m_loop), m_serial(client.m_serial)
+{
+
+}
+
+Socket* CoSocket::get() const
+{
+    return m_loop->_FindClient(m_serial);
+}
+
+EventLoop* CoSocket::getLoop() const
+{
+    return m_loop;
+}
+
+uint64_t CoSocket::getSerial() const
+{
+    return m_serial;
+}
+
+bool CoSocket::ReadAwaiter::await_ready() const
+{
+    Socket* client = m_socket.get();
+    return !client || client->m_input.getReadableBytes() >= m_wanted;
+}
+
+void CoSocket::ReadAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    // The loop resumes it from EventLoop::_Received() once enough arrived, or when the client closes.
+    Socket* client = m_socket.get();
+    client->m_reader = handle.address();
+    client->m_readWanted = m_wanted;
+}
+
+bool CoSocket::ReadAwaiter::await_resume() const
+{
+    Socket* client = m_socket.get();
+    return client && client->m_input.getReadableBytes() >= m_wanted;
+}
+
+bool CoSocket::WriteAwaiter::await_ready()
+{
+    Socket* client = m_socket.get();
+    if (!client) return true;
+    m_sent = client->Send(m_data, m_size);
+    return !m_sent || m_socket.m_loop->_getPendingOutput(*client) <= m_socket.m_loop->_getHighWaterMark();
+}
+
+void CoSocket::WriteAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_socket.m_loop->m_writers.emplace_back(m_socket.m_serial, handle.address());
+}
+
+bool CoSocket::WriteAwaiter::await_resume() const
+{
+    return m_sent && m_socket.get() != nullptr;
+}
@@ -0,0 +1,128 @@
+/*
+ * @FilePath: /simtochat/util/src/Histogram.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 20:05:13
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 20:05:13
+ * @Description:
+ *  With S = 2^HISTOGRAM_PRECISION, a value v >= S whose highest bit is b is kept in the bucket
+ *  (b - HISTOGRAM_PRECISION) * S + (v >> (b - HISTOGRAM_PRECISION)), and a smaller one in the bucket v.
+ */
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const uint64_t kSubBuckets = uint64_t(1) << HISTOGRAM_PRECISION;
+const uint64_t kLargest = (uint64_t(1) << HISTOGRAM_BITS) - 1;
+const size_t kBuckets = Histogram::BUCKETS;
+
+} // namespace
+
+Histogram::Histogram()
+    : m_counts(kBuckets, 0), m_count(0), m_min(UINT64_MAX), m_max(0), m_sum(0)
+{
+
+}
+
+Histogram::~Histogram()
+{
+
+}
+
+void Histogram::Record(uint64_t value, uint64_t count)
+{
+    m_counts[getBucket(value)] += count;
+    m_count += count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_sum += double(value) * count;
+}
+
+void Histogram::Merge(const Histogram& other)
+{
+    for (size_t i = 0; i < kBuckets; i++) m_counts[i] += other.m_counts[i];
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+void Histogram::Merge(const uint64_t* buckets, uint64_t min, uint64_t max, double sum)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < kBuckets; i++)
+    {
+        m_counts[i] += buckets[i];
+        count += buckets[i];
+    }
+    if (count == 0) return;
+    m_count += count;
+    m_min = std::min(m_min, min);
+    m_max = std::max(m_max, max);
+    m_sum += sum;
+}
+
+void Histogram::Reset()
+{
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+    m_sum = 0;
+}
+
+uint64_t Histogram::getPercentile(double percentile) const
+{
+    if (m_count == 0) return 0;
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(percentile / 100 * m_count)));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++)
+    {
+        seen += m_counts[i];
+        // The last bucket holds everything past the range, only the largest of them is known.
+        if (seen >= rank) return i + 1 < kBuckets ? std::min(_Highest(i), m_max) : m_max;
+    }
+    return m_max;
+}
+
+uint64_t Histogram::getCount() const
+{
+    return m_count;
+}
+
+uint64_t Histogram::getMin() const
+{
+    return m_count ? m_min : 0;
+}
+
+uint64_t Histogram::getMax() const
+{
+    return m_max;
+}
+
+double Histogram::getMean() const
+{
+    return m_count ? m_sum / m_count : 0;
+}
+
+size_t Histogram::getBucket(uint64_t value)
+{
+    if (value < kSubBuckets) return size_t(value);
+    value = std::min(value, kLargest);
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_PRECISION;
+    return size_t(shift) * kSubBuckets + size_t(value >> shift);
+}
+
+uint64_t Histogram::_Highest(size_t index)
+{
+    if (index < kSubBuckets) return index;
+    uint64_t shift = index / kSubBuckets - 1;
+    uint64_t mantissa = index - shift * kSubBuckets;
+    return ((mantissa + 1) << shift) - 1;
+}
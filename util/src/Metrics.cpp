@@ -0,0 +1,300 @@
+/*
+ * @FilePath: /simtochat/util/src/Metrics.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 23:11:40
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 23:11:40
+ * @Description:
+ */
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+
+// The histogram of one thread. Only its thread writes it, other threads only read.
+struct ThreadHistogram
+{
+    std::atomic<uint64_t> buckets[Histogram::BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> sum;
+};
+
+// The metrics of one thread, on cache lines of its own.
+struct alignas(64) ThreadBlock
+{
+    std::atomic<uint64_t> counters[METRICS_MAX_COUNTERS];
+    std::atomic<ThreadHistogram*> histograms[METRICS_MAX_HISTOGRAMS];
+};
+
+// A single writer does not need an atomic read-modify-write.
+inline void Bump(std::atomic<uint64_t>& value, uint64_t n)
+{
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Registry
+{
+    std::mutex lock;
+    std::vector<std::string> counters;
+    std::vector<std::string> histograms;
+    std::vector<std::pair<std::string, std::function<int64_t()>>> gauges;
+    std::vector<ThreadBlock*> blocks;
+
+    // What the threads which exited had counted.
+    uint64_t retiredCounters[METRICS_MAX_COUNTERS] = {};
+    std::vector<std::unique_ptr<Histogram>> retiredHistograms{ METRICS_MAX_HISTOGRAMS };
+};
+
+// Never destroyed, the threads which exit during the static destruction still fold their blocks into it.
+Registry& GetRegistry()
+{
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+int Register(std::vector<std::string>& names, const std::string& name, size_t limit)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{ registry.lock };
+    auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end()) return int(it - names.begin());
+    if (names.size() >= limit) return -1;
+    names.push_back(name);
+    return int(names.size() - 1);
+}
+
+// Add a histogram of a thread to a merged one. The registry lock must be held.
+void MergeThreadHistogram(Histogram& merged, const ThreadHistogram& histogram)
+{
+    if (histogram.count.load(std::memory_order_relaxed) == 0) return;
+    std::vector<uint64_t> buckets(Histogram::BUCKETS);
+    for (size_t i = 0; i < Histogram::BUCKETS; i++) buckets[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+    merged.Merge(buckets.data(), histogram.min.load(std::memory_order_relaxed),
+        histogram.max.load(std::memory_order_relaxed), double(histogram.sum.load(std::memory_order_relaxed)));
+}
+
+// Trivial, so reading them on the hot path is a plain TLS access.
+thread_local ThreadBlock* t_block = nullptr;
+thread_local bool t_retired = false;
+
+// Registers the block of its thread, and folds it into the registry when the thread exits.
+struct ThreadOwner
+{
+    ThreadBlock* block;
+
+    ThreadOwner() : block(new ThreadBlock())
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock{ registry.lock };
+        registry.blocks.push_back(block);
+    }
+
+    ~ThreadOwner()
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock{ registry.lock };
+        registry.blocks.erase(std::find(registry.blocks.begin(), registry.blocks.end(), block));
+        for (int i = 0; i < METRICS_MAX_COUNTERS; i++)
+        {
+            registry.retiredCounters[i] += block->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < METRICS_MAX_HISTOGRAMS; i++)
+        {
+            ThreadHistogram* histogram = block->histograms[i].load(std::memory_order_relaxed);
+            if (!histogram) continue;
+            auto& retired = registry.retiredHistograms[i];
+            if (!retired) retired.reset(new Histogram);
+            MergeThreadHistogram(*retired, *histogram);
+            delete histogram;
+        }
+        delete block;
+        t_block = nullptr;
+        t_retired = true;
+    }
+};
+
+ThreadBlock& GetBlock()
+{
+    if (!t_block)
+    {
+        // Updates from the destructors of other thread_locals, after the block was folded, are dropped.
+        static ThreadBlock* discarded = new ThreadBlock();
+        if (t_retired) return *discarded;
+        static thread_local ThreadOwner owner;
+        t_block = owner.block;
+    }
+    return *t_block;
+}
+
+} // namespace
+
+int Metrics::RegisterCounter(const std::string& name)
+{
+    return Register(GetRegistry().counters, name, METRICS_MAX_COUNTERS);
+}
+
+int Metrics::RegisterHistogram(const std::string& name)
+{
+    return Register(GetRegistry().histograms, name, METRICS_MAX_HISTOGRAMS);
+}
+
+void Metrics::RegisterGauge(const std::string& name, std::function<int64_t()> read)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{ registry.lock };
+    for (auto& gauge : registry.gauges)
+    {
+        if (gauge.first != name) continue;
+        gauge.second = std::move(read);
+        return;
+    }
+    registry.gauges.emplace_back(name, std::move(read));
+}
+
+void Metrics::RemoveGauge(const std::string& name)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{ registry.lock };
+    auto& gauges = registry.gauges;
+    gauges.erase(std::remove_if(gauges.begin(), gauges.end(),
+        [&name](const std::pair<std::string, std::function<int64_t()>>& gauge) { return gauge.first == name; }),
+        gauges.end());
+}
+
+void Metrics::Add(int counter, uint64_t n)
+{
+    if (unsigned(counter) >= METRICS_MAX_COUNTERS) return;
+    Bump(GetBlock().counters[counter], n);
+}
+
+void Metrics::Record(int histogram, uint64_t nanoseconds)
+{
+    if (unsigned(histogram) >= METRICS_MAX_HISTOGRAMS) return;
+    ThreadBlock& block = GetBlock();
+    ThreadHistogram* mine = block.histograms[histogram].load(std::memory_order_relaxed);
+    if (!mine)
+    {
+        // Zeroed. Published with release, so a reader never sees it half made.
+        mine = new ThreadHistogram();
+        mine->min.store(UINT64_MAX, std::memory_order_relaxed);
+        block.histograms[histogram].store(mine, std::memory_order_release);
+    }
+
+    Bump(mine->buckets[Histogram::getBucket(nanoseconds)], 1);
+    Bump(mine->count, 1);
+    Bump(mine->sum, nanoseconds);
+    if (nanoseconds < mine->min.load(std::memory_order_relaxed)) mine->min.store(nanoseconds, std::memory_order_relaxed);
+    if (nanoseconds > mine->max.load(std::memory_order_relaxed)) mine->max.store(nanoseconds, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::getCounter(int counter)
+{
+    if (unsigned(counter) >= METRICS_MAX_COUNTERS) return 0;
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{ registry.lock };
+    uint64_t sum = registry.retiredCounters[counter];
+    for (ThreadBlock* block : registry.blocks) sum += block->counters[counter].load(std::memory_order_relaxed);
+    return sum;
+}
+
+MetricsSnapshot Metrics::Snapshot()
+{
+    Registry& registry = GetRegistry();
+    MetricsSnapshot snapshot;
+    std::vector<std::pair<std::string, std::function<int64_t()>>> gauges;
+    {
+        std::lock_guard<std::mutex> lock{ registry.lock };
+        for (size_t i = 0; i < registry.counters.size(); i++)
+        {
+            uint64_t sum = registry.retiredCounters[i];
+            for (ThreadBlock* block : registry.blocks) sum += block->counters[i].load(std::memory_order_relaxed);
+            snapshot.counters.emplace_back(registry.counters[i], sum);
+        }
+        for (size_t i = 0; i < registry.histograms.size(); i++)
+        {
+            Histogram merged;
+            if (registry.retiredHistograms[i]) merged.Merge(*registry.retiredHistograms[i]);
+            for (ThreadBlock* block : registry.blocks)
+            {
+                ThreadHistogram* histogram = block->histograms[i].load(std::memory_order_acquire);
+                if (histogram) MergeThreadHistogram(merged, *histogram);
+            }
+            snapshot.histograms.emplace_back(registry.histograms[i], std::move(merged));
+        }
+        gauges = registry.gauges;
+    }
+
+    // Out of the lock: a gauge may read counters itself.
+    for (auto& gauge : gauges) snapshot.gauges.emplace_back(gauge.first, gauge.second());
+    return snapshot;
+}
+
+std::string Metrics::Format(const MetricsSnapshot& snapshot)
+{
+    std::ostringstream out;
+    for (auto& counter : snapshot.counters) out << "counter " << counter.first << " " << counter.second << "\n";
+    for (auto& gauge : snapshot.gauges) out << "gauge " << gauge.first << " " << gauge.second << "\n";
+
+    char line[256];
+    for (auto& entry : snapshot.histograms)
+    {
+        const Histogram& histogram = entry.second;
+        auto us = [](uint64_t ns) { return ns / 1e3; };
+        snprintf(line, sizeof(line),
+            "histogram %s count=%llu mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+            entry.first.c_str(), (unsigned long long)histogram.getCount(), histogram.getMean() / 1e3,
+            us(histogram.getPercentile(50)), us(histogram.getPercentile(90)), us(histogram.getPercentile(99)),
+            us(histogram.getPercentile(99.9)), us(histogram.getMax()));
+        out << line;
+    }
+    return out.str();
+}
+
+MetricsDumper::MetricsDumper(const std::string& path, std::chrono::milliseconds interval)
+    : m_path(path), m_interval(interval), m_running(true)
+{
+    m_thread = std::thread(&MetricsDumper::_Run, this);
+}
+
+MetricsDumper::~MetricsDumper()
+{
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_running = false;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+    Dump();
+}
+
+bool MetricsDumper::Dump()
+{
+    std::string temporary = m_path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << Metrics::Format(Metrics::Snapshot());
+        if (!file.flush()) return false;
+    }
+    return 0 == rename(temporary.c_str(), m_path.c_str());
+}
+
+void MetricsDumper::_Run()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    while (m_running)
+    {
+        if (m_wake.wait_for(lock, m_interval, [this] { return !m_running; })) break;
+        lock.unlock();
+        Dump();
+        lock.lock();
+    }
+}
@@ -0,0 +1,299 @@
+/*
+ * @FilePath: /simtochat/util/src/MySQLBatchWriter.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 17:20:45
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 17:20:45
+ * @Description:
+ *  A queued row is its values one after another, each a type byte followed by
+ *  an int64, a double, or a u32 length and the bytes of a string.
+ */
+#include "MySQLBatchWriter.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+MySQLBatchWriter::MySQLBatchWriter(MySQLConnectionPool& pool, const std::string& table,
+    const std::vector<std::string>& columns, size_t batchRows, std::chrono::milliseconds deadline, size_t capacity)
+    : m_pool(pool), m_table(table), m_columns(columns), m_deadline(deadline), m_capacity(capacity),
+      m_rows(0), m_done(0), m_waiting(0), m_running(true), m_totalLatency(0)
+{
+    // A prepared statement takes 65535 parameters at most.
+    size_t limit = columns.empty() ? 1 : 65535 / columns.size();
+    m_batchRows = std::max<size_t>(1, std::min(batchRows, limit));
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_worker = std::thread(&MySQLBatchWriter::_Run, this);
+}
+
+MySQLBatchWriter::~MySQLBatchWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_running = false;
+    }
+    m_wake.notify_one();
+    m_space.notify_all();
+    m_worker.join();
+}
+
+bool MySQLBatchWriter::Insert(std::initializer_list<MySQLValue> values)
+{
+    if (values.size() != m_columns.size()) return false;
+    size_t size = _RowSize(values);
+
+    std::lock_guard<std::mutex> lock{ m_lock };
+    if (_Push(values, size)) return true;
+    m_stats.rejected++;
+    return false;
+}
+
+bool MySQLBatchWriter::Insert(std::initializer_list<MySQLValue> values, std::chrono::milliseconds timeout)
+{
+    if (values.size() != m_columns.size()) return false;
+    size_t size = _RowSize(values);
+
+    std::unique_lock<std::mutex> lock{ m_lock };
+    m_space.wait_for(lock, timeout, [&] { return !m_running || m_queue.size() + size <= m_capacity; });
+    if (_Push(values, size)) return true;
+    m_stats.rejected++;
+    return false;
+}
+
+void MySQLBatchWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    uint64_t target = m_stats.inserted;
+    m_waiting++;
+    m_wake.notify_one();
+    m_flushed.wait(lock, [&] { return m_done >= target; });
+    m_waiting--;
+}
+
+MySQLBatchStats MySQLBatchWriter::getStats()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    MySQLBatchStats stats = m_stats;
+    stats.queuedRows = m_rows;
+    stats.queuedBytes = m_queue.size();
+    stats.meanLatency = stats.flushes ? m_totalLatency / stats.flushes : 0;
+    return stats;
+}
+
+std::string MySQLBatchWriter::getLastError()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_lastError;
+}
+
+bool MySQLBatchWriter::_Push(std::initializer_list<MySQLValue> values, size_t size)
+{
+    if (!m_running || m_queue.size() + size > m_capacity) return false;
+
+    size_t offset = m_queue.size();
+    m_queue.resize(offset + size);
+    char* p = m_queue.data() + offset;
+    for (const MySQLValue& value : values)
+    {
+        *p++ = char(value.type);
+        switch (value.type)
+        {
+        case MySQLValue::MV_INT:
+            memcpy(p, &value.integer, sizeof(value.integer));
+            p += sizeof(value.integer);
+            break;
+        case MySQLValue::MV_DOUBLE:
+            memcpy(p, &value.real, sizeof(value.real));
+            p += sizeof(value.real);
+            break;
+        case MySQLValue::MV_STRING:
+        {
+            uint32_t length = uint32_t(value.length);
+            memcpy(p, &length, sizeof(length));
+            memcpy(p + sizeof(length), value.data, length);
+            p += sizeof(length) + length;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // The worker sleeps until the deadline of the first row, or until a batch is full.
+    if (m_rows++ == 0)
+    {
+        m_oldest = std::chrono::steady_clock::now();
+        m_wake.notify_one();
+    }
+    else if (m_rows == m_batchRows)
+    {
+        m_wake.notify_one();
+    }
+    m_stats.inserted++;
+    return true;
+}
+
+size_t MySQLBatchWriter::_RowSize(std::initializer_list<MySQLValue> values)
+{
+    size_t size = 0;
+    for (const MySQLValue& value : values)
+    {
+        size += 1;
+        if (value.type == MySQLValue::MV_INT || value.type == MySQLValue::MV_DOUBLE) size += 8;
+        else if (value.type == MySQLValue::MV_STRING) size += sizeof(uint32_t) + value.length;
+    }
+    return size;
+}
+
+bool MySQLBatchWriter::_Write(const std::vector<char>& rows, size_t count)
+{
+    TRACE_REQUEST("mysql.flush");
+    const size_t columns = m_columns.size();
+    for (int attempt = 0; attempt < MYSQL_BATCH_RETRIES; attempt++)
+    {
+        if (attempt > 0) std::this_thread::sleep_for(std::chrono::milliseconds(50 * attempt));
+
+        MySQLConnectionPool::Handle handle;
+        try
+        {
+            handle = m_pool.Checkout();
+            handle->Excute("START TRANSACTION");
+            const char* p = rows.data();
+            size_t left = count;
+            while (left > 0)
+            {
+                // Full statements first, then the largest power of two that fits.
+                size_t n = m_batchRows;
+                if (left < n)
+                {
+                    n = 1;
+                    while (n * 2 <= left) n *= 2;
+                }
+
+                MySQLStatement& insert = handle->Prepare(_InsertSql(n));
+                unsigned int index = 0;
+                for (size_t i = 0; i < n * columns; i++, index++)
+                {
+                    MySQLValue::Type type = MySQLValue::Type(*p++);
+                    if (type == MySQLValue::MV_INT)
+                    {
+                        int64_t value;
+                        memcpy(&value, p, sizeof(value));
+                        p += sizeof(value);
+                        insert.BindInt(index, value);
+                    }
+                    else if (type == MySQLValue::MV_DOUBLE)
+                    {
+                        double value;
+                        memcpy(&value, p, sizeof(value));
+                        p += sizeof(value);
+                        insert.BindDouble(index, value);
+                    }
+                    else if (type == MySQLValue::MV_STRING)
+                    {
+                        uint32_t length;
+                        memcpy(&length, p, sizeof(length));
+                        insert.BindString(index, p + sizeof(length), length);
+                        p += sizeof(length) + length;
+                    }
+                    else
+                    {
+                        insert.BindNull(index);
+                    }
+                }
+                insert.Excute();
+                left -= n;
+            }
+            handle->Excute("COMMIT");
+            return true;
+        }
+        catch(const MySQLException& e)
+        {
+            {
+                std::lock_guard<std::mutex> lock{ m_lock };
+                m_lastError = e.what();
+            }
+            // The connection may be broken, the pool reconnects it when it comes back.
+            if (handle)
+            {
+                try
+                {
+                    handle->Excute("ROLLBACK");
+                }
+                catch(const MySQLException&)
+                {
+
+                }
+            }
+        }
+    }
+    return false;
+}
+
+std::string MySQLBatchWriter::_InsertSql(size_t rows) const
+{
+    std::string sql = "INSERT INTO " + m_table + " (";
+    std::string tuple = "(";
+    for (size_t i = 0; i < m_columns.size(); i++)
+    {
+        sql += (i ? ", " : "") + m_columns[i];
+        tuple += i ? ", ?" : "?";
+    }
+    tuple += ")";
+    sql += ") VALUES ";
+    sql.reserve(sql.size() + rows * (tuple.size() + 2));
+    for (size_t i = 0; i < rows; i++)
+    {
+        if (i) sql += ", ";
+        sql += tuple;
+    }
+    return sql;
+}
+
+void MySQLBatchWriter::_Run()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    while (true)
+    {
+        if (m_rows == 0)
+        {
+            if (!m_running) break;
+            m_wake.wait(lock);
+            continue;
+        }
+
+        // Wait for a full batch or the deadline of the oldest row, unless someone flushes or the writer stops.
+        auto due = m_oldest + m_deadline;
+        if (m_running && m_waiting == 0 && m_rows < m_batchRows && std::chrono::steady_clock::now() < due)
+        {
+            m_wake.wait_until(lock, due);
+            continue;
+        }
+
+        size_t count = m_rows;
+        auto oldest = m_oldest;
+        m_spare.clear();
+        m_queue.swap(m_spare);
+        m_rows = 0;
+        lock.unlock();
+        m_space.notify_all();
+
+        bool ok = _Write(m_spare, count);
+        double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - oldest).count();
+
+        lock.lock();
+        if (ok)
+        {
+            m_stats.written += count;
+            m_stats.flushes++;
+            m_stats.lastLatency = latency;
+            m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+            m_totalLatency += latency;
+        }
+        else
+        {
+            m_stats.failed += count;
+        }
+        m_done += count;
+        m_flushed.notify_all();
+    }
+}
@@ -0,0 +1,240 @@
+/*
+ * @FilePath: /simtochat/util/src/MySQLConnectionPool.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 18:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 18:02:37
+ * @Description:
+ */
+#include "MySQLConnectionPool.h"
+#include <mysql/mysql.h>
+#include <algorithm>
+
+MySQLConnectionPool::Handle::Handle()
+    : m_pool(nullptr)
+{
+
+}
+
+MySQLConnectionPool::Handle::Handle(MySQLConnectionPool* pool, std::unique_ptr<MySQLConnector> connector)
+    : m_pool(pool), m_connector(std::move(connector))
+{
+
+}
+
+MySQLConnectionPool::Handle::Handle(Handle&& other)
+    : m_pool(other.m_pool), m_connector(std::move(other.m_connector))
+{
+    other.m_pool = nullptr;
+}
+
+MySQLConnectionPool::Handle& MySQLConnectionPool::Handle::operator=(Handle&& other)
+{
+    if (this != &other)
+    {
+        Release();
+        m_pool = other.m_pool;
+        m_connector = std::move(other.m_connector);
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+MySQLConnectionPool::Handle::~Handle()
+{
+    Release();
+}
+
+MySQLConnector* MySQLConnectionPool::Handle::operator->() const
+{
+    return m_connector.get();
+}
+
+MySQLConnector& MySQLConnectionPool::Handle::operator*() const
+{
+    return *m_connector;
+}
+
+MySQLConnectionPool::Handle::operator bool() const
+{
+    return m_connector != nullptr;
+}
+
+void MySQLConnectionPool::Handle::Release()
+{
+    if (m_pool && m_connector) m_pool->_Return(std::move(m_connector));
+    m_pool = nullptr;
+}
+
+MySQLConnectionPool::MySQLConnectionPool(unsigned int minSize, unsigned int maxSize, std::chrono::seconds idleTimeout)
+    : m_port(0), m_minSize(minSize), m_maxSize(std::max(minSize, maxSize)), m_idleTimeout(idleTimeout),
+      m_validation(5), m_size(0)
+{
+
+}
+
+MySQLConnectionPool::~MySQLConnectionPool()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    m_idle.clear();
+}
+
+void MySQLConnectionPool::Setup(
+    const std::string& serverIp,
+    const std::string& username,
+    const std::string& password,
+    const std::string& dbname,
+    unsigned int port
+)
+{
+    // The client library must be initialized before several threads use it.
+    if (0 != mysql_library_init(0, nullptr, nullptr)) throw MySQLException();
+
+    std::vector<IdleConnector> opened;
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_serverIp = serverIp;
+        m_username = username;
+        m_password = password;
+        m_dbname = dbname;
+        m_port = port;
+    }
+
+    for (unsigned int i = 0; i < m_minSize; i++)
+    {
+        opened.push_back({ _Open(), std::chrono::steady_clock::now() });
+    }
+
+    std::lock_guard<std::mutex> lock{ m_lock };
+    for (auto& idle : opened)
+    {
+        m_idle.push_back(std::move(idle));
+        m_size++;
+    }
+}
+
+MySQLConnectionPool::Handle MySQLConnectionPool::Checkout(std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<std::unique_ptr<MySQLConnector>> expired;
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (true)
+    {
+        auto now = std::chrono::steady_clock::now();
+        _Reap(now, expired);
+
+        if (!m_idle.empty())
+        {
+            IdleConnector idle = std::move(m_idle.back());
+            m_idle.pop_back();
+            lock.unlock();
+            expired.clear();
+
+            // The server may have dropped a connection which was idle for a while.
+            if (now - idle.since > m_validation && !idle.connector->Ping())
+            {
+                try
+                {
+                    idle.connector->Close();
+                    idle.connector->Connect();
+                }
+                catch(...)
+                {
+                    lock.lock();
+                    m_size--;
+                    m_cvReturn.notify_one();
+                    throw;
+                }
+            }
+            return Handle(this, std::move(idle.connector));
+        }
+
+        if (m_size < m_maxSize)
+        {
+            m_size++;
+            lock.unlock();
+            expired.clear();
+            try
+            {
+                return Handle(this, _Open());
+            }
+            catch(...)
+            {
+                lock.lock();
+                m_size--;
+                m_cvReturn.notify_one();
+                throw;
+            }
+        }
+
+        if (m_cvReturn.wait_until(lock, deadline) == std::cv_status::timeout) throw MySQLException();
+    }
+}
+
+unsigned int MySQLConnectionPool::getSize()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_size;
+}
+
+unsigned int MySQLConnectionPool::getIdleCount()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_idle.size();
+}
+
+void MySQLConnectionPool::_Return(std::unique_ptr<MySQLConnector> connector)
+{
+    // Check the connection outside the lock, a broken one is reconnected or dropped.
+    if (!connector->Ping())
+    {
+        try
+        {
+            connector->Close();
+            connector->Connect();
+        }
+        catch(...)
+        {
+            connector.reset();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{ m_lock };
+    if (connector)
+    {
+        m_idle.push_back({ std::move(connector), std::chrono::steady_clock::now() });
+    }
+    else
+    {
+        m_size--;
+    }
+    m_cvReturn.notify_one();
+}
+
+std::unique_ptr<MySQLConnector> MySQLConnectionPool::_Open()
+{
+    std::unique_ptr<MySQLConnector> connector(new MySQLConnector);
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        connector->Setup(m_serverIp, m_username, m_password, m_dbname, m_port);
+    }
+    connector->Connect();
+    return connector;
+}
+
+void MySQLConnectionPool::_Reap(
+    std::chrono::steady_clock::time_point now,
+    std::vector<std::unique_ptr<MySQLConnector>>& expired
+)
+{
+    // The front of the stack is the one idle for the longest time.
+    size_t count = 0;
+    while (count < m_idle.size() && m_size > m_minSize && now - m_idle[count].since > m_idleTimeout)
+    {
+        expired.push_back(std::move(m_idle[count].connector));
+        m_size--;
+        count++;
+    }
+    m_idle.erase(m_idle.begin(), m_idle.begin() + count);
+}
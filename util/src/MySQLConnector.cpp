@@ -7,13 +7,30 @@
  * @Description: 
  */
 #include "MySQLConnector.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <mysql/mysql.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include <algorithm>
+#include <vector>
+
+// The time of every query and execution of a statement, with its results when they are stored.
+static const int s_queryTime = Metrics::RegisterHistogram("mysql.query");
 
 MySQLException::MySQLException()
+    : m_errMsg("An exception occurred while accessing MySQL!")
 {
     
 }
 
+MySQLException::MySQLException(const std::string& msg)
+    : m_errMsg(msg)
+{
+
+}
+
 MySQLException::~MySQLException()
 {
     
@@ -21,11 +38,11 @@ MySQLException::~MySQLException()
 
 const char* MySQLException::what() const noexcept
 {
-    return "An exception occurred while accessing MySQL!";
+    return m_errMsg.c_str();
 }
 
-MySQLResultSet::MySQLResultSet(MYSQL_RES* mysql_res)
-    : m_res(mysql_res), m_rows(nullptr)
+MySQLResultSet::MySQLResultSet(MYSQL_RES* mysql_res, MYSQL* mysql)
+    : m_res(mysql_res), m_mysql(mysql), m_rows(nullptr), m_lengths(nullptr)
 {
 
 }
@@ -38,7 +55,16 @@ MySQLResultSet::~MySQLResultSet()
 bool MySQLResultSet::NextRow()
 {
     m_rows = mysql_fetch_row(m_res);
-    return m_rows != nullptr;
+    if (!m_rows)
+    {
+        m_lengths = nullptr;
+
+        // A streamed result also ends with a null row when the connection fails.
+        if (m_mysql && mysql_errno(m_mysql)) throw MySQLException(mysql_error(m_mysql));
+        return false;
+    }
+    m_lengths = mysql_fetch_lengths(m_res);
+    return true;
 }
 
 char* MySQLResultSet::getData(unsigned int cols) const
@@ -51,9 +77,37 @@ const char* MySQLResultSet::operator[](unsigned int cols) const
     return getData(cols);
 }
 
+unsigned long MySQLResultSet::getLength(unsigned int cols) const
+{
+    return m_lengths[cols];
+}
+
+bool MySQLResultSet::isNull(unsigned int cols) const
+{
+    return m_rows[cols] == nullptr;
+}
+
+int64_t MySQLResultSet::getInt(unsigned int cols) const
+{
+    return m_rows[cols] ? strtoll(m_rows[cols], nullptr, 10) : 0;
+}
+
+double MySQLResultSet::getDouble(unsigned int cols) const
+{
+    return m_rows[cols] ? strtod(m_rows[cols], nullptr) : 0;
+}
+
+std::string MySQLResultSet::getString(unsigned int cols) const
+{
+    return m_rows[cols] ? std::string(m_rows[cols], m_lengths[cols]) : std::string();
+}
+
 void MySQLResultSet::Release()
 {
     mysql_free_result(m_res);
+    m_res = nullptr;
+    m_rows = nullptr;
+    m_lengths = nullptr;
 }
 
 unsigned int MySQLResultSet::getRowsNum() const
@@ -66,6 +120,286 @@ unsigned int MySQLResultSet::getFiledsNum() const
     return mysql_num_fields(m_res);
 }
 
+/**
+ * @author: CGL
+ * @struct MySQLStatement::Binding
+ * @description: The parameters and the columns of a statement with their storage.
+ */
+struct MySQLStatement::Binding
+{
+    // my_bool in older client libraries, bool in MySQL 8.
+    using Flag = std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type;
+
+    struct Param
+    {
+        int64_t integer;
+        double real;
+        std::string text;
+        unsigned long length;
+    };
+
+    struct Column
+    {
+        enum_field_types type;
+        std::vector<char> buffer;
+        unsigned long length;
+        Flag isNull;
+        Flag error;
+    };
+
+    std::vector<MYSQL_BIND> params;
+    std::vector<Param> values;
+    std::vector<MYSQL_BIND> results;
+    std::vector<Column> columns;
+};
+
+MySQLStatement::MySQLStatement(MYSQL* mysql, const std::string& sql)
+    : m_stmt(nullptr), m_binding(new Binding)
+{
+    m_stmt = mysql_stmt_init(mysql);
+    if (!m_stmt) throw MySQLException(mysql_error(mysql));
+    if (0 != mysql_stmt_prepare(m_stmt, sql.c_str(), sql.length()))
+    {
+        MySQLException e(mysql_stmt_error(m_stmt));
+        mysql_stmt_close(m_stmt);
+        throw e;
+    }
+
+    unsigned long count = mysql_stmt_param_count(m_stmt);
+    m_binding->params.resize(count);
+    m_binding->values.resize(count);
+    memset(m_binding->params.data(), 0, sizeof(MYSQL_BIND) * count);
+    for (auto& param : m_binding->params) param.buffer_type = MYSQL_TYPE_NULL;
+
+    MYSQL_RES* meta = mysql_stmt_result_metadata(m_stmt);
+    if (!meta) return;
+
+    // Integers and reals are fetched in their binary form, everything else as a string.
+    unsigned int fields = mysql_num_fields(meta);
+    MYSQL_FIELD* field = mysql_fetch_fields(meta);
+    m_binding->columns.resize(fields);
+    for (unsigned int i = 0; i < fields; i++)
+    {
+        Binding::Column& column = m_binding->columns[i];
+        switch (field[i].type)
+        {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_YEAR:
+            column.type = MYSQL_TYPE_LONGLONG;
+            column.buffer.resize(sizeof(int64_t));
+            break;
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+            column.type = MYSQL_TYPE_DOUBLE;
+            column.buffer.resize(sizeof(double));
+            break;
+        default:
+            column.type = MYSQL_TYPE_STRING;
+            column.buffer.resize(64);
+            break;
+        }
+    }
+    mysql_free_result(meta);
+
+    m_binding->results.resize(fields);
+    memset(m_binding->results.data(), 0, sizeof(MYSQL_BIND) * fields);
+    for (unsigned int i = 0; i < fields; i++)
+    {
+        Binding::Column& column = m_binding->columns[i];
+        MYSQL_BIND& bind = m_binding->results[i];
+        bind.buffer_type = column.type;
+        bind.buffer = column.buffer.data();
+        bind.buffer_length = column.buffer.size();
+        bind.length = &column.length;
+        bind.is_null = &column.isNull;
+        bind.error = &column.error;
+    }
+}
+
+MySQLStatement::~MySQLStatement()
+{
+    if (m_stmt) mysql_stmt_close(m_stmt);
+}
+
+void MySQLStatement::BindInt(unsigned int index, int64_t value)
+{
+    if (index >= m_binding->params.size()) throw MySQLException("Parameter index out of range!");
+    Binding::Param& param = m_binding->values[index];
+    MYSQL_BIND& bind = m_binding->params[index];
+    param.integer = value;
+    bind.buffer_type = MYSQL_TYPE_LONGLONG;
+    bind.buffer = &param.integer;
+    bind.length = nullptr;
+}
+
+void MySQLStatement::BindDouble(unsigned int index, double value)
+{
+    if (index >= m_binding->params.size()) throw MySQLException("Parameter index out of range!");
+    Binding::Param& param = m_binding->values[index];
+    MYSQL_BIND& bind = m_binding->params[index];
+    param.real = value;
+    bind.buffer_type = MYSQL_TYPE_DOUBLE;
+    bind.buffer = &param.real;
+    bind.length = nullptr;
+}
+
+void MySQLStatement::BindString(unsigned int index, const char* data, size_t length)
+{
+    if (index >= m_binding->params.size()) throw MySQLException("Parameter index out of range!");
+    Binding::Param& param = m_binding->values[index];
+    MYSQL_BIND& bind = m_binding->params[index];
+    param.text.assign(data, length);
+    param.length = length;
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = &param.text[0];
+    bind.buffer_length = length;
+    bind.length = &param.length;
+}
+
+void MySQLStatement::BindString(unsigned int index, const std::string& value)
+{
+    BindString(index, value.data(), value.length());
+}
+
+void MySQLStatement::BindNull(unsigned int index)
+{
+    if (index >= m_binding->params.size()) throw MySQLException("Parameter index out of range!");
+    MYSQL_BIND& bind = m_binding->params[index];
+    bind.buffer_type = MYSQL_TYPE_NULL;
+    bind.buffer = nullptr;
+    bind.length = nullptr;
+}
+
+uint64_t MySQLStatement::Excute()
+{
+    MetricsTimer timer(s_queryTime);
+    TRACE_SCOPE("mysql.query");
+    _Execute();
+    return mysql_stmt_affected_rows(m_stmt);
+}
+
+void MySQLStatement::ExcuteQuery()
+{
+    MetricsTimer timer(s_queryTime);
+    TRACE_SCOPE("mysql.query");
+    _Execute();
+    if (mysql_stmt_bind_result(m_stmt, m_binding->results.data())) _Throw();
+    if (0 != mysql_stmt_store_result(m_stmt)) _Throw();
+}
+
+bool MySQLStatement::NextRow()
+{
+    int rst = mysql_stmt_fetch(m_stmt);
+    if (rst == MYSQL_NO_DATA) return false;
+    if (rst == 1) _Throw();
+    if (rst != MYSQL_DATA_TRUNCATED) return true;
+
+    // A string was longer than its buffer: grow the buffer and fetch the column again.
+    for (unsigned int i = 0; i < m_binding->columns.size(); i++)
+    {
+        Binding::Column& column = m_binding->columns[i];
+        MYSQL_BIND& bind = m_binding->results[i];
+        if (column.type != MYSQL_TYPE_STRING || column.length <= column.buffer.size()) continue;
+        column.buffer.resize(column.length);
+        bind.buffer = column.buffer.data();
+        bind.buffer_length = column.buffer.size();
+        if (0 != mysql_stmt_fetch_column(m_stmt, &bind, i, 0)) _Throw();
+    }
+    if (mysql_stmt_bind_result(m_stmt, m_binding->results.data())) _Throw();
+    return true;
+}
+
+bool MySQLStatement::isNull(unsigned int cols) const
+{
+    return m_binding->columns.at(cols).isNull;
+}
+
+int64_t MySQLStatement::getInt(unsigned int cols) const
+{
+    const Binding::Column& column = m_binding->columns.at(cols);
+    if (column.isNull) return 0;
+
+    int64_t integer;
+    double real;
+    switch (column.type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+        memcpy(&integer, column.buffer.data(), sizeof(integer));
+        return integer;
+    case MYSQL_TYPE_DOUBLE:
+        memcpy(&real, column.buffer.data(), sizeof(real));
+        return static_cast<int64_t>(real);
+    default:
+        return strtoll(getString(cols).c_str(), nullptr, 10);
+    }
+}
+
+double MySQLStatement::getDouble(unsigned int cols) const
+{
+    const Binding::Column& column = m_binding->columns.at(cols);
+    if (column.isNull) return 0;
+
+    double real;
+    switch (column.type)
+    {
+    case MYSQL_TYPE_DOUBLE:
+        memcpy(&real, column.buffer.data(), sizeof(real));
+        return real;
+    case MYSQL_TYPE_LONGLONG:
+        return static_cast<double>(getInt(cols));
+    default:
+        return strtod(getString(cols).c_str(), nullptr);
+    }
+}
+
+std::string MySQLStatement::getString(unsigned int cols) const
+{
+    const Binding::Column& column = m_binding->columns.at(cols);
+    if (column.isNull) return std::string();
+
+    switch (column.type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+        return std::to_string(getInt(cols));
+    case MYSQL_TYPE_DOUBLE:
+        return std::to_string(getDouble(cols));
+    default:
+        return std::string(column.buffer.data(), std::min<size_t>(column.length, column.buffer.size()));
+    }
+}
+
+unsigned int MySQLStatement::getFiledsNum() const
+{
+    return m_binding->columns.size();
+}
+
+uint64_t MySQLStatement::getInsertId() const
+{
+    return mysql_stmt_insert_id(m_stmt);
+}
+
+void MySQLStatement::Release()
+{
+    mysql_stmt_free_result(m_stmt);
+}
+
+void MySQLStatement::_Execute()
+{
+    // A result which was not released would block the next execution.
+    mysql_stmt_free_result(m_stmt);
+    if (!m_binding->params.empty() && mysql_stmt_bind_param(m_stmt, m_binding->params.data())) _Throw();
+    if (0 != mysql_stmt_execute(m_stmt)) _Throw();
+}
+
+void MySQLStatement::_Throw() const
+{
+    throw MySQLException(mysql_stmt_error(m_stmt));
+}
+
 MySQLConnector::MySQLConnector()
     : m_mysql(nullptr), m_result(nullptr), m_ready(false), m_init(false)
 {
@@ -99,15 +433,17 @@ void MySQLConnector::Connect()
     if (m_ready) return;
     
     _SafeInit();
-    m_mysql = mysql_real_connect(
+
+    // Keep the handle on failure, it still has to be closed.
+    MYSQL* mysql = mysql_real_connect(
         m_mysql,
         m_config.serverIp.c_str(),
         m_config.username.c_str(),
         m_config.password.c_str(),
         m_config.dbname.c_str(),
-        0, nullptr, 0
+        m_config.port, nullptr, 0
     );
-    if (!m_mysql) throw MySQLException();
+    if (!mysql) throw MySQLException();
     m_ready = true;
 }
 
@@ -116,8 +452,20 @@ void MySQLConnector::Close()
     _SafeClose();
 }
 
+bool MySQLConnector::Ping()
+{
+    return m_ready && 0 == mysql_ping(m_mysql);
+}
+
+bool MySQLConnector::isConnected() const
+{
+    return m_ready;
+}
+
 uint64_t MySQLConnector::Excute(const std::string& sql)
 {
+    MetricsTimer timer(s_queryTime);
+    TRACE_SCOPE("mysql.query");
     if (0 != mysql_real_query(m_mysql, sql.c_str(), sql.length()))
     {
         throw MySQLException();
@@ -125,14 +473,35 @@ uint64_t MySQLConnector::Excute(const std::string& sql)
     return mysql_affected_rows(m_mysql);
 }
 
-MySQLResultSet MySQLConnector::ExcuteQuery(const std::string& query)
+MySQLResultSet MySQLConnector::ExcuteQuery(const std::string& query, MySQLResultMode mode)
 {
+    MetricsTimer timer(s_queryTime);
+    TRACE_SCOPE("mysql.query");
     if (0 != mysql_real_query(m_mysql, query.c_str(), query.length()))
     {
         throw MySQLException();
     }
-    MYSQL_RES* res = mysql_store_result(m_mysql);
-    return MySQLResultSet(res);
+    if (mode == MRM_STORE)
+    {
+        MYSQL_RES* res = mysql_store_result(m_mysql);
+        return MySQLResultSet(res);
+    }
+
+    // The rows stay on the server side of the socket until NextRow() reads them.
+    MYSQL_RES* res = mysql_use_result(m_mysql);
+    if (!res && mysql_errno(m_mysql)) throw MySQLException(mysql_error(m_mysql));
+    return MySQLResultSet(res, m_mysql);
+}
+
+MySQLStatement& MySQLConnector::Prepare(const std::string& sql)
+{
+    auto it = m_statements.find(sql);
+    if (it != m_statements.end()) return *it->second;
+
+    std::unique_ptr<MySQLStatement> statement(new MySQLStatement(m_mysql, sql));
+    MySQLStatement& ref = *statement;
+    m_statements.emplace(sql, std::move(statement));
+    return ref;
 }
 
 void MySQLConnector::_SafeInit()
@@ -147,8 +516,12 @@ void MySQLConnector::_SafeInit()
 
 void MySQLConnector::_SafeClose()
 {
+    // The statements belong to the connection, close them first.
+    m_statements.clear();
     mysql_free_result(m_result);
     mysql_close(m_mysql);
+    m_result = nullptr;
+    m_mysql = nullptr;
     m_ready = false;
     m_init = false;
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+ * @FilePath: /simtochat/util/src/OrderedExecutor.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 15:02:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 15:02:37
+ * @Description:
+ */
+#include "OrderedExecutor.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+OrderedExecutor::OrderedExecutor(unsigned short threads, ThreadPoolMode mode)
+    : m_pool(std::max<unsigned short>(threads, 1), mode)
+{
+
+}
+
+OrderedExecutor::~OrderedExecutor()
+{
+
+}
+
+void OrderedExecutor::Post(uint64_t key, Task&& task)
+{
+    Shard& shard = _ShardOf(key);
+    {
+        std::lock_guard<std::mutex> lock{ shard.lock };
+        Strand** found = shard.strands.Find(key);
+        if (found)
+        {
+            // The strand is queued or running, it will get to this task.
+            (*found)->tasks.push_back(std::move(task));
+            return;
+        }
+
+        Strand* strand;
+        if (shard.spare.empty())
+        {
+            shard.owned.emplace_back(new Strand);
+            strand = shard.owned.back().get();
+        }
+        else
+        {
+            strand = shard.spare.back();
+            shard.spare.pop_back();
+        }
+        strand->tasks.push_back(std::move(task));
+        shard.strands.Insert(key, strand);
+    }
+    m_pool.post(&OrderedExecutor::_Drain, this, key);
+}
+
+size_t OrderedExecutor::getActiveCount()
+{
+    size_t count = 0;
+    for (Shard& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock{ shard.lock };
+        count += shard.strands.getSize();
+    }
+    return count;
+}
+
+OrderedExecutor::Shard& OrderedExecutor::_ShardOf(uint64_t key)
+{
+    // The low bits of a serial are a file descriptor, mix in the generation above them.
+    return m_shards[(key ^ (key >> 32)) % ORDERED_EXECUTOR_SHARDS];
+}
+
+void OrderedExecutor::_Drain(uint64_t key)
+{
+    Shard& shard = _ShardOf(key);
+    for (int ran = 0; ; ran++)
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock{ shard.lock };
+            Strand* strand = *shard.strands.Find(key);
+            if (strand->head == strand->tasks.size())
+            {
+                // Dry: the next Post() of the key starts a new strand.
+                strand->tasks.clear();
+                strand->head = 0;
+                shard.strands.Erase(key);
+                shard.spare.push_back(strand);
+                return;
+            }
+            if (ran == ORDERED_EXECUTOR_BATCH) break;
+
+            task = std::move(strand->tasks[strand->head++]);
+
+            // Drop the tasks already run once they are most of the vector.
+            if (strand->head >= ORDERED_EXECUTOR_BATCH && strand->head * 2 >= strand->tasks.size())
+            {
+                strand->tasks.erase(strand->tasks.begin(), strand->tasks.begin() + strand->head);
+                strand->head = 0;
+            }
+        }
+
+        // A task which throws must not take the worker down, nor leave the strand of its key running.
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+
+        }
+    }
+
+    // The key keeps its strand, so its tasks stay in order behind the other keys.
+    try
+    {
+        m_pool.post(&OrderedExecutor::_Drain, this, key);
+    }
+    catch(const std::runtime_error&)
+    {
+        // The executor is being destroyed, the rest of the strand is dropped with it.
+    }
+}
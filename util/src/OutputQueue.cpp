@@ -0,0 +1,141 @@
+/*
+ * @FilePath: /simtochat/util/src/OutputQueue.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 23:20:06
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 23:20:06
+ * @Description:
+ */
+#include "OutputQueue.h"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <algorithm>
+
+#define OUTPUT_QUEUE_IOVECS     64      // Pieces written by one sendmsg
+
+OutputQueue::OutputQueue(size_t capacity)
+    : m_buffer(capacity), m_first(0), m_gaps(0), m_sharedBytes(0)
+{
+
+}
+
+OutputQueue::OutputQueue(OutputQueue&& other) noexcept
+    : m_buffer(std::move(other.m_buffer)), m_segments(std::move(other.m_segments)), m_first(other.m_first),
+      m_gaps(other.m_gaps), m_sharedBytes(other.m_sharedBytes)
+{
+    other.m_segments.clear();
+    other.m_first = other.m_gaps = other.m_sharedBytes = 0;
+}
+
+OutputQueue& OutputQueue::operator=(OutputQueue&& other) noexcept
+{
+    if (this != &other)
+    {
+        m_buffer = std::move(other.m_buffer);
+        m_segments = std::move(other.m_segments);
+        m_first = other.m_first;
+        m_gaps = other.m_gaps;
+        m_sharedBytes = other.m_sharedBytes;
+        other.m_segments.clear();
+        other.m_first = other.m_gaps = other.m_sharedBytes = 0;
+    }
+    return *this;
+}
+
+void OutputQueue::Append(const SharedBuffer& buffer, size_t offset)
+{
+    if (offset >= buffer.getSize()) return;
+    size_t gap = m_buffer.getReadableBytes() - m_gaps;
+    m_segments.push_back(Segment{ buffer, offset, gap });
+    m_gaps += gap;
+    m_sharedBytes += buffer.getSize() - offset;
+}
+
+int OutputQueue::Gather(iovec* vec, int max)
+{
+    size_t readable = m_buffer.getReadableBytes();
+    const char* bytes = readable > 0 ? m_buffer.Peek() : nullptr;
+    size_t consumed = 0;
+    int count = 0;
+    for (size_t i = m_first; i < m_segments.size() && count < max; i++)
+    {
+        const Segment& segment = m_segments[i];
+        if (segment.gap > 0)
+        {
+            vec[count].iov_base = const_cast<char*>(bytes + consumed);
+            vec[count++].iov_len = segment.gap;
+            consumed += segment.gap;
+            if (count == max) return count;
+        }
+        vec[count].iov_base = const_cast<char*>(segment.buffer.getData() + segment.offset);
+        vec[count++].iov_len = segment.buffer.getSize() - segment.offset;
+    }
+    if (count < max && consumed < readable)
+    {
+        vec[count].iov_base = const_cast<char*>(bytes + consumed);
+        vec[count++].iov_len = readable - consumed;
+    }
+    return count;
+}
+
+void OutputQueue::Retrieve(size_t n)
+{
+    while (n > 0 && m_first < m_segments.size())
+    {
+        Segment& segment = m_segments[m_first];
+        size_t gap = std::min(n, segment.gap);
+        m_buffer.Retrieve(gap);
+        segment.gap -= gap;
+        m_gaps -= gap;
+        n -= gap;
+        if (segment.gap > 0) return;
+
+        size_t sent = std::min(n, segment.buffer.getSize() - segment.offset);
+        segment.offset += sent;
+        m_sharedBytes -= sent;
+        n -= sent;
+        if (segment.offset < segment.buffer.getSize()) return;
+
+        // Released as soon as it is sent, the last connection frees the bytes.
+        segment.buffer.Reset();
+        m_first++;
+    }
+
+    if (m_first == m_segments.size())
+    {
+        m_segments.clear();
+        m_first = 0;
+    }
+    else if (m_first >= 64 && m_first * 2 >= m_segments.size())
+    {
+        m_segments.erase(m_segments.begin(), m_segments.begin() + m_first);
+        m_first = 0;
+    }
+    m_buffer.Retrieve(n);
+}
+
+void OutputQueue::RetrieveAll()
+{
+    m_buffer.RetrieveAll();
+    m_segments.clear();
+    m_first = m_gaps = m_sharedBytes = 0;
+}
+
+ssize_t OutputQueue::WriteFd(int fd, int* savedErrno)
+{
+    if (!hasShared()) return m_buffer.WriteFd(fd, savedErrno);
+
+    iovec vec[OUTPUT_QUEUE_IOVECS];
+    msghdr msg = {};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = Gather(vec, OUTPUT_QUEUE_IOVECS);
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+        return -1;
+    }
+    Retrieve(n);
+    return n;
+}
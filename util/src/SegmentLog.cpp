@@ -0,0 +1,713 @@
+/*
+ * @FilePath: /simtochat/util/src/SegmentLog.cpp
+ * @Author: CGL
+ * @Date: 2026-10-18 14:36:02
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-18 14:36:02
+ * @Description:
+ */
+#include "SegmentLog.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define SEGMENT_LOG_HEADER      16              // length, checksum and key
+#define SEGMENT_LOG_ACK         0x80000000u     // Set in the length of an acknowledgement record
+#define SEGMENT_LOG_MOVED       0x40000000u     // Set in the length of a record holding moved records
+#define SEGMENT_LOG_LENGTH      0x3fffffffu     // The bits of the length itself
+#define SEGMENT_LOG_ENTRY       16              // position and length of a moved record, padded
+#define SEGMENT_LOG_SUFFIX      ".log"
+
+namespace
+{
+
+// CRC-32 (IEEE), one table lookup per byte.
+struct Crc32Table
+{
+    uint32_t entries[256];
+
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320u & (0 - (crc & 1)));
+            entries[i] = crc;
+        }
+    }
+};
+
+const Crc32Table g_crc32;
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t n)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = g_crc32.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+size_t Align8(size_t n)
+{
+    return (n + 7) & ~size_t(7);
+}
+
+// The checksum covers the length, the key and the data.
+uint32_t RecordChecksum(uint32_t length, uint64_t key, const iovec* vec, int count)
+{
+    uint32_t crc = Crc32(0, &length, sizeof(length));
+    crc = Crc32(crc, &key, sizeof(key));
+    for (int i = 0; i < count; i++) crc = Crc32(crc, vec[i].iov_base, vec[i].iov_len);
+    return crc;
+}
+
+} // namespace
+
+LogException::LogException()
+    : m_errid(0), m_errMsg("ERROR: Exception.")
+{
+
+}
+
+LogException::LogException(const std::string& msg)
+    : m_errid(0), m_errMsg(msg)
+{
+
+}
+
+LogException::LogException(int errid, const std::string& msg)
+    : m_errid(errid)
+{
+    char buffer[1024] = {0};
+    snprintf(buffer, sizeof(buffer), "ERROR(%d): %s: %s.", errid, msg.c_str(), strerror(errid));
+    m_errMsg = buffer;
+}
+
+LogException::~LogException()
+{
+
+}
+
+const char* LogException::what() const noexcept
+{
+    return m_errMsg.c_str();
+}
+
+int LogException::getErrorId() const
+{
+    return m_errid;
+}
+
+SegmentLog::SegmentLog(const std::string& dir, size_t segmentSize, std::chrono::milliseconds interval)
+    : m_dir(dir), m_segmentSize(std::min<size_t>(Align8(segmentSize), SEGMENT_LOG_LENGTH & ~7u)), m_interval(interval),
+      m_pendingBytes(0), m_liveBytes(0), m_compactAfter(0), m_appended(0), m_durable(0), m_commits(0), m_waiting(0), m_error(0), m_running(true)
+{
+    if (-1 == mkdir(m_dir.c_str(), 0755) && errno != EEXIST) throw LogException(errno, "mkdir " + m_dir);
+
+    DIR* handle = opendir(m_dir.c_str());
+    if (!handle) throw LogException(errno, "opendir " + m_dir);
+    std::vector<uint64_t> ids;
+    while (dirent* entry = readdir(handle))
+    {
+        char* end = nullptr;
+        uint64_t id = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name && strcmp(end, SEGMENT_LOG_SUFFIX) == 0) ids.push_back(id);
+    }
+    closedir(handle);
+    std::sort(ids.begin(), ids.end());
+
+    try
+    {
+        for (uint64_t id : ids)
+        {
+            m_segments.push_back(_OpenSegment(id, false));
+            _Recover(m_segments.back());
+        }
+
+        // A torn tail may be followed by older bytes, the next records go to a new segment.
+        m_segments.push_back(_OpenSegment(ids.empty() ? 1 : ids.back() + 1, true));
+    }
+    catch (...)
+    {
+        for (Segment& segment : m_segments)
+        {
+            munmap(segment.map, segment.mapSize);
+            close(segment.fd);
+        }
+        throw;
+    }
+    _DropSegments();
+
+    m_committer = std::thread(&SegmentLog::_Commit, this);
+}
+
+SegmentLog::~SegmentLog()
+{
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_committer.join();
+
+    for (Segment& segment : m_segments)
+    {
+        munmap(segment.map, segment.mapSize);
+        close(segment.fd);
+    }
+}
+
+bool SegmentLog::Append(uint64_t key, const void* data, size_t n)
+{
+    iovec vec = { const_cast<void*>(data), n };
+    return Append(key, &vec, 1);
+}
+
+bool SegmentLog::Append(uint64_t key, const iovec* vec, int count)
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return _Append(key, vec, count, 0);
+}
+
+size_t SegmentLog::Take(uint64_t key, std::vector<SharedBuffer>& batches, size_t batchSize)
+{
+    std::vector<Location> locations;
+    std::vector<Copy> copies;
+    std::vector<uint64_t> pinned;
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        std::vector<Location>* found = m_index.Find(key);
+        if (!found) return 0;
+        locations = std::move(*found);
+        _Gather(locations.data(), locations.size(), batches, batchSize, copies, pinned);
+        _Forget(key, locations, locations.size());
+        _Append(key, nullptr, 0, SEGMENT_LOG_ACK);
+    }
+    _Finish(copies, pinned);
+    return locations.size();
+}
+
+size_t SegmentLog::Read(uint64_t key, std::vector<SharedBuffer>& batches, uint64_t& position, uint64_t after,
+    size_t batchSize)
+{
+    std::vector<Copy> copies;
+    std::vector<uint64_t> pinned;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        std::vector<Location>* found = m_index.Find(key);
+        if (!found) return 0;
+        auto first = std::upper_bound(found->begin(), found->end(), after,
+            [](uint64_t after, const Location& location) { return after < location.position; });
+        count = found->end() - first;
+        if (count == 0) return 0;
+        _Gather(&*first, count, batches, batchSize, copies, pinned);
+        position = found->back().position;
+    }
+    _Finish(copies, pinned);
+    return count;
+}
+
+size_t SegmentLog::Remove(uint64_t key, uint64_t position)
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    std::vector<Location>* found = m_index.Find(key);
+    if (!found) return 0;
+    auto last = std::upper_bound(found->begin(), found->end(), position,
+        [](uint64_t position, const Location& location) { return position < location.position; });
+    size_t count = last - found->begin();
+    if (count == 0) return 0;
+
+    // All of them: the acknowledgement of Take() is enough. Otherwise it keeps the position for the recovery.
+    bool all = count == found->size();
+    _Forget(key, *found, count);
+    iovec vec = { &position, sizeof(position) };
+    _Append(key, &vec, all ? 0 : 1, SEGMENT_LOG_ACK);
+    _DropSegments();
+    return count;
+}
+
+size_t SegmentLog::getCount(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    std::vector<Location>* found = m_index.Find(key);
+    return found ? found->size() : 0;
+}
+
+void SegmentLog::Sync()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    uint64_t target = m_appended;
+    m_waiting++;
+    m_wake.notify_one();
+    m_committed.wait(lock, [this, target] { return m_durable >= target || m_error != 0; });
+    m_waiting--;
+    if (m_error != 0) throw LogException(m_error, "write " + m_dir);
+}
+
+size_t SegmentLog::getSegmentCount()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_segments.size();
+}
+
+uint64_t SegmentLog::getCommitCount()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    return m_commits;
+}
+
+SegmentLog::Segment SegmentLog::_OpenSegment(uint64_t id, bool create)
+{
+    std::string path = _Path(id);
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd == -1) throw LogException(errno, "open " + path);
+
+    // Preallocated, the commits only write data and the mapping never grows.
+    size_t size = m_segmentSize;
+    if (create)
+    {
+        int error = posix_fallocate(fd, 0, size);
+        if (error != 0 && -1 == ftruncate(fd, size)) error = errno;
+        else error = 0;
+        if (error != 0)
+        {
+            close(fd);
+            unlink(path.c_str());
+            throw LogException(error, "fallocate " + path);
+        }
+
+        // The new entry of the directory must be durable too, or the segment may be gone after a crash.
+        int dirfd = open(m_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd == -1 || -1 == fsync(dirfd))
+        {
+            error = errno;
+            if (dirfd != -1) close(dirfd);
+            close(fd);
+            unlink(path.c_str());
+            throw LogException(error, "fsync " + m_dir);
+        }
+        close(dirfd);
+    }
+    else
+    {
+        struct stat st;
+        if (-1 == fstat(fd, &st))
+        {
+            int error = errno;
+            close(fd);
+            throw LogException(error, "fstat " + path);
+        }
+        size = st.st_size;
+    }
+
+    void* map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+    if (map == MAP_FAILED)
+    {
+        int error = errno;
+        close(fd);
+        throw LogException(error, "mmap " + path);
+    }
+    return Segment{ id, fd, static_cast<char*>(map), size, 0, 0, 0, 0 };
+}
+
+void SegmentLog::_Recover(Segment& segment)
+{
+    size_t offset = 0;
+    while (offset + SEGMENT_LOG_HEADER <= segment.mapSize)
+    {
+        uint32_t length, checksum;
+        uint64_t key;
+        memcpy(&length, segment.map + offset, sizeof(length));
+        memcpy(&checksum, segment.map + offset + 4, sizeof(checksum));
+        memcpy(&key, segment.map + offset + 8, sizeof(key));
+        if (length == 0) break;
+
+        bool ack = length & SEGMENT_LOG_ACK;
+        size_t n = length & SEGMENT_LOG_LENGTH;
+        if (offset + SEGMENT_LOG_HEADER + n > segment.mapSize) break;
+        iovec vec = { segment.map + offset + SEGMENT_LOG_HEADER, n };
+        if (RecordChecksum(length, key, &vec, 1) != checksum) break;
+
+        if (ack)
+        {
+            // An acknowledgement with a position leaves the records after it.
+            std::vector<Location>* found = m_index.Find(key);
+            if (found)
+            {
+                size_t count = found->size();
+                if (n == sizeof(uint64_t))
+                {
+                    uint64_t position;
+                    memcpy(&position, vec.iov_base, sizeof(position));
+                    count = std::upper_bound(found->begin(), found->end(), position,
+                        [](uint64_t position, const Location& location) { return position < location.position; })
+                        - found->begin();
+                }
+                _Forget(key, *found, count);
+            }
+        }
+        else if (length & SEGMENT_LOG_MOVED)
+        {
+            // Records moved out of an older segment, which may still be there: they take the places of the originals.
+            std::vector<Location> moved;
+            const char* data = segment.map + offset + SEGMENT_LOG_HEADER;
+            for (size_t at = 0; at + SEGMENT_LOG_ENTRY <= n; )
+            {
+                uint64_t position;
+                uint32_t size;
+                memcpy(&position, data + at, sizeof(position));
+                memcpy(&size, data + at + 8, sizeof(size));
+                if (at + SEGMENT_LOG_ENTRY + size > n) break;
+                moved.push_back(Location{ position, segment.id, uint32_t(offset + SEGMENT_LOG_HEADER + at + SEGMENT_LOG_ENTRY), size });
+                at += Align8(SEGMENT_LOG_ENTRY + size);
+            }
+            if (!moved.empty()) _Replace(key, moved);
+        }
+        else
+        {
+            uint32_t at = uint32_t(offset + SEGMENT_LOG_HEADER);
+            m_index[key].push_back(Location{ _Position(segment.id, at), segment.id, at, uint32_t(n) });
+            segment.live++;
+            m_liveBytes += n;
+        }
+        offset += Align8(SEGMENT_LOG_HEADER + n);
+    }
+    segment.end = offset;
+}
+
+bool SegmentLog::_Append(uint64_t key, const iovec* vec, int count, uint32_t type)
+{
+    size_t n = 0;
+    for (int i = 0; i < count; i++) n += vec[i].iov_len;
+    size_t size = Align8(SEGMENT_LOG_HEADER + n);
+
+    // A record leaves room to be moved with its position and length.
+    size_t room = type == 0 ? SEGMENT_LOG_ENTRY : 0;
+    if (m_error != 0 || key == 0 || (n == 0 && type != SEGMENT_LOG_ACK) || size + room > m_segmentSize) return false;
+
+    if (m_segments.back().end + size > m_segmentSize)
+    {
+        try
+        {
+            m_segments.push_back(_OpenSegment(m_segments.back().id + 1, true));
+        }
+        catch (const LogException& e)
+        {
+            m_error = e.getErrorId() ? e.getErrorId() : EIO;
+            return false;
+        }
+    }
+    Segment& segment = m_segments.back();
+    if (m_pending.empty() || m_pending.back().segment != segment.id)
+    {
+        m_pending.push_back(Chunk{ segment.id, segment.end, std::vector<char>() });
+        m_pending.back().data.reserve(64 * 1024);
+    }
+
+    uint32_t length = uint32_t(n) | type;
+    uint32_t checksum = RecordChecksum(length, key, vec, count);
+    std::vector<char>& data = m_pending.back().data;
+    size_t start = data.size();
+    data.resize(start + size);
+    char* p = data.data() + start;
+    memcpy(p, &length, sizeof(length));
+    memcpy(p + 4, &checksum, sizeof(checksum));
+    memcpy(p + 8, &key, sizeof(key));
+    p += SEGMENT_LOG_HEADER;
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(p, vec[i].iov_base, vec[i].iov_len);
+        p += vec[i].iov_len;
+    }
+    memset(p, 0, size - SEGMENT_LOG_HEADER - n);
+
+    if (type == 0)
+    {
+        uint32_t at = uint32_t(segment.end + SEGMENT_LOG_HEADER);
+        m_index[key].push_back(Location{ _Position(segment.id, at), segment.id, at, uint32_t(n) });
+        segment.live++;
+        m_liveBytes += n;
+    }
+    segment.end += size;
+    m_appended += size;
+    m_pendingBytes += size;
+    if (m_pendingBytes >= SEGMENT_LOG_FLUSH_BYTES) m_wake.notify_one();
+    return true;
+}
+
+uint64_t SegmentLog::_Position(uint64_t segment, size_t offset)
+{
+    // The offsets are below 4 GiB, a segment is never larger.
+    return (segment << 32) | offset;
+}
+
+void SegmentLog::_Replace(uint64_t key, const std::vector<Location>& moved)
+{
+    // The live records of a key are the ones after a position, the moved ones are a run of them or all of them.
+    std::vector<Location>& locations = m_index[key];
+    auto first = std::lower_bound(locations.begin(), locations.end(), moved.front().position,
+        [](const Location& location, uint64_t position) { return location.position < position; });
+    auto last = std::upper_bound(first, locations.end(), moved.back().position,
+        [](uint64_t position, const Location& location) { return position < location.position; });
+    for (auto it = first; it != last; ++it)
+    {
+        _FindSegment(it->segment)->live--;
+        m_liveBytes -= it->length;
+    }
+    first = locations.erase(first, last);
+    locations.insert(first, moved.begin(), moved.end());
+    for (const Location& location : moved)
+    {
+        _FindSegment(location.segment)->live++;
+        m_liveBytes += location.length;
+    }
+}
+
+void SegmentLog::_Compact()
+{
+    // Only while most of the segments is records which are gone, or the live ones would be copied over and over.
+    while (m_error == 0 && m_segments.size() > 2 && m_segments.front().live > 0
+        && m_liveBytes * 2 < (m_segments.size() - 1) * m_segmentSize)
+    {
+        // The records of a key are in the order of the segments, the keys in the oldest one start there.
+        if (m_segments.back().id <= m_compactAfter) return;
+        uint64_t id = m_segments.front().id;
+        std::vector<uint64_t> keys;
+        size_t bytes = 0;
+        m_index.ForEach(
+            [&keys, &bytes, id](uint64_t key, const std::vector<Location>& locations)
+            {
+                if (locations.front().segment != id) return;
+                keys.push_back(key);
+                for (const Location& location : locations) bytes += location.length;
+            }
+        );
+
+        // Keys whose records are all over the segments would be copied whole, they are left to be taken.
+        if (bytes > m_segmentSize)
+        {
+            m_compactAfter = m_segments.back().id;
+            return;
+        }
+        for (uint64_t key : keys)
+        {
+            if (!_Move(key)) return;
+        }
+        m_segments.front().moved = m_appended;
+    }
+}
+
+bool SegmentLog::_Move(uint64_t key)
+{
+    std::vector<Location> locations = *m_index.Find(key);
+    std::vector<char> data;
+    for (size_t first = 0, last = 0; first < locations.size(); first = last)
+    {
+        // A few records at a time, each group replaces its originals on its own, a torn one leaves them where they were.
+        // They are copied before the append, which may grow the chunks they are read from.
+        data.clear();
+        while (last < locations.size()
+            && (last == first || data.size() + SEGMENT_LOG_ENTRY + locations[last].length <= SEGMENT_LOG_BATCH))
+        {
+            const Location& location = locations[last++];
+            const char* from = _ReadPending(location);
+            if (!from) from = _FindSegment(location.segment)->map + location.offset;
+            size_t at = data.size();
+            data.resize(at + Align8(SEGMENT_LOG_ENTRY + location.length));
+            memcpy(&data[at], &location.position, sizeof(location.position));
+            memcpy(&data[at + 8], &location.length, sizeof(location.length));
+            memcpy(&data[at + SEGMENT_LOG_ENTRY], from, location.length);
+        }
+        iovec vec = { data.data(), data.size() };
+        if (!_Append(key, &vec, 1, SEGMENT_LOG_MOVED)) return false;
+
+        Segment& segment = m_segments.back();
+        size_t offset = segment.end - Align8(SEGMENT_LOG_HEADER + data.size()) + SEGMENT_LOG_HEADER;
+        std::vector<Location> moved;
+        for (size_t i = first; i < last; i++)
+        {
+            moved.push_back(Location{ locations[i].position, segment.id, uint32_t(offset + SEGMENT_LOG_ENTRY), locations[i].length });
+            offset += Align8(SEGMENT_LOG_ENTRY + locations[i].length);
+        }
+        _Replace(key, moved);
+    }
+    return true;
+}
+
+void SegmentLog::_Gather(const Location* locations, size_t count, std::vector<SharedBuffer>& batches,
+    size_t batchSize, std::vector<Copy>& copies, std::vector<uint64_t>& pinned)
+{
+    // Group the records into batches first, so every batch is allocated once at its size.
+    copies.reserve(count);
+    for (size_t first = 0, last = 0; first < count; first = last)
+    {
+        size_t size = 0;
+        while (last < count && (last == first || size + locations[last].length <= batchSize))
+        {
+            size += locations[last++].length;
+        }
+
+        SharedBuffer batch(size);
+        char* p = batch.getMutableData();
+        for (size_t i = first; i < last; i++)
+        {
+            // The chunks change once the lock is released, only what is not written yet is copied now.
+            Segment* segment = _FindSegment(locations[i].segment);
+            if (const char* data = _ReadPending(locations[i])) memcpy(p, data, locations[i].length);
+            else copies.push_back(Copy{ p, segment->map + locations[i].offset, locations[i].length });
+
+            // The records of a key are in the order of the segments, so each is pinned once.
+            if (pinned.empty() || pinned.back() != segment->id)
+            {
+                segment->pins++;
+                pinned.push_back(segment->id);
+            }
+            p += locations[i].length;
+        }
+        batches.push_back(std::move(batch));
+    }
+}
+
+void SegmentLog::_Finish(const std::vector<Copy>& copies, const std::vector<uint64_t>& pinned)
+{
+    // Reading a mapping may fault in pages from the disk, the appends of the other threads go on meanwhile.
+    for (const Copy& copy : copies) memcpy(copy.to, copy.from, copy.length);
+
+    std::lock_guard<std::mutex> lock{ m_lock };
+    for (uint64_t id : pinned) _FindSegment(id)->pins--;
+    _DropSegments();
+}
+
+void SegmentLog::_Forget(uint64_t key, std::vector<Location>& locations, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        _FindSegment(locations[i].segment)->live--;
+        m_liveBytes -= locations[i].length;
+    }
+    if (count == locations.size()) m_index.Erase(key);
+    else locations.erase(locations.begin(), locations.begin() + count);
+}
+
+SegmentLog::Segment* SegmentLog::_FindSegment(uint64_t id)
+{
+    auto it = std::lower_bound(m_segments.begin(), m_segments.end(), id,
+        [](const Segment& segment, uint64_t id) { return segment.id < id; });
+    return it != m_segments.end() && it->id == id ? &*it : nullptr;
+}
+
+const char* SegmentLog::_ReadPending(const Location& location)
+{
+    // The committer only reads the chunks it writes, they can be read here too.
+    for (std::vector<Chunk>* chunks : { &m_writing, &m_pending })
+    {
+        for (const Chunk& chunk : *chunks)
+        {
+            if (chunk.segment == location.segment && location.offset >= chunk.offset
+                && location.offset < chunk.offset + chunk.data.size())
+            {
+                return chunk.data.data() + (location.offset - chunk.offset);
+            }
+        }
+    }
+    return nullptr;
+}
+
+void SegmentLog::_DropSegments()
+{
+    // Only the oldest: an acknowledgement in a later segment must outlive the records it covers.
+    // A segment whose records were moved waits until the moved ones are durable.
+    while (m_segments.size() > 1 && m_segments.front().live == 0 && m_segments.front().pins == 0
+        && m_durable >= m_segments.front().moved)
+    {
+        Segment& segment = m_segments.front();
+        auto writes = [&segment](const Chunk& chunk) { return chunk.segment == segment.id; };
+        if (std::any_of(m_pending.begin(), m_pending.end(), writes)
+            || std::any_of(m_writing.begin(), m_writing.end(), writes))
+        {
+            return;
+        }
+
+        munmap(segment.map, segment.mapSize);
+        close(segment.fd);
+        unlink(_Path(segment.id).c_str());
+        m_segments.pop_front();
+    }
+}
+
+void SegmentLog::_Commit()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    while (true)
+    {
+        // Commit what is pending after the interval, or at once if it is a lot or someone waits for it.
+        m_wake.wait_for(lock, m_interval,
+            [this]
+            {
+                return !m_running || m_pendingBytes >= SEGMENT_LOG_FLUSH_BYTES || (m_waiting > 0 && !m_pending.empty());
+            }
+        );
+        if (m_pending.empty())
+        {
+            if (!m_running) return;
+            continue;
+        }
+
+        // The appends go on into new chunks while these are written.
+        std::swap(m_pending, m_writing);
+        uint64_t target = m_appended;
+        m_pendingBytes = 0;
+        std::vector<int> fds;
+        for (const Chunk& chunk : m_writing) fds.push_back(_FindSegment(chunk.segment)->fd);
+        lock.unlock();
+
+        int error = 0;
+        for (size_t i = 0; i < m_writing.size() && error == 0; i++)
+        {
+            const Chunk& chunk = m_writing[i];
+            size_t written = 0;
+            while (written < chunk.data.size())
+            {
+                ssize_t n = pwrite(fds[i], chunk.data.data() + written, chunk.data.size() - written,
+                    chunk.offset + written);
+                if (n > 0) written += n;
+                else if (n == -1 && errno == EINTR) continue;
+                else
+                {
+                    error = n == -1 ? errno : EIO;
+                    break;
+                }
+            }
+        }
+        // One fdatasync per segment commits every append of the pass.
+        for (size_t i = 0; i < fds.size() && error == 0; i++)
+        {
+            if (i > 0 && fds[i] == fds[i - 1]) continue;
+            if (-1 == fdatasync(fds[i])) error = errno;
+        }
+
+        lock.lock();
+        m_writing.clear();
+        if (error != 0) m_error = error;
+        else m_durable = target;
+        m_commits++;
+        _Compact();
+        _DropSegments();
+        m_committed.notify_all();
+        if (error != 0) return;
+    }
+}
+
+std::string SegmentLog::_Path(uint64_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llu" SEGMENT_LOG_SUFFIX, (unsigned long long)id);
+    return m_dir + "/" + name;
+}
@@ -0,0 +1,81 @@
+/*
+ * @FilePath: /simtochat/util/src/SharedBuffer.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 23:20:06
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 23:20:06
+ * @Description:
+ */
+#include "SharedBuffer.h"
+#include "Slab.h"
+
+#include <string.h>
+#include <new>
+
+SharedBuffer::SharedBuffer(size_t size)
+    : m_block(nullptr)
+{
+    if (size > UINT32_MAX) throw std::bad_alloc();
+    m_block = ::new (SlabPool::Allocate(sizeof(Block) + size)) Block;
+    m_block->refs.store(1, std::memory_order_relaxed);
+    m_block->size = uint32_t(size);
+}
+
+SharedBuffer::SharedBuffer(const void* data, size_t size)
+    : SharedBuffer(size)
+{
+    memcpy(getMutableData(), data, size);
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) noexcept
+    : m_block(other.m_block)
+{
+    if (m_block) m_block->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+SharedBuffer::SharedBuffer(SharedBuffer&& other) noexcept
+    : m_block(other.m_block)
+{
+    other.m_block = nullptr;
+}
+
+SharedBuffer& SharedBuffer::operator=(const SharedBuffer& other) noexcept
+{
+    if (m_block != other.m_block)
+    {
+        if (other.m_block) other.m_block->refs.fetch_add(1, std::memory_order_relaxed);
+        Reset();
+        m_block = other.m_block;
+    }
+    return *this;
+}
+
+SharedBuffer& SharedBuffer::operator=(SharedBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        Reset();
+        m_block = other.m_block;
+        other.m_block = nullptr;
+    }
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer()
+{
+    Reset();
+}
+
+void SharedBuffer::Reset() noexcept
+{
+    if (!m_block) return;
+
+    // Release: the last owner must see every write made before the other owners let go.
+    if (m_block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        size_t size = m_block->size;
+        m_block->~Block();
+        SlabPool::Deallocate(m_block, sizeof(Block) + size);
+    }
+    m_block = nullptr;
+}
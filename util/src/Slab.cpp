@@ -0,0 +1,144 @@
+/*
+ * @FilePath: /simtochat/util/src/Slab.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 16:40:18
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 16:40:18
+ * @Description:
+ */
+#include "Slab.h"
+
+#include <mutex>
+
+#define SLAB_GRANULARITY    64
+#define SLAB_CLASSES        (SLAB_MAX_SIZE / SLAB_GRANULARITY)
+#define SLAB_CHUNK_BLOCKS   64      // Blocks carved from the heap at once
+#define SLAB_CACHE_BLOCKS   32      // Free blocks kept by a thread per class
+
+namespace
+{
+
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+/**
+ * @author: CGL
+ * @struct SlabClass
+ * @description: The shared free list of one size class.
+ */
+struct SlabClass
+{
+    std::mutex lock;
+    FreeBlock* free = nullptr;
+};
+
+// Never destroyed: thread caches may flush into it while the process exits.
+SlabClass* Classes()
+{
+    static SlabClass* classes = new SlabClass[SLAB_CLASSES];
+    return classes;
+}
+
+/**
+ * @author: CGL
+ * @struct ThreadCache
+ * @description: The free blocks owned by one thread, given back to the classes when it exits.
+ */
+struct ThreadCache
+{
+    FreeBlock* free[SLAB_CLASSES] = {};
+    int count[SLAB_CLASSES] = {};
+
+    ~ThreadCache()
+    {
+        for (int i = 0; i < SLAB_CLASSES; i++)
+        {
+            while (free[i])
+            {
+                FreeBlock* block = free[i];
+                free[i] = block->next;
+                std::lock_guard<std::mutex> lock{ Classes()[i].lock };
+                block->next = Classes()[i].free;
+                Classes()[i].free = block;
+            }
+        }
+    }
+};
+
+thread_local ThreadCache t_cache;
+
+// Take half a cache of blocks from the class, carving a new chunk if it is empty.
+void Refill(int index)
+{
+    size_t size = size_t(index + 1) * SLAB_GRANULARITY;
+    SlabClass& slab = Classes()[index];
+    {
+        std::lock_guard<std::mutex> lock{ slab.lock };
+        while (slab.free && t_cache.count[index] < SLAB_CACHE_BLOCKS / 2)
+        {
+            FreeBlock* block = slab.free;
+            slab.free = block->next;
+            block->next = t_cache.free[index];
+            t_cache.free[index] = block;
+            t_cache.count[index]++;
+        }
+    }
+    if (t_cache.free[index]) return;
+
+    char* chunk = static_cast<char*>(::operator new(size * SLAB_CHUNK_BLOCKS));
+    for (int i = 0; i < SLAB_CHUNK_BLOCKS; i++)
+    {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + size * i);
+        block->next = t_cache.free[index];
+        t_cache.free[index] = block;
+    }
+    t_cache.count[index] += SLAB_CHUNK_BLOCKS;
+}
+
+// Give half of a full cache back to the class.
+void Flush(int index)
+{
+    SlabClass& slab = Classes()[index];
+    std::lock_guard<std::mutex> lock{ slab.lock };
+    while (t_cache.count[index] > SLAB_CACHE_BLOCKS / 2)
+    {
+        FreeBlock* block = t_cache.free[index];
+        t_cache.free[index] = block->next;
+        block->next = slab.free;
+        slab.free = block;
+        t_cache.count[index]--;
+    }
+}
+
+} // namespace
+
+void* SlabPool::Allocate(size_t size)
+{
+    if (size > SLAB_MAX_SIZE || size == 0) return ::operator new(size);
+
+    int index = int((size - 1) / SLAB_GRANULARITY);
+    if (!t_cache.free[index]) Refill(index);
+
+    FreeBlock* block = t_cache.free[index];
+    t_cache.free[index] = block->next;
+    t_cache.count[index]--;
+    return block;
+}
+
+void SlabPool::Deallocate(void* p, size_t size)
+{
+    if (!p) return;
+    if (size > SLAB_MAX_SIZE || size == 0)
+    {
+        ::operator delete(p);
+        return;
+    }
+
+    int index = int((size - 1) / SLAB_GRANULARITY);
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = t_cache.free[index];
+    t_cache.free[index] = block;
+    if (++t_cache.count[index] > SLAB_CACHE_BLOCKS) Flush(index);
+}
@@ -7,18 +7,51 @@
  * @Description: 
  */
 #include "Socket.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "OrderedExecutor.h"
 
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <coroutine>
+#include <utility>
 
 #define SOCKET_UTIL_EXCEPTION(errid, msg) if((msg)) throw SocketException(errid, __FILE__, __LINE__, #msg)
 
+#define CLIENT_SLOT_PAGE    256             // Slots added to the registry of a loop at once
+#define SOCKET_KEPT_BUFFER  (64 * 1024)     // Larger buffers are freed when a connection closes
+#define TIMER_TASK_PAGE     256             // Slots added to the delayed tasks of a loop at once
+#define TIMER_KIND_CLIENT   1               // TimerNode::token is the serial of the client
+#define TIMER_KIND_TASK     2               // TimerNode::token is the index of the TimerTask
+
+#define SOCKET_ZEROCOPY_UNSET   0           // SO_ZEROCOPY is not set on the file descriptor yet
+#define SOCKET_ZEROCOPY_ON      1
+#define SOCKET_ZEROCOPY_OFF     2           // Not supported, or the kernel copied: copy in user space instead
+
+#define EPOLL_DIRTY             (1u << 24)  // Queued in EpollLoop::m_dirty, not an epoll event
+
+// The metrics of all the servers of the process.
+static const int s_accepted = Metrics::RegisterCounter("server.accepted");
+static const int s_closed = Metrics::RegisterCounter("server.closed");
+static const int s_bytesIn = Metrics::RegisterCounter("server.bytes_in");
+static const int s_bytesOut = Metrics::RegisterCounter("server.bytes_out");
+static const int s_events = Metrics::RegisterCounter("loop.events");
+static const int s_dispatch = Metrics::RegisterHistogram("loop.dispatch");
+static const int s_acceptor = Metrics::RegisterHistogram("server.acceptor");
+static const int s_processor = Metrics::RegisterHistogram("server.processor");
+
 SocketException::SocketException()
     : m_errid(0), m_errMsg("ERROR: Exception.")
 {
@@ -71,15 +104,14 @@ std::string SocketException::getErrorMsg() const
 }
 
 _SocketUtil::_SocketUtil()
-    : m_fd(0), m_addr(nullptr)
+    : m_fd(-1), m_addr{}, m_addrLen(sizeof(m_addr))
 {
-    m_addr = new sockaddr_in{0};
-    m_addrLen = sizeof(*m_addr);
+
 }
 
 _SocketUtil::~_SocketUtil()
 {
-    if (m_addr) delete m_addr;
+
 }
 
 int _SocketUtil::getfd() const
@@ -89,22 +121,22 @@ int _SocketUtil::getfd() const
 
 sockaddr_in _SocketUtil::getAddr_in() const
 {
-    return *m_addr;
+    return m_addr;
 }
 
 const sockaddr* _SocketUtil::getpAddr() const
 {
-    return (sockaddr*)m_addr;
+    return (const sockaddr*)&m_addr;
 }
 
 std::string _SocketUtil::getIpStr() const
 {
-    return inet_ntoa(m_addr->sin_addr);
+    return inet_ntoa(m_addr.sin_addr);
 }
 
 int _SocketUtil::getPort() const
 {
-    return ntohs(m_addr->sin_port);
+    return ntohs(m_addr.sin_port);
 }
 
 _SocketUtil::operator int() const
@@ -160,6 +192,18 @@ void _SocketUtil::_close(int fd)
     SOCKET_UTIL_EXCEPTION(0, -1 == close(fd));
 }
 
+void _SocketUtil::_setsockopt(int fd, int level, int optname, const void* optval, socklen_t optlen)
+{
+    SOCKET_UTIL_EXCEPTION(0, -1 == setsockopt(fd, level, optname, optval, optlen));
+}
+
+int _SocketUtil::_eventfd(unsigned int initval, int flags)
+{
+    int rst;
+    SOCKET_UTIL_EXCEPTION(0, -1 == (rst = eventfd(initval, flags)));
+    return rst;
+}
+
 int _SocketUtil::_epoll_create (int size)
 {
     int rst;
@@ -187,32 +231,177 @@ void _SocketUtil::_epoll_ctl (int epfd, int op, int fd, struct epoll_event *even
 }
 
 Socket::Socket()
-    : _SocketUtil()
+    : _SocketUtil(), m_input(0), m_output(0), m_loop(nullptr), m_watching(0), m_broken(false),
+      m_serial(0), m_context(0), m_lastActive(0), m_lastHeartbeat(0), m_offloads(0), m_reader(nullptr),
+      m_readWanted(0), m_zeroCopyNext(0), m_zeroCopy(SOCKET_ZEROCOPY_UNSET)
 {
 
 }
 
 Socket::Socket(int fd, const sockaddr_in& addr_in)
-    : _SocketUtil()
+    : _SocketUtil(), m_loop(nullptr), m_watching(0), m_broken(false), m_serial(0), m_context(0),
+      m_lastActive(0), m_lastHeartbeat(0), m_offloads(0), m_reader(nullptr), m_readWanted(0), m_zeroCopyNext(0),
+      m_zeroCopy(SOCKET_ZEROCOPY_UNSET)
 {
     m_fd = fd;
-    memcpy(m_addr, &addr_in, m_addrLen);
+    m_addr = addr_in;
+}
+
+Socket::Socket(Socket&& other)
+    : _SocketUtil(), m_input(std::move(other.m_input)), m_output(std::move(other.m_output)),
+      m_loop(other.m_loop), m_watching(other.m_watching), m_broken(other.m_broken),
+      m_serial(other.m_serial), m_context(other.m_context), m_lastActive(other.m_lastActive),
+      m_lastHeartbeat(other.m_lastHeartbeat), m_offloads(other.m_offloads), m_reader(other.m_reader),
+      m_readWanted(other.m_readWanted), m_zeroCopies(std::move(other.m_zeroCopies)),
+      m_zeroCopyNext(other.m_zeroCopyNext), m_zeroCopy(other.m_zeroCopy)
+{
+    m_fd = other.m_fd;
+    m_addr = other.m_addr;
+    other.m_fd = -1;
 }
 
 Socket::~Socket()
 {
-    close(m_fd);
+    if (m_fd != -1) close(m_fd);
 }
 
 void Socket::Connect(const std::string& ip, int port)
 {
     m_fd = _socket(AF_INET, SOCK_STREAM, 0);
-    m_addr->sin_family = AF_INET;
-    m_addr->sin_port = htons(port);
-    m_addr->sin_addr.s_addr = inet_addr(ip.c_str());
+    m_addr.sin_family = AF_INET;
+    m_addr.sin_port = htons(port);
+    m_addr.sin_addr.s_addr = inet_addr(ip.c_str());
     _connect(m_fd, getpAddr(), m_addrLen);
 }
 
+bool Socket::Send(const void* data, size_t n, bool more)
+{
+    if (!m_loop) return _write(m_fd, data, n, more ? MSG_MORE : 0);
+    if (m_broken) return false;
+    iovec vec{ const_cast<void*>(data), n };
+    return m_loop->_Send(*this, &vec, 1, more);
+}
+
+bool Socket::Send(const iovec* vec, int count, bool more)
+{
+    if (m_loop)
+    {
+        if (m_broken) return false;
+        return m_loop->_Send(*this, vec, count, more);
+    }
+
+    // A standalone socket blocks until everything is written.
+    for (int i = 0; i < count; i++)
+    {
+        const char* data = static_cast<const char*>(vec[i].iov_base);
+        size_t n = vec[i].iov_len;
+        while (n > 0)
+        {
+            ssize_t sent = send(m_fd, data, n, MSG_NOSIGNAL | (more || i + 1 < count ? MSG_MORE : 0));
+            if (sent < 0 && errno == EINTR) continue;
+            SOCKET_UTIL_EXCEPTION(0, sent < 0);
+            data += sent;
+            n -= sent;
+        }
+    }
+    return true;
+}
+
+bool Socket::SendZeroCopy(const void* data, size_t n, std::shared_ptr<const void> owner)
+{
+    if (!m_loop) return Send(data, n);
+    if (m_broken) return false;
+    return m_loop->_SendZeroCopy(*this, data, n, std::move(owner));
+}
+
+bool Socket::Send(const SharedBuffer& buffer, bool more)
+{
+    if (!m_loop) return Send(buffer.getData(), buffer.getSize());
+    if (m_broken) return false;
+    return m_loop->_SendShared(*this, buffer, more);
+}
+
+void Socket::Disconnect()
+{
+    if (m_loop)
+    {
+        // Closed after the callbacks of its events, or by the loop after a timer or a posted task.
+        if (!m_broken) m_loop->m_closing.push_back(m_serial);
+        m_broken = true;
+        return;
+    }
+    close(m_fd);
+    m_fd = -1;
+}
+
+Buffer& Socket::getInput()
+{
+    return m_input;
+}
+
+Buffer& Socket::getOutput()
+{
+    return m_output.getBuffer();
+}
+
+EventLoop* Socket::getLoop() const
+{
+    return m_loop;
+}
+
+uint64_t Socket::getSerial() const
+{
+    return m_serial;
+}
+
+uint64_t Socket::getContext() const
+{
+    return m_context;
+}
+
+void Socket::setContext(uint64_t context)
+{
+    m_context = context;
+}
+
+bool Socket::isOffloading() const
+{
+    return m_offloads != 0;
+}
+
+void Socket::_Attach(EventLoop* loop, int fd, const sockaddr_in& addr, uint64_t serial)
+{
+    m_fd = fd;
+    m_addr = addr;
+    m_loop = loop;
+    m_watching = 0;
+    m_broken = false;
+    m_serial = serial;
+    m_context = 0;
+    m_offloads = 0;
+    m_reader = nullptr;
+    m_readWanted = 0;
+    m_zeroCopyNext = 0;
+    m_zeroCopy = SOCKET_ZEROCOPY_UNSET;
+}
+
+void Socket::_Detach()
+{
+    if (m_fd != -1) close(m_fd);
+    m_fd = -1;
+    m_broken = false;
+    m_context = 0;
+    m_input.RetrieveAll();
+    m_output.RetrieveAll();
+
+    // A loop which did not retire the file descriptor has no completions to wait for.
+    m_zeroCopies.clear();
+
+    // Only keep the memory of usual connections, not the peak of a slow consumer.
+    if (m_input.getCapacity() > SOCKET_KEPT_BUFFER) m_input = Buffer(0);
+    if (m_output.getBuffer().getCapacity() > SOCKET_KEPT_BUFFER) m_output.getBuffer() = Buffer(0);
+}
+
 SingleServer::SingleServer()
     : _SocketUtil()
 {
@@ -226,12 +415,14 @@ SingleServer::~SingleServer()
 
 void SingleServer::Listen(int port)
 {
-    m_fd = _socket(AF_INET, SOCK_STREAM, 0);
-    m_addr->sin_family = AF_INET;
-    m_addr->sin_port = htons(port);
-    m_addr->sin_addr.s_addr = INADDR_ANY;
+    int on = 1;
+    m_fd = _socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    _setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    m_addr.sin_family = AF_INET;
+    m_addr.sin_port = htons(port);
+    m_addr.sin_addr.s_addr = INADDR_ANY;
     _bind(m_fd, getpAddr(), m_addrLen);
-    _listen(m_fd, INT32_MAX);
+    _listen(m_fd, SOMAXCONN);
 }
 
 Socket SingleServer::Accept()
@@ -242,76 +433,939 @@ Socket SingleServer::Accept()
     return Socket(sockfd, addrClient);
 }
 
-EpollServer::EpollServer()
-    : m_running(true), m_epfd(0), m_events{0}, m_acceptor(nullptr), m_processor(nullptr)
+EventLoop::EventLoop(EpollServer* server)
+    : _SocketUtil(), m_server(server), m_running(true), m_wakeupfd(-1), m_sparefd(-1), m_signaled(false),
+      m_start(std::chrono::steady_clock::now()), m_now(0)
 {
 
 }
 
-EpollServer::~EpollServer()
+EventLoop::~EventLoop()
 {
-    close(m_epfd);
-    close(m_fd);
+    if (m_wakeupfd != -1) close(m_wakeupfd);
+    if (m_sparefd != -1) close(m_sparefd);
+    if (m_fd != -1) close(m_fd);
 }
 
-void EpollServer::Run(int port)
+void EventLoop::Stop()
 {
-    m_fd = _socket(AF_INET, SOCK_STREAM, 0);
-    m_addr->sin_family = AF_INET;
-    m_addr->sin_port = htons(port);
-    m_addr->sin_addr.s_addr = INADDR_ANY;
+    m_running = false;
+    if (m_wakeupfd == -1) return;
+    uint64_t one = 1;
+    write(m_wakeupfd, &one, sizeof(one));
+}
+
+void EventLoop::Post(Task&& task)
+{
+    m_mailbox.Push(std::move(task));
+    if (m_signaled.exchange(true)) return;
+    uint64_t one = 1;
+    write(m_wakeupfd, &one, sizeof(one));
+}
+
+Socket* EventLoop::getClient(int fd)
+{
+    ClientSlot* slot = _FindSlot(fd);
+    if (!slot || !slot->used || slot->socket.m_broken) return nullptr;
+    return &slot->socket;
+}
+
+uint64_t EventLoop::RunAfter(std::chrono::milliseconds delay, Task&& task)
+{
+    if (m_freeTimerTasks.empty())
+    {
+        uint32_t first = uint32_t(m_timerTasks.size() * TIMER_TASK_PAGE);
+        m_timerTasks.emplace_back(new TimerTask[TIMER_TASK_PAGE]);
+        for (uint32_t i = TIMER_TASK_PAGE; i > 0; i--) m_freeTimerTasks.push_back(first + i - 1);
+    }
+    uint32_t index = m_freeTimerTasks.back();
+    m_freeTimerTasks.pop_back();
+
+    TimerTask& timer = m_timerTasks[index / TIMER_TASK_PAGE][index % TIMER_TASK_PAGE];
+    if (++timer.generation == 0) timer.generation = 1;
+    timer.task = std::move(task);
+    timer.node.kind = TIMER_KIND_TASK;
+    timer.node.token = index;
+    m_wheel.Schedule(timer.node, m_now + std::max<int64_t>(delay.count(), 0));
+    return (uint64_t(timer.generation) << 32) | index;
+}
+
+bool EventLoop::Cancel(uint64_t id)
+{
+    uint32_t index = uint32_t(id & 0xffffffff);
+    if (index >= m_timerTasks.size() * TIMER_TASK_PAGE) return false;
+    TimerTask& timer = m_timerTasks[index / TIMER_TASK_PAGE][index % TIMER_TASK_PAGE];
+    if (timer.generation != uint32_t(id >> 32) || !m_wheel.Cancel(timer.node)) return false;
+
+    timer.task.Reset();
+    m_freeTimerTasks.push_back(index);
+    return true;
+}
+
+void EventLoop::_ListenSocket(int port)
+{
+    const SocketOptions& options = m_server->m_options;
+    int on = 1;
+    m_fd = _socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    _setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (options.reuseAddr) _setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (options.noDelay) _setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // The buffers must be set before listen() to take part in the window scale of the handshake.
+    if (options.recvBuffer > 0)
+    {
+        _setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &options.recvBuffer, sizeof(options.recvBuffer));
+    }
+    if (options.sendBuffer > 0)
+    {
+        _setsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &options.sendBuffer, sizeof(options.sendBuffer));
+    }
+    if (options.deferAccept > 0)
+    {
+        _setsockopt(m_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.deferAccept, sizeof(options.deferAccept));
+    }
+    if (options.fastOpen > 0)
+    {
+        _setsockopt(m_fd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpen, sizeof(options.fastOpen));
+    }
+
+    m_addr.sin_family = AF_INET;
+    m_addr.sin_port = htons(port);
+    m_addr.sin_addr.s_addr = INADDR_ANY;
     _bind(m_fd, getpAddr(), m_addrLen);
-    _listen(m_fd, INT32_MAX);
+    _listen(m_fd, options.backlog > 0 ? options.backlog : SOMAXCONN);
+    m_wakeupfd = _eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+bool EventLoop::_Shed()
+{
+    // Without a free file descriptor the connection can be neither accepted nor refused,
+    // and the listener stays readable forever. Free the spare one to take the connection and close it.
+    if (m_sparefd != -1) close(m_sparefd);
+    int fd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd != -1) close(fd);
+    m_sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd != -1;
+}
+
+bool EventLoop::_SendZeroCopy(Socket& client, const void* data, size_t n,
+    [[maybe_unused]] std::shared_ptr<const void>&& owner)
+{
+    iovec vec{ const_cast<void*>(data), n };
+    return _Send(client, &vec, 1, false);
+}
+
+void EventLoop::_RunPosted()
+{
+    // Cleared before draining: a task pushed from now on writes the wakeup again.
+    m_signaled.store(false);
+
+    Task task;
+    while (m_mailbox.Pop(task))
+    {
+        task();
+        task.Reset();
+    }
+}
+
+void EventLoop::_Offload(uint64_t serial, Task&& task)
+{
+    if (m_server->m_workers) m_server->m_workers->Post(serial, std::move(task));
+    else task();
+}
+
+Socket* EventLoop::_FindClient(uint64_t serial)
+{
+    Socket* client = getClient(int(serial & 0xffffffff));
+    return client && client->m_serial == serial ? client : nullptr;
+}
+
+size_t EventLoop::_getPendingOutput(Socket& client)
+{
+    return client.m_output.getReadableBytes();
+}
+
+void EventLoop::_ResumeWriters()
+{
+    if (m_writers.empty()) return;
+    size_t lowWater = _getHighWaterMark() / 2;
+    m_resuming.swap(m_writers);
+    for (auto& writer : m_resuming)
+    {
+        // A resumed writer may write again and wait in m_writers for the next round.
+        Socket* client = _FindClient(writer.first);
+        if (client && _getPendingOutput(*client) > lowWater) m_writers.push_back(writer);
+        else std::coroutine_handle<>::from_address(writer.second).resume();
+    }
+    m_resuming.clear();
+}
+
+void EventLoop::_UpdateClock()
+{
+    auto elapsed = std::chrono::steady_clock::now() - m_start;
+    m_now = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void EventLoop::_RunTimers()
+{
+    m_wheel.Advance(m_now, [this](TimerNode& node) { _Expired(node); });
+    _CloseBroken();
+}
+
+int EventLoop::_getTimeout() const
+{
+    // Disconnected clients are closed before waiting, so no timer is needed for them.
+    int64_t timeout = m_wheel.getTimeout(m_now);
+    return int(std::min<int64_t>(timeout, INT32_MAX));
+}
+
+void EventLoop::_Expired(TimerNode& node)
+{
+    if (node.kind == TIMER_KIND_TASK)
+    {
+        // Free the slot first, the task may schedule another one.
+        uint32_t index = uint32_t(node.token);
+        Task task = std::move(m_timerTasks[index / TIMER_TASK_PAGE][index % TIMER_TASK_PAGE].task);
+        m_freeTimerTasks.push_back(index);
+        task();
+        return;
+    }
+
+    ClientSlot* slot = _FindSlot(int(node.token & 0xffffffff));
+    if (slot && slot->used && slot->socket.m_serial == node.token) _ClientTimer(*slot);
+}
+
+void EventLoop::_ClientTimer(ClientSlot& slot)
+{
+    Socket& client = slot.socket;
+    uint64_t idleTimeout = m_server->m_idleTimeout;
+    uint64_t heartbeatInterval = m_server->m_heartbeatInterval;
+
+    if (client.m_broken || (idleTimeout && m_now >= client.m_lastActive + idleTimeout))
+    {
+        _Close(slot);
+        return;
+    }
+    if (heartbeatInterval && m_now >= client.m_lastHeartbeat + heartbeatInterval)
+    {
+        client.m_lastHeartbeat = m_now;
+        if (m_server->m_heartbeat) m_server->m_heartbeat(client);
+        if (client.m_broken)
+        {
+            _Close(slot);
+            return;
+        }
+    }
+    _ScheduleClient(client);
+}
+
+void EventLoop::_ScheduleClient(Socket& client)
+{
+    uint64_t idleTimeout = m_server->m_idleTimeout;
+    uint64_t heartbeatInterval = m_server->m_heartbeatInterval;
+    if (!idleTimeout && !heartbeatInterval) return;
+
+    uint64_t expire = UINT64_MAX;
+    if (idleTimeout) expire = client.m_lastActive + idleTimeout;
+    if (heartbeatInterval) expire = std::min(expire, client.m_lastHeartbeat + heartbeatInterval);
+    client.m_timer.kind = TIMER_KIND_CLIENT;
+    client.m_timer.token = client.m_serial;
+    m_wheel.Schedule(client.m_timer, expire);
+}
+
+void EventLoop::_CloseBroken()
+{
+    // A client disconnected inside its own callbacks is usually closed already, or reused by a new one.
+    for (size_t i = 0; i < m_closing.size(); i++)
+    {
+        uint64_t serial = m_closing[i];
+        ClientSlot* slot = _FindSlot(int(serial & 0xffffffff));
+        if (slot && slot->used && slot->socket.m_serial == serial && slot->socket.m_broken) _Close(*slot);
+    }
+    m_closing.clear();
+}
+
+void EventLoop::_Accepted(Socket& client)
+{
+    Metrics::Add(s_accepted);
+    if (!m_server->m_acceptor) return;
+    MetricsTimer timer(s_acceptor);
+    TRACE_SCOPE("server.acceptor");
+    m_server->m_acceptor(client);
+}
+
+void EventLoop::_Received(Socket& client)
+{
+    if (client.m_reader)
+    {
+        // A coroutine handler waits for the input instead of the processor.
+        if (client.m_input.getReadableBytes() < client.m_readWanted) return;
+        MetricsTimer timer(s_processor);
+        TRACE_SCOPE("server.processor");
+        std::coroutine_handle<>::from_address(std::exchange(client.m_reader, nullptr)).resume();
+        return;
+    }
+    if (!m_server->m_processor) return;
+    MetricsTimer timer(s_processor);
+    TRACE_SCOPE("server.processor");
+    m_server->m_processor(client);
+}
+
+void EventLoop::_CountReceived(size_t bytes)
+{
+    Metrics::Add(s_bytesIn, bytes);
+}
+
+void EventLoop::_CountSent(size_t bytes)
+{
+    Metrics::Add(s_bytesOut, bytes);
+}
+
+void EventLoop::_Dispatched(size_t events, uint64_t start)
+{
+    uint64_t now = Metrics::Now();
+    Metrics::Add(s_events, events);
+    Metrics::Record(s_dispatch, now - start);
+    TRACE_SPAN("loop.dispatch", start, now);
+}
+
+size_t EventLoop::_getHighWaterMark() const
+{
+    return m_server->m_highWaterMark;
+}
+
+size_t EventLoop::_getMaxInputSize() const
+{
+    return m_server->m_maxInputSize;
+}
+
+EventLoop::ClientSlot& EventLoop::_GetSlot(int fd)
+{
+    while (size_t(fd) >= m_slots.size() * CLIENT_SLOT_PAGE)
+    {
+        m_slots.emplace_back(new ClientSlot[CLIENT_SLOT_PAGE]);
+    }
+    return m_slots[fd / CLIENT_SLOT_PAGE][fd % CLIENT_SLOT_PAGE];
+}
+
+EventLoop::ClientSlot* EventLoop::_FindSlot(int fd)
+{
+    if (fd < 0 || size_t(fd) >= m_slots.size() * CLIENT_SLOT_PAGE) return nullptr;
+    return &m_slots[fd / CLIENT_SLOT_PAGE][fd % CLIENT_SLOT_PAGE];
+}
+
+EventLoop::ClientSlot& EventLoop::_OpenClient(int fd, const sockaddr_in& addr)
+{
+    ClientSlot& slot = _GetSlot(fd);
+    if (++slot.generation == 0) slot.generation = 1;
+    slot.used = true;
+    slot.socket._Attach(this, fd, addr, (uint64_t(slot.generation) << 32) | uint32_t(fd));
+    slot.socket.m_lastActive = slot.socket.m_lastHeartbeat = m_now;
+    _ScheduleClient(slot.socket);
+    return slot;
+}
+
+void EventLoop::_CloseClient(ClientSlot& slot)
+{
+    Metrics::Add(s_closed);
+    if (slot.socket.m_reader)
+    {
+        // The handler sees the client closed and returns false from its read.
+        slot.socket.m_broken = true;
+        std::coroutine_handle<>::from_address(std::exchange(slot.socket.m_reader, nullptr)).resume();
+    }
+    auto& closer = m_server->m_closer;
+    if (closer) closer(slot.socket);
+    m_wheel.Cancel(slot.socket.m_timer);
+    if (_Retire(slot.socket)) slot.socket.m_fd = -1;
+    slot.socket._Detach();
+    slot.used = false;
+}
+
+void EventLoop::_Close(ClientSlot& slot)
+{
+    _CloseClient(slot);
+}
+
+bool EventLoop::_Retire([[maybe_unused]] Socket& client)
+{
+    return false;
+}
+
+void EventLoop::_CloseAll()
+{
+    // Let the application forget the clients before they are closed with the loop.
+    // A backend may only finish closing some of them after their operations in flight.
+    for (auto& page : m_slots)
+    {
+        for (int i = 0; i < CLIENT_SLOT_PAGE; i++)
+        {
+            if (page[i].used) _Close(page[i]);
+        }
+    }
+    _ResumeWriters();
+}
+
+bool EventLoop::_HasClients()
+{
+    for (auto& page : m_slots)
+    {
+        for (int i = 0; i < CLIENT_SLOT_PAGE; i++)
+        {
+            if (page[i].used) return true;
+        }
+    }
+    return false;
+}
+
+EpollLoop::EpollLoop(EpollServer* server)
+    : EventLoop(server), m_epfd(-1), m_events{}
+{
+
+}
 
+EpollLoop::~EpollLoop()
+{
+    // The payloads still in flight go with the process, which is usually exiting now.
+    for (Retired& retired : m_retired) close(retired.fd);
+    if (m_epfd != -1) close(m_epfd);
+}
+
+void EpollLoop::Listen(int port)
+{
+    _ListenSocket(port);
     m_epfd = _epoll_create(128);
-    addfd(m_epfd, m_fd, true);
+    addfd(m_epfd, m_fd, true, m_fd);
+    addfd(m_epfd, m_wakeupfd, false, m_wakeupfd);
+}
 
+void EpollLoop::Loop()
+{
+    _UpdateClock();
     while (m_running)
     {
-        int count = epoll_wait(m_epfd, m_events, 128, -1);
-        for (size_t i = 0; i < count; i++)
+        // One iteration is a request of the tracer.
+        TRACE_REQUEST("loop");
+        _RunTimers();
+        _ResumeWriters();
+        _ProcessDirty();
+        int count;
+        {
+            TRACE_SCOPE("loop.wait");
+            count = epoll_wait(m_epfd, m_events, 128, _getTimeout());
+        }
+        _UpdateClock();
+        uint64_t start = Metrics::Now();
+        for (int i = 0; i < count; i++)
         {
-            int sockfd = m_events[i].data.fd;
-            if (sockfd == m_fd)
+            uint64_t token = m_events[i].data.u64;
+            int sockfd = int(token & 0xffffffff);
+            uint32_t generation = uint32_t(token >> 32);
+            if (generation != 0)
+            {
+                // An event queued for a connection which was closed earlier in this batch is stale.
+                ClientSlot* slot = _FindSlot(sockfd);
+                if (!slot || !slot->used || slot->generation != generation) continue;
+                if (!_HandleEvent(slot->socket, m_events[i].events)) _CloseClient(*slot);
+            }
+            else if (sockfd == m_fd)
             {
-                sockaddr_in addrClient;
-                socklen_t addrLen = sizeof(addrClient);
-                int clientfd = _accept(m_fd, (sockaddr*)&addrClient, &addrLen);
-                m_clientMap[clientfd] = Socket(clientfd, addrClient);
-                addfd(m_epfd, clientfd, true);
-                if (!m_acceptor) continue;
-                m_acceptor(m_clientMap[clientfd]);
+                _HandleAccept();
+            }
+            else if (sockfd == m_wakeupfd)
+            {
+                uint64_t one;
+                while (read(m_wakeupfd, &one, sizeof(one)) > 0);
+                _RunPosted();
+                _CloseBroken();
             }
             else
             {
-                if (!m_processor) continue;
-                m_processor(m_clientMap[sockfd]);
+                _ReapRetired(sockfd);
             }
         }
+        if (count > 0) _Dispatched(count, start);
     }
+
+    _CloseAll();
 }
 
-void EpollServer::setAcceptor(std::function<void(Socket&)> acceptor)
+bool EpollLoop::_Send(Socket& client, const iovec* vec, int count, bool more)
 {
-    m_acceptor = acceptor;
+    // Nothing is queued: write directly and only queue what the kernel does not take.
+    size_t sent = 0;
+    if (client.m_output.getReadableBytes() == 0)
+    {
+        msghdr msg = {};
+        msg.msg_iov = const_cast<iovec*>(vec);
+        msg.msg_iovlen = std::min(count, IOV_MAX);
+        ssize_t rst = sendmsg(client.m_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (more ? MSG_MORE : 0));
+        if (rst >= 0) _CountSent(sent = rst);
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            client.m_broken = true;
+            return false;
+        }
+    }
+
+    bool queued = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (sent >= vec[i].iov_len)
+        {
+            sent -= vec[i].iov_len;
+            continue;
+        }
+        client.m_output.Append(static_cast<const char*>(vec[i].iov_base) + sent, vec[i].iov_len - sent);
+        sent = 0;
+        queued = true;
+    }
+    if (queued && !_UpdateEvents(client)) return false;
+    return true;
 }
 
-void EpollServer::setProcessor(std::function<void(Socket&)> processor)
+bool EpollLoop::_SendShared(Socket& client, const SharedBuffer& buffer, bool more)
 {
-    m_processor = processor;
+    if (more)
+    {
+        client.m_output.Append(buffer);
+        _MarkDirty(client);
+        return true;
+    }
+
+    size_t sent = 0;
+    if (client.m_output.getReadableBytes() == 0)
+    {
+        ssize_t rst = send(client.m_fd, buffer.getData(), buffer.getSize(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rst >= 0) _CountSent(sent = rst);
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            client.m_broken = true;
+            return false;
+        }
+    }
+
+    if (sent < buffer.getSize())
+    {
+        client.m_output.Append(buffer, sent);
+        if (!_UpdateEvents(client)) return false;
+    }
+    return true;
+}
+
+void EpollLoop::_MarkDirty(Socket& client)
+{
+    if (client.m_watching & EPOLL_DIRTY) return;
+    client.m_watching |= EPOLL_DIRTY;
+    m_dirty.push_back(client.m_serial);
+}
+
+void EpollLoop::_ProcessDirty()
+{
+    // Closing a client runs the closer, which may mark more clients. They are visited in the same pass.
+    for (size_t i = 0; i < m_dirty.size(); i++)
+    {
+        uint64_t serial = m_dirty[i];
+        ClientSlot* slot = _FindSlot(int(serial & 0xffffffff));
+        if (!slot || !slot->used || slot->generation != uint32_t(serial >> 32)) continue;
+
+        // Waiting for EPOLLOUT already: the kernel takes nothing now.
+        Socket& client = slot->socket;
+        client.m_watching &= ~EPOLL_DIRTY;
+        bool flushed = (client.m_watching & EPOLLOUT) || _Flush(client);
+        if (client.m_broken || !flushed || !_UpdateEvents(client)) _CloseClient(*slot);
+    }
+    m_dirty.clear();
+}
+
+bool EpollLoop::_SendZeroCopy(Socket& client, const void* data, size_t n, std::shared_ptr<const void>&& owner)
+{
+    // Behind queued output the payload would have to wait in the buffer anyway.
+    if (n < SOCKET_ZEROCOPY_MIN || client.m_zeroCopy == SOCKET_ZEROCOPY_OFF || client.m_output.getReadableBytes() > 0)
+    {
+        return EventLoop::_SendZeroCopy(client, data, n, std::move(owner));
+    }
+    if (client.m_zeroCopy == SOCKET_ZEROCOPY_UNSET)
+    {
+        int on = 1;
+        bool enabled = 0 == setsockopt(client.m_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+        client.m_zeroCopy = enabled ? SOCKET_ZEROCOPY_ON : SOCKET_ZEROCOPY_OFF;
+        if (!enabled) return EventLoop::_SendZeroCopy(client, data, n, std::move(owner));
+    }
+
+    size_t sent = 0;
+    ssize_t rst = send(client.m_fd, data, n, MSG_NOSIGNAL | MSG_DONTWAIT | MSG_ZEROCOPY);
+    if (rst > 0)
+    {
+        // The kernel numbers every zero-copy send which took data, the completions come back by these numbers.
+        _CountSent(sent = rst);
+        client.m_zeroCopies.push_back(Socket::ZeroCopySend{ client.m_zeroCopyNext++, std::move(owner) });
+    }
+    else if (rst < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ENOBUFS)
+    {
+        // ENOBUFS: out of the memory for pinning pages, copy this time.
+        client.m_broken = true;
+        return false;
+    }
+
+    if (sent < n)
+    {
+        client.m_output.Append(static_cast<const char*>(data) + sent, n - sent);
+        if (!_UpdateEvents(client)) return false;
+    }
+    return true;
+}
+
+void EpollLoop::_ReapZeroCopy(Socket& client)
+{
+    // A loopback or a device without scatter-gather copies anyway, and pinning only costs more.
+    if (_ReapZeroCopy(client.m_fd, client.m_zeroCopies)) client.m_zeroCopy = SOCKET_ZEROCOPY_OFF;
+}
+
+bool EpollLoop::_ReapZeroCopy(int fd, std::vector<Socket::ZeroCopySend>& sends)
+{
+    bool copied = false;
+    char control[256];
+    while (!sends.empty())
+    {
+        msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT))
+        {
+            if (errno == EINTR) continue;
+            return copied;
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            bool recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recverr) continue;
+            const sock_extended_err* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) continue;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) copied = true;
+
+            // The sends from ee_info to ee_data are complete. The counter may wrap around.
+            uint32_t first = err->ee_info, last = err->ee_data;
+            sends.erase(std::remove_if(sends.begin(), sends.end(),
+                [first, last](const Socket::ZeroCopySend& zc) { return zc.id - first <= last - first; }),
+                sends.end());
+        }
+    }
+    return copied;
+}
+
+bool EpollLoop::_Retire(Socket& client)
+{
+    _ReapZeroCopy(client);
+    if (client.m_zeroCopies.empty()) return false;
+
+    // Closing would leave the sends queued in the kernel, reading pages whose owners are freed and reused.
+    // Only the errors are watched now: the completions raise EPOLLERR, the stale serial is never dispatched.
+    epoll_event ev;
+    ev.data.u64 = uint32_t(client.m_fd);
+    ev.events = EPOLLET;
+    if (-1 == epoll_ctl(m_epfd, EPOLL_CTL_MOD, client.m_fd, &ev)) return false;
+    m_retired.push_back(Retired{ client.m_fd, std::move(client.m_zeroCopies) });
+    return true;
+}
+
+void EpollLoop::_ReapRetired(int fd)
+{
+    auto it = std::find_if(m_retired.begin(), m_retired.end(), [fd](const Retired& retired) { return retired.fd == fd; });
+    if (it == m_retired.end()) return;
+    _ReapZeroCopy(fd, it->sends);
+    if (!it->sends.empty()) return;
+    close(fd);
+    m_retired.erase(it);
+}
+
+bool EpollLoop::_HandleEvent(Socket& client, uint32_t events)
+{
+    // The completions of zero-copy sends raise EPOLLERR too, it is only an error if the socket has one.
+    if ((events & EPOLLERR) && !client.m_zeroCopies.empty())
+    {
+        _ReapZeroCopy(client);
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (0 == getsockopt(client.m_fd, SOL_SOCKET, SO_ERROR, &error, &len) && error == 0) events &= ~EPOLLERR;
+    }
+
+    // Writable: the peer has taken some data, continue with the pending output.
+    if ((events & EPOLLOUT) && !_Flush(client)) return false;
+
+    if (client.m_watching & EPOLLIN)
+    {
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !_HandleRead(client)) return false;
+    }
+    else if (events & (EPOLLHUP | EPOLLERR))
+    {
+        // Reading is paused, nobody would ever notice the error.
+        return false;
+    }
+
+    return !client.m_broken && _UpdateEvents(client);
+}
+
+bool EpollLoop::_HandleRead(Socket& client)
+{
+    int savedErrno = 0;
+    bool eof = false;
+
+    // Edge-triggered: everything in the kernel must be read now, no other event will come for it.
+    // The drain stops at the maximum input, so the processor consumes a flood as it arrives.
+    bool full = true;
+    while (full)
+    {
+        ssize_t n = client.getInput().ReadFd(client.getfd(), &savedErrno, &eof, _getMaxInputSize());
+        full = client.m_input.getReadableBytes() > _getMaxInputSize();
+        if (n > 0)
+        {
+            _CountReceived(n);
+            client.m_lastActive = m_now;
+            _Received(client);
+        }
+        if (n < 0 || eof || client.m_broken) return false;
+
+        // What the processor left behind is a partial request, past the maximum it is never going to complete.
+        if (client.m_input.getReadableBytes() > _getMaxInputSize()) return false;
+    }
+
+    // Data appended to the output buffer directly. Skip it if it is already waiting for EPOLLOUT.
+    if (client.m_watching & EPOLLOUT) return true;
+    return _Flush(client);
+}
+
+bool EpollLoop::_Flush(Socket& client)
+{
+    int savedErrno = 0;
+    OutputQueue& output = client.m_output;
+    while (output.getReadableBytes() > 0)
+    {
+        ssize_t n = output.WriteFd(client.getfd(), &savedErrno);
+        if (n >= 0)
+        {
+            _CountSent(n);
+            continue;
+        }
+        if (savedErrno == EINTR) continue;
+
+        // The socket buffer is full, keep the rest until EPOLLOUT.
+        return savedErrno == EAGAIN || savedErrno == EWOULDBLOCK;
+    }
+    return true;
 }
 
-void EpollServer::setnonblocking(int fd)
+bool EpollLoop::_UpdateEvents(Socket& client)
 {
-    fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    size_t pending = client.m_output.getReadableBytes();
+    size_t highWater = _getHighWaterMark();
+    bool reading = client.m_watching & EPOLLIN;
+
+    // Stop reading from a peer which does not read its replies, resume after half is drained.
+    if (pending > highWater) reading = false;
+    else if (pending <= highWater / 2) reading = true;
+
+    uint32_t events = EPOLLET;
+    if (reading) events |= EPOLLIN;
+    if (pending > 0) events |= EPOLLOUT;
+    if (events == (client.m_watching & ~EPOLL_DIRTY)) return true;
+
+    // Modifying re-checks the readiness, so bytes which arrived while paused are reported again.
+    epoll_event ev;
+    ev.data.u64 = client.m_serial;
+    ev.events = events;
+    if (-1 == epoll_ctl(m_epfd, EPOLL_CTL_MOD, client.getfd(), &ev))
+    {
+        client.m_broken = true;
+        return false;
+    }
+    client.m_watching = events | (client.m_watching & EPOLL_DIRTY);
+    return true;
 }
 
-void EpollServer::addfd(int epfd, int fd, bool enable_et)
+void EpollLoop::addfd(int epfd, int fd, bool enable_et, uint64_t token)
 {
     epoll_event ev;
-    ev.data.fd = fd;
+    ev.data.u64 = token;
     ev.events = EPOLLIN;
     if (enable_et) ev.events = EPOLLIN | EPOLLET;
     _epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
-    setnonblocking(fd);
-}
\ No newline at end of file
+}
+
+void EpollLoop::_HandleAccept()
+{
+    while (m_running)
+    {
+        sockaddr_in addrClient;
+        socklen_t addrLen = sizeof(addrClient);
+        int clientfd = accept4(m_fd, (sockaddr*)&addrClient, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientfd == -1)
+        {
+            int error = errno;
+            if (error == EINTR || error == ECONNABORTED || error == EPROTO) continue;
+            if (error == EAGAIN || error == EWOULDBLOCK) return;
+            if (error == EMFILE || error == ENFILE)
+            {
+                if (_Shed()) continue;
+                return;
+            }
+            throw SocketException(error, __FILE__, __LINE__, "accept4");
+        }
+
+        ClientSlot& slot = _OpenClient(clientfd, addrClient);
+        Socket& client = slot.socket;
+        addfd(m_epfd, clientfd, true, client.m_serial);
+        client.m_watching = EPOLLIN | EPOLLET;
+        _Accepted(client);
+        if (client.m_broken || !_Flush(client) || !_UpdateEvents(client)) _CloseClient(slot);
+    }
+}
+
+EpollServer::EpollServer()
+    : m_loopCount(1), m_highWaterMark(4 * 1024 * 1024), m_maxInputSize(4 * 1024 * 1024),
+      m_acceptor(nullptr), m_processor(nullptr), m_closer(nullptr), m_idleTimeout(0), m_heartbeatInterval(0), m_heartbeat(nullptr), m_workerCount(0)
+{
+    // Every server registers the same gauge, it counts the connections of all of them.
+    Metrics::RegisterGauge("server.connections",
+        [] { return int64_t(Metrics::getCounter(s_accepted) - Metrics::getCounter(s_closed)); });
+}
+
+EpollServer::~EpollServer()
+{
+    Stop();
+    for (auto& thread : m_threads)
+    {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void EpollServer::Run(int port)
+{
+    unsigned short count = m_loopCount;
+    if (count == 0) count = std::max(1u, std::thread::hardware_concurrency());
+
+    // The workers of a previous run stop before its loops go, they may still post to them.
+    m_workers.reset();
+    if (m_workerCount > 0) m_workers.reset(new OrderedExecutor(m_workerCount));
+
+    // Every loop listens before any of them runs, so a bind error is thrown from here.
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_error = nullptr;
+        m_loops.clear();
+        for (unsigned short i = 0; i < count; i++)
+        {
+            m_loops.emplace_back(_CreateLoop());
+            m_loops.back()->Listen(port);
+        }
+    }
+
+    for (unsigned short i = 1; i < count; i++)
+    {
+        EventLoop* loop = m_loops[i].get();
+        m_threads.emplace_back(
+            [this, loop]
+            {
+                try
+                {
+                    loop->Loop();
+                }
+                catch(...)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{ m_lock };
+                        if (!m_error) m_error = std::current_exception();
+                    }
+                    Stop();
+                }
+            }
+        );
+    }
+
+    try
+    {
+        m_loops[0]->Loop();
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        if (!m_error) m_error = std::current_exception();
+    }
+
+    Stop();
+    for (auto& thread : m_threads)
+    {
+        if (thread.joinable()) thread.join();
+    }
+    m_threads.clear();
+
+    if (m_error) std::rethrow_exception(m_error);
+}
+
+void EpollServer::Stop()
+{
+    std::lock_guard<std::mutex> lock{ m_lock };
+    for (auto& loop : m_loops)
+    {
+        loop->Stop();
+    }
+}
+
+void EpollServer::setLoopCount(unsigned short count)
+{
+    m_loopCount = count;
+}
+
+void EpollServer::setHighWaterMark(size_t bytes)
+{
+    m_highWaterMark = bytes;
+}
+
+void EpollServer::setMaxInputSize(size_t bytes)
+{
+    m_maxInputSize = bytes;
+}
+
+void EpollServer::setAcceptor(std::function<void(Socket&)> acceptor)
+{
+    m_acceptor = acceptor;
+}
+
+void EpollServer::setProcessor(std::function<void(Socket&)> processor)
+{
+    m_processor = processor;
+}
+
+void EpollServer::setCloser(std::function<void(Socket&)> closer)
+{
+    m_closer = closer;
+}
+
+void EpollServer::setIdleTimeout(std::chrono::milliseconds timeout)
+{
+    m_idleTimeout = std::max<int64_t>(timeout.count(), 0);
+}
+
+void EpollServer::setHeartbeat(std::chrono::milliseconds interval, std::function<void(Socket&)> heartbeat)
+{
+    m_heartbeatInterval = std::max<int64_t>(interval.count(), 0);
+    m_heartbeat = heartbeat;
+}
+
+void EpollServer::setSocketOptions(const SocketOptions& options)
+{
+    m_options = options;
+}
+
+void EpollServer::setWorkerCount(unsigned short count)
+{
+    m_workerCount = count;
+}
+
+std::unique_ptr<EventLoop> EpollServer::_CreateLoop()
+{
+    return std::unique_ptr<EventLoop>(new EpollLoop(this));
+}
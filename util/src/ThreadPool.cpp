@@ -4,49 +4,45 @@
  * @Date: 2021-05-13 22:53:07
  * @LastEditors: CGL
  * @LastEditTime: 2021-05-19 21:51:14
- * @Description: 
+ * @Description:
  */
 #include "ThreadPool.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <algorithm>
 
-ThreadPool::ThreadPool(unsigned short size)
-    : m_stoped(false)
+// The time a task waits in a queue, and the time it runs.
+static const int s_wait = Metrics::RegisterHistogram("threadpool.wait");
+static const int s_run = Metrics::RegisterHistogram("threadpool.run");
+
+// The pool and the index of the current thread if it is a worker in TPM_STEALING mode.
+static thread_local ThreadPool* t_pool = nullptr;
+static thread_local unsigned short t_index = 0;
+
+ThreadPool::ThreadPool(unsigned short size, ThreadPoolMode mode)
+    : m_mode(mode), m_stoped(false), m_nextQueue(0), m_pending(0), m_sleeping(0)
 {
     m_idleNum = std::max<unsigned short>(size, 1u);
 
+    // There is no deque to hold the tasks without any thread.
+    if (size == 0) m_mode = TPM_SHARED;
+
+    if (m_mode == TPM_STEALING)
+    {
+        // All the deques exist before any thread may steal from them.
+        for (unsigned short i = 0; i < size; ++i)
+        {
+            m_queues.emplace_back(new WorkerQueue);
+        }
+    }
+
     for (unsigned short i = 0; i < size; ++i)
     {
         m_poll.emplace_back(
-            [this]
+            [this, i]
             {
-                while (!this->m_stoped)
-                {
-                    Task task;
-
-                    // Control the life cycle of lock.
-                    {
-                        std::unique_lock<std::mutex> lock(this->m_lock);
-
-                        // Block the thread when no task is available.
-                        this->m_cvTask.wait(
-                            lock,
-                            [this]
-                            {
-                                return this->m_stoped.load() || !this->m_tasks.empty();
-                            }
-                        );
-                        if (this->m_stoped && this->m_tasks.empty()) return;
-
-                        // Get the task from the task queue.
-                        task = std::move(this->m_tasks.front());
-                        this->m_tasks.pop();
-                    }
-                    
-                    // Do the task.
-                    this->m_idleNum--;
-                    task();
-                    this->m_idleNum++;
-                }
+                if (this->m_mode == TPM_STEALING) this->_RunStealing(i);
+                else this->_RunShared();
             }
         );
     }
@@ -54,7 +50,11 @@ ThreadPool::ThreadPool(unsigned short size)
 
 ThreadPool::~ThreadPool()
 {
-    m_stoped.store(true);
+    {
+        // Under the lock, so that a thread can not miss it between checking and waiting.
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_stoped.store(true);
+    }
     m_cvTask.notify_all();
     for (auto& thread : m_poll)
     {
@@ -65,4 +65,141 @@ ThreadPool::~ThreadPool()
 unsigned short ThreadPool::getIdleCount()
 {
     return m_idleNum;
-}
\ No newline at end of file
+}
+
+void ThreadPool::_Enqueue(Task&& task)
+{
+    uint64_t now = Metrics::Now();
+    if (m_mode == TPM_SHARED)
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_lock };
+
+            // Enqueue.
+            m_tasks.PushBack(std::move(task), now);
+        }
+
+        // Wake up a thread to execute.
+        m_cvTask.notify_one();
+        return;
+    }
+
+    // A worker keeps its own tasks, others are spread over all the deques.
+    unsigned int index = (t_pool == this) ? t_index : m_nextQueue++ % m_queues.size();
+    WorkerQueue& queue = *m_queues[index];
+    {
+        std::lock_guard<std::mutex> lock{ queue.lock };
+        queue.tasks.PushBack(std::move(task), now);
+    }
+    m_pending++;
+
+    // Only pay for the lock and the notification when a thread is really sleeping.
+    // A thread counts itself as sleeping before it checks m_pending, so one of the two sees the other.
+    if (m_sleeping.load() > 0)
+    {
+        { std::lock_guard<std::mutex> lock{ m_lock }; }
+        m_cvTask.notify_one();
+    }
+}
+
+void ThreadPool::_RunShared()
+{
+    while (!this->m_stoped)
+    {
+        Task task;
+        uint64_t queued;
+
+        // Control the life cycle of lock.
+        {
+            std::unique_lock<std::mutex> lock(this->m_lock);
+
+            // Block the thread when no task is available.
+            this->m_cvTask.wait(
+                lock,
+                [this]
+                {
+                    return this->m_stoped.load() || this->m_tasks.getSize() > 0;
+                }
+            );
+
+            // Get the task from the task queue.
+            if (!this->m_tasks.PopFront(task, &queued)) return;
+        }
+
+        // Do the task.
+        this->m_idleNum--;
+        _Run(task, queued);
+        this->m_idleNum++;
+    }
+}
+
+void ThreadPool::_RunStealing(unsigned short index)
+{
+    t_pool = this;
+    t_index = index;
+
+    while (true)
+    {
+        Task task;
+        uint64_t queued;
+        if (_TakeTask(index, task, queued))
+        {
+            // Do the task.
+            m_idleNum--;
+            _Run(task, queued);
+            m_idleNum++;
+            continue;
+        }
+
+        // Nothing to run or steal: sleep until a task is queued.
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_sleeping++;
+        m_cvTask.wait(
+            lock,
+            [this]
+            {
+                return m_stoped.load() || m_pending.load() > 0;
+            }
+        );
+        m_sleeping--;
+        if (m_stoped && m_pending.load() <= 0) return;
+    }
+}
+
+bool ThreadPool::_TakeTask(unsigned short index, Task& task, uint64_t& queued)
+{
+    if (m_pending.load() <= 0) return false;
+
+    // The own deque first, newest task first while it is still hot in the cache.
+    {
+        WorkerQueue& queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock{ queue.lock };
+        if (queue.tasks.PopBack(task, &queued))
+        {
+            m_pending--;
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another deque, starting from the neighbour.
+    size_t size = m_queues.size();
+    for (size_t i = 1; i < size; i++)
+    {
+        WorkerQueue& queue = *m_queues[(index + i) % size];
+        std::unique_lock<std::mutex> lock{ queue.lock, std::try_to_lock };
+        if (!lock.owns_lock() || !queue.tasks.PopFront(task, &queued)) continue;
+        m_pending--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::_Run(Task& task, uint64_t queued)
+{
+    uint64_t start = Metrics::Now();
+    Metrics::Record(s_wait, start - queued);
+    TRACE_REQUEST("threadpool.task");
+    TRACE_SPAN("threadpool.wait", queued, start);
+    task();
+    Metrics::Record(s_run, Metrics::Now() - start);
+}
@@ -0,0 +1,187 @@
+/*
+ * @FilePath: /simtochat/util/src/TimerWheel.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 21:05:37
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 21:05:37
+ * @Description:
+ */
+#include "TimerWheel.h"
+
+#include <string.h>
+
+#define TIMER_EXPIRED_SLOT  (TIMER_LEVELS * TIMER_SLOTS)    // The slot of the timers in m_expired
+#define TIMER_MAX_DELAY     ((1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+// The distance from start to the next slot in use, or -1 if the bitmap is empty.
+static int FindNextSlot(const uint64_t* bitmap, unsigned int start)
+{
+    for (unsigned int distance = 0; distance < TIMER_SLOTS; )
+    {
+        unsigned int index = (start + distance) & (TIMER_SLOTS - 1);
+        uint64_t bits = bitmap[index >> 6] >> (index & 63);
+        if (bits) return int(distance + __builtin_ctzll(bits));
+        distance += 64 - (index & 63);
+    }
+    return -1;
+}
+
+static void InitList(TimerNode& sentinel)
+{
+    sentinel.prev = &sentinel;
+    sentinel.next = &sentinel;
+}
+
+TimerWheel::TimerWheel()
+    : m_current(0), m_size(0)
+{
+    for (TimerNode& slot : m_slots) InitList(slot);
+    InitList(m_expired);
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+    memset(m_levelSize, 0, sizeof(m_levelSize));
+}
+
+void TimerWheel::Schedule(TimerNode& node, uint64_t expire)
+{
+    if (node.isPending()) Cancel(node);
+    node.expire = expire;
+    _Insert(node);
+    m_size++;
+}
+
+bool TimerWheel::Cancel(TimerNode& node)
+{
+    if (!node.isPending()) return false;
+
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    if (node.slot != TIMER_EXPIRED_SLOT)
+    {
+        int level = node.slot / TIMER_SLOTS;
+        m_levelSize[level]--;
+        TimerNode& sentinel = m_slots[node.slot];
+        if (sentinel.next == &sentinel)
+        {
+            unsigned int index = node.slot % TIMER_SLOTS;
+            m_bitmap[level][index >> 6] &= ~(1ull << (index & 63));
+        }
+    }
+    node.prev = node.next = nullptr;
+    m_size--;
+    return true;
+}
+
+int64_t TimerWheel::getTimeout(uint64_t now) const
+{
+    uint64_t next = _NextEvent();
+    if (next == UINT64_MAX) return -1;
+    return next <= now ? 0 : int64_t(next - now);
+}
+
+void TimerWheel::_Insert(TimerNode& node)
+{
+    if (node.expire < m_current) node.expire = m_current;
+    if (node.expire - m_current > TIMER_MAX_DELAY) node.expire = m_current + TIMER_MAX_DELAY;
+
+    // The lowest level whose span covers the delay.
+    uint64_t delay = node.expire - m_current;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delay >= (1ull << (TIMER_SLOT_BITS * (level + 1)))) level++;
+    unsigned int index = (node.expire >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+
+    TimerNode& sentinel = m_slots[level * TIMER_SLOTS + index];
+    node.slot = uint16_t(level * TIMER_SLOTS + index);
+    node.prev = sentinel.prev;
+    node.next = &sentinel;
+    sentinel.prev->next = &node;
+    sentinel.prev = &node;
+    m_bitmap[level][index >> 6] |= 1ull << (index & 63);
+    m_levelSize[level]++;
+}
+
+uint64_t TimerWheel::_NextEvent() const
+{
+    uint64_t next = UINT64_MAX;
+    if (m_levelSize[0] > 0)
+    {
+        int distance = FindNextSlot(m_bitmap[0], m_current & (TIMER_SLOTS - 1));
+        next = m_current + distance;
+    }
+
+    // A slot of a higher level is due when the ticks reach a multiple of its span with its index.
+    for (int level = 1; level < TIMER_LEVELS; level++)
+    {
+        if (m_levelSize[level] == 0) continue;
+        int shift = TIMER_SLOT_BITS * level;
+        uint64_t block = (m_current + (1ull << shift) - 1) >> shift;
+        int distance = FindNextSlot(m_bitmap[level], block & (TIMER_SLOTS - 1));
+        uint64_t tick = (block + distance) << shift;
+        if (tick < next) next = tick;
+    }
+    return next;
+}
+
+bool TimerWheel::_Step(uint64_t now)
+{
+    uint64_t tick = _NextEvent();
+    if (tick == UINT64_MAX || tick > now)
+    {
+        if (now >= m_current) m_current = now + 1;
+        return false;
+    }
+
+    // Bring the timers of this tick down to the first level, from the highest level first.
+    m_current = tick;
+    for (int level = TIMER_LEVELS - 1; level > 0; level--)
+    {
+        int shift = TIMER_SLOT_BITS * level;
+        if ((tick & ((1ull << shift) - 1)) == 0) _Cascade(level, (tick >> shift) & (TIMER_SLOTS - 1));
+    }
+
+    unsigned int index = tick & (TIMER_SLOTS - 1);
+    TimerNode& sentinel = m_slots[index];
+    if (sentinel.next != &sentinel)
+    {
+        for (TimerNode* node = sentinel.next; node != &sentinel; node = node->next)
+        {
+            node->slot = TIMER_EXPIRED_SLOT;
+            m_levelSize[0]--;
+        }
+        m_expired.next = sentinel.next;
+        m_expired.prev = sentinel.prev;
+        m_expired.next->prev = &m_expired;
+        m_expired.prev->next = &m_expired;
+        InitList(sentinel);
+        m_bitmap[0][index >> 6] &= ~(1ull << (index & 63));
+    }
+
+    // The callbacks schedule relative to the next tick.
+    m_current = tick + 1;
+    return true;
+}
+
+TimerNode* TimerWheel::_PopExpired()
+{
+    if (m_expired.next == &m_expired) return nullptr;
+    TimerNode* node = m_expired.next;
+    Cancel(*node);
+    return node;
+}
+
+void TimerWheel::_Cascade(int level, unsigned int index)
+{
+    TimerNode& sentinel = m_slots[level * TIMER_SLOTS + index];
+    if (sentinel.next == &sentinel) return;
+
+    TimerNode* node = sentinel.next;
+    sentinel.prev->next = nullptr;
+    InitList(sentinel);
+    m_bitmap[level][index >> 6] &= ~(1ull << (index & 63));
+    while (node)
+    {
+        TimerNode* next = node->next;
+        m_levelSize[level]--;
+        _Insert(*node);
+        node = next;
+    }
+}
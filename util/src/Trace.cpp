@@ -0,0 +1,228 @@
+/*
+ * @FilePath: /simtochat/util/src/Trace.cpp
+ * @Author: CGL
+ * @Date: 2026-10-19 10:24:05
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-19 10:24:05
+ * @Description:
+ */
+#include "Trace.h"
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <memory>
+
+namespace
+{
+
+// The spans of one thread. Only its thread writes them, Collect() copies them and checks the head again.
+struct TraceRing
+{
+    std::atomic<uint64_t> head{ 0 };     // Spans ever written, grows without wrapping
+    uint32_t thread = 0;
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+struct Registry
+{
+    std::mutex lock;
+    std::vector<TraceRing*> rings;
+    std::deque<std::unique_ptr<TraceRing>> retired;
+};
+
+// Never destroyed, like the registry of Metrics.
+Registry& GetRegistry()
+{
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+std::atomic<uint32_t> s_period{ 0 };
+std::atomic<uint64_t> s_requests{ 0 };
+
+// Trivial, so reading them on the hot path is a plain TLS access.
+thread_local bool t_inside = false;     // Inside a request, sampled or not
+thread_local uint64_t t_request = 0;    // The sampled request, 0 if not sampled
+thread_local uint32_t t_seen = 0;       // Requests since the last sampled one
+thread_local TraceRing* t_ring = nullptr;
+thread_local bool t_retired = false;
+
+// Registers the ring of its thread, and retires it when the thread exits.
+struct RingOwner
+{
+    TraceRing* ring;
+
+    RingOwner() : ring(new TraceRing)
+    {
+        ring->thread = uint32_t(syscall(SYS_gettid));
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock{ registry.lock };
+        registry.rings.push_back(ring);
+    }
+
+    ~RingOwner()
+    {
+        Registry& registry = GetRegistry();
+        {
+            std::lock_guard<std::mutex> lock{ registry.lock };
+            registry.rings.erase(std::find(registry.rings.begin(), registry.rings.end(), ring));
+            registry.retired.emplace_back(ring);
+            if (registry.retired.size() > TRACE_RETIRED_RINGS) registry.retired.pop_front();
+        }
+        t_ring = nullptr;
+        t_retired = true;
+    }
+};
+
+TraceRing* GetRing()
+{
+    if (!t_ring)
+    {
+        // Spans from the destructors of other thread_locals, after the ring was retired, are dropped.
+        if (t_retired) return nullptr;
+        static thread_local RingOwner owner;
+        t_ring = owner.ring;
+    }
+    return t_ring;
+}
+
+// Copy the spans of a ring which were not overwritten while copying. The registry lock must be held.
+void CopyRing(const TraceRing& ring, std::vector<TraceEvent>& events)
+{
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    size_t begin = events.size();
+    for (uint64_t i = first; i < head; i++) events.push_back(ring.events[i & (TRACE_RING_EVENTS - 1)]);
+
+    // The writer may be in the slot after the new head, so that one is dropped too.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = ring.head.load(std::memory_order_relaxed);
+    uint64_t valid = now + 1 > TRACE_RING_EVENTS ? now + 1 - TRACE_RING_EVENTS : 0;
+    if (valid > first) events.erase(events.begin() + begin, events.begin() + begin + std::min(valid, head) - first);
+    for (size_t i = begin; i < events.size(); i++) events[i].thread = ring.thread;
+}
+
+} // namespace
+
+void Tracer::setSampling(double rate)
+{
+    uint32_t period = 0;
+    if (rate > 0) period = uint32_t(std::max(1.0, std::round(1 / std::min(rate, 1.0))));
+    s_period.store(period, std::memory_order_relaxed);
+}
+
+uint32_t Tracer::getPeriod()
+{
+    return s_period.load(std::memory_order_relaxed);
+}
+
+bool Tracer::isSampling()
+{
+    return t_request != 0;
+}
+
+void Tracer::Record(const char* name, uint64_t start, uint64_t end)
+{
+    TraceRing* ring = GetRing();
+    if (!ring) return;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent& event = ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.request = t_request;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool Tracer::Begin()
+{
+    if (t_inside) return false;
+    t_inside = true;
+    uint32_t period = s_period.load(std::memory_order_relaxed);
+    if (period != 0 && ++t_seen >= period)
+    {
+        t_seen = 0;
+        t_request = s_requests.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    return true;
+}
+
+void Tracer::End()
+{
+    t_inside = false;
+    t_request = 0;
+}
+
+std::vector<TraceEvent> Tracer::Collect()
+{
+    Registry& registry = GetRegistry();
+    std::vector<TraceEvent> events;
+    std::lock_guard<std::mutex> lock{ registry.lock };
+    for (auto& ring : registry.retired) CopyRing(*ring, events);
+    for (TraceRing* ring : registry.rings) CopyRing(*ring, events);
+    return events;
+}
+
+std::string Tracer::Format(const std::vector<TraceEvent>& events)
+{
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    int pid = int(getpid());
+    char line[512];
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const TraceEvent& event = events[i];
+        snprintf(line, sizeof(line),
+            "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+            i ? "," : "", event.name, pid, event.thread, event.start / 1e3,
+            (event.end > event.start ? event.end - event.start : 0) / 1e3, (unsigned long long)event.request);
+        json += line;
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+bool Tracer::Export(const std::string& path)
+{
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << Format(Collect());
+        if (!file.flush()) return false;
+    }
+    return 0 == rename(temporary.c_str(), path.c_str());
+}
+
+TraceDumper::TraceDumper(const std::string& path, std::chrono::milliseconds interval)
+    : m_path(path), m_interval(interval), m_running(true)
+{
+    m_thread = std::thread(&TraceDumper::_Run, this);
+}
+
+TraceDumper::~TraceDumper()
+{
+    {
+        std::lock_guard<std::mutex> lock{ m_lock };
+        m_running = false;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+    Tracer::Export(m_path);
+}
+
+void TraceDumper::_Run()
+{
+    std::unique_lock<std::mutex> lock{ m_lock };
+    while (m_running)
+    {
+        if (m_wake.wait_for(lock, m_interval, [this] { return !m_running; })) break;
+        lock.unlock();
+        Tracer::Export(m_path);
+        lock.lock();
+    }
+}
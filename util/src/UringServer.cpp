@@ -0,0 +1,646 @@
+/*
+ * @FilePath: /simtochat/util/src/UringServer.cpp
+ * @Author: CGL
+ * @Date: 2026-10-17 20:14:09
+ * @LastEditors: CGL
+ * @LastEditTime: 2026-10-17 20:14:09
+ * @Description:
+ */
+#include "UringServer.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#define URING_ENTRIES       1024        // Submission entries, the completion ring is 4 times larger
+#define URING_BUFFERS       1024        // Buffers provided to the multishot recvs, a power of two
+#define URING_BUFFER_SIZE   4096
+#define URING_BUFFER_GROUP  0
+
+// The operation of a completion, in the high 8 bits of its user_data.
+#define URING_OP_ACCEPT     1ull
+#define URING_OP_WAKEUP     2ull
+#define URING_OP_RECV       3ull
+#define URING_OP_SEND       4ull
+#define URING_OP_CANCEL     5ull
+#define URING_OP_PROVIDE    6ull
+
+// The state of a client in Socket::m_watching.
+#define URING_RECV          (1u << 0)   // A multishot recv is armed
+#define URING_SEND          (1u << 1)   // A send is in flight
+#define URING_DIRTY         (1u << 2)   // Queued in m_dirty
+#define URING_INPUT         (1u << 3)   // Received data the processor has not seen
+#define URING_EOF           (1u << 4)   // The peer closed or the recv failed
+#define URING_PAUSED        (1u << 5)   // Reading is paused by the high-water mark
+#define URING_CLOSING       (1u << 6)   // Shut down, closed once the send in flight completes
+
+static int UringSetup(unsigned int entries, io_uring_params* params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int UringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags,
+    const void* arg = nullptr, size_t argSize = 0)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int UringRegister(int fd, unsigned int opcode, void* arg, unsigned int count)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// The user_data of an operation on a client: the operation, 24 bits of generation and the fd.
+static uint64_t MakeToken(uint64_t op, uint64_t serial)
+{
+    return (op << 56) | (serial & 0x00ffffffffffffffull);
+}
+
+UringLoop::UringLoop(EpollServer* server)
+    : EventLoop(server), m_ringfd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED),
+      m_sqRingSize(0), m_cqRingSize(0), m_sqes(nullptr), m_sqEntries(0),
+      m_sqHead(nullptr), m_sqTail(nullptr), m_sqMask(nullptr), m_sqArray(nullptr),
+      m_sqLocalTail(0), m_sqSubmitted(0), m_cqHead(nullptr), m_cqTail(nullptr), m_cqMask(nullptr),
+      m_cqes(nullptr), m_bufPool(nullptr), m_wakeupValue(0)
+{
+
+}
+
+UringLoop::~UringLoop()
+{
+    // Closing the ring cancels everything in flight before the buffers are freed.
+    if (m_ringfd != -1) close(m_ringfd);
+    if (m_sqes) munmap(m_sqes, m_sqEntries * sizeof(io_uring_sqe));
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED) munmap(m_sqRing, m_sqRingSize);
+    delete[] m_bufPool;
+}
+
+bool UringLoop::isSupported()
+{
+    static const bool supported = []
+    {
+        // Multishot recv came with Linux 6.0.
+        utsname name;
+        int major = 0, minor = 0;
+        if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2) return false;
+        if (major < 6) return false;
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = UringSetup(8, &params);
+        if (fd < 0) return false;
+
+        bool ok = (params.features & IORING_FEAT_SINGLE_MMAP) && (params.features & IORING_FEAT_NODROP)
+            && (params.features & IORING_FEAT_EXT_ARG);
+        const size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        std::unique_ptr<char[]> memory(new char[probeSize]());
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(memory.get());
+        ok = ok && UringRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+        for (int op : { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG, IORING_OP_READ,
+            IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS })
+        {
+            ok = ok && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        }
+        close(fd);
+        return ok;
+    }();
+    return supported;
+}
+
+void UringLoop::Listen(int port)
+{
+    _ListenSocket(port);
+
+    // The wakeup is read by the ring, which waits for a blocking file instead of failing with EAGAIN.
+    fcntl(m_wakeupfd, F_SETFL, fcntl(m_wakeupfd, F_GETFL, 0) & ~O_NONBLOCK);
+}
+
+void UringLoop::Loop()
+{
+    _SetupRing();
+    _ArmAccept();
+    _ArmWakeup();
+
+    _UpdateClock();
+    while (m_running)
+    {
+        // One iteration is a request of the tracer.
+        TRACE_REQUEST("loop");
+        _RunTimers();
+        _ResumeWriters();
+        _ProcessDirty();
+        {
+            TRACE_SCOPE("loop.wait");
+            _Enter(1, _getTimeout());
+        }
+        _UpdateClock();
+        uint64_t start = Metrics::Now();
+        size_t count = _Reap();
+        if (count > 0) _Dispatched(count, start);
+    }
+
+    // The clients with a send in flight close when it completes, the kernel still reads their sending queues.
+    _CloseAll();
+    while (_HasClients())
+    {
+        _Enter(1);
+        _Reap();
+    }
+}
+
+void UringLoop::_SetupRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = URING_ENTRIES * 4;
+    m_ringfd = UringSetup(URING_ENTRIES, &params);
+    if (m_ringfd < 0)
+    {
+        // Before Linux 6.1 completions can not be deferred to io_uring_enter.
+        params.flags = IORING_SETUP_CQSIZE;
+        m_ringfd = UringSetup(URING_ENTRIES, &params);
+    }
+    if (m_ringfd < 0) throw SocketException(errno, "io_uring_setup");
+
+    // One mapping holds both rings with IORING_FEAT_SINGLE_MMAP, checked by isSupported().
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) throw SocketException(errno, "mmap io_uring");
+    m_cqRing = m_sqRing;
+    void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) throw SocketException(errno, "mmap io_uring");
+
+    char* sq = static_cast<char*>(m_sqRing);
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+    m_sqEntries = params.sq_entries;
+    m_sqHead = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    m_sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    m_sqLocalTail = m_sqSubmitted = *m_sqTail;
+    char* cq = static_cast<char*>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    m_cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Give all the buffers to the kernel, before any recv is submitted.
+    m_bufPool = new char[size_t(URING_BUFFERS) * URING_BUFFER_SIZE];
+    for (uint16_t bid = 0; bid < URING_BUFFERS; bid++) _RecycleBuffer(bid);
+    _ProvideBuffers();
+}
+
+bool UringLoop::_Send(Socket& client, const iovec* vec, int count, [[maybe_unused]] bool more)
+{
+    // Only queue: the sends of the whole round are submitted together, which batches better than MSG_MORE.
+    client.m_output.Append(vec, count);
+    _MarkDirty(client);
+    return true;
+}
+
+bool UringLoop::_SendShared(Socket& client, const SharedBuffer& buffer, [[maybe_unused]] bool more)
+{
+    client.m_output.Append(buffer);
+    _MarkDirty(client);
+    return true;
+}
+
+io_uring_sqe* UringLoop::_GetSqe()
+{
+    auto* head = reinterpret_cast<std::atomic<unsigned int>*>(m_sqHead);
+    while (m_sqLocalTail - head->load(std::memory_order_acquire) >= m_sqEntries)
+    {
+        // A submission may be partial, or refused with EBUSY while the completion ring is full.
+        // The completions are stashed instead of handled, the caller may be in the middle of an update.
+        unsigned int before = head->load(std::memory_order_acquire);
+        _Enter(0);
+        if (m_sqLocalTail - head->load(std::memory_order_acquire) < m_sqEntries) break;
+
+        // Nothing to stash and nothing taken: the kernel is short of resources, give it a moment.
+        if (_Stash() == 0 && head->load(std::memory_order_acquire) == before) _Enter(1, 1);
+    }
+
+    unsigned int index = m_sqLocalTail & *m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    m_sqLocalTail++;
+    return sqe;
+}
+
+void UringLoop::_Enter(unsigned int minComplete, int timeout)
+{
+    reinterpret_cast<std::atomic<unsigned int>*>(m_sqTail)->store(m_sqLocalTail, std::memory_order_release);
+
+    // The timeout of the timers goes with the wait, like the timeout of epoll_wait.
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    unsigned int flags = IORING_ENTER_GETEVENTS;
+    if (minComplete > 0 && timeout >= 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000ll;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    while (true)
+    {
+        int rst = UringEnter(m_ringfd, m_sqLocalTail - m_sqSubmitted, minComplete, flags,
+            (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr, sizeof(arg));
+        if (rst >= 0)
+        {
+            m_sqSubmitted += rst;
+            return;
+        }
+        if (errno == EINTR) continue;
+
+        // The timeout expired, or the completion ring is full and the caller reaps before submitting more.
+        if (errno == ETIME || errno == EBUSY || errno == EAGAIN) return;
+        throw SocketException(errno, "io_uring_enter");
+    }
+}
+
+size_t UringLoop::_Stash()
+{
+    auto* tail = reinterpret_cast<std::atomic<unsigned int>*>(m_cqTail);
+    auto* head = reinterpret_cast<std::atomic<unsigned int>*>(m_cqHead);
+    unsigned int mask = *m_cqMask;
+    unsigned int current = head->load(std::memory_order_relaxed);
+    unsigned int last = tail->load(std::memory_order_acquire);
+    for (unsigned int i = current; i != last; i++) m_stashed.push_back(m_cqes[i & mask]);
+    head->store(last, std::memory_order_release);
+    return last - current;
+}
+
+size_t UringLoop::_Reap()
+{
+    auto* tail = reinterpret_cast<std::atomic<unsigned int>*>(m_cqTail);
+    auto* head = reinterpret_cast<std::atomic<unsigned int>*>(m_cqHead);
+    unsigned int mask = *m_cqMask;
+    size_t count = 0;
+
+    // A completion handler may stash the rest of the ring, the head is read again for every completion.
+    while (true)
+    {
+        if (!m_stashed.empty())
+        {
+            m_reaping.swap(m_stashed);
+            for (const io_uring_cqe& cqe : m_reaping) _Complete(cqe);
+            count += m_reaping.size();
+            m_reaping.clear();
+            continue;
+        }
+        unsigned int current = head->load(std::memory_order_relaxed);
+        if (current == tail->load(std::memory_order_acquire)) break;
+        io_uring_cqe cqe = m_cqes[current & mask];
+        head->store(current + 1, std::memory_order_release);
+        _Complete(cqe);
+        count++;
+    }
+
+    _ProvideBuffers();
+    return count;
+}
+
+
+void UringLoop::_Complete(const io_uring_cqe& cqe)
+{
+    uint64_t op = cqe.user_data >> 56;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    if (op == URING_OP_ACCEPT)
+    {
+        if (cqe.res >= 0 && !m_running)
+        {
+            // The multishot accept goes on while the loop waits for its last sends.
+            close(cqe.res);
+        }
+        else if (cqe.res >= 0)
+        {
+            int clientfd = cqe.res;
+            sockaddr_in addrClient;
+            socklen_t addrLen = sizeof(addrClient);
+            memset(&addrClient, 0, sizeof(addrClient));
+            getpeername(clientfd, (sockaddr*)&addrClient, &addrLen);
+
+            ClientSlot& slot = _OpenClient(clientfd, addrClient);
+            Socket& client = slot.socket;
+            while (m_sending.size() <= size_t(clientfd)) m_sending.emplace_back(0);
+            _ArmRecv(client);
+            _Accepted(client);
+            _MarkDirty(client);
+        }
+        else if (cqe.res == -EMFILE || cqe.res == -ENFILE)
+        {
+            // Drop the connection the kernel could not hand over, or the accept fails again at once.
+            _Shed();
+        }
+        if (!more && m_running) _ArmAccept();
+        return;
+    }
+
+    if (op == URING_OP_WAKEUP)
+    {
+        _RunPosted();
+        _CloseBroken();
+        if (m_running) _ArmWakeup();
+        return;
+    }
+
+    if (op == URING_OP_RECV)
+    {
+        ClientSlot* slot = _FindLive(cqe.user_data);
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+        {
+            uint16_t bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (slot && cqe.res > 0) slot->socket.m_input.Append(m_bufPool + size_t(bid) * URING_BUFFER_SIZE, cqe.res);
+            _RecycleBuffer(bid);
+        }
+        if (!slot) return;
+
+        Socket& client = slot->socket;
+        if (cqe.res > 0)
+        {
+            _CountReceived(cqe.res);
+            client.m_watching |= URING_INPUT;
+            client.m_lastActive = m_now;
+        }
+        if (!more)
+        {
+            client.m_watching &= ~URING_RECV;
+
+            // Out of buffers or cancelled by the high-water mark, the connection is fine
+            // and _UpdateReading() arms it again after the buffers are given back.
+            if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED))
+            {
+                client.m_watching |= URING_EOF;
+            }
+        }
+        _MarkDirty(client);
+        return;
+    }
+
+    if (op == URING_OP_SEND)
+    {
+        ClientSlot* slot = _FindLive(cqe.user_data);
+        if (!slot) return;
+
+        Socket& client = slot->socket;
+        client.m_watching &= ~URING_SEND;
+        if (client.m_watching & URING_CLOSING)
+        {
+            // The kernel is done with the sending queue, the close can go on.
+            _Close(*slot);
+            return;
+        }
+        if (cqe.res < 0)
+        {
+            client.m_broken = true;
+        }
+        else
+        {
+            _CountSent(cqe.res);
+            m_sending[client.m_fd].Retrieve(cqe.res);
+        }
+        _MarkDirty(client);
+    }
+}
+
+void UringLoop::_ArmAccept()
+{
+    io_uring_sqe* sqe = _GetSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_OP_ACCEPT << 56;
+}
+
+void UringLoop::_ArmWakeup()
+{
+    io_uring_sqe* sqe = _GetSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakeupfd;
+    sqe->addr = reinterpret_cast<uint64_t>(&m_wakeupValue);
+    sqe->len = sizeof(m_wakeupValue);
+    sqe->user_data = URING_OP_WAKEUP << 56;
+}
+
+void UringLoop::_ArmRecv(Socket& client)
+{
+    io_uring_sqe* sqe = _GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client.m_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = MakeToken(URING_OP_RECV, client.m_serial);
+    client.m_watching |= URING_RECV;
+}
+
+void UringLoop::_StartSend(Socket& client)
+{
+    if (client.m_watching & URING_SEND) return;
+
+    // The sending queue must not move while the kernel reads it, new output goes to m_output.
+    OutputQueue& sending = m_sending[client.m_fd];
+    if (sending.getReadableBytes() == 0)
+    {
+        if (client.m_output.getReadableBytes() == 0) return;
+        std::swap(sending, client.m_output);
+    }
+
+    io_uring_sqe* sqe = _GetSqe();
+    sqe->fd = client.m_fd;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = MakeToken(URING_OP_SEND, client.m_serial);
+    if (sending.hasShared())
+    {
+        while (m_messages.size() <= size_t(client.m_fd)) m_messages.emplace_back();
+        std::unique_ptr<UringMessage>& message = m_messages[client.m_fd];
+        if (!message) message.reset(new UringMessage);
+        memset(&message->msg, 0, sizeof(message->msg));
+        message->msg.msg_iov = message->vec;
+        message->msg.msg_iovlen = sending.Gather(message->vec, URING_SEND_IOVECS);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&message->msg);
+        sqe->len = 1;
+    }
+    else
+    {
+        Buffer& bytes = sending.getBuffer();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uint64_t>(bytes.Peek());
+        sqe->len = uint32_t(std::min<size_t>(bytes.getReadableBytes(), UINT32_MAX));
+    }
+    client.m_watching |= URING_SEND;
+}
+
+void UringLoop::_MarkDirty(Socket& client)
+{
+    if (client.m_watching & URING_DIRTY) return;
+    client.m_watching |= URING_DIRTY;
+    m_dirty.push_back(client.m_serial);
+}
+
+void UringLoop::_ProcessDirty()
+{
+    // The callbacks may mark more clients, they are visited in the same pass.
+    for (size_t i = 0; i < m_dirty.size(); i++)
+    {
+        ClientSlot* slot = _FindLive(m_dirty[i]);
+        if (!slot) continue;
+
+        Socket& client = slot->socket;
+        client.m_watching &= ~URING_DIRTY;
+        if (client.m_watching & URING_CLOSING) continue;
+        if (client.m_watching & URING_INPUT)
+        {
+            client.m_watching &= ~URING_INPUT;
+            _Received(client);
+        }
+        bool overflow = client.m_input.getReadableBytes() > _getMaxInputSize();
+        if (client.m_broken || overflow || (client.m_watching & URING_EOF))
+        {
+            _Close(*slot);
+            continue;
+        }
+        _StartSend(client);
+        _UpdateReading(client);
+    }
+    m_dirty.clear();
+}
+
+size_t UringLoop::_getPendingOutput(Socket& client)
+{
+    return client.m_output.getReadableBytes() + m_sending[client.m_fd].getReadableBytes();
+}
+
+void UringLoop::_UpdateReading(Socket& client)
+{
+    size_t pending = _getPendingOutput(client);
+    size_t highWater = _getHighWaterMark();
+
+    if (pending > highWater && !(client.m_watching & URING_PAUSED))
+    {
+        // Stop reading from a peer which does not read its replies.
+        client.m_watching |= URING_PAUSED;
+        if (!(client.m_watching & URING_RECV)) return;
+        io_uring_sqe* sqe = _GetSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = MakeToken(URING_OP_RECV, client.m_serial);
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = URING_OP_CANCEL << 56;
+        return;
+    }
+    if (pending <= highWater / 2) client.m_watching &= ~URING_PAUSED;
+    if (!(client.m_watching & (URING_PAUSED | URING_RECV))) _ArmRecv(client);
+}
+
+void UringLoop::_RecycleBuffer(uint16_t bid)
+{
+    m_recycled.push_back(bid);
+}
+
+void UringLoop::_ProvideBuffers()
+{
+    if (m_recycled.empty()) return;
+
+    // One operation for every run of consecutive buffers.
+    std::sort(m_recycled.begin(), m_recycled.end());
+    for (size_t first = 0, last = 0; first < m_recycled.size(); first = last)
+    {
+        last = first + 1;
+        while (last < m_recycled.size() && m_recycled[last] == m_recycled[last - 1] + 1) last++;
+
+        io_uring_sqe* sqe = _GetSqe();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = int(last - first);
+        sqe->addr = reinterpret_cast<uint64_t>(m_bufPool + size_t(m_recycled[first]) * URING_BUFFER_SIZE);
+        sqe->len = URING_BUFFER_SIZE;
+        sqe->off = m_recycled[first];
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = URING_OP_PROVIDE << 56;
+    }
+    m_recycled.clear();
+}
+
+UringLoop::ClientSlot* UringLoop::_FindLive(uint64_t token)
+{
+    ClientSlot* slot = _FindSlot(int(token & 0xffffffff));
+    uint32_t generation = uint32_t(token >> 32) & 0xffffff;
+    if (!slot || !slot->used || (slot->generation & 0xffffff) != generation) return nullptr;
+    return slot;
+}
+
+void UringLoop::_Close(ClientSlot& slot)
+{
+    Socket& client = slot.socket;
+    int fd = client.m_fd;
+    if (!(client.m_watching & URING_CLOSING))
+    {
+        // The operations in flight complete with an error, the recvs are dropped as stale.
+        shutdown(fd, SHUT_RDWR);
+        client.m_broken = true;
+        client.m_watching |= URING_CLOSING;
+    }
+
+    // The kernel may still read a send from the sending queue: keep it, and the file descriptor
+    // so no new connection gets its number, until the completion of the send comes back.
+    if (client.m_watching & URING_SEND) return;
+
+    OutputQueue released(0);
+    std::swap(m_sending[fd], released);
+    _CloseClient(slot);
+}
+
+UringServer::UringServer()
+    : EpollServer(), m_enabled(true), m_uring(false)
+{
+
+}
+
+UringServer::~UringServer()
+{
+
+}
+
+void UringServer::Run(int port)
+{
+    m_uring = m_enabled && UringLoop::isSupported();
+    EpollServer::Run(port);
+}
+
+void UringServer::setUringEnabled(bool enable)
+{
+    m_enabled = enable;
+}
+
+bool UringServer::isUsingUring() const
+{
+    return m_uring;
+}
+
+std::unique_ptr<EventLoop> UringServer::_CreateLoop()
+{
+    if (!m_uring) return EpollServer::_CreateLoop();
+    return std::unique_ptr<EventLoop>(new UringLoop(this));
+}